@@ -0,0 +1,287 @@
+#include "../GL/glew.h"
+#include "../GL/3dglAmbientOcclusion.h"
+#include "../GL/3dglThreadPool.h"
+#include "../GL/assimp/cimport.h"
+
+// standard libraries
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+
+// GLM include files
+#include "../glm/geometric.hpp"
+#include "../glm/common.hpp"
+#include "../glm/matrix.hpp"
+#include "../glm/mat3x3.hpp"
+#include "../glm/gtc/type_ptr.hpp"
+
+using namespace std;
+using namespace _3dgl;
+
+static const unsigned c_nChunk = 256;		// vertices per thread pool job
+static const char c_magic[4] = { '3', 'D', 'A', 'O' };
+
+// radical inverse base 2 - the second coordinate of the Hammersley set
+static inline float radicalInverse(unsigned i)
+{
+	i = (i << 16) | (i >> 16);
+	i = ((i & 0x55555555u) << 1) | ((i & 0xAAAAAAAAu) >> 1);
+	i = ((i & 0x33333333u) << 2) | ((i & 0xCCCCCCCCu) >> 2);
+	i = ((i & 0x0F0F0F0Fu) << 4) | ((i & 0xF0F0F0F0u) >> 4);
+	i = ((i & 0x00FF00FFu) << 8) | ((i & 0xFF00FF00u) >> 8);
+	return i * (1.0f / 4294967296.0f);
+}
+
+void C3dglAmbientOcclusion::add(C3dglModel &model, glm::mat4 matrix, int iNode)
+{
+	const aiScene *pScene = model.GetScene();
+	if (!pScene || !pScene->mRootNode) return;
+
+	// the same node transforms as in C3dglDrawList
+	aiNode *pRoot = pScene->mRootNode;
+	if (iNode < 0)
+		addNode(model, pRoot, matrix);
+	else if ((unsigned)iNode < pRoot->mNumChildren)
+	{
+		aiMatrix4x4 mx = pRoot->mTransformation;
+		aiTransposeMatrix4(&mx);
+		addNode(model, pRoot->mChildren[iNode], matrix * glm::make_mat4((GLfloat*)&mx));
+	}
+}
+
+void C3dglAmbientOcclusion::addNode(C3dglModel &model, aiNode *pNode, glm::mat4 m)
+{
+	aiMatrix4x4 mx = pNode->mTransformation;
+	aiTransposeMatrix4(&mx);
+	m *= glm::make_mat4((GLfloat*)&mx);
+
+	for (unsigned iMesh : vector<unsigned>(pNode->mMeshes, pNode->mMeshes + pNode->mNumMeshes))
+	{
+		C3dglModel::MESH *pMesh = model.getMesh(iMesh);
+		const aiMesh *pAiMesh = model.GetScene()->mMeshes[iMesh];
+		if (!pMesh || !pAiMesh->mVertices) continue;
+
+		auto it = m_index.insert(make_pair(pMesh, (unsigned)m_meshes.size()));
+		if (it.second)
+		{
+			MESH mesh;
+			mesh.pMesh = pMesh;
+			mesh.pAiMesh = pAiMesh;
+			mesh.nInstances = 0;
+			m_meshes.push_back(mesh);
+		}
+		m_meshes[it.first->second].nInstances++;
+
+		ENTRY entry;
+		entry.iMesh = it.first->second;
+		entry.matrix = m;
+		m_entries.push_back(entry);
+	}
+
+	for (aiNode *p : vector<aiNode*>(pNode->mChildren, pNode->mChildren + pNode->mNumChildren))
+		addNode(model, p, m);
+}
+
+void C3dglAmbientOcclusion::clear()
+{
+	m_entries.clear();
+	m_meshes.clear();
+	m_index.clear();
+	m_bvh.clear();
+}
+
+bool C3dglAmbientOcclusion::bake()
+{
+	if (m_entries.empty())
+		return logError("nothing to bake");
+
+	// the occluders - all the instances, in world space
+	m_bvh.clear();
+	glm::vec3 bbMin(FLT_MAX), bbMax(-FLT_MAX);
+	for (const ENTRY &entry : m_entries)
+	{
+		const aiMesh *pMesh = m_meshes[entry.iMesh].pAiMesh;
+		vector<glm::vec3> pos(pMesh->mNumVertices);
+		for (unsigned i = 0; i < pMesh->mNumVertices; i++)
+		{
+			pos[i] = glm::vec3(entry.matrix * glm::vec4(pMesh->mVertices[i].x, pMesh->mVertices[i].y, pMesh->mVertices[i].z, 1));
+			bbMin = glm::min(bbMin, pos[i]);
+			bbMax = glm::max(bbMax, pos[i]);
+		}
+		for (const aiFace &face : vector<aiFace>(pMesh->mFaces, pMesh->mFaces + pMesh->mNumFaces))
+			if (face.mNumIndices == 3)
+				m_bvh.addTriangle(pos[face.mIndices[0]], pos[face.mIndices[1]], pos[face.mIndices[2]]);
+	}
+	m_bvh.build();
+	float distance = m_distance > 0 ? m_distance : 0.1f * glm::length(bbMax - bbMin);
+
+	// model space vertex normals - from the faces, if the mesh has none
+	vector<vector<glm::vec3> > normals(m_meshes.size());
+	for (unsigned iMesh = 0; iMesh < m_meshes.size(); iMesh++)
+	{
+		const aiMesh *pMesh = m_meshes[iMesh].pAiMesh;
+		vector<glm::vec3> &n = normals[iMesh];
+		n.assign(pMesh->mNumVertices, glm::vec3(0));
+		if (pMesh->mNormals)
+			memcpy(&n[0], pMesh->mNormals, n.size() * sizeof(n[0]));
+		else
+			for (const aiFace &face : vector<aiFace>(pMesh->mFaces, pMesh->mFaces + pMesh->mNumFaces))
+			{
+				if (face.mNumIndices != 3) continue;
+				const aiVector3D *v = pMesh->mVertices;
+				const unsigned *idx = face.mIndices;
+				aiVector3D c = (v[idx[1]] - v[idx[0]]) ^ (v[idx[2]] - v[idx[0]]);
+				for (unsigned k = 0; k < 3; k++)
+					n[idx[k]] += glm::vec3(c.x, c.y, c.z);
+			}
+	}
+
+	// cast the rays: chunks of vertices of each instance, one job per chunk
+	struct JOB { unsigned iEntry, first, count; };
+	vector<JOB> jobs;
+	vector<vector<float> > results(m_entries.size());
+	for (unsigned iEntry = 0; iEntry < m_entries.size(); iEntry++)
+	{
+		unsigned nVertices = m_meshes[m_entries[iEntry].iMesh].pAiMesh->mNumVertices;
+		results[iEntry].resize(nVertices);
+		for (unsigned first = 0; first < nVertices; first += c_nChunk)
+		{
+			JOB job = { iEntry, first, min(c_nChunk, nVertices - first) };
+			jobs.push_back(job);
+		}
+	}
+	C3dglThreadPool::get().parallelFor((unsigned)jobs.size(), [&](unsigned iJob)
+	{
+		const JOB &job = jobs[iJob];
+		const ENTRY &entry = m_entries[job.iEntry];
+		const aiMesh *pMesh = m_meshes[entry.iMesh].pAiMesh;
+		glm::mat3 matrixNormal = glm::transpose(glm::inverse(glm::mat3(entry.matrix)));
+		for (unsigned i = job.first; i < job.first + job.count; i++)
+		{
+			glm::vec3 pos = glm::vec3(entry.matrix * glm::vec4(pMesh->mVertices[i].x, pMesh->mVertices[i].y, pMesh->mVertices[i].z, 1));
+			glm::vec3 normal = matrixNormal * normals[entry.iMesh][i];
+			float len = glm::length(normal);
+			results[job.iEntry][i] = len > 0 ? bakeVertex(pos, normal / len, distance, (job.iEntry * 7919u + i + 1) * 2654435761u) : 1;
+		}
+	});
+
+	// the average of the instances
+	for (MESH &mesh : m_meshes)
+		mesh.occlusion.assign(mesh.pAiMesh->mNumVertices, 0);
+	for (unsigned iEntry = 0; iEntry < m_entries.size(); iEntry++)
+	{
+		MESH &mesh = m_meshes[m_entries[iEntry].iMesh];
+		for (unsigned i = 0; i < mesh.occlusion.size(); i++)
+			mesh.occlusion[i] += results[iEntry][i] / mesh.nInstances;
+	}
+
+	m_bvh.clear();
+	return logSuccess("baked: " + to_string(m_meshes.size()) + " meshes, " + to_string(m_entries.size()) + " instances, "
+		+ to_string((m_nSamples + 3) / 4 * 4) + " rays per vertex, " + to_string(C3dglThreadPool::get().getThreadCount()) + " threads");
+}
+
+float C3dglAmbientOcclusion::bakeVertex(const glm::vec3 &pos, const glm::vec3 &normal, float distance, unsigned seed)
+{
+	// tangent frame
+	glm::vec3 t = fabs(normal.x) > 0.5f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0);
+	glm::vec3 b1 = glm::normalize(glm::cross(normal, t));
+	glm::vec3 b2 = glm::cross(normal, b1);
+
+	// the Hammersley set, randomly shifted per vertex - stratified, without the same pattern at every vertex
+	seed ^= seed >> 16; seed *= 0x7FEB352Du; seed ^= seed >> 15;
+	float shift1 = (seed & 0xFFFF) / 65536.0f, shift2 = (seed >> 16) / 65536.0f;
+
+	// offset along the normal - the rays must not hit the triangles around the vertex
+	glm::vec3 orig[4];
+	orig[0] = orig[1] = orig[2] = orig[3] = pos + normal * (distance * 1e-3f);
+
+	unsigned nPackets = max((m_nSamples + 3) / 4, 1u);
+	unsigned nSamples = 4 * nPackets, nHits = 0;
+	for (unsigned p = 0; p < nPackets; p++)
+	{
+		glm::vec3 dir[4];
+		for (unsigned k = 0; k < 4; k++)
+		{
+			unsigned i = 4 * p + k;
+			float r1 = (i + 0.5f) / nSamples + shift1, r2 = radicalInverse(i) + shift2;
+			r1 -= floor(r1); r2 -= floor(r2);
+
+			// cosine weighted
+			float phi = 6.2831853f * r1, r = sqrt(r2);
+			dir[k] = b1 * (r * cos(phi)) + b2 * (r * sin(phi)) + normal * sqrt(max(0.0f, 1 - r2));
+		}
+		unsigned mask = m_bvh.occluded4(orig, dir, distance);
+		nHits += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+	}
+	return 1 - (float)nHits / nSamples;
+}
+
+bool C3dglAmbientOcclusion::save(const std::string &fileName)
+{
+	for (MESH &mesh : m_meshes)
+		if (mesh.occlusion.size() != mesh.pAiMesh->mNumVertices)
+			return logError("nothing to save - bake first");
+
+	ofstream file(fileName.c_str(), ios::binary);
+	if (!file)
+		return logError("cannot write " + fileName);
+	unsigned nMeshes = (unsigned)m_meshes.size();
+	file.write(c_magic, sizeof(c_magic));
+	file.write((const char*)&nMeshes, sizeof(nMeshes));
+	for (MESH &mesh : m_meshes)
+	{
+		unsigned nVertices = (unsigned)mesh.occlusion.size();
+		file.write((const char*)&nVertices, sizeof(nVertices));
+		if (nVertices)
+			file.write((const char*)&mesh.occlusion[0], nVertices * sizeof(float));
+	}
+	if (!file)
+		return logError("cannot write " + fileName);
+	return logSuccess("saved: " + fileName);
+}
+
+bool C3dglAmbientOcclusion::load(const std::string &fileName)
+{
+	ifstream file(fileName.c_str(), ios::binary);
+	if (!file)
+		return false;		// not baked yet - not an error
+
+	char magic[4];
+	unsigned nMeshes = 0;
+	if (!file.read(magic, sizeof(magic)) || memcmp(magic, c_magic, sizeof(magic)) != 0 || !file.read((char*)&nMeshes, sizeof(nMeshes)))
+		return logError(fileName + " is not an ambient occlusion file");
+	if (nMeshes != m_meshes.size())
+		return logError(fileName + " was baked for a different scene");
+
+	vector<vector<float> > occlusion(nMeshes);
+	for (unsigned iMesh = 0; iMesh < nMeshes; iMesh++)
+	{
+		unsigned nVertices = 0;
+		if (!file.read((char*)&nVertices, sizeof(nVertices)))
+			return logError("cannot read " + fileName);
+		if (nVertices != m_meshes[iMesh].pAiMesh->mNumVertices)
+			return logError(fileName + " was baked for a different scene");
+		occlusion[iMesh].resize(nVertices);
+		if (nVertices && !file.read((char*)&occlusion[iMesh][0], nVertices * sizeof(float)))
+			return logError("cannot read " + fileName);
+	}
+
+	for (unsigned iMesh = 0; iMesh < nMeshes; iMesh++)
+		m_meshes[iMesh].occlusion.swap(occlusion[iMesh]);
+	return logSuccess("loaded: " + fileName);
+}
+
+void C3dglAmbientOcclusion::apply()
+{
+	vector<aiColor4D> colors;
+	for (MESH &mesh : m_meshes)
+	{
+		if (mesh.occlusion.empty()) continue;
+		colors.resize(mesh.occlusion.size());
+		for (unsigned i = 0; i < colors.size(); i++)
+			colors[i] = aiColor4D(mesh.occlusion[i], mesh.occlusion[i], mesh.occlusion[i], 1);
+		mesh.pMesh->setColors(&colors[0], (unsigned)colors.size(), ATTRIB_COLOR);
+	}
+}
@@ -0,0 +1,192 @@
+#include "../GL/glew.h"
+#include "../GL/3dglAsyncCompiler.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <set>
+
+using namespace std;
+using namespace _3dgl;
+
+// KHR_parallel_shader_compile - not known to this version of GLEW
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+typedef void (GLAPIENTRY *PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+C3dglAsyncCompiler::MODE C3dglAsyncCompiler::c_mode = C3dglAsyncCompiler::MODE_SYNC;
+
+#ifdef _WIN32
+
+// Worker thread with a GL context sharing objects with the main one
+struct WORKER
+{
+	struct JOB
+	{
+		GLuint idProgram;
+		vector<GLuint> shaders;
+	};
+
+	HDC hDC;
+	HGLRC hRC;
+	thread worker;
+	mutex mtx;
+	condition_variable cv;
+	deque<JOB> jobs;
+	set<GLuint> completed;
+	bool bQuit;
+
+	void run()
+	{
+		wglMakeCurrent(hDC, hRC);
+		for (;;)
+		{
+			JOB job;
+			{
+				unique_lock<mutex> lock(mtx);
+				cv.wait(lock, [this] { return bQuit || !jobs.empty(); });
+				if (bQuit) break;
+				job = jobs.front();
+				jobs.pop_front();
+			}
+
+			for (GLuint id : job.shaders)
+				glCompileShader(id);
+			glLinkProgram(job.idProgram);
+			glFinish();		// the results must be visible to the main context
+
+			lock_guard<mutex> lock(mtx);
+			completed.insert(job.idProgram);
+		}
+		wglMakeCurrent(NULL, NULL);
+	}
+};
+
+// never deleted unless shut down - a joinable thread must not be destroyed at exit
+static WORKER *c_pWorker = NULL;
+
+#endif // _WIN32
+
+static bool hasExtension(const char *name)
+{
+	GLint n = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &n);
+	for (GLint i = 0; i < n; i++)
+	{
+		const char *p = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (p && strcmp(p, name) == 0) return true;
+	}
+	return false;
+}
+
+C3dglAsyncCompiler::MODE C3dglAsyncCompiler::init(bool bAllowWorker, GLuint nThreads)
+{
+	shutdown();
+
+	if (hasExtension("GL_KHR_parallel_shader_compile") || hasExtension("GL_ARB_parallel_shader_compile"))
+	{
+#ifdef _WIN32
+		// the KHR and ARB entry points are interchangeable
+		PFNGLMAXSHADERCOMPILERTHREADSKHRPROC pfnMaxThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)wglGetProcAddress("glMaxShaderCompilerThreadsKHR");
+		if (!pfnMaxThreads) pfnMaxThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)wglGetProcAddress("glMaxShaderCompilerThreadsARB");
+		if (pfnMaxThreads && nThreads != 0xFFFFFFFF) pfnMaxThreads(nThreads);
+#endif
+		return c_mode = MODE_PARALLEL;
+	}
+
+#ifdef _WIN32
+	if (bAllowWorker)
+	{
+		// shared context - must be created and shared before it owns any objects
+		HDC hDC = wglGetCurrentDC();
+		HGLRC hMainRC = wglGetCurrentContext();
+		HGLRC hRC = hDC ? wglCreateContext(hDC) : NULL;
+		if (hRC && wglShareLists(hMainRC, hRC))
+		{
+			c_pWorker = new WORKER;
+			c_pWorker->hDC = hDC;
+			c_pWorker->hRC = hRC;
+			c_pWorker->bQuit = false;
+			c_pWorker->worker = thread(&WORKER::run, c_pWorker);
+			return c_mode = MODE_WORKER;
+		}
+		if (hRC) wglDeleteContext(hRC);
+	}
+#else
+	(void)bAllowWorker; (void)nThreads;	// the worker context and the thread count need WGL
+#endif
+
+	return c_mode = MODE_SYNC;
+}
+
+void C3dglAsyncCompiler::shutdown()
+{
+#ifdef _WIN32
+	if (c_pWorker)
+	{
+		{
+			lock_guard<mutex> lock(c_pWorker->mtx);
+			c_pWorker->bQuit = true;
+		}
+		c_pWorker->cv.notify_one();
+		c_pWorker->worker.join();
+		wglDeleteContext(c_pWorker->hRC);
+		delete c_pWorker;
+		c_pWorker = NULL;
+	}
+#endif
+	c_mode = MODE_SYNC;
+}
+
+void C3dglAsyncCompiler::submit(GLuint idProgram, const std::vector<GLuint> &shaders)
+{
+#ifdef _WIN32
+	if (c_mode == MODE_WORKER)
+	{
+		// sources and attachments must reach the shared objects before the worker uses them
+		glFlush();
+		WORKER::JOB job;
+		job.idProgram = idProgram;
+		job.shaders = shaders;
+		{
+			lock_guard<mutex> lock(c_pWorker->mtx);
+			c_pWorker->jobs.push_back(job);
+		}
+		c_pWorker->cv.notify_one();
+		return;
+	}
+#endif
+
+	// with KHR_parallel_shader_compile these calls return immediately
+	for (GLuint id : shaders)
+		glCompileShader(id);
+	glLinkProgram(idProgram);
+}
+
+bool C3dglAsyncCompiler::isComplete(GLuint idProgram)
+{
+	switch (c_mode)
+	{
+	case MODE_PARALLEL:
+		{
+			GLint result = GL_FALSE;
+			glGetProgramiv(idProgram, GL_COMPLETION_STATUS_KHR, &result);
+			return result != GL_FALSE;
+		}
+#ifdef _WIN32
+	case MODE_WORKER:
+		{
+			lock_guard<mutex> lock(c_pWorker->mtx);
+			return c_pWorker->completed.erase(idProgram) > 0;
+		}
+#endif
+	default:
+		return true;
+	}
+}
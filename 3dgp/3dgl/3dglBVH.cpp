@@ -0,0 +1,442 @@
+#include "../gl/glew.h"
+#include "../gl/3dglBVH.h"
+#include "../gl/3dglThreadPool.h"
+
+// standard libraries
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include <emmintrin.h>
+
+// GLM include files
+#include "../glm/geometric.hpp"
+#include "../glm/common.hpp"
+
+using namespace std;
+using namespace _3dgl;
+
+// binned SAH
+static const unsigned c_nBins = 16;
+static const unsigned c_maxDepth = 64;		// the traversal stack size
+
+// surface area of a box, halved
+static float area(const glm::vec3 &bbMin, const glm::vec3 &bbMax)
+{
+	glm::vec3 d = bbMax - bbMin;
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+void C3dglBVH::clear()
+{
+	m_vertices.clear();
+	m_triangles.clear();
+	m_packs.clear();
+	m_nodes.clear();
+}
+
+unsigned C3dglBVH::addTriangle(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c)
+{
+	m_vertices.push_back(a);
+	m_vertices.push_back(b);
+	m_vertices.push_back(c);
+	return (unsigned)(m_vertices.size() / 3 - 1);
+}
+
+void C3dglBVH::build(unsigned nMaxLeaf)
+{
+	m_nMaxLeaf = max(nMaxLeaf, 1u);
+	m_nodes.clear();
+	m_triangles.clear();
+	m_packs.clear();
+	unsigned n = getTriangleCount();
+	if (n == 0) return;
+
+	// bounds and centroids
+	m_build.resize(n);
+	m_order.resize(n);
+	for (unsigned i = 0; i < n; i++)
+	{
+		const glm::vec3 *v = &m_vertices[3 * i];
+		m_build[i].bbMin = glm::min(v[0], glm::min(v[1], v[2]));
+		m_build[i].bbMax = glm::max(v[0], glm::max(v[1], v[2]));
+		m_build[i].centroid = (m_build[i].bbMin + m_build[i].bbMax) * 0.5f;
+		m_order[i] = i;
+	}
+
+	m_nodes.reserve(2 * n);
+	m_nodes.push_back(NODE());
+	buildNode(0, 0, n, 0);
+
+	// triangles in the leaf order, pre-processed for the intersection test
+	m_triangles.reserve(n + 3 * m_nodes.size() / 2);
+	for (NODE &node : m_nodes)
+		if (node.count)
+			addLeafTriangles(node);
+
+	m_build.clear();
+	m_build.shrink_to_fit();
+	logInfo("built: " + to_string(n) + " triangles, " + to_string(m_nodes.size()) + " nodes");
+}
+
+void C3dglBVH::addLeafTriangles(NODE &node)
+{
+	unsigned first = (unsigned)m_triangles.size();
+	for (unsigned i = node.first; i < node.first + node.count; i++)
+	{
+		const glm::vec3 *v = &m_vertices[3 * m_order[i]];
+		TRIANGLE tri;
+		tri.a = v[0];
+		tri.e1 = v[1] - v[0];
+		tri.e2 = v[2] - v[0];
+		tri.index = m_order[i];
+		m_triangles.push_back(tri);
+	}
+
+	// padding - never hit, the determinant is 0
+	TRIANGLE empty;
+	empty.a = empty.e1 = empty.e2 = glm::vec3(0);
+	empty.index = (unsigned)-1;
+	while (m_triangles.size() % 4)
+		m_triangles.push_back(empty);
+
+	for (unsigned i = first; i < m_triangles.size(); i += 4)
+	{
+		TRIANGLE4 pack;
+		for (unsigned j = 0; j < 4; j++)
+		{
+			const TRIANGLE &tri = m_triangles[i + j];
+			pack.ax[j] = tri.a.x;   pack.ay[j] = tri.a.y;   pack.az[j] = tri.a.z;
+			pack.e1x[j] = tri.e1.x; pack.e1y[j] = tri.e1.y; pack.e1z[j] = tri.e1.z;
+			pack.e2x[j] = tri.e2.x; pack.e2y[j] = tri.e2.y; pack.e2z[j] = tri.e2.z;
+		}
+		m_packs.push_back(pack);
+	}
+	node.first = first;
+}
+
+void C3dglBVH::buildNode(unsigned iNode, unsigned first, unsigned count, unsigned depth)
+{
+	// node bounds and centroid bounds
+	glm::vec3 bbMin(FLT_MAX), bbMax(-FLT_MAX), cMin(FLT_MAX), cMax(-FLT_MAX);
+	for (unsigned i = first; i < first + count; i++)
+	{
+		const BUILD &b = m_build[m_order[i]];
+		bbMin = glm::min(bbMin, b.bbMin);
+		bbMax = glm::max(bbMax, b.bbMax);
+		cMin = glm::min(cMin, b.centroid);
+		cMax = glm::max(cMax, b.centroid);
+	}
+	m_nodes[iNode].bbMin = bbMin;
+	m_nodes[iNode].bbMax = bbMax;
+	m_nodes[iNode].first = first;
+	m_nodes[iNode].count = count;
+	if (count <= m_nMaxLeaf || depth >= c_maxDepth - 2)
+		return;
+
+	// the cheapest split over all axes: cost = (area left * count left + area right * count right) / area
+	float bestCost = FLT_MAX;
+	unsigned bestAxis = 0, bestBin = 0;
+	for (unsigned axis = 0; axis < 3; axis++)
+	{
+		float extent = cMax[axis] - cMin[axis];
+		if (extent <= 0) continue;
+		float scale = c_nBins / extent;
+
+		unsigned binCount[c_nBins] = { 0 };
+		glm::vec3 binMin[c_nBins], binMax[c_nBins];
+		for (unsigned b = 0; b < c_nBins; b++)
+			binMin[b] = glm::vec3(FLT_MAX), binMax[b] = glm::vec3(-FLT_MAX);
+		for (unsigned i = first; i < first + count; i++)
+		{
+			const BUILD &b = m_build[m_order[i]];
+			unsigned bin = min((unsigned)((b.centroid[axis] - cMin[axis]) * scale), c_nBins - 1);
+			binCount[bin]++;
+			binMin[bin] = glm::min(binMin[bin], b.bbMin);
+			binMax[bin] = glm::max(binMax[bin], b.bbMax);
+		}
+
+		// sweep from the right, then from the left
+		float rightCost[c_nBins];
+		glm::vec3 rMin(FLT_MAX), rMax(-FLT_MAX);
+		unsigned rCount = 0;
+		for (unsigned b = c_nBins - 1; b > 0; b--)
+		{
+			rMin = glm::min(rMin, binMin[b]);
+			rMax = glm::max(rMax, binMax[b]);
+			rCount += binCount[b];
+			rightCost[b] = rCount ? area(rMin, rMax) * rCount : 0;
+		}
+		glm::vec3 lMin(FLT_MAX), lMax(-FLT_MAX);
+		unsigned lCount = 0;
+		for (unsigned b = 0; b < c_nBins - 1; b++)
+		{
+			lMin = glm::min(lMin, binMin[b]);
+			lMax = glm::max(lMax, binMax[b]);
+			lCount += binCount[b];
+			if (lCount == 0 || lCount == count) continue;
+			float cost = area(lMin, lMax) * lCount + rightCost[b + 1];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = b;
+			}
+		}
+	}
+
+	// no useful split: all centroids coincide, or a leaf is cheaper
+	if (bestCost == FLT_MAX || (bestCost / area(bbMin, bbMax) + 1 >= count && count <= 4 * m_nMaxLeaf))
+		return;
+
+	// partition
+	float scale = c_nBins / (cMax[bestAxis] - cMin[bestAxis]);
+	unsigned *pMid = partition(&m_order[first], &m_order[first] + count, [&](unsigned i)
+		{ return min((unsigned)((m_build[i].centroid[bestAxis] - cMin[bestAxis]) * scale), c_nBins - 1) <= bestBin; });
+	unsigned nLeft = (unsigned)(pMid - &m_order[first]);
+
+	unsigned iLeft = (unsigned)m_nodes.size();
+	m_nodes.push_back(NODE());
+	m_nodes.push_back(NODE());
+	m_nodes[iNode].first = iLeft;
+	m_nodes[iNode].count = 0;
+	buildNode(iLeft, first, nLeft, depth + 1);
+	buildNode(iLeft + 1, first + nLeft, count - nLeft, depth + 1);
+}
+
+// slab test; returns the entry distance or FLT_MAX if missed
+static inline float intersectBox(const glm::vec3 &bbMin, const glm::vec3 &bbMax, const glm::vec3 &orig, const glm::vec3 &invDir, float tMax)
+{
+	glm::vec3 t0 = (bbMin - orig) * invDir;
+	glm::vec3 t1 = (bbMax - orig) * invDir;
+	glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+	float tEnter = max(max(tNear.x, tNear.y), max(tNear.z, 0.0f));
+	float tExit = min(min(tFar.x, tFar.y), min(tFar.z, tMax));
+	return tEnter <= tExit ? tEnter : FLT_MAX;
+}
+
+template <bool bAnyHit>
+bool C3dglBVH::traverse(const glm::vec3 &orig, const glm::vec3 &dir, float tMax, HIT &hit) const
+{
+	if (m_nodes.empty()) return false;
+
+	glm::vec3 invDir(1 / dir.x, 1 / dir.y, 1 / dir.z);
+	bool bHit = false;
+	hit.t = tMax;
+
+	// the ray broadcast, for the triangle packs
+	__m128 ox = _mm_set1_ps(orig.x), oy = _mm_set1_ps(orig.y), oz = _mm_set1_ps(orig.z);
+	__m128 dx = _mm_set1_ps(dir.x), dy = _mm_set1_ps(dir.y), dz = _mm_set1_ps(dir.z);
+	__m128 one = _mm_set1_ps(1), zero = _mm_setzero_ps();
+	__m128 eps = _mm_set1_ps(1e-12f);
+	__m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+
+	unsigned stack[c_maxDepth];
+	unsigned nStack = 0;
+	unsigned iNode = 0;
+	if (intersectBox(m_nodes[0].bbMin, m_nodes[0].bbMax, orig, invDir, tMax) == FLT_MAX)
+		return false;
+
+	for (;;)
+	{
+		const NODE &node = m_nodes[iNode];
+		if (node.count)
+		{
+			// Moller-Trumbore: the ray against 4 triangles at once
+			for (unsigned iPack = node.first / 4; iPack < (node.first + node.count + 3) / 4; iPack++)
+			{
+				const TRIANGLE4 &pack = m_packs[iPack];
+				__m128 e1x = _mm_loadu_ps(pack.e1x), e1y = _mm_loadu_ps(pack.e1y), e1z = _mm_loadu_ps(pack.e1z);
+				__m128 e2x = _mm_loadu_ps(pack.e2x), e2y = _mm_loadu_ps(pack.e2y), e2z = _mm_loadu_ps(pack.e2z);
+
+				// p = dir x e2, det = e1 . p
+				__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+				__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+				__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+				__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+				__m128 mask = _mm_cmpgt_ps(_mm_and_ps(det, absMask), eps);
+				__m128 invDet = _mm_div_ps(one, det);
+
+				// s = orig - a, u = s . p / det
+				__m128 sx = _mm_sub_ps(ox, _mm_loadu_ps(pack.ax)), sy = _mm_sub_ps(oy, _mm_loadu_ps(pack.ay)), sz = _mm_sub_ps(oz, _mm_loadu_ps(pack.az));
+				__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+				mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+
+				// q = s x e1, v = dir . q / det, t = e2 . q / det
+				__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+				__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+				__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+				__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+				mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+				__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+				mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_cmplt_ps(t, _mm_set1_ps(hit.t))));
+
+				unsigned bits = _mm_movemask_ps(mask);
+				if (bits == 0) continue;
+				if (bAnyHit) return true;
+
+				// the closest of the lanes hit
+				float ts[4], us[4], vs[4];
+				_mm_storeu_ps(ts, t);
+				_mm_storeu_ps(us, u);
+				_mm_storeu_ps(vs, v);
+				for (unsigned j = 0; j < 4; j++)
+					if ((bits & (1 << j)) && ts[j] < hit.t)
+					{
+						hit.t = ts[j];
+						hit.u = us[j];
+						hit.v = vs[j];
+						hit.iTriangle = m_triangles[iPack * 4 + j].index;
+					}
+				bHit = true;
+			}
+		}
+		else
+		{
+			// the nearer child first
+			unsigned iLeft = node.first, iRight = node.first + 1;
+			float tLeft = intersectBox(m_nodes[iLeft].bbMin, m_nodes[iLeft].bbMax, orig, invDir, hit.t);
+			float tRight = intersectBox(m_nodes[iRight].bbMin, m_nodes[iRight].bbMax, orig, invDir, hit.t);
+			if (tLeft > tRight)
+			{
+				swap(tLeft, tRight);
+				swap(iLeft, iRight);
+			}
+			if (tLeft != FLT_MAX)
+			{
+				if (tRight != FLT_MAX)
+					stack[nStack++] = iRight;
+				iNode = iLeft;
+				continue;
+			}
+		}
+
+		if (nStack == 0) break;
+		iNode = stack[--nStack];
+	}
+	return bHit;
+}
+
+bool C3dglBVH::intersect(const glm::vec3 &orig, const glm::vec3 &dir, float tMax, HIT &hit) const
+{
+	return traverse<false>(orig, dir, tMax, hit);
+}
+
+bool C3dglBVH::occluded(const glm::vec3 &orig, const glm::vec3 &dir, float tMax) const
+{
+	HIT hit;
+	return traverse<true>(orig, dir, tMax, hit);
+}
+
+unsigned C3dglBVH::occluded4(const glm::vec3 orig[4], const glm::vec3 dir[4], float tMax) const
+{
+	if (m_nodes.empty()) return 0;
+
+	// the packet in SoA form
+	__m128 ox = _mm_setr_ps(orig[0].x, orig[1].x, orig[2].x, orig[3].x);
+	__m128 oy = _mm_setr_ps(orig[0].y, orig[1].y, orig[2].y, orig[3].y);
+	__m128 oz = _mm_setr_ps(orig[0].z, orig[1].z, orig[2].z, orig[3].z);
+	__m128 dx = _mm_setr_ps(dir[0].x, dir[1].x, dir[2].x, dir[3].x);
+	__m128 dy = _mm_setr_ps(dir[0].y, dir[1].y, dir[2].y, dir[3].y);
+	__m128 dz = _mm_setr_ps(dir[0].z, dir[1].z, dir[2].z, dir[3].z);
+	__m128 one = _mm_set1_ps(1), zero = _mm_setzero_ps();
+	__m128 ix = _mm_div_ps(one, dx), iy = _mm_div_ps(one, dy), iz = _mm_div_ps(one, dz);
+	__m128 tFar = _mm_set1_ps(tMax);
+	__m128 eps = _mm_set1_ps(1e-12f);
+	__m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+
+	unsigned hits = 0;
+	unsigned stack[c_maxDepth];
+	unsigned nStack = 0;
+	stack[nStack++] = 0;
+	while (nStack)
+	{
+		const NODE &node = m_nodes[stack[--nStack]];
+
+		// slab test of the rays still to be resolved
+		__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bbMin.x), ox), ix), t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bbMax.x), ox), ix);
+		__m128 tEnter = _mm_max_ps(_mm_min_ps(t0, t1), zero), tExit = _mm_min_ps(_mm_max_ps(t0, t1), tFar);
+		t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bbMin.y), oy), iy); t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bbMax.y), oy), iy);
+		tEnter = _mm_max_ps(tEnter, _mm_min_ps(t0, t1)); tExit = _mm_min_ps(tExit, _mm_max_ps(t0, t1));
+		t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bbMin.z), oz), iz); t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.bbMax.z), oz), iz);
+		tEnter = _mm_max_ps(tEnter, _mm_min_ps(t0, t1)); tExit = _mm_min_ps(tExit, _mm_max_ps(t0, t1));
+		if ((_mm_movemask_ps(_mm_cmple_ps(tEnter, tExit)) & ~hits) == 0)
+			continue;
+
+		if (node.count == 0)
+		{
+			stack[nStack++] = node.first + 1;
+			stack[nStack++] = node.first;
+			continue;
+		}
+
+		// Moller-Trumbore: one triangle against the 4 rays
+		for (unsigned i = node.first; i < node.first + node.count; i++)
+		{
+			const TRIANGLE &tri = m_triangles[i];
+			__m128 e1x = _mm_set1_ps(tri.e1.x), e1y = _mm_set1_ps(tri.e1.y), e1z = _mm_set1_ps(tri.e1.z);
+			__m128 e2x = _mm_set1_ps(tri.e2.x), e2y = _mm_set1_ps(tri.e2.y), e2z = _mm_set1_ps(tri.e2.z);
+
+			// p = dir x e2, det = e1 . p
+			__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+			__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+			__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+			__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+			__m128 mask = _mm_cmpgt_ps(_mm_and_ps(det, absMask), eps);
+			__m128 invDet = _mm_div_ps(one, det);
+
+			// s = orig - a, u = s . p / det
+			__m128 sx = _mm_sub_ps(ox, _mm_set1_ps(tri.a.x)), sy = _mm_sub_ps(oy, _mm_set1_ps(tri.a.y)), sz = _mm_sub_ps(oz, _mm_set1_ps(tri.a.z));
+			__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+			mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+
+			// q = s x e1, v = dir . q / det, t = e2 . q / det
+			__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+			__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+			__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+			__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+			mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+			__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+			mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_cmplt_ps(t, tFar)));
+
+			hits |= _mm_movemask_ps(mask);
+			if (hits == 0xF) return hits;
+		}
+	}
+	return hits;
+}
+
+unsigned C3dglBVH::intersect(const glm::vec3 *orig, const glm::vec3 *dir, unsigned n, float tMax, HIT *hits) const
+{
+	// chunks of 64 rays - fine enough to balance, coarse enough to keep the pool overhead low
+	const unsigned nChunk = 64;
+	vector<unsigned> nHits((n + nChunk - 1) / nChunk, 0);
+	C3dglThreadPool::get().parallelFor((unsigned)nHits.size(), [&](unsigned iChunk)
+	{
+		for (unsigned i = iChunk * nChunk; i < min(n, (iChunk + 1) * nChunk); i++)
+			if (traverse<false>(orig[i], dir[i], tMax, hits[i]))
+				nHits[iChunk]++;
+			else
+				hits[i].iTriangle = (unsigned)-1;
+	});
+	unsigned nTotal = 0;
+	for (unsigned nHit : nHits)
+		nTotal += nHit;
+	return nTotal;
+}
+
+unsigned C3dglBVH::occluded(const glm::vec3 *orig, const glm::vec3 *dir, unsigned n, float tMax, bool *pOccluded) const
+{
+	const unsigned nChunk = 64;
+	vector<unsigned> nHits((n + nChunk - 1) / nChunk, 0);
+	C3dglThreadPool::get().parallelFor((unsigned)nHits.size(), [&](unsigned iChunk)
+	{
+		HIT hit;
+		for (unsigned i = iChunk * nChunk; i < min(n, (iChunk + 1) * nChunk); i++)
+			if ((pOccluded[i] = traverse<true>(orig[i], dir[i], tMax, hit)))
+				nHits[iChunk]++;
+	});
+	unsigned nTotal = 0;
+	for (unsigned nHit : nHits)
+		nTotal += nHit;
+	return nTotal;
+}
@@ -0,0 +1,298 @@
+#include "../GL/glew.h"
+#include "../GL/3dglClusteredLights.h"
+#include "../GL/3dglShader.h"
+#include "../GL/3dglState.h"
+#include "../GL/3dglThreadPool.h"
+
+// standard libraries
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <xmmintrin.h>
+
+using namespace std;
+using namespace _3dgl;
+
+C3dglClusteredLights::C3dglClusteredLights() : C3dglObject()
+{
+	m_nx = m_ny = m_nz = 0;
+	m_near = m_far = 0;
+	m_matrixProjection = glm::mat4(0);
+	memset(&m_block, 0, sizeof(m_block));
+	memset(m_idBuffer, 0, sizeof(m_idBuffer));
+	memset(m_idTexture, 0, sizeof(m_idTexture));
+	m_maxTexels = 0;
+}
+
+bool C3dglClusteredLights::create(unsigned nx, unsigned ny, unsigned nz)
+{
+	destroy();
+
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &m_maxTexels);
+	if (nx == 0 || ny == 0 || nz == 0 || nx * ny * nz > (unsigned)m_maxTexels)
+		return logError("invalid grid size: " + to_string(nx) + " x " + to_string(ny) + " x " + to_string(nz));
+	m_nx = nx; m_ny = ny; m_nz = nz;
+
+	// texture buffers: lights (5 texels each), cluster ranges (offset, count), light indices
+	GLenum formats[] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+	glGenBuffers(3, m_idBuffer);
+	glGenTextures(3, m_idTexture);
+	for (unsigned i = 0; i < 3; i++)
+	{
+		C3dglState::bindBuffer(GL_TEXTURE_BUFFER, m_idBuffer[i]);
+		glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+		C3dglState::bindTexture(UNIT_LIGHTS + i, GL_TEXTURE_BUFFER, m_idTexture[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, formats[i], m_idBuffer[i]);
+	}
+
+	m_block.grid = glm::ivec4(nx, ny, nz, 0);
+	m_ubo.create(UBO_CLUSTERS, m_block);
+
+	// programs linked from now on find the light lists at their units
+	C3dglProgram::SetSamplerUnit("clusterLights", UNIT_LIGHTS);
+	C3dglProgram::SetSamplerUnit("clusterRanges", UNIT_RANGES);
+	C3dglProgram::SetSamplerUnit("clusterIndices", UNIT_INDICES);
+
+	m_matrixProjection = glm::mat4(0);		// forces _buildClusters on the first update
+	m_sliceLights.resize(nz);
+	m_slices.resize(nz);
+
+	return logSuccess("created: " + to_string(nx) + " x " + to_string(ny) + " x " + to_string(nz) + " clusters");
+}
+
+void C3dglClusteredLights::destroy()
+{
+	if (m_idBuffer[0])
+	{
+		C3dglState::deleteTextures(3, m_idTexture);
+		C3dglState::deleteBuffers(3, m_idBuffer);
+	}
+	memset(m_idBuffer, 0, sizeof(m_idBuffer));
+	memset(m_idTexture, 0, sizeof(m_idTexture));
+	m_ubo.destroy();
+	m_nx = m_ny = m_nz = 0;
+}
+
+void C3dglClusteredLights::_buildClusters(const glm::mat4 &P)
+{
+	m_matrixProjection = P;
+
+	// near and far planes from the perspective matrix; an infinite far plane is replaced with a finite one
+	m_near = P[3][2] / (P[2][2] - 1);
+	m_far = (P[2][2] + 1 < 0) ? P[3][2] / (P[2][2] + 1) : m_near * 10000;
+
+	// exponential slices: slice = log(depth) * scale + bias
+	float scale = m_nz / log(m_far / m_near);
+	m_block.params.z = scale;
+	m_block.params.w = -log(m_near) * scale;
+
+	// padded by 3, so that the 4-wide loads never read past the end
+	size_t n = m_nx * m_ny * m_nz + 3;
+	for (vector<float> *p : { &m_minX, &m_minY, &m_minZ, &m_maxX, &m_maxY, &m_maxZ })
+		p->assign(n, 0);
+
+	for (unsigned z = 0; z < m_nz; z++)
+	{
+		float dNear = m_near * pow(m_far / m_near, (float)z / m_nz);
+		float dFar = m_near * pow(m_far / m_near, (float)(z + 1) / m_nz);
+		for (unsigned y = 0; y < m_ny; y++)
+		{
+			// view space y at the depth of 1: (ndc + P[2][1]) / P[1][1]
+			float y0 = (-1 + 2.f * y / m_ny + P[2][1]) / P[1][1];
+			float y1 = (-1 + 2.f * (y + 1) / m_ny + P[2][1]) / P[1][1];
+			for (unsigned x = 0; x < m_nx; x++)
+			{
+				float x0 = (-1 + 2.f * x / m_nx + P[2][0]) / P[0][0];
+				float x1 = (-1 + 2.f * (x + 1) / m_nx + P[2][0]) / P[0][0];
+
+				unsigned c = (z * m_ny + y) * m_nx + x;
+				m_minX[c] = std::min(x0 * dNear, x0 * dFar);
+				m_maxX[c] = std::max(x1 * dNear, x1 * dFar);
+				m_minY[c] = std::min(y0 * dNear, y0 * dFar);
+				m_maxY[c] = std::max(y1 * dNear, y1 * dFar);
+				m_minZ[c] = -dFar;
+				m_maxZ[c] = -dNear;
+			}
+		}
+	}
+}
+
+void C3dglClusteredLights::update(const glm::mat4 &matrixView, const glm::mat4 &matrixProjection, int width, int height)
+{
+	if (m_nx == 0) return;
+	if (matrixProjection != m_matrixProjection)
+		_buildClusters(matrixProjection);
+	const glm::mat4 &P = m_matrixProjection;
+	float scale = m_block.params.z, bias = m_block.params.w;
+
+	// active lights in view space, and their images for the GPU
+	m_viewLights.clear();
+	m_gpuLights.clear();
+	size_t maxLights = m_maxTexels / TEXELS_PER_LIGHT;
+	for (const C3dglPointLightBlock &light : m_lights)
+	{
+		if (light.isDark()) continue;
+		if (m_viewLights.size() == maxLights)
+		{
+			logWarning("too many lights - only " + to_string(maxLights) + " used");
+			break;
+		}
+
+		LIGHT l;
+		l.pos = glm::vec3(matrixView * glm::vec4(light.position, 1));
+		l.range = light.getRange();
+
+		// the range of tiles - from the bounding box of the sphere, unless it crosses the near plane
+		float d = -l.pos.z;
+		float dMin = d - l.range, dMax = d + l.range;
+		if (dMax < m_near || dMin > m_far) continue;
+		if (dMin <= m_near)
+		{
+			l.x0 = l.y0 = 0;
+			l.x1 = m_nx - 1;
+			l.y1 = m_ny - 1;
+		}
+		else
+		{
+			// the extremes of x / depth and y / depth are at the corners of the box
+			float ax = std::min((l.pos.x - l.range) / dMin, (l.pos.x - l.range) / dMax);
+			float bx = std::max((l.pos.x + l.range) / dMin, (l.pos.x + l.range) / dMax);
+			float ay = std::min((l.pos.y - l.range) / dMin, (l.pos.y - l.range) / dMax);
+			float by = std::max((l.pos.y + l.range) / dMin, (l.pos.y + l.range) / dMax);
+			auto tile = [](float ndc, unsigned n) { return std::min(std::max((int)floor((ndc + 1) * 0.5f * n), 0), (int)n - 1); };
+			l.x0 = tile(ax * P[0][0] - P[2][0], m_nx);
+			l.x1 = tile(bx * P[0][0] - P[2][0], m_nx);
+			l.y0 = tile(ay * P[1][1] - P[2][1], m_ny);
+			l.y1 = tile(by * P[1][1] - P[2][1], m_ny);
+		}
+		m_viewLights.push_back(l);
+
+		glm::vec4 texels[TEXELS_PER_LIGHT] = {
+			glm::vec4(l.pos, light.radius),
+			glm::vec4(light.ambient, light.cutoff),
+			glm::vec4(light.diffuse, light.diffuseStrength),
+			glm::vec4(light.specular, light.specularPower),
+			glm::vec4((float)light.shadow, 0, 0, 0)
+		};
+		m_gpuLights.insert(m_gpuLights.end(), texels, texels + TEXELS_PER_LIGHT);
+	}
+
+	// the depth slices each light reaches
+	for (auto &lights : m_sliceLights)
+		lights.clear();
+	for (unsigned i = 0; i < m_viewLights.size(); i++)
+	{
+		const LIGHT &l = m_viewLights[i];
+		float dMin = -l.pos.z - l.range, dMax = -l.pos.z + l.range;
+		int z0 = dMin <= m_near ? 0 : (int)(log(dMin) * scale + bias);
+		int z1 = dMax >= m_far ? m_nz - 1 : (int)(log(dMax) * scale + bias);
+		z0 = std::max(z0, 0);
+		z1 = std::min(z1, (int)m_nz - 1);
+		for (int z = z0; z <= z1; z++)
+			m_sliceLights[z].push_back(i);
+	}
+
+	// the slices are independent
+	C3dglThreadPool::get().parallelFor(m_nz, [this](unsigned z) { _binSlice(z); });
+
+	// merge: the global index list and (offset, count) for every cluster
+	unsigned nTiles = m_nx * m_ny;
+	size_t maxIndices = m_maxTexels;
+	m_ranges.resize(2 * nTiles * m_nz);
+	m_indices.clear();
+	for (unsigned z = 0; z < m_nz; z++)
+	{
+		const SLICE &slice = m_slices[z];
+		size_t base = m_indices.size();
+		for (unsigned t = 0; t < nTiles; t++)
+		{
+			size_t offset = base + slice.first[t];
+			size_t count = offset < maxIndices ? std::min<size_t>(slice.counts[t], maxIndices - offset) : 0;
+			m_ranges[2 * (z * nTiles + t)] = (GLuint)(count ? offset : 0);
+			m_ranges[2 * (z * nTiles + t) + 1] = (GLuint)count;
+		}
+		size_t n = std::min(slice.indices.size(), maxIndices - std::min(base, maxIndices));
+		m_indices.insert(m_indices.end(), slice.indices.begin(), slice.indices.begin() + n);
+	}
+	if (m_indices.size() == maxIndices)
+		logWarning("light index list full - some clusters have lost their lights");
+
+	// upload - glBufferData orphans last frame's storage, so there is no wait for the GPU
+	auto upload = [](GLuint id, const void *pData, size_t size)
+	{
+		static const GLuint dummy[4] = { 0, 0, 0, 0 };
+		C3dglState::bindBuffer(GL_TEXTURE_BUFFER, id);
+		glBufferData(GL_TEXTURE_BUFFER, size ? size : sizeof(dummy), size ? pData : dummy, GL_STREAM_DRAW);
+	};
+	upload(m_idBuffer[0], m_gpuLights.data(), m_gpuLights.size() * sizeof(glm::vec4));
+	upload(m_idBuffer[1], m_ranges.data(), m_ranges.size() * sizeof(GLuint));
+	upload(m_idBuffer[2], m_indices.data(), m_indices.size() * sizeof(GLuint));
+
+	m_block.grid.w = (int)m_viewLights.size();
+	m_block.params.x = (float)m_nx / std::max(width, 1);
+	m_block.params.y = (float)m_ny / std::max(height, 1);
+	m_ubo.update(m_block);
+}
+
+void C3dglClusteredLights::_binSlice(unsigned z)
+{
+	SLICE &slice = m_slices[z];
+	unsigned nTiles = m_nx * m_ny;
+	slice.counts.assign(nTiles, 0);
+	slice.tiles.clear();
+	slice.lights.clear();
+
+	// sphere vs cluster box tests, 4 neighbouring clusters of a row at once
+	const __m128 zero = _mm_setzero_ps();
+	unsigned base = z * nTiles;
+	for (unsigned i : m_sliceLights[z])
+	{
+		const LIGHT &l = m_viewLights[i];
+		__m128 cx = _mm_set1_ps(l.pos.x), cy = _mm_set1_ps(l.pos.y), cz = _mm_set1_ps(l.pos.z);
+		__m128 r2 = _mm_set1_ps(l.range * l.range);
+		for (int y = l.y0; y <= l.y1; y++)
+			for (int x = l.x0; x <= l.x1; x += 4)
+			{
+				unsigned c = base + y * m_nx + x;
+
+				// squared distance from the centre to the box: per axis max(min - c, 0) + max(c - max, 0)
+				__m128 dx = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&m_minX[c]), cx), zero), _mm_max_ps(_mm_sub_ps(cx, _mm_loadu_ps(&m_maxX[c])), zero));
+				__m128 dy = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&m_minY[c]), cy), zero), _mm_max_ps(_mm_sub_ps(cy, _mm_loadu_ps(&m_maxY[c])), zero));
+				__m128 dz = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&m_minZ[c]), cz), zero), _mm_max_ps(_mm_sub_ps(cz, _mm_loadu_ps(&m_maxZ[c])), zero));
+				__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+				int mask = _mm_movemask_ps(_mm_cmple_ps(d2, r2));
+
+				// lanes past the light's tile range belong to other tiles (or the next row)
+				mask &= (1 << std::min(4, l.x1 - x + 1)) - 1;
+				for (int k = 0; k < 4; k++)
+					if (mask & (1 << k))
+					{
+						unsigned tile = y * m_nx + x + k;
+						slice.tiles.push_back(tile);
+						slice.lights.push_back(i);
+						slice.counts[tile]++;
+					}
+			}
+	}
+
+	// counting sort by tile
+	slice.first.resize(nTiles);
+	unsigned n = 0;
+	for (unsigned t = 0; t < nTiles; t++)
+	{
+		slice.first[t] = n;
+		n += slice.counts[t];
+	}
+	slice.indices.resize(n);
+	vector<unsigned> cursor(slice.first);
+	for (size_t k = 0; k < slice.tiles.size(); k++)
+		slice.indices[cursor[slice.tiles[k]]++] = slice.lights[k];
+}
+
+void C3dglClusteredLights::bind()
+{
+	if (m_idBuffer[0] == 0) return;
+	for (unsigned i = 0; i < 3; i++)
+		C3dglState::bindTexture(UNIT_LIGHTS + i, GL_TEXTURE_BUFFER, m_idTexture[i]);
+	m_ubo.bind();
+}
@@ -0,0 +1,237 @@
+#include "../GL/glew.h"
+#include "../GL/3dglDeferredRenderer.h"
+#include "../GL/3dglState.h"
+
+// standard libraries
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <algorithm>
+
+// GLM include files
+#include "../glm/vec4.hpp"
+#include "../glm/matrix.hpp"
+
+using namespace std;
+using namespace _3dgl;
+
+// sampler names of the G-buffer, in the order of RT, then the depth
+static const char *GBUFFER_SAMPLERS[] = { "gbufferAlbedo", "gbufferNormal", "gbufferDiffuse", "gbufferAmbient", "gbufferLight", "gbufferDepth" };
+
+C3dglDeferredRenderer::C3dglDeferredRenderer() : C3dglObject()
+{
+	m_idFBO = m_idFBOLight = 0;
+	memset(m_idTex, 0, sizeof(m_idTex));
+	m_idDepth = 0;
+	m_idVAO = 0;
+	m_width = m_height = 0;
+	m_locLightData = (GLuint)-1;
+	m_nLightsDrawn = m_nLightsCulled = 0;
+}
+
+bool C3dglDeferredRenderer::create(int width, int height, std::string pathShaders)
+{
+	destroy();
+
+	// programs linked from now on find the G-buffer at its units
+	for (unsigned i = 0; i <= RT_LAST; i++)
+		C3dglProgram::SetSamplerUnit(GBUFFER_SAMPLERS[i], UNIT_GBUFFER + i);
+
+	// the light passes share the vertex shader; the point and the directional light differ in the defines
+	if (!m_vertexShader.Create(GL_VERTEX_SHADER)) return false;
+	if (!m_vertexShader.LoadFromFile(pathShaders + "deferred.vert")) return false;
+	if (!m_vertexShader.Compile()) return false;
+	if (!m_fragDirLight.Create(GL_FRAGMENT_SHADER)) return false;
+	if (!m_fragDirLight.LoadFromFile(pathShaders + "deferred_light.frag", "DIR_LIGHT")) return false;
+	if (!m_fragDirLight.Compile()) return false;
+	if (!m_fragPointLight.Create(GL_FRAGMENT_SHADER)) return false;
+	if (!m_fragPointLight.LoadFromFile(pathShaders + "deferred_light.frag")) return false;
+	if (!m_fragPointLight.Compile()) return false;
+	if (!m_fragCompose.Create(GL_FRAGMENT_SHADER)) return false;
+	if (!m_fragCompose.LoadFromFile(pathShaders + "deferred_compose.frag")) return false;
+	if (!m_fragCompose.Compile()) return false;
+
+	if (!m_programDirLight.Create() || !m_programDirLight.Attach(m_vertexShader) || !m_programDirLight.Attach(m_fragDirLight) || !m_programDirLight.Link()) return false;
+	if (!m_programPointLight.Create() || !m_programPointLight.Attach(m_vertexShader) || !m_programPointLight.Attach(m_fragPointLight) || !m_programPointLight.Link()) return false;
+	if (!m_programCompose.Create() || !m_programCompose.Attach(m_vertexShader) || !m_programCompose.Attach(m_fragCompose) || !m_programCompose.Link()) return false;
+	m_locLightData = m_programPointLight.GetUniformLocation("lightData");
+
+	glGenVertexArrays(1, &m_idVAO);
+
+	// render targets
+	glGenTextures(RT_LAST, m_idTex);
+	glGenTextures(1, &m_idDepth);
+	if (!resize(width, height)) return false;
+
+	glGenFramebuffers(1, &m_idFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_idFBO);
+	GLenum drawBuffers[RT_LAST];
+	for (unsigned i = 0; i < RT_LAST; i++)
+	{
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, m_idTex[i], 0);
+		drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+	}
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_idDepth, 0);
+	glDrawBuffers(RT_LAST, drawBuffers);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+	glGenFramebuffers(1, &m_idFBOLight);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_idFBOLight);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_idTex[RT_LIGHT], 0);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	GLenum statusLight = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE || statusLight != GL_FRAMEBUFFER_COMPLETE)
+		return logError("G-buffer incomplete: status " + to_string(status) + ", " + to_string(statusLight));
+
+	return logSuccess("created: " + to_string(width) + " x " + to_string(height));
+}
+
+bool C3dglDeferredRenderer::resize(int width, int height)
+{
+	if (m_idDepth == 0) return logError("not created.");
+	width = std::max(width, 1);
+	height = std::max(height, 1);
+	if (width == m_width && height == m_height) return true;
+	m_width = width;
+	m_height = height;
+
+	// albedo is 8-bit; normals and the light accumulation need more range and precision
+	GLenum formats[RT_LAST] = { GL_RGBA8, GL_RGBA16F, GL_RGBA16F, GL_RGBA16F, GL_RGBA16F };
+	for (unsigned i = 0; i <= RT_LAST; i++)
+	{
+		C3dglState::bindTexture(UNIT_GBUFFER + i, GL_TEXTURE_2D, i < RT_LAST ? m_idTex[i] : m_idDepth);
+		if (i < RT_LAST)
+			glTexImage2D(GL_TEXTURE_2D, 0, formats[i], width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+		else
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	return true;
+}
+
+void C3dglDeferredRenderer::destroy()
+{
+	if (m_idFBO) glDeleteFramebuffers(1, &m_idFBO);
+	if (m_idFBOLight) glDeleteFramebuffers(1, &m_idFBOLight);
+	if (m_idTex[0]) C3dglState::deleteTextures(RT_LAST, m_idTex);
+	if (m_idDepth) C3dglState::deleteTextures(1, &m_idDepth);
+	if (m_idVAO) C3dglState::deleteVertexArrays(1, &m_idVAO);
+	m_idFBO = m_idFBOLight = 0;
+	memset(m_idTex, 0, sizeof(m_idTex));
+	m_idDepth = 0;
+	m_idVAO = 0;
+	m_width = m_height = 0;
+}
+
+void C3dglDeferredRenderer::beginGeometry()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, m_idFBO);
+
+	// glClearBuffer leaves the clear colour of the default framebuffer alone
+	static const GLfloat zero[] = { 0, 0, 0, 0 };
+	static const GLfloat one = 1;
+	C3dglState::depthMask(GL_TRUE);
+	for (GLint i = 0; i < RT_LAST; i++)
+		glClearBufferfv(GL_COLOR, i, zero);
+	glClearBufferfv(GL_DEPTH, 0, &one);
+}
+
+bool C3dglDeferredRenderer::_getScreenBounds(const glm::vec3 &pos, float range, const glm::mat4 &P, int &x0, int &y0, int &x1, int &y1)
+{
+	float fNear = P[3][2] / (P[2][2] - 1);
+	float fFar = (P[2][2] + 1 < 0) ? P[3][2] / (P[2][2] + 1) : FLT_MAX;
+	float d = -pos.z;
+	float dMin = d - range, dMax = d + range;
+	if (dMax < fNear || dMin > fFar) return false;
+
+	// crossing the near plane - the whole screen
+	x0 = y0 = 0;
+	x1 = m_width;
+	y1 = m_height;
+	if (dMin <= fNear) return true;
+
+	// the extremes of x / depth and y / depth are at the corners of the bounding box
+	float ax = std::min((pos.x - range) / dMin, (pos.x - range) / dMax) * P[0][0] - P[2][0];
+	float bx = std::max((pos.x + range) / dMin, (pos.x + range) / dMax) * P[0][0] - P[2][0];
+	float ay = std::min((pos.y - range) / dMin, (pos.y - range) / dMax) * P[1][1] - P[2][1];
+	float by = std::max((pos.y + range) / dMin, (pos.y + range) / dMax) * P[1][1] - P[2][1];
+	if (bx < -1 || ax > 1 || by < -1 || ay > 1) return false;
+
+	x0 = (int)floor((std::max(ax, -1.f) + 1) * 0.5f * m_width);
+	x1 = (int)ceil((std::min(bx, 1.f) + 1) * 0.5f * m_width);
+	y0 = (int)floor((std::max(ay, -1.f) + 1) * 0.5f * m_height);
+	y1 = (int)ceil((std::min(by, 1.f) + 1) * 0.5f * m_height);
+	return x1 > x0 && y1 > y0;
+}
+
+void C3dglDeferredRenderer::render(const glm::mat4 &matrixView, const glm::mat4 &matrixProjection, bool bDirLight)
+{
+	m_nLightsDrawn = m_nLightsCulled = 0;
+	if (m_idFBO == 0) return;
+	glm::mat4 matrixInvProjection = glm::inverse(matrixProjection);
+
+	// G-buffer textures - the light target is written, not sampled, until the compose pass
+	for (unsigned i = 0; i < RT_LAST; i++)
+		C3dglState::bindTexture(UNIT_GBUFFER + i, GL_TEXTURE_2D, m_idTex[i]);
+	C3dglState::bindTexture(UNIT_GBUFFER + RT_LAST, GL_TEXTURE_2D, m_idDepth);
+	C3dglState::bindVertexArray(m_idVAO);
+
+	// light accumulation: additive, no depth
+	glBindFramebuffer(GL_FRAMEBUFFER, m_idFBOLight);
+	C3dglState::disable(GL_DEPTH_TEST);
+	C3dglState::depthMask(GL_FALSE);
+	C3dglState::enable(GL_BLEND);
+	C3dglState::blendFunc(GL_ONE, GL_ONE);
+
+	if (bDirLight && m_programDirLight.Use())
+	{
+		m_programDirLight.SendUniform("matrixInvProjection", matrixInvProjection);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+
+	if (!m_lights.empty() && m_programPointLight.Use())
+	{
+		m_programPointLight.SendUniform("matrixInvProjection", matrixInvProjection);
+		C3dglState::enable(GL_SCISSOR_TEST);
+		for (const C3dglPointLightBlock &light : m_lights)
+		{
+			if (light.isDark()) continue;
+
+			// each light covers only the pixels within the range of its attenuation
+			glm::vec3 pos = glm::vec3(matrixView * glm::vec4(light.position, 1));
+			int x0, y0, x1, y1;
+			if (!_getScreenBounds(pos, light.getRange(), matrixProjection, x0, y0, x1, y1))
+			{
+				m_nLightsCulled++;
+				continue;
+			}
+			glScissor(x0, y0, x1 - x0, y1 - y0);
+
+			glm::vec4 data[4] = {
+				glm::vec4(pos, light.radius),
+				glm::vec4(light.ambient, light.cutoff),
+				glm::vec4(light.diffuse, light.diffuseStrength),
+				glm::vec4(light.specular, light.specularPower) };
+			m_programPointLight.SendUniform4v(m_locLightData, &data[0][0], 4);
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+			m_nLightsDrawn++;
+		}
+		C3dglState::disable(GL_SCISSOR_TEST);
+	}
+
+	// compose into the default framebuffer, writing the scene depth as well
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	C3dglState::disable(GL_BLEND);
+	C3dglState::enable(GL_DEPTH_TEST);
+	C3dglState::depthMask(GL_TRUE);
+	GLenum depthFunc = C3dglState::getDepthFunc();
+	C3dglState::depthFunc(GL_ALWAYS);
+	if (m_programCompose.Use())
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	C3dglState::depthFunc(depthFunc);
+}
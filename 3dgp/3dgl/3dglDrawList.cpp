@@ -0,0 +1,445 @@
+#include "../GL/glew.h"
+#include "../GL/3dglDrawList.h"
+#include "../GL/3dglShader.h"
+
+// assimp include file
+#include "../GL/assimp/cimport.h"
+
+// GLM include files
+#include "../glm/gtc/type_ptr.hpp"
+#include "../glm/geometric.hpp"
+#include "../glm/matrix.hpp"
+
+#include <algorithm>
+
+using namespace std;
+using namespace _3dgl;
+
+unsigned C3dglDrawList::add(C3dglModel &model, C3dglMaterial *pMaterial, glm::mat4 matrix, int iNode)
+{
+	OBJECT obj;
+	obj.pModel = &model;
+	obj.pMaterial = pMaterial;
+	obj.iNode = iNode;
+	obj.matrix = matrix;
+	obj.bAlive = true;
+	obj.bProbeLit = false;
+	obj.bDynamic = false;
+	obj.bCastShadows = true;
+	obj.revision = ++m_nRevision;
+	m_objects.push_back(obj);
+	m_bCompiled = false;
+	m_nStaticRevision++;
+	return m_objects.size() - 1;
+}
+
+void C3dglDrawList::remove(unsigned id)
+{
+	if (id >= m_objects.size() || !m_objects[id].bAlive) return;
+	m_objects[id].bAlive = false;
+	m_bCompiled = false;
+	m_nStaticRevision++;
+	m_nRevisionRemoved = ++m_nRevision;
+}
+
+void C3dglDrawList::clear()
+{
+	m_objects.clear();
+	m_packets.clear();
+	m_culler.resize(0);
+	m_bvh.clear();
+	m_iCullQuery = -1;
+	m_bCompiled = true;
+	m_nStaticRevision++;
+	m_nRevisionRemoved = ++m_nRevision;
+}
+
+void C3dglDrawList::setMatrix(unsigned id, glm::mat4 matrix)
+{
+	if (id >= m_objects.size()) return;
+	OBJECT &obj = m_objects[id];
+	obj.matrix = matrix;
+	obj.revision = ++m_nRevision;
+	if (!obj.bDynamic)
+		m_nStaticRevision++;
+
+	// patch only the packets of this object
+	if (m_bCompiled)
+		for (unsigned i : obj.packets)
+		{
+			m_packets[i].matrix = matrix * m_packets[i].matrixNode;
+			updateBounds(i);
+		}
+}
+
+void C3dglDrawList::setMaterial(unsigned id, C3dglMaterial *pMaterial)
+{
+	if (id >= m_objects.size()) return;
+	OBJECT &obj = m_objects[id];
+	if (obj.pMaterial == pMaterial) return;
+	obj.pMaterial = pMaterial;
+
+	// patch only the packets of this object
+	if (m_bCompiled)
+		for (unsigned i : obj.packets)
+			m_packets[i].pMaterial = pMaterial;
+}
+
+void C3dglDrawList::compileNode(unsigned idObject, aiNode *pNode, glm::mat4 m)
+{
+	aiMatrix4x4 mx = pNode->mTransformation;
+	aiTransposeMatrix4(&mx);
+	m *= glm::make_mat4((GLfloat*)&mx);
+
+	OBJECT &obj = m_objects[idObject];
+	for (unsigned iMesh : vector<unsigned>(pNode->mMeshes, pNode->mMeshes + pNode->mNumMeshes))
+	{
+		PACKET packet;
+		packet.idObject = idObject;
+		packet.pMesh = obj.pModel->getMesh(iMesh);
+		packet.pMaterial = obj.pMaterial;
+		packet.matrixNode = m;
+		packet.matrix = obj.matrix * m;
+		packet.proxy = 0;
+		if (packet.pMesh) m_packets.push_back(packet);
+	}
+
+	for (aiNode *p : vector<aiNode*>(pNode->mChildren, pNode->mChildren + pNode->mNumChildren))
+		compileNode(idObject, p, m);
+}
+
+void C3dglDrawList::compile()
+{
+	m_bCompiled = false;
+	m_packets.clear();
+	m_bvh.clear();
+	m_iCullQuery = -1;
+	for (unsigned id = 0; id < m_objects.size(); id++)
+	{
+		OBJECT &obj = m_objects[id];
+		obj.packets.clear();
+		if (!obj.bAlive || !obj.pModel->GetScene() || !obj.pModel->GetScene()->mRootNode) continue;
+
+		aiNode *pRoot = obj.pModel->GetScene()->mRootNode;
+		if (obj.iNode < 0)
+			compileNode(id, pRoot, glm::mat4(1));
+		else if ((unsigned)obj.iNode < pRoot->mNumChildren)
+		{
+			aiMatrix4x4 mx = pRoot->mTransformation;
+			aiTransposeMatrix4(&mx);
+			compileNode(id, pRoot->mChildren[obj.iNode], glm::make_mat4((GLfloat*)&mx));
+		}
+	}
+
+	m_culler.resize(m_packets.size());
+	for (unsigned i = 0; i < m_packets.size(); i++)
+	{
+		m_objects[m_packets[i].idObject].packets.push_back(i);
+		updateBounds(i);
+		m_packets[i].proxy = m_bvh.insert(m_packets[i].bbMin, m_packets[i].bbMax, i);
+	}
+
+	m_bCompiled = true;
+	logInfo("compiled: " + to_string(m_packets.size()) + " packets");
+}
+
+void C3dglDrawList::updateBounds(unsigned iPacket)
+{
+	PACKET &packet = m_packets[iPacket];
+	glm::vec3 centre, extent;
+	float radius;
+	C3dglFrustumCuller::getBounds(packet.pMesh->getBB(), packet.matrix, centre, extent, radius);
+	packet.bbMin = centre - extent;
+	packet.bbMax = centre + extent;
+	m_culler.set(iPacket, centre, extent, radius);
+	if (m_bCompiled)
+		m_bvh.move(packet.proxy, packet.bbMin, packet.bbMax);
+}
+
+void C3dglDrawList::findPackets(const glm::vec3 &centre, float radius)
+{
+	// the BVH tests the fat boxes - the packet boxes are tested again
+	m_found.clear();
+	m_bvh.querySphere(centre, radius, m_found);
+	sort(m_found.begin(), m_found.end());
+	unsigned n = 0;
+	for (unsigned i : m_found)
+	{
+		glm::vec3 d = centre - glm::clamp(centre, m_packets[i].bbMin, m_packets[i].bbMax);
+		if (glm::dot(d, d) < radius * radius)
+			m_found[n++] = i;
+	}
+	m_found.resize(n);
+}
+
+void C3dglDrawList::getBoundingSphere(PACKET &packet, glm::vec3 &centre, float &radius)
+{
+	// world space bounding sphere of the packet
+	aiVector3D *bb = packet.pMesh->getBB();
+	aiVector3D c = packet.pMesh->getCentre();
+	centre = glm::vec3(packet.matrix * glm::vec4(c.x, c.y, c.z, 1));
+	float scale = max(glm::length(glm::vec3(packet.matrix[0])), max(glm::length(glm::vec3(packet.matrix[1])), glm::length(glm::vec3(packet.matrix[2]))));
+	radius = 0.5f * glm::length(glm::vec3(bb[1].x - bb[0].x, bb[1].y - bb[0].y, bb[1].z - bb[0].z)) * scale;
+}
+
+void C3dglDrawList::submit(C3dglRenderQueue &queue)
+{
+	if (!m_bCompiled)
+		compile();
+
+	if (m_pVisible)
+		for (unsigned i : *m_pVisible)
+			submitPacket(queue, i);
+	else
+		for (unsigned i = 0; i < m_packets.size(); i++)
+			if (!m_bCulled || m_culler.isVisible(i))
+				submitPacket(queue, i);
+}
+
+void C3dglDrawList::submitPacket(C3dglRenderQueue &queue, unsigned iPacket)
+{
+	PACKET &packet = m_packets[iPacket];
+
+	// lightmapped packets swap the directional light for the lightmap; meshes with the colour stream are AO baked
+	int iLightmap = (m_pLightmap && m_pVariants) ? m_pLightmap->find(packet.pMesh, packet.matrix) : -1;
+	auto program = [&](unsigned key) -> C3dglProgram*
+	{
+		if (!m_pVariants) return NULL;
+		if (iLightmap >= 0) key = C3dglProgramVariants::getLightmappedKey(key);
+		if (packet.pMesh->hasColors()) key = C3dglProgramVariants::getVertexAOKey(key);
+		return m_pVariants->get(key);
+	};
+
+	if (m_pLightProbes && m_objects[packet.idObject].bProbeLit)
+	{
+		glm::vec3 centre;
+		float radius;
+		getBoundingSphere(packet, centre, radius);
+		m_pLightProbes->sample(centre, packet.probe);
+		queue.submit(packet.pMesh, packet.pMaterial, packet.matrix, C3dglRenderQueue::PASS_OPAQUE, program(m_pVariants ? m_pVariants->selectKeyProbeLit(packet.pMaterial) : 0), NULL, 0, &packet.probe, iLightmap);
+		return;
+	}
+
+	if (!m_pLightSets)
+	{
+		queue.submit(packet.pMesh, packet.pMaterial, packet.matrix, C3dglRenderQueue::PASS_OPAQUE, program(m_pVariants ? m_pVariants->selectKey(packet.pMaterial) : 0), NULL, 0, NULL, iLightmap);
+		return;
+	}
+
+	glm::vec3 centre;
+	float radius;
+	getBoundingSphere(packet, centre, radius);
+	unsigned nLights = 0;
+	unsigned iSet = m_pLightSets->assign(centre, radius, nLights);
+	queue.submit(packet.pMesh, packet.pMaterial, packet.matrix, C3dglRenderQueue::PASS_OPAQUE, program(m_pVariants ? m_pVariants->selectKey(packet.pMaterial, nLights) : 0), m_pLightSets, iSet, NULL, iLightmap);
+}
+
+void C3dglDrawList::render(glm::mat4 matrixView)
+{
+	m_queue.begin(matrixView);
+	if (m_pLightSets) m_pLightSets->begin(matrixView);
+	submit(m_queue);
+	if (m_pLightSets) m_pLightSets->upload();
+	m_queue.flush();
+}
+
+void C3dglDrawList::beginCull(const glm::mat4 &matrixViewProj)
+{
+	if (!m_bCompiled)
+		compile();
+	glm::vec4 planes[6];
+	C3dglFrustumCuller::getPlanes(matrixViewProj, planes);
+	m_bvh.clearQueries();
+	m_iCullQuery = m_bvh.addFrustumQuery(planes, 6);
+	m_bvh.dispatch();
+}
+
+void C3dglDrawList::render(glm::mat4 matrixView, glm::mat4 matrixProjection)
+{
+	if (!m_bCompiled)
+		compile();
+	// the BVH lists the visible packets - taken as they are, the SIMD culler marks them
+	const vector<unsigned> *pVisible = NULL;
+	if (m_iCullQuery >= 0)
+	{
+		m_bvh.wait();
+		pVisible = &m_bvh.getResults(m_iCullQuery);
+		m_nVisible = (unsigned)pVisible->size();
+		m_iCullQuery = -1;
+	}
+	else
+	{
+		glm::vec4 planes[6];
+		C3dglFrustumCuller::getPlanes(matrixProjection * matrixView, planes);
+		m_nVisible = m_culler.cull(planes, 6);
+	}
+	m_nOccluded = 0;
+	if (m_pOcclusionCuller)
+	{
+		cullOccluded(matrixView, matrixProjection, pVisible);
+		pVisible = &m_found;
+		m_nVisible = (unsigned)m_found.size();
+	}
+
+	m_bCulled = true;
+	m_pVisible = pVisible;
+	render(matrixView);
+	m_pVisible = NULL;
+	m_bCulled = false;
+}
+
+void C3dglDrawList::cullOccluded(const glm::mat4 &matrixView, const glm::mat4 &matrixProjection, const vector<unsigned> *pVisible)
+{
+	C3dglOcclusionCuller &oc = *m_pOcclusionCuller;
+	glm::vec3 eye = glm::vec3(glm::inverse(matrixView)[3]);
+
+	// the occluders: the visible meshes with an occluder proxy, or the BVH triangles at hand, the biggest on the screen first
+	vector<unsigned> visible;
+	if (!pVisible)
+	{
+		for (unsigned i = 0; i < m_packets.size(); i++)
+			if (m_culler.isVisible(i))
+				visible.push_back(i);
+		pVisible = &visible;
+	}
+	vector<pair<float, unsigned> > occluders;
+	for (unsigned i : *pVisible)
+	{
+		C3dglBVH *pBVH = m_packets[i].pMesh->getBVH();
+		if (!m_packets[i].pMesh->getOccluderProxy() && (!pBVH || pBVH->getTriangleCount() > oc.getMaxTriangles())) continue;
+		glm::vec3 centre;
+		float radius;
+		getBoundingSphere(m_packets[i], centre, radius);
+		float size = radius / max(glm::length(centre - eye), 1e-3f);
+		if (size >= oc.getMinOccluderSize())
+			occluders.push_back(make_pair(size, i));
+	}
+	sort(occluders.begin(), occluders.end(), [](const pair<float, unsigned> &a, const pair<float, unsigned> &b) { return a.first > b.first; });
+	if (occluders.size() > oc.getMaxOccluders())
+		occluders.resize(oc.getMaxOccluders());
+
+	oc.begin(matrixProjection * matrixView);
+	for (auto &occluder : occluders)
+	{
+		PACKET &packet = m_packets[occluder.second];
+		C3dglOccluderProxy *pProxy = packet.pMesh->getOccluderProxy();
+		C3dglBVH *pBVH = packet.pMesh->getBVH();
+		if (pProxy)
+			oc.addOccluder(pProxy->getTriangle(0), pProxy->getTriangleCount(), packet.matrix);
+		else
+			oc.addOccluder(pBVH->getTriangle(0), pBVH->getTriangleCount(), packet.matrix);
+	}
+	oc.rasterize();
+
+	// the occludees - the occluders test themselves against their own depth, but their boxes are never behind it
+	m_found.clear();
+	for (unsigned i : *pVisible)
+	{
+		if (oc.testBox(m_packets[i].bbMin, m_packets[i].bbMax))
+			m_found.push_back(i);
+		else
+			m_nOccluded++;
+	}
+}
+
+unsigned C3dglDrawList::renderDepth(const glm::mat4 &matrixViewProj, unsigned filter)
+{
+	if (!m_bCompiled)
+		compile();
+	C3dglProgram *pProgram = C3dglProgram::GetCurrentProgram();
+	if (!pProgram) return 0;
+
+	// the side planes and the far plane - the first five
+	glm::vec4 planes[6];
+	C3dglFrustumCuller::getPlanes(matrixViewProj, planes);
+	m_nVisible = m_culler.cull(planes, 5);
+
+	unsigned nDrawn = 0;
+	for (unsigned i = 0; i < m_packets.size(); i++)
+	{
+		PACKET &packet = m_packets[i];
+		OBJECT &obj = m_objects[packet.idObject];
+		if (!obj.bCastShadows || !(filter & (obj.bDynamic ? DRAW_DYNAMIC : DRAW_STATIC)) || !m_culler.isVisible(i))
+			continue;
+
+		pProgram->SendStandardUniform(C3dglProgram::UNI_MODELVIEW, matrixViewProj * packet.matrix);
+		packet.pMesh->renderDepth();
+		nDrawn++;
+	}
+	return nDrawn;
+}
+
+unsigned C3dglDrawList::getSignature(const glm::vec3 &centre, float radius)
+{
+	if (!m_bCompiled)
+		compile();
+	unsigned signature = m_nRevisionRemoved;
+	findPackets(centre, radius);
+	for (unsigned i : m_found)
+	{
+		PACKET &packet = m_packets[i];
+		if (m_objects[packet.idObject].bCastShadows)
+			signature = signature * 31 + ((i * 2654435761u) ^ m_objects[packet.idObject].revision);
+	}
+	return signature;
+}
+
+int C3dglDrawList::pick(const glm::vec3 &orig, const glm::vec3 &dir, float tMax, float *pDistance)
+{
+	if (!m_bCompiled)
+		compile();
+	vector<unsigned> found;
+	vector<float> distances;
+	m_bvh.queryRay(orig, dir, tMax, found, distances);
+
+	// the fat boxes come sorted by distance - the closest triangle (or packet box, if no triangle BVH) hit wins
+	int idObject = -1;
+	float tClosest = tMax;
+	glm::vec3 invDir = 1.0f / dir;
+	for (unsigned j = 0; j < found.size() && distances[j] < tClosest; j++)
+	{
+		PACKET &packet = m_packets[found[j]];
+		if (packet.pMesh->getBVH())
+		{
+			C3dglBVH::HIT hit;
+			if (packet.pMesh->intersect(packet.matrix, orig, dir, tClosest, hit))
+			{
+				tClosest = hit.t;
+				idObject = packet.idObject;
+			}
+			continue;
+		}
+		glm::vec3 t0 = (packet.bbMin - orig) * invDir, t1 = (packet.bbMax - orig) * invDir;
+		glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+		float tEnter = max(max(tNear.x, tNear.y), max(tNear.z, 0.0f));
+		float tExit = min(min(tFar.x, tFar.y), min(tFar.z, tClosest));
+		if (tEnter > tExit || tEnter >= tClosest) continue;
+		tClosest = tEnter;
+		idObject = packet.idObject;
+	}
+	if (pDistance) *pDistance = tClosest;
+	return idObject;
+}
+
+unsigned C3dglDrawList::renderDepth(const glm::vec3 &centre, float radius, unsigned filter)
+{
+	if (!m_bCompiled)
+		compile();
+	C3dglProgram *pProgram = C3dglProgram::GetCurrentProgram();
+	if (!pProgram) return 0;
+
+	unsigned nDrawn = 0;
+	findPackets(centre, radius);
+	for (unsigned i : m_found)
+	{
+		PACKET &packet = m_packets[i];
+		OBJECT &obj = m_objects[packet.idObject];
+		if (!obj.bCastShadows || !(filter & (obj.bDynamic ? DRAW_DYNAMIC : DRAW_STATIC)))
+			continue;
+
+		pProgram->SendStandardUniform(C3dglProgram::UNI_MODELVIEW, packet.matrix);
+		packet.pMesh->renderDepth();
+		nDrawn++;
+	}
+	return nDrawn;
+}
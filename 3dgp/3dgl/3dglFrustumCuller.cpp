@@ -0,0 +1,165 @@
+#include "../GL/glew.h"
+#include "../GL/3dglFrustumCuller.h"
+
+// standard libraries
+#include <cmath>
+#include <algorithm>
+
+// GLM include files
+#include "../glm/geometric.hpp"
+
+// SIMD - AVX if the compiler is allowed to use it (/arch:AVX), SSE on any x86
+#if defined(__AVX__)
+#include <immintrin.h>
+#define CULL_AVX
+#elif defined(_M_IX86) || defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#define CULL_SSE
+#endif
+
+using namespace std;
+using namespace _3dgl;
+
+// the radius of an empty volume - it is behind any plane
+static const float c_emptyRadius = -1e30f;
+
+void C3dglFrustumCuller::resize(unsigned n)
+{
+	unsigned nPadded = (n + 7) & ~7u;
+	m_cx.resize(nPadded, 0); m_cy.resize(nPadded, 0); m_cz.resize(nPadded, 0);
+	m_ex.resize(nPadded, 0); m_ey.resize(nPadded, 0); m_ez.resize(nPadded, 0);
+	m_r.resize(nPadded, c_emptyRadius);
+	for (unsigned i = min(n, m_n); i < nPadded; i++)
+		m_r[i] = c_emptyRadius;		// the padding, and the volumes not set yet
+	m_n = n;
+	m_mask.assign(nPadded / 8, 0);
+	m_nVisible = 0;
+}
+
+void C3dglFrustumCuller::set(unsigned i, const glm::vec3 &centre, const glm::vec3 &extent, float radius)
+{
+	if (i >= m_n) return;
+	m_cx[i] = centre.x; m_cy[i] = centre.y; m_cz[i] = centre.z;
+	m_ex[i] = extent.x; m_ey[i] = extent.y; m_ez[i] = extent.z;
+	m_r[i] = radius;
+}
+
+void C3dglFrustumCuller::set(unsigned i, const aiVector3D bb[2], const glm::mat4 &matrix)
+{
+	glm::vec3 centre, extent;
+	float radius;
+	getBounds(bb, matrix, centre, extent, radius);
+	set(i, centre, extent, radius);
+}
+
+void C3dglFrustumCuller::getBounds(const aiVector3D bb[2], const glm::mat4 &matrix, glm::vec3 &centre, glm::vec3 &extent, float &radius)
+{
+	glm::vec3 c(0.5f * (bb[0].x + bb[1].x), 0.5f * (bb[0].y + bb[1].y), 0.5f * (bb[0].z + bb[1].z));
+	glm::vec3 e(0.5f * (bb[1].x - bb[0].x), 0.5f * (bb[1].y - bb[0].y), 0.5f * (bb[1].z - bb[0].z));
+
+	// the box transformed and boxed again: each world extent is the sum of the absolute projections of the local ones
+	centre = glm::vec3(matrix * glm::vec4(c, 1));
+	extent = glm::abs(glm::vec3(matrix[0])) * e.x + glm::abs(glm::vec3(matrix[1])) * e.y + glm::abs(glm::vec3(matrix[2])) * e.z;
+	float scale = max(glm::length(glm::vec3(matrix[0])), max(glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2]))));
+	radius = glm::length(e) * scale;
+}
+
+unsigned C3dglFrustumCuller::cull(const std::vector<unsigned> &visible)
+{
+	fill(m_mask.begin(), m_mask.end(), 0);
+	m_nVisible = 0;
+	for (unsigned i : visible)
+	{
+		if (i >= m_n || (m_mask[i >> 3] >> (i & 7)) & 1) continue;
+		m_mask[i >> 3] |= 1 << (i & 7);
+		m_nVisible++;
+	}
+	return m_nVisible;
+}
+
+void C3dglFrustumCuller::getPlanes(const glm::mat4 &matrixViewProj, glm::vec4 planes[6])
+{
+	glm::vec4 row[4];
+	for (unsigned i = 0; i < 4; i++)
+		row[i] = glm::vec4(matrixViewProj[0][i], matrixViewProj[1][i], matrixViewProj[2][i], matrixViewProj[3][i]);
+	planes[0] = row[3] + row[0];
+	planes[1] = row[3] - row[0];
+	planes[2] = row[3] + row[1];
+	planes[3] = row[3] - row[1];
+	planes[4] = row[3] - row[2];
+	planes[5] = row[3] + row[2];
+	for (unsigned i = 0; i < 6; i++)
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+unsigned C3dglFrustumCuller::cull(const glm::vec4 *planes, unsigned nPlanes)
+{
+	// a volume is behind a plane if the distance of its centre is below minus its projected radius:
+	// |n.x| * e.x + |n.y| * e.y + |n.z| * e.z for the box, r for the sphere - the smaller one wins
+	glm::vec4 absPlanes[6];
+	nPlanes = min(nPlanes, 6u);
+	for (unsigned p = 0; p < nPlanes; p++)
+		absPlanes[p] = glm::abs(planes[p]);
+
+	m_nVisible = 0;
+	for (unsigned block = 0; block < m_mask.size(); block++)
+	{
+		unsigned i = block * 8;
+		unsigned mask;
+#if defined(CULL_AVX)
+		__m256 cx = _mm256_loadu_ps(&m_cx[i]), cy = _mm256_loadu_ps(&m_cy[i]), cz = _mm256_loadu_ps(&m_cz[i]);
+		__m256 ex = _mm256_loadu_ps(&m_ex[i]), ey = _mm256_loadu_ps(&m_ey[i]), ez = _mm256_loadu_ps(&m_ez[i]);
+		__m256 r = _mm256_loadu_ps(&m_r[i]);
+		__m256 zero = _mm256_setzero_ps();
+		__m256 visible = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);	// all set
+		for (unsigned p = 0; p < nPlanes; p++)
+		{
+			__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(planes[p].x)), _mm256_mul_ps(cy, _mm256_set1_ps(planes[p].y))),
+									 _mm256_add_ps(_mm256_mul_ps(cz, _mm256_set1_ps(planes[p].z)), _mm256_set1_ps(planes[p].w)));
+			__m256 e = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ex, _mm256_set1_ps(absPlanes[p].x)), _mm256_mul_ps(ey, _mm256_set1_ps(absPlanes[p].y))),
+									 _mm256_mul_ps(ez, _mm256_set1_ps(absPlanes[p].z)));
+			visible = _mm256_and_ps(visible, _mm256_cmp_ps(_mm256_add_ps(d, _mm256_min_ps(e, r)), zero, _CMP_GE_OQ));
+		}
+		mask = _mm256_movemask_ps(visible);
+#elif defined(CULL_SSE)
+		// two halves of four, interleaved
+		__m128 cx0 = _mm_loadu_ps(&m_cx[i]), cy0 = _mm_loadu_ps(&m_cy[i]), cz0 = _mm_loadu_ps(&m_cz[i]);
+		__m128 cx1 = _mm_loadu_ps(&m_cx[i + 4]), cy1 = _mm_loadu_ps(&m_cy[i + 4]), cz1 = _mm_loadu_ps(&m_cz[i + 4]);
+		__m128 ex0 = _mm_loadu_ps(&m_ex[i]), ey0 = _mm_loadu_ps(&m_ey[i]), ez0 = _mm_loadu_ps(&m_ez[i]);
+		__m128 ex1 = _mm_loadu_ps(&m_ex[i + 4]), ey1 = _mm_loadu_ps(&m_ey[i + 4]), ez1 = _mm_loadu_ps(&m_ez[i + 4]);
+		__m128 r0 = _mm_loadu_ps(&m_r[i]), r1 = _mm_loadu_ps(&m_r[i + 4]);
+		__m128 zero = _mm_setzero_ps();
+		__m128 visible0 = _mm_cmpeq_ps(zero, zero), visible1 = visible0;	// all set
+		for (unsigned p = 0; p < nPlanes; p++)
+		{
+			__m128 nx = _mm_set1_ps(planes[p].x), ny = _mm_set1_ps(planes[p].y), nz = _mm_set1_ps(planes[p].z), nw = _mm_set1_ps(planes[p].w);
+			__m128 ax = _mm_set1_ps(absPlanes[p].x), ay = _mm_set1_ps(absPlanes[p].y), az = _mm_set1_ps(absPlanes[p].z);
+			__m128 d0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx0, nx), _mm_mul_ps(cy0, ny)), _mm_add_ps(_mm_mul_ps(cz0, nz), nw));
+			__m128 d1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx1, nx), _mm_mul_ps(cy1, ny)), _mm_add_ps(_mm_mul_ps(cz1, nz), nw));
+			__m128 e0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex0, ax), _mm_mul_ps(ey0, ay)), _mm_mul_ps(ez0, az));
+			__m128 e1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex1, ax), _mm_mul_ps(ey1, ay)), _mm_mul_ps(ez1, az));
+			visible0 = _mm_and_ps(visible0, _mm_cmpge_ps(_mm_add_ps(d0, _mm_min_ps(e0, r0)), zero));
+			visible1 = _mm_and_ps(visible1, _mm_cmpge_ps(_mm_add_ps(d1, _mm_min_ps(e1, r1)), zero));
+		}
+		mask = _mm_movemask_ps(visible0) | (_mm_movemask_ps(visible1) << 4);
+#else
+		mask = 0;
+		for (unsigned j = 0; j < 8; j++)
+		{
+			bool bVisible = true;
+			for (unsigned p = 0; p < nPlanes && bVisible; p++)
+			{
+				float d = planes[p].x * m_cx[i + j] + planes[p].y * m_cy[i + j] + planes[p].z * m_cz[i + j] + planes[p].w;
+				float e = absPlanes[p].x * m_ex[i + j] + absPlanes[p].y * m_ey[i + j] + absPlanes[p].z * m_ez[i + j];
+				bVisible = d + min(e, m_r[i + j]) >= 0;
+			}
+			if (bVisible) mask |= 1 << j;
+		}
+#endif
+		// the padding is empty - never visible
+		m_mask[block] = (unsigned char)mask;
+		for (; mask; mask &= mask - 1)
+			m_nVisible++;
+	}
+	return m_nVisible;
+}
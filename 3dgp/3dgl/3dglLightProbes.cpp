@@ -0,0 +1,152 @@
+#include "../GL/glew.h"
+#include "../GL/3dglLightProbes.h"
+#include "../GL/3dglShader.h"
+#include "../GL/3dglThreadPool.h"
+
+// standard libraries
+#include <cstring>
+#include <algorithm>
+
+// GLM include files
+#include "../glm/geometric.hpp"
+
+using namespace std;
+using namespace _3dgl;
+
+// squared SH basis constants times the cosine lobe convolution (A0, A1, A2 = pi, 2pi/3, pi/4; divided by pi
+// to match the diffuse term of CalculateDiffuse): the projection and the evaluation constants in one
+static const float c_shK[9] = {
+	0.282095f * 0.282095f,
+	0.488603f * 0.488603f * 2.0f / 3.0f, 0.488603f * 0.488603f * 2.0f / 3.0f, 0.488603f * 0.488603f * 2.0f / 3.0f,
+	1.092548f * 1.092548f * 0.25f, 1.092548f * 1.092548f * 0.25f, 0.315392f * 0.315392f * 0.25f, 1.092548f * 1.092548f * 0.25f, 0.546274f * 0.546274f * 0.25f
+};
+
+void C3dglSHProbe::apply(C3dglProgram *pProgram) const
+{
+	if (!pProgram) return;
+	GLuint location = pProgram->GetUniformLocation(C3dglProgram::UNI_SH_COEFFS);
+	if (location != (GLuint)-1)
+		pProgram->SendUniform3v(location, (GLfloat*)&sh[0].x, 9);
+	location = pProgram->GetUniformLocation(C3dglProgram::UNI_SH_AMBIENT);
+	if (location != (GLuint)-1)
+		pProgram->SendUniform4v(location, (GLfloat*)&ambient.x);
+}
+
+C3dglLightProbes::C3dglLightProbes() : C3dglObject()
+{
+	m_min = m_max = glm::vec3(0);
+	m_nx = m_ny = m_nz = 0;
+	m_bBaked = false;
+}
+
+bool C3dglLightProbes::create(const glm::vec3 &minBound, const glm::vec3 &maxBound, unsigned nx, unsigned ny, unsigned nz)
+{
+	if (nx == 0 || ny == 0 || nz == 0)
+		return logError("Light probe grid cannot be empty");
+	m_min = glm::min(minBound, maxBound);
+	m_max = glm::max(minBound, maxBound);
+	m_nx = nx; m_ny = ny; m_nz = nz;
+	m_probes.assign(nx * ny * nz, C3dglSHProbe());
+	m_lightsBaked.clear();
+	m_bBaked = false;
+	logInfo("light probes: " + to_string(m_probes.size()));
+	return true;
+}
+
+glm::vec3 C3dglLightProbes::getProbePos(unsigned x, unsigned y, unsigned z)
+{
+	glm::vec3 t(m_nx > 1 ? (float)x / (m_nx - 1) : 0.5f, m_ny > 1 ? (float)y / (m_ny - 1) : 0.5f, m_nz > 1 ? (float)z / (m_nz - 1) : 0.5f);
+	return m_min + (m_max - m_min) * t;
+}
+
+bool C3dglLightProbes::update()
+{
+	if (m_bBaked && m_lights.size() == m_lightsBaked.size()
+		&& (m_lights.empty() || memcmp(&m_lights[0], &m_lightsBaked[0], m_lights.size() * sizeof(C3dglPointLightBlock)) == 0))
+		return false;
+	bake();
+	return true;
+}
+
+void C3dglLightProbes::bake()
+{
+	m_lightsBaked = m_lights;
+	m_bBaked = true;
+	C3dglThreadPool::get().parallelFor((unsigned)m_probes.size(), [this](unsigned i) { bakeProbe(i); });
+}
+
+void C3dglLightProbes::bakeProbe(unsigned i)
+{
+	C3dglSHProbe &probe = m_probes[i];
+	memset(&probe, 0, sizeof(probe));
+	glm::vec3 pos = getProbePos(i % m_nx, (i / m_nx) % m_ny, i / (m_nx * m_ny));
+
+	for (const C3dglPointLightBlock &light : m_lightsBaked)
+	{
+		if (light.isDark()) continue;
+		glm::vec3 v = light.position - pos;
+		float dist = glm::length(v);
+		if (dist <= 0 || dist >= light.getRange()) continue;
+		glm::vec3 d = v / dist;
+
+		// as CalculateAttenuation in the shaders
+		float attenuation = 1;
+		if (light.radius > 0)
+		{
+			float denom = max(dist - light.radius, 0.0f) / light.radius + 1;
+			attenuation = 1 / (denom * denom);
+			if (light.cutoff < 1)
+				attenuation = max((attenuation - light.cutoff) / (1 - light.cutoff), 0.0f);
+		}
+
+		// ambient, and the material.diffuse part of CalculateDiffuse
+		probe.ambient += glm::vec4(light.ambient * attenuation, light.diffuseStrength * attenuation);
+
+		// the directional part - a delta light projected onto the basis
+		glm::vec3 c = light.diffuse * (light.diffuseStrength * attenuation);
+		probe.sh[0] += c * c_shK[0];
+		probe.sh[1] += c * (c_shK[1] * d.y);
+		probe.sh[2] += c * (c_shK[2] * d.z);
+		probe.sh[3] += c * (c_shK[3] * d.x);
+		probe.sh[4] += c * (c_shK[4] * d.x * d.y);
+		probe.sh[5] += c * (c_shK[5] * d.y * d.z);
+		probe.sh[6] += c * (c_shK[6] * (3 * d.z * d.z - 1));
+		probe.sh[7] += c * (c_shK[7] * d.x * d.z);
+		probe.sh[8] += c * (c_shK[8] * (d.x * d.x - d.y * d.y));
+	}
+}
+
+void C3dglLightProbes::sample(const glm::vec3 &pos, C3dglSHProbe &probe)
+{
+	memset(&probe, 0, sizeof(probe));
+	if (m_probes.empty()) return;
+
+	// grid coordinates, clamped to the grid
+	unsigned n[3] = { m_nx, m_ny, m_nz };
+	unsigned i0[3], i1[3];
+	float t[3];
+	glm::vec3 size = m_max - m_min;
+	for (unsigned a = 0; a < 3; a++)
+	{
+		float f = size[a] > 0 ? (pos[a] - m_min[a]) / size[a] * (n[a] - 1) : 0;
+		f = min(max(f, 0.0f), (float)(n[a] - 1));
+		i0[a] = min((unsigned)f, n[a] - 1);
+		i1[a] = min(i0[a] + 1, n[a] - 1);
+		t[a] = f - i0[a];
+	}
+
+	// trilinear blend of the eight probes around
+	for (unsigned corner = 0; corner < 8; corner++)
+	{
+		unsigned x = (corner & 1) ? i1[0] : i0[0];
+		unsigned y = (corner & 2) ? i1[1] : i0[1];
+		unsigned z = (corner & 4) ? i1[2] : i0[2];
+		float w = ((corner & 1) ? t[0] : 1 - t[0]) * ((corner & 2) ? t[1] : 1 - t[1]) * ((corner & 4) ? t[2] : 1 - t[2]);
+		if (w <= 0) continue;
+
+		const C3dglSHProbe &p = m_probes[x + m_nx * (y + m_ny * z)];
+		for (unsigned i = 0; i < 9; i++)
+			probe.sh[i] += p.sh[i] * w;
+		probe.ambient += p.ambient * w;
+	}
+}
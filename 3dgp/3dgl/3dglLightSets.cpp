@@ -0,0 +1,128 @@
+#include "../GL/glew.h"
+#include "../GL/3dglLightSets.h"
+
+// standard libraries
+#include <cstring>
+#include <algorithm>
+#include <functional>
+
+// GLM include files
+#include "../glm/geometric.hpp"
+
+using namespace std;
+using namespace _3dgl;
+
+C3dglLightSets::C3dglLightSets() : C3dglObject()
+{
+	m_nMaxLights = C3dglLightsBlock::MAX_POINT_LIGHTS;
+	memset(&m_lightDirectional, 0, sizeof(m_lightDirectional));
+	m_matrixView = glm::mat4(1);
+	m_stride = sizeof(C3dglLightsBlock);
+}
+
+bool C3dglLightSets::create(unsigned nMaxLights)
+{
+	if (nMaxLights > C3dglLightsBlock::MAX_POINT_LIGHTS)
+	{
+		logWarning("Up to " + to_string((long long)C3dglLightsBlock::MAX_POINT_LIGHTS) + " lights per object supported (the shaders' MAX_POINT_LIGHTS)");
+		nMaxLights = C3dglLightsBlock::MAX_POINT_LIGHTS;
+	}
+	m_nMaxLights = nMaxLights;
+
+	// sets are bound with glBindBufferRange - the stride must respect the offset alignment
+	GLint align = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+	if (align < 1) align = 256;
+	m_stride = (sizeof(C3dglLightsBlock) + align - 1) / align * align;
+
+	return m_ubo.create(UBO_LIGHTS, m_stride);
+}
+
+void C3dglLightSets::begin(const glm::mat4 &matrixView)
+{
+	m_matrixView = matrixView;
+	m_sets.clear();
+	m_data.clear();
+
+	// collect the lights that can light anything at all
+	m_candidates.clear();
+	for (unsigned i = 0; i < m_lights.size(); i++)
+	{
+		const C3dglPointLightBlock &light = m_lights[i];
+		if (light.isDark()) continue;
+
+		// unattenuated brightness - the luminance of all the terms the light contributes
+		glm::vec3 colour = light.ambient + light.diffuse * light.diffuseStrength;
+		if (light.specularPower > 0) colour += light.specular;
+
+		LIGHT l;
+		l.pos = light.position;
+		l.range = light.getRange();
+		l.intensity = 0.2126f * colour.r + 0.7152f * colour.g + 0.0722f * colour.b;
+		l.index = i;
+		m_candidates.push_back(l);
+	}
+}
+
+unsigned C3dglLightSets::assign(const glm::vec3 &centre, float radius, unsigned &nLights)
+{
+	// rank the lights reaching the sphere by their contribution at its nearest point
+	m_ranked.clear();
+	for (unsigned i = 0; i < m_candidates.size(); i++)
+	{
+		const LIGHT &l = m_candidates[i];
+		float dist = max(glm::length(l.pos - centre) - radius, 0.0f);
+		if (dist >= l.range) continue;
+
+		// as CalculateAttenuation in the shaders
+		const C3dglPointLightBlock &light = m_lights[l.index];
+		float attenuation = 1;
+		if (light.radius > 0)
+		{
+			float denom = max(dist - light.radius, 0.0f) / light.radius + 1;
+			attenuation = 1 / (denom * denom);
+			if (light.cutoff > 0 && light.cutoff < 1)
+				attenuation = max((attenuation - light.cutoff) / (1 - light.cutoff), 0.0f);
+		}
+		m_ranked.push_back(make_pair(l.intensity * attenuation, i));
+	}
+
+	// the top K
+	size_t n = min(m_ranked.size(), (size_t)m_nMaxLights);
+	partial_sort(m_ranked.begin(), m_ranked.begin() + n, m_ranked.end(), greater<pair<float, unsigned> >());
+	m_key.resize(n);
+	for (size_t i = 0; i < n; i++)
+		m_key[i] = m_ranked[i].second;
+	sort(m_key.begin(), m_key.end());
+	nLights = (unsigned)n;
+
+	// objects lit by the same lights share the set
+	map<vector<unsigned>, unsigned>::iterator it = m_sets.find(m_key);
+	if (it != m_sets.end())
+		return it->second;
+
+	// a new set: the directional light and the chosen point lights, in view space
+	C3dglLightsBlock block;
+	memset(&block, 0, sizeof(block));
+	block.lightDirectional = m_lightDirectional;
+	for (size_t i = 0; i < n; i++)
+		block.lightPoint[i] = m_lights[m_candidates[m_key[i]].index];
+	block = block.toViewSpace(m_matrixView);
+
+	unsigned iSet = (unsigned)m_sets.size();
+	m_sets[m_key] = iSet;
+	m_data.resize((iSet + 1) * m_stride);
+	memcpy(&m_data[iSet * m_stride], &block, sizeof(block));
+	return iSet;
+}
+
+void C3dglLightSets::upload()
+{
+	if (m_data.empty()) return;
+	m_ubo.update(&m_data[0], m_data.size());
+}
+
+void C3dglLightSets::bind(unsigned iSet)
+{
+	m_ubo.bindRange(iSet * m_stride, sizeof(C3dglLightsBlock));
+}
@@ -0,0 +1,151 @@
+#include "../gl/glew.h"
+#include "../gl/3dglLightmap.h"
+#include "../gl/3dglmodel.h"
+#include "../gl/3dglMaterial.h"
+#include "../gl/3dglShader.h"
+#include "../gl/3dglState.h"
+#include "../gl/assimp/cimport.h"
+
+// standard libraries
+#include <cmath>
+
+// GLM include files
+#include "../glm/gtc/type_ptr.hpp"
+
+using namespace std;
+using namespace _3dgl;
+
+void C3dglLightmap::add(C3dglModel &model, C3dglMaterial *pMaterial, glm::mat4 matrix, int iNode)
+{
+	const aiScene *pScene = model.GetScene();
+	if (!pScene) return;
+	vector<const void*> keys(pScene->mNumMeshes);
+	for (unsigned i = 0; i < pScene->mNumMeshes; i++)
+		keys[i] = model.getMesh(i);
+	addScene(pScene, keys.empty() ? NULL : &keys[0], pMaterial, matrix, iNode);
+}
+
+void C3dglLightmap::add(const aiScene *pScene, C3dglMaterial *pMaterial, glm::mat4 matrix, int iNode)
+{
+	addScene(pScene, NULL, pMaterial, matrix, iNode);
+}
+
+void C3dglLightmap::addScene(const aiScene *pScene, const void *const *pKeys, C3dglMaterial *pMaterial, glm::mat4 matrix, int iNode)
+{
+	if (!pScene || !pScene->mRootNode) return;
+
+	// the same node transforms as in C3dglDrawList
+	aiNode *pRoot = pScene->mRootNode;
+	if (iNode < 0)
+		addNode(pScene, pKeys, pMaterial, pRoot, matrix);
+	else if ((unsigned)iNode < pRoot->mNumChildren)
+	{
+		aiMatrix4x4 mx = pRoot->mTransformation;
+		aiTransposeMatrix4(&mx);
+		addNode(pScene, pKeys, pMaterial, pRoot->mChildren[iNode], matrix * glm::make_mat4((GLfloat*)&mx));
+	}
+}
+
+void C3dglLightmap::addNode(const aiScene *pScene, const void *const *pKeys, C3dglMaterial *pMaterial, aiNode *pNode, glm::mat4 m)
+{
+	aiMatrix4x4 mx = pNode->mTransformation;
+	aiTransposeMatrix4(&mx);
+	m *= glm::make_mat4((GLfloat*)&mx);
+
+	for (unsigned iMesh : vector<unsigned>(pNode->mMeshes, pNode->mMeshes + pNode->mNumMeshes))
+	{
+		ENTRY entry;
+		entry.pKey = pKeys ? pKeys[iMesh] : NULL;
+		entry.pMesh = pScene->mMeshes[iMesh];
+		entry.matrix = m;
+		entry.ambient = entry.diffuse = glm::vec3(1);
+		if (pMaterial)
+		{
+			pMaterial->getAmbient(entry.ambient.r, entry.ambient.g, entry.ambient.b);
+			pMaterial->getDiffuse(entry.diffuse.r, entry.diffuse.g, entry.diffuse.b);
+		}
+		else if (entry.pMesh->mMaterialIndex < pScene->mNumMaterials)
+		{
+			aiColor4D c;
+			const aiMaterial *pMat = pScene->mMaterials[entry.pMesh->mMaterialIndex];
+			if (aiGetMaterialColor(pMat, AI_MATKEY_COLOR_AMBIENT, &c) == AI_SUCCESS) entry.ambient = glm::vec3(c.r, c.g, c.b);
+			if (aiGetMaterialColor(pMat, AI_MATKEY_COLOR_DIFFUSE, &c) == AI_SUCCESS) entry.diffuse = glm::vec3(c.r, c.g, c.b);
+		}
+		entry.firstTriangle = m_nTriangles;
+		m_nTriangles += entry.pMesh->mNumFaces;
+
+		if (entry.pKey)
+			m_keys.insert(make_pair(entry.pKey, (unsigned)m_entries.size()));
+		m_entries.push_back(entry);
+	}
+
+	for (aiNode *p : vector<aiNode*>(pNode->mChildren, pNode->mChildren + pNode->mNumChildren))
+		addNode(pScene, pKeys, pMaterial, p, m);
+}
+
+bool C3dglLightmap::upload()
+{
+	destroy();
+	if (m_lightmap.size() != m_size * m_size || m_maps.empty())
+		return logError("nothing to upload - bake or load first");
+
+	GLint maxTexels = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+	if (m_maps.size() > (size_t)maxTexels)
+		return logError("too many triangles: " + to_string(m_nTriangles));
+
+	// the lightmap
+	glGenTextures(1, &m_idTexture);
+	C3dglState::bindTexture(UNIT_LIGHTMAP, GL_TEXTURE_2D, m_idTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, m_size, m_size, 0, GL_RGB, GL_FLOAT, &m_lightmap[0]);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	// the chart maps - two texels per triangle
+	glGenBuffers(1, &m_idBuffer);
+	C3dglState::bindBuffer(GL_TEXTURE_BUFFER, m_idBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, m_maps.size() * sizeof(m_maps[0]), &m_maps[0], GL_STATIC_DRAW);
+	glGenTextures(1, &m_idCharts);
+	C3dglState::bindTexture(UNIT_CHARTS, GL_TEXTURE_BUFFER, m_idCharts);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_idBuffer);
+
+	// programs linked from now on find the lightmap at its units
+	C3dglProgram::SetSamplerUnit("lightmap", UNIT_LIGHTMAP);
+	C3dglProgram::SetSamplerUnit("lightmapCharts", UNIT_CHARTS);
+
+	return logSuccess("uploaded: " + to_string(m_size) + " x " + to_string(m_size) + ", " + to_string(m_nTriangles) + " triangles");
+}
+
+void C3dglLightmap::destroy()
+{
+	if (m_idTexture) C3dglState::deleteTextures(1, &m_idTexture);
+	if (m_idCharts) C3dglState::deleteTextures(1, &m_idCharts);
+	if (m_idBuffer) C3dglState::deleteBuffers(1, &m_idBuffer);
+	m_idTexture = m_idBuffer = m_idCharts = 0;
+}
+
+void C3dglLightmap::bind()
+{
+	if (!m_idTexture) return;
+	C3dglState::bindTexture(UNIT_LIGHTMAP, GL_TEXTURE_2D, m_idTexture);
+	C3dglState::bindTexture(UNIT_CHARTS, GL_TEXTURE_BUFFER, m_idCharts);
+}
+
+int C3dglLightmap::find(const void *pKey, const glm::mat4 &matrix)
+{
+	if (!pKey || !m_idTexture || m_triChart.empty()) return -1;
+	auto range = m_keys.equal_range(pKey);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		const ENTRY &entry = m_entries[it->second];
+		bool bMatch = true;
+		for (unsigned c = 0; c < 4 && bMatch; c++)
+			for (unsigned r = 0; r < 4 && bMatch; r++)
+				bMatch = fabs(entry.matrix[c][r] - matrix[c][r]) <= 1e-4f * (1 + fabs(matrix[c][r]));
+		if (bMatch)
+			return m_triChart[entry.firstTriangle] != 0xFFFFFFFF ? (int)entry.firstTriangle : -1;
+	}
+	return -1;
+}
@@ -0,0 +1,745 @@
+#include "../gl/glew.h"			// the GL types only - nothing here calls GL
+#include "../gl/3dglLightmap.h"
+#include "../gl/3dglThreadPool.h"
+
+// standard libraries
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+#include <tuple>
+
+// GLM include files
+#include "../glm/geometric.hpp"
+#include "../glm/common.hpp"
+#include "../glm/matrix.hpp"
+#include "../glm/mat3x3.hpp"
+
+using namespace std;
+using namespace _3dgl;
+
+static const unsigned c_pad = 2;			// texels around each chart - room for the dilation and the bilinear filter
+static const float c_bias = 1e-3f;			// ray origin offset along the normal
+static const char c_idPrefix[] = "3dgl lightmap ";	// the TGA image id: the prefix and the input hash, in hex
+static const char c_jobMagic[8] = { '3', 'D', 'G', 'L', 'L', 'M', 'J', '1' };
+static const unsigned c_jobMaxCount = 1 << 24;	// of the lights, meshes, vertices and faces in a job - anything more is a corrupted file
+
+// xorshift - per texel random sequences, so that the bake is deterministic whatever the thread count
+static inline float rnd(unsigned &seed)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return (seed >> 8) * (1.0f / 16777216.0f);
+}
+
+// cosine weighted direction around n
+static glm::vec3 sampleCosine(const glm::vec3 &n, unsigned &seed)
+{
+	float r1 = rnd(seed), r2 = rnd(seed);
+	float phi = 6.2831853f * r1, r = sqrt(r2);
+	glm::vec3 t = fabs(n.x) > 0.5f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0);
+	glm::vec3 b1 = glm::normalize(glm::cross(n, t));
+	glm::vec3 b2 = glm::cross(n, b1);
+	return b1 * (r * cos(phi)) + b2 * (r * sin(phi)) + n * sqrt(max(0.0f, 1 - r2));
+}
+
+static inline float edge(const glm::vec2 &a, const glm::vec2 &b, const glm::vec2 &p)
+{
+	return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+}
+
+C3dglLightmap::C3dglLightmap() : C3dglObject()
+{
+	m_nTriangles = 0;
+	m_size = 512;
+	m_density = 0;
+	m_densityUsed = 0;
+	memset(&m_lightDirectional, 0, sizeof(m_lightDirectional));
+	m_nSamples = 32;
+	m_nBounces = 2;
+	m_reflectance = 0.5f;
+	m_sky = glm::vec3(0);
+	m_idTexture = m_idBuffer = m_idCharts = 0;
+}
+
+void C3dglLightmap::clear()
+{
+	for (aiMesh *pMesh : m_meshesOwned)
+		delete pMesh;
+	m_meshesOwned.clear();
+	m_entries.clear();
+	m_keys.clear();
+	m_nTriangles = 0;
+	m_charts.clear();
+	m_triChart.clear();
+	m_maps.clear();
+	m_lightmap.clear();
+}
+
+bool C3dglLightmap::unwrap()
+{
+	m_charts.clear();
+	m_triChart.assign(m_nTriangles, 0xFFFFFFFF);
+	m_maps.assign(2 * m_nTriangles, glm::vec4(0));
+	if (m_size == 0)
+		return logError("lightmap size cannot be zero");
+
+	for (unsigned iEntry = 0; iEntry < m_entries.size(); iEntry++)
+	{
+		const ENTRY &entry = m_entries[iEntry];
+		const aiMesh *pMesh = entry.pMesh;
+		unsigned nFaces = pMesh->mNumFaces, nVertices = pMesh->mNumVertices;
+
+		// triangles only - gl_PrimitiveID must match the face index
+		bool bTriangles = nFaces > 0 && pMesh->mVertices;
+		for (unsigned f = 0; f < nFaces && bTriangles; f++)
+			bTriangles = pMesh->mFaces[f].mNumIndices == 3;
+		if (!bTriangles)
+		{
+			logWarning("mesh " + string(pMesh->mName.C_Str()) + " skipped - not made of triangles");
+			continue;
+		}
+
+		// world positions; vertices split by AssImp (normals, UV seams) are joined back by their positions
+		vector<glm::vec3> pos(nVertices);
+		vector<unsigned> canon(nVertices);
+		map<tuple<float, float, float>, unsigned> positions;
+		for (unsigned i = 0; i < nVertices; i++)
+		{
+			const aiVector3D &v = pMesh->mVertices[i];
+			pos[i] = glm::vec3(entry.matrix * glm::vec4(v.x, v.y, v.z, 1));
+			canon[i] = positions.insert(make_pair(make_tuple(v.x, v.y, v.z), (unsigned)positions.size())).first->second;
+		}
+
+		// each triangle goes to one of six projections (main axis of the normal, and its sign);
+		// connected triangles of the same projection make a chart
+		vector<unsigned> bucket(nFaces), parent(nFaces);
+		vector<int> first(positions.size() * 6, -1);
+		auto root = [&](unsigned i) { while (parent[i] != i) i = parent[i] = parent[parent[i]]; return i; };
+		for (unsigned f = 0; f < nFaces; f++)
+		{
+			const unsigned *idx = pMesh->mFaces[f].mIndices;
+			glm::vec3 n = glm::cross(pos[idx[1]] - pos[idx[0]], pos[idx[2]] - pos[idx[0]]);
+			glm::vec3 a = glm::abs(n);
+			unsigned axis = (a.x >= a.y && a.x >= a.z) ? 0 : (a.y >= a.z) ? 1 : 2;
+			bucket[f] = axis * 2 + (n[axis] < 0 ? 1 : 0);
+			parent[f] = f;
+			for (unsigned k = 0; k < 3; k++)
+			{
+				int &slot = first[canon[idx[k]] * 6 + bucket[f]];
+				if (slot < 0)
+					slot = f;
+				else
+					parent[root(f)] = root(slot);
+			}
+		}
+
+		map<unsigned, unsigned> charts;
+		for (unsigned f = 0; f < nFaces; f++)
+		{
+			auto it = charts.insert(make_pair(root(f), (unsigned)m_charts.size()));
+			if (it.second)
+			{
+				CHART chart;
+				chart.iEntry = iEntry;
+				chart.axis = bucket[f] / 2;
+				chart.uvMin = glm::vec2(FLT_MAX);
+				chart.uvMax = glm::vec2(-FLT_MAX);
+				chart.x = chart.y = chart.w = chart.h = 0;
+				m_charts.push_back(chart);
+			}
+			CHART &chart = m_charts[it.first->second];
+			m_triChart[entry.firstTriangle + f] = it.first->second;
+			for (unsigned k = 0; k < 3; k++)
+			{
+				const glm::vec3 &p = pos[pMesh->mFaces[f].mIndices[k]];
+				glm::vec2 uv(p[(chart.axis + 1) % 3], p[(chart.axis + 2) % 3]);
+				chart.uvMin = glm::min(chart.uvMin, uv);
+				chart.uvMax = glm::max(chart.uvMax, uv);
+			}
+		}
+	}
+	if (m_charts.empty())
+		return logError("nothing to unwrap");
+
+	// the density fitted to the atlas - unless set; lowered until the charts fit
+	float area = 0;
+	for (CHART &chart : m_charts)
+		area += (chart.uvMax.x - chart.uvMin.x) * (chart.uvMax.y - chart.uvMin.y);
+	float density = m_density > 0 ? m_density : sqrt(0.5f * m_size * m_size / max(area, 1e-12f));
+	unsigned nAttempts = 0;
+	while (!pack(density))
+	{
+		density *= 0.9f;
+		if (++nAttempts > 100)
+			return logError("charts do not fit the " + to_string(m_size) + " x " + to_string(m_size) + " lightmap");
+	}
+	m_densityUsed = density;
+
+	// chart maps: uv = (world position in the chart plane - uvMin) * density + atlas position, in [0..1]
+	for (unsigned t = 0; t < m_nTriangles; t++)
+	{
+		if (m_triChart[t] == 0xFFFFFFFF) continue;
+		const CHART &chart = m_charts[m_triChart[t]];
+		const glm::mat4 &m = m_entries[chart.iEntry].matrix;
+		unsigned u = (chart.axis + 1) % 3, v = (chart.axis + 2) % 3;
+		float scale = density / m_size;
+		m_maps[2 * t] = glm::vec4(m[0][u], m[1][u], m[2][u], m[3][u]) * scale + glm::vec4(0, 0, 0, (chart.x + c_pad - chart.uvMin.x * density) / m_size);
+		m_maps[2 * t + 1] = glm::vec4(m[0][v], m[1][v], m[2][v], m[3][v]) * scale + glm::vec4(0, 0, 0, (chart.y + c_pad - chart.uvMin.y * density) / m_size);
+	}
+
+	logInfo("unwrapped: " + to_string(m_charts.size()) + " charts, " + to_string(density) + " texels per unit");
+	return true;
+}
+
+bool C3dglLightmap::pack(float density)
+{
+	for (CHART &chart : m_charts)
+	{
+		chart.w = max((unsigned)ceil((chart.uvMax.x - chart.uvMin.x) * density), 1u) + 2 * c_pad;
+		chart.h = max((unsigned)ceil((chart.uvMax.y - chart.uvMin.y) * density), 1u) + 2 * c_pad;
+		if (chart.w > m_size || chart.h > m_size)
+			return false;
+	}
+
+	// shelf packing, the tallest charts first
+	vector<unsigned> order(m_charts.size());
+	for (unsigned i = 0; i < order.size(); i++)
+		order[i] = i;
+	stable_sort(order.begin(), order.end(), [this](unsigned a, unsigned b) { return m_charts[a].h > m_charts[b].h; });
+
+	unsigned x = 0, y = 0, hShelf = 0;
+	for (unsigned i : order)
+	{
+		CHART &chart = m_charts[i];
+		if (x + chart.w > m_size)
+		{
+			y += hShelf;
+			x = hShelf = 0;
+		}
+		if (y + chart.h > m_size)
+			return false;
+		chart.x = x;
+		chart.y = y;
+		x += chart.w;
+		hShelf = max(hShelf, chart.h);
+	}
+	return true;
+}
+
+void C3dglLightmap::rasterize()
+{
+	m_texels.assign(m_size * m_size, TEXEL());
+	m_valid.assign(m_size * m_size, false);
+
+	for (unsigned iEntry = 0; iEntry < m_entries.size(); iEntry++)
+	{
+		const ENTRY &entry = m_entries[iEntry];
+		const aiMesh *pMesh = entry.pMesh;
+		glm::mat3 matrixNormal = glm::transpose(glm::inverse(glm::mat3(entry.matrix)));
+
+		for (unsigned f = 0; f < pMesh->mNumFaces; f++)
+		{
+			unsigned t = entry.firstTriangle + f;
+			if (m_triChart[t] == 0xFFFFFFFF) continue;
+
+			// the triangle in texels
+			glm::vec3 p[3], n[3];
+			glm::vec2 tc[3];
+			for (unsigned k = 0; k < 3; k++)
+			{
+				unsigned i = pMesh->mFaces[f].mIndices[k];
+				glm::vec4 v(pMesh->mVertices[i].x, pMesh->mVertices[i].y, pMesh->mVertices[i].z, 1);
+				p[k] = glm::vec3(entry.matrix * v);
+				tc[k] = glm::vec2(glm::dot(m_maps[2 * t], v), glm::dot(m_maps[2 * t + 1], v)) * (float)m_size;
+				if (pMesh->mNormals)
+					n[k] = matrixNormal * glm::vec3(pMesh->mNormals[i].x, pMesh->mNormals[i].y, pMesh->mNormals[i].z);
+			}
+			float area = edge(tc[0], tc[1], tc[2]);
+			if (fabs(area) < 1e-12f) continue;
+			glm::vec3 nFace = glm::normalize(glm::cross(p[1] - p[0], p[2] - p[0]));
+
+			// texel centres inside the triangle
+			glm::vec2 tcMin = glm::min(tc[0], glm::min(tc[1], tc[2]));
+			glm::vec2 tcMax = glm::max(tc[0], glm::max(tc[1], tc[2]));
+			unsigned x0 = (unsigned)max(tcMin.x, 0.0f), x1 = min((unsigned)max(tcMax.x, 0.0f), m_size - 1);
+			unsigned y0 = (unsigned)max(tcMin.y, 0.0f), y1 = min((unsigned)max(tcMax.y, 0.0f), m_size - 1);
+			for (unsigned y = y0; y <= y1; y++)
+				for (unsigned x = x0; x <= x1; x++)
+				{
+					glm::vec2 c(x + 0.5f, y + 0.5f);
+					float w0 = edge(tc[1], tc[2], c) / area, w1 = edge(tc[2], tc[0], c) / area, w2 = edge(tc[0], tc[1], c) / area;
+					if (w0 < -1e-4f || w1 < -1e-4f || w2 < -1e-4f) continue;
+
+					TEXEL &texel = m_texels[y * m_size + x];
+					texel.pos = p[0] * w0 + p[1] * w1 + p[2] * w2;
+					texel.normal = pMesh->mNormals ? n[0] * w0 + n[1] * w1 + n[2] * w2 : nFace;
+					float len = glm::length(texel.normal);
+					texel.normal = len > 0 ? texel.normal / len : nFace;
+					texel.iEntry = iEntry;
+					texel.iChart = m_triChart[t];
+					m_valid[y * m_size + x] = true;
+				}
+		}
+	}
+}
+
+glm::vec3 C3dglLightmap::lightDirect(const glm::vec3 &pos, const glm::vec3 &normal, const ENTRY *pEntry)
+{
+	// as in lighting.glsl - without the specular; with pEntry NULL, only the part reflected off the surface (for the bounces)
+	glm::vec3 colour(0);
+	glm::vec3 orig = pos + normal * c_bias;
+
+	const C3dglDirLightBlock &dl = m_lightDirectional;
+	if (dl.on)
+	{
+		glm::vec3 l = -glm::normalize(dl.direction);
+		float nDotL = glm::dot(normal, l);
+		if (pEntry)
+			colour += pEntry->ambient * dl.ambient + pEntry->diffuse * dl.diffuseStrength;
+		if (nDotL > 0 && !m_bvh.occluded(orig, l, FLT_MAX))
+			colour += dl.diffuse * (dl.diffuseStrength * nDotL);
+	}
+
+	for (const C3dglPointLightBlock &light : m_lights)
+	{
+		if (light.isDark()) continue;
+		glm::vec3 v = light.position - pos;
+		float dist = glm::length(v);
+		if (dist <= 0 || dist >= light.getRange()) continue;
+		glm::vec3 l = v / dist;
+
+		float attenuation = 1;
+		if (light.radius > 0)
+		{
+			float denom = max(dist - light.radius, 0.0f) / light.radius + 1;
+			attenuation = 1 / (denom * denom);
+			if (light.cutoff < 1)
+				attenuation = max((attenuation - light.cutoff) / (1 - light.cutoff), 0.0f);
+		}
+
+		glm::vec3 c(0);
+		if (pEntry)
+			c += light.ambient + pEntry->diffuse * light.diffuseStrength;
+		float nDotL = glm::dot(normal, l);
+		if (nDotL > 0 && !m_bvh.occluded(orig, l, dist - c_bias))
+			c += light.diffuse * (light.diffuseStrength * nDotL);
+		colour += c * attenuation;
+	}
+	return colour;
+}
+
+glm::vec3 C3dglLightmap::lightIndirect(const glm::vec3 &pos, const glm::vec3 &normal, unsigned &seed)
+{
+	// cosine weighted paths - each hit adds the direct light it reflects
+	glm::vec3 sum(0);
+	for (unsigned s = 0; s < m_nSamples; s++)
+	{
+		glm::vec3 orig = pos + normal * c_bias;
+		glm::vec3 dir = sampleCosine(normal, seed);
+		float throughput = 1;
+		for (unsigned b = 0; b < m_nBounces; b++)
+		{
+			C3dglBVH::HIT hit;
+			if (!m_bvh.intersect(orig, dir, FLT_MAX, hit))
+			{
+				sum += m_sky * throughput;
+				break;
+			}
+
+			const glm::vec3 *v = m_bvh.getTriangle(hit.iTriangle);
+			glm::vec3 n = glm::cross(v[1] - v[0], v[2] - v[0]);
+			float len = glm::length(n);
+			if (len <= 0) break;
+			n /= len;
+			if (glm::dot(n, dir) > 0) n = -n;
+
+			glm::vec3 q = orig + dir * hit.t;
+			throughput *= m_reflectance;
+			sum += lightDirect(q, n, NULL) * throughput;
+
+			orig = q + n * c_bias;
+			dir = sampleCosine(n, seed);
+		}
+	}
+	return m_nSamples ? sum / (float)m_nSamples : sum;
+}
+
+void C3dglLightmap::denoise()
+{
+	// edge-aware blur of the indirect light within the charts: position and normal weighted
+	vector<glm::vec3> result(m_indirect.size(), glm::vec3(0));
+	float sigma = 1.5f / max(m_densityUsed, 1e-12f);
+	float k = -0.5f / (sigma * sigma);
+	int r = 2, n = (int)m_size;
+	C3dglThreadPool::get().parallelFor(m_size, [&](unsigned y)
+	{
+		for (int x = 0; x < n; x++)
+		{
+			unsigned i = y * n + x;
+			if (!m_valid[i]) continue;
+			const TEXEL &texel = m_texels[i];
+			glm::vec3 sum(0);
+			float sumW = 0;
+			for (int dy = -r; dy <= r; dy++)
+				for (int dx = -r; dx <= r; dx++)
+				{
+					int xx = x + dx, yy = (int)y + dy;
+					if (xx < 0 || yy < 0 || xx >= n || yy >= n) continue;
+					unsigned j = yy * n + xx;
+					if (!m_valid[j] || m_texels[j].iChart != texel.iChart) continue;
+					glm::vec3 d = m_texels[j].pos - texel.pos;
+					float w = exp(glm::dot(d, d) * k) * pow(max(glm::dot(m_texels[j].normal, texel.normal), 0.0f), 8.0f);
+					sum += m_indirect[j] * w;
+					sumW += w;
+				}
+			result[i] = sumW > 0 ? sum / sumW : m_indirect[i];
+		}
+	});
+	m_indirect.swap(result);
+}
+
+void C3dglLightmap::dilate(unsigned nPasses)
+{
+	// empty texels next to the charts take the average of their neighbours - so that bilinear filtering does not bleed black
+	vector<bool> valid = m_valid;
+	int n = (int)m_size;
+	for (unsigned pass = 0; pass < nPasses; pass++)
+	{
+		vector<bool> validNext = valid;
+		for (int y = 0; y < n; y++)
+			for (int x = 0; x < n; x++)
+			{
+				unsigned i = y * n + x;
+				if (valid[i]) continue;
+				glm::vec3 sum(0);
+				unsigned count = 0;
+				for (int dy = -1; dy <= 1; dy++)
+					for (int dx = -1; dx <= 1; dx++)
+					{
+						int xx = x + dx, yy = y + dy;
+						if (xx < 0 || yy < 0 || xx >= n || yy >= n || !valid[yy * n + xx]) continue;
+						sum += m_lightmap[yy * n + xx];
+						count++;
+					}
+				if (count)
+				{
+					m_lightmap[i] = sum / (float)count;
+					validNext[i] = true;
+				}
+			}
+		valid.swap(validNext);
+	}
+}
+
+bool C3dglLightmap::bake()
+{
+	if (!unwrap()) return false;
+
+	// BVH of all the triangles
+	m_bvh.clear();
+	for (const ENTRY &entry : m_entries)
+		for (unsigned f = 0; f < entry.pMesh->mNumFaces; f++)
+		{
+			const aiFace &face = entry.pMesh->mFaces[f];
+			if (face.mNumIndices != 3) continue;
+			glm::vec3 v[3];
+			for (unsigned k = 0; k < 3; k++)
+			{
+				const aiVector3D &p = entry.pMesh->mVertices[face.mIndices[k]];
+				v[k] = glm::vec3(entry.matrix * glm::vec4(p.x, p.y, p.z, 1));
+			}
+			m_bvh.addTriangle(v[0], v[1], v[2]);
+		}
+	m_bvh.build();
+
+	rasterize();
+
+	// path trace - one row of texels per job
+	m_direct.assign(m_size * m_size, glm::vec3(0));
+	m_indirect.assign(m_size * m_size, glm::vec3(0));
+	C3dglThreadPool::get().parallelFor(m_size, [this](unsigned y)
+	{
+		for (unsigned x = 0; x < m_size; x++)
+		{
+			unsigned i = y * m_size + x;
+			if (!m_valid[i]) continue;
+			const TEXEL &texel = m_texels[i];
+			m_direct[i] = lightDirect(texel.pos, texel.normal, &m_entries[texel.iEntry]);
+			unsigned seed = (i + 1) * 2654435761u;
+			if (seed == 0) seed = 1;
+			m_indirect[i] = lightIndirect(texel.pos, texel.normal, seed);
+		}
+	});
+
+	denoise();
+
+	m_lightmap.resize(m_size * m_size);
+	for (unsigned i = 0; i < m_lightmap.size(); i++)
+		m_lightmap[i] = m_direct[i] + m_indirect[i];
+	dilate(c_pad);
+
+	// release the bake data
+	m_texels.clear(); m_texels.shrink_to_fit();
+	m_direct.clear(); m_direct.shrink_to_fit();
+	m_indirect.clear(); m_indirect.shrink_to_fit();
+	m_bvh.clear();
+
+	return logSuccess("baked: " + to_string(m_size) + " x " + to_string(m_size) + ", " + to_string(m_nSamples) + " samples, " + to_string(m_nBounces) + " bounces, "
+		+ to_string(C3dglThreadPool::get().getThreadCount()) + " threads");
+}
+
+bool C3dglLightmap::save(const std::string &fileName)
+{
+	if (m_lightmap.size() != m_size * m_size)
+		return logError("nothing to save - bake first");
+
+	ofstream file(fileName.c_str(), ios::binary);
+	if (!file)
+		return logError("cannot write " + fileName);
+
+	// uncompressed true-colour TGA, origin at the bottom left - the GL row order; the image id holds the input hash
+	char id[64];
+	snprintf(id, sizeof(id), "%s%016llx", c_idPrefix, getHash());
+	unsigned char header[18] = { (unsigned char)strlen(id), 0, 2 };
+	header[12] = m_size & 0xFF; header[13] = (m_size >> 8) & 0xFF;
+	header[14] = m_size & 0xFF; header[15] = (m_size >> 8) & 0xFF;
+	header[16] = 32;
+	header[17] = 8;
+	file.write((const char*)header, sizeof(header));
+	file.write(id, header[0]);
+
+	vector<unsigned char> pixels(4 * m_lightmap.size());
+	for (unsigned i = 0; i < m_lightmap.size(); i++)
+	{
+		glm::vec3 c = glm::clamp(m_lightmap[i] * (255.0f / RANGE) + 0.5f, 0.0f, 255.0f);
+		pixels[4 * i + 0] = (unsigned char)c.b;
+		pixels[4 * i + 1] = (unsigned char)c.g;
+		pixels[4 * i + 2] = (unsigned char)c.r;
+		pixels[4 * i + 3] = 255;
+	}
+	file.write((const char*)&pixels[0], pixels.size());
+	if (!file)
+		return logError("cannot write " + fileName);
+	return logSuccess("saved: " + fileName);
+}
+
+bool C3dglLightmap::load(const std::string &fileName)
+{
+	ifstream file(fileName.c_str(), ios::binary);
+	if (!file)
+		return false;		// not baked yet - not an error
+	if (!unwrap()) return false;
+
+	unsigned char header[18];
+	if (!file.read((char*)header, sizeof(header)))
+		return logError("cannot read " + fileName);
+	unsigned w = header[12] | (header[13] << 8), h = header[14] | (header[15] << 8), bpp = header[16];
+	if (header[2] != 2 || (bpp != 24 && bpp != 32))
+		return logError(fileName + " is not an uncompressed true-colour TGA file");
+	if (w != m_size || h != m_size)
+		return logError(fileName + " was baked for a different lightmap size");
+	char id[256], idExpected[64];
+	if (!file.read(id, header[0]))
+		return logError("cannot read " + fileName);
+	id[header[0]] = 0;
+	snprintf(idExpected, sizeof(idExpected), "%s%016llx", c_idPrefix, getHash());
+	if (strcmp(id, idExpected) != 0)
+		return logError(fileName + " was baked for a different scene, lights or settings");
+
+	unsigned nBytes = bpp / 8;
+	vector<unsigned char> pixels(nBytes * w * h);
+	if (!file.read((char*)&pixels[0], pixels.size()))
+		return logError("cannot read " + fileName);
+
+	bool bTopDown = (header[17] & 0x20) != 0;
+	m_lightmap.resize(w * h);
+	for (unsigned y = 0; y < h; y++)
+		for (unsigned x = 0; x < w; x++)
+		{
+			const unsigned char *p = &pixels[nBytes * ((bTopDown ? h - 1 - y : y) * w + x)];
+			m_lightmap[y * w + x] = glm::vec3(p[2], p[1], p[0]) * ((float)RANGE / 255.0f);
+		}
+	return logSuccess("loaded: " + fileName);
+}
+
+
+// FNV-1a, 64 bits
+static void hashBytes(unsigned long long &hash, const void *p, size_t n)
+{
+	const unsigned char *bytes = (const unsigned char*)p;
+	for (size_t i = 0; i < n; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+}
+
+template <class T>
+static void hashValue(unsigned long long &hash, const T &value)
+{
+	hashBytes(hash, &value, sizeof(value));
+}
+
+unsigned long long C3dglLightmap::getHash()
+{
+	unsigned long long hash = 14695981039346656037ull;
+
+	// settings
+	hashValue(hash, m_size);
+	hashValue(hash, m_density);
+	hashValue(hash, m_nSamples);
+	hashValue(hash, m_nBounces);
+	hashValue(hash, m_reflectance);
+	hashValue(hash, m_sky);
+
+	// lights - field by field, the padding of the blocks is not always set
+	const C3dglDirLightBlock &dl = m_lightDirectional;
+	hashValue(hash, dl.on);
+	hashValue(hash, dl.direction);
+	hashValue(hash, dl.ambient);
+	hashValue(hash, dl.diffuse);
+	hashValue(hash, dl.diffuseStrength);
+	for (const C3dglPointLightBlock &light : m_lights)
+	{
+		hashValue(hash, light.on);
+		hashValue(hash, light.position);
+		hashValue(hash, light.ambient);
+		hashValue(hash, light.diffuse);
+		hashValue(hash, light.diffuseStrength);
+		hashValue(hash, light.specular);
+		hashValue(hash, light.specularPower);
+		hashValue(hash, light.radius);
+		hashValue(hash, light.cutoff);
+	}
+
+	// meshes
+	for (const ENTRY &entry : m_entries)
+	{
+		const aiMesh *pMesh = entry.pMesh;
+		hashValue(hash, entry.matrix);
+		hashValue(hash, entry.ambient);
+		hashValue(hash, entry.diffuse);
+		hashValue(hash, pMesh->mNumVertices);
+		hashBytes(hash, pMesh->mVertices, pMesh->mNumVertices * sizeof(aiVector3D));
+		if (pMesh->mNormals)
+			hashBytes(hash, pMesh->mNormals, pMesh->mNumVertices * sizeof(aiVector3D));
+		hashValue(hash, pMesh->mNumFaces);
+		for (unsigned f = 0; f < pMesh->mNumFaces; f++)
+			hashBytes(hash, pMesh->mFaces[f].mIndices, pMesh->mFaces[f].mNumIndices * sizeof(unsigned));
+	}
+	return hash;
+}
+
+bool C3dglLightmap::saveJob(const std::string &fileName)
+{
+	ofstream file(fileName.c_str(), ios::binary);
+	if (!file)
+		return logError("cannot write " + fileName);
+
+	auto write = [&file](const void *p, size_t n) { file.write((const char*)p, n); };
+	write(c_jobMagic, sizeof(c_jobMagic));
+	write(&m_size, sizeof(m_size));
+	write(&m_density, sizeof(m_density));
+	write(&m_nSamples, sizeof(m_nSamples));
+	write(&m_nBounces, sizeof(m_nBounces));
+	write(&m_reflectance, sizeof(m_reflectance));
+	write(&m_sky, sizeof(m_sky));
+	write(&m_lightDirectional, sizeof(m_lightDirectional));
+	unsigned nLights = (unsigned)m_lights.size(), nEntries = (unsigned)m_entries.size();
+	write(&nLights, sizeof(nLights));
+	if (nLights) write(&m_lights[0], nLights * sizeof(m_lights[0]));
+
+	write(&nEntries, sizeof(nEntries));
+	for (const ENTRY &entry : m_entries)
+	{
+		const aiMesh *pMesh = entry.pMesh;
+		unsigned bNormals = pMesh->mNormals ? 1 : 0;
+		write(&entry.matrix, sizeof(entry.matrix));
+		write(&entry.ambient, sizeof(entry.ambient));
+		write(&entry.diffuse, sizeof(entry.diffuse));
+		write(&pMesh->mNumVertices, sizeof(pMesh->mNumVertices));
+		write(&bNormals, sizeof(bNormals));
+		write(pMesh->mVertices, pMesh->mNumVertices * sizeof(aiVector3D));
+		if (bNormals) write(pMesh->mNormals, pMesh->mNumVertices * sizeof(aiVector3D));
+		write(&pMesh->mNumFaces, sizeof(pMesh->mNumFaces));
+		for (unsigned f = 0; f < pMesh->mNumFaces; f++)
+		{
+			write(&pMesh->mFaces[f].mNumIndices, sizeof(unsigned));
+			write(pMesh->mFaces[f].mIndices, pMesh->mFaces[f].mNumIndices * sizeof(unsigned));
+		}
+	}
+	if (!file)
+		return logError("cannot write " + fileName);
+	return logSuccess("bake job saved: " + fileName + ", " + to_string(m_nTriangles) + " triangles");
+}
+
+bool C3dglLightmap::loadJob(const std::string &fileName)
+{
+	ifstream file(fileName.c_str(), ios::binary);
+	if (!file)
+		return logError("cannot read " + fileName);
+
+	clear();
+	auto read = [&file](void *p, size_t n) { return (bool)file.read((char*)p, n); };
+	char magic[sizeof(c_jobMagic)];
+	if (!read(magic, sizeof(magic)) || memcmp(magic, c_jobMagic, sizeof(magic)) != 0)
+		return logError(fileName + " is not a lightmap bake job");
+	unsigned nLights = 0, nEntries = 0;
+	bool bOK = read(&m_size, sizeof(m_size)) && read(&m_density, sizeof(m_density))
+		&& read(&m_nSamples, sizeof(m_nSamples)) && read(&m_nBounces, sizeof(m_nBounces))
+		&& read(&m_reflectance, sizeof(m_reflectance)) && read(&m_sky, sizeof(m_sky))
+		&& read(&m_lightDirectional, sizeof(m_lightDirectional)) && read(&nLights, sizeof(nLights));
+	if (bOK && nLights < c_jobMaxCount)
+	{
+		m_lights.resize(nLights);
+		bOK = (nLights == 0 || read(&m_lights[0], nLights * sizeof(m_lights[0]))) && read(&nEntries, sizeof(nEntries)) && nEntries < c_jobMaxCount;
+	}
+	else
+		bOK = false;
+
+	for (unsigned i = 0; i < nEntries && bOK; i++)
+	{
+		aiMesh *pMesh = new aiMesh;
+		m_meshesOwned.push_back(pMesh);
+
+		ENTRY entry;
+		unsigned bNormals = 0;
+		bOK = read(&entry.matrix, sizeof(entry.matrix)) && read(&entry.ambient, sizeof(entry.ambient)) && read(&entry.diffuse, sizeof(entry.diffuse))
+			&& read(&pMesh->mNumVertices, sizeof(pMesh->mNumVertices)) && read(&bNormals, sizeof(bNormals)) && pMesh->mNumVertices < c_jobMaxCount;
+		if (!bOK) break;
+		pMesh->mVertices = new aiVector3D[pMesh->mNumVertices];
+		bOK = read(pMesh->mVertices, pMesh->mNumVertices * sizeof(aiVector3D));
+		if (bOK && bNormals)
+		{
+			pMesh->mNormals = new aiVector3D[pMesh->mNumVertices];
+			bOK = read(pMesh->mNormals, pMesh->mNumVertices * sizeof(aiVector3D));
+		}
+		bOK = bOK && read(&pMesh->mNumFaces, sizeof(pMesh->mNumFaces)) && pMesh->mNumFaces < c_jobMaxCount;
+		if (!bOK) break;
+		pMesh->mFaces = new aiFace[pMesh->mNumFaces];
+		for (unsigned f = 0; f < pMesh->mNumFaces && bOK; f++)
+		{
+			aiFace &face = pMesh->mFaces[f];
+			bOK = read(&face.mNumIndices, sizeof(unsigned)) && face.mNumIndices <= 64;
+			if (!bOK) break;
+			face.mIndices = new unsigned[face.mNumIndices];
+			bOK = read(face.mIndices, face.mNumIndices * sizeof(unsigned));
+			for (unsigned k = 0; k < face.mNumIndices && bOK; k++)
+				bOK = face.mIndices[k] < pMesh->mNumVertices;
+		}
+		if (!bOK) break;
+
+		entry.pKey = NULL;
+		entry.pMesh = pMesh;
+		entry.firstTriangle = m_nTriangles;
+		m_nTriangles += pMesh->mNumFaces;
+		m_entries.push_back(entry);
+	}
+	if (!bOK)
+	{
+		clear();
+		return logError("cannot read " + fileName + " - truncated or corrupted");
+	}
+	return logSuccess("bake job loaded: " + fileName + ", " + to_string(m_entries.size()) + " meshes, " + to_string(m_nTriangles) + " triangles");
+}
@@ -0,0 +1,89 @@
+#include "../GL/glew.h"
+#include "../GL/3dglShader.h"
+#include "../GL/3dglMaterial.h"
+#include "../GL/3dglState.h"
+
+using namespace std;
+using namespace _3dgl;
+
+unsigned C3dglMaterial::c_idTexBlank = 0xFFFFFFFF;
+
+C3dglMaterial::C3dglMaterial()
+{
+	m_amb[0] = m_amb[1] = m_amb[2] = 1.0f;
+	m_diff[0] = m_diff[1] = m_diff[2] = 1.0f;
+	memset(m_spec, 0, sizeof(m_spec));
+	memset(m_emiss, 0, sizeof(m_emiss));
+	m_shininess = 0.0f;
+	m_idTexture = m_idNormalMap = 0xFFFFFFFF;
+	m_bDirty = true;
+}
+
+unsigned C3dglMaterial::getBlankTexture()
+{
+	if (c_idTexBlank == 0xFFFFFFFF)
+	{
+		glGenTextures(1, &c_idTexBlank);
+		C3dglState::bindTexture(GL_TEXTURE_2D, c_idTexBlank);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		unsigned char bytes[] = { 255, 255, 255, 255 };
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &bytes);
+	}
+	return c_idTexBlank;
+}
+
+void C3dglMaterial::applyColours(C3dglProgram *pProgram)
+{
+	if (pProgram == NULL) pProgram = C3dglProgram::GetCurrentProgram();
+	if (pProgram == NULL) return;
+
+	if (pProgram->HasUniformBlock(UBO_MATERIAL))
+	{
+		// upload only if changed, then just attach the buffer
+		if (m_bDirty || !m_ubo.isCreated())
+		{
+			C3dglMaterialBlock block;
+			getBlock(block);
+			if (!m_ubo.isCreated()) m_ubo.create(UBO_MATERIAL, block);
+			else m_ubo.update(block);
+			m_bDirty = false;
+		}
+		m_ubo.bind();
+		return;
+	}
+
+	pProgram->SendStandardUniform(C3dglProgram::UNI_MAT_AMBIENT, m_amb[0], m_amb[1], m_amb[2]);
+	pProgram->SendStandardUniform(C3dglProgram::UNI_MAT_DIFFUSE, m_diff[0], m_diff[1], m_diff[2]);
+	pProgram->SendStandardUniform(C3dglProgram::UNI_MAT_SPECULAR, m_spec[0], m_spec[1], m_spec[2]);
+	pProgram->SendStandardUniform(C3dglProgram::UNI_MAT_EMISSIVE, m_emiss[0], m_emiss[1], m_emiss[2]);
+	pProgram->SendStandardUniform(C3dglProgram::UNI_MAT_SHININESS, m_shininess);
+}
+
+void C3dglMaterial::getBlock(C3dglMaterialBlock &block)
+{
+	memset(&block, 0, sizeof(block));
+	block.ambient = glm::vec3(m_amb[0], m_amb[1], m_amb[2]);
+	block.diffuse = glm::vec3(m_diff[0], m_diff[1], m_diff[2]);
+	block.specular = glm::vec3(m_spec[0], m_spec[1], m_spec[2]);
+	block.emissive = glm::vec3(m_emiss[0], m_emiss[1], m_emiss[2]);
+	block.shininess = m_shininess;
+}
+
+void C3dglMaterial::applyTextures(C3dglProgram *pProgram)
+{
+	if (pProgram == NULL) pProgram = C3dglProgram::GetCurrentProgram();
+	if (pProgram == NULL) return;
+
+	C3dglState::bindTexture(0, GL_TEXTURE_2D, m_idTexture != 0xFFFFFFFF ? m_idTexture : getBlankTexture());
+	pProgram->SendStandardUniform(C3dglProgram::UNI_MAT_TEXTURE, 0);
+
+	// programs (or variants) without a normal map do not need the blank one
+	if (pProgram->GetUniformLocation(C3dglProgram::UNI_MAT_NORMALMAP) != (GLuint)-1)
+	{
+		C3dglState::bindTexture(1, GL_TEXTURE_2D, m_idNormalMap != 0xFFFFFFFF ? m_idNormalMap : getBlankTexture());
+		pProgram->SendStandardUniform(C3dglProgram::UNI_MAT_NORMALMAP, 1);
+	}
+
+	C3dglState::activeTexture(GL_TEXTURE0);
+}
@@ -4,6 +4,8 @@
 #include "../GL/3dglModel.h"
 #include "../GL/3dglShader.h"
 #include "../GL/3dglBitmap.h"
+#include "../GL/3dglRenderQueue.h"
+#include "../GL/3dglThreadPool.h"
 
 // assimp include file
 #include "../GL/assimp/cimport.h"
@@ -14,6 +16,7 @@
 #include "../glm/mat4x4.hpp"
 #include "../glm/trigonometric.hpp"
 #include "../glm/gtc/type_ptr.hpp"
+#include "../glm/gtc/matrix_inverse.hpp"
 
 #include <assert.h>
 
@@ -48,9 +51,9 @@ void C3dglModel::MESH::create(const aiMesh *pMesh, unsigned maskEnabledBufData)
 		if (vec.x < bb[0].x) bb[0].x = vec.x;
 		if (vec.y < bb[0].y) bb[0].y = vec.y;
 		if (vec.z < bb[0].z) bb[0].z = vec.z;
-		if (vec.x > bb[0].x) bb[1].x = vec.x;
-		if (vec.y > bb[0].y) bb[1].y = vec.y;
-		if (vec.z > bb[0].z) bb[1].z = vec.z;
+		if (vec.x > bb[1].x) bb[1].x = vec.x;
+		if (vec.y > bb[1].y) bb[1].y = vec.y;
+		if (vec.z > bb[1].z) bb[1].z = vec.z;
 	}
 	centre.x = 0.5f * (bb[0].x + bb[1].x);
 	centre.y = 0.5f * (bb[0].y + bb[1].y);
@@ -78,7 +81,7 @@ void C3dglModel::MESH::create(const aiMesh *pMesh, unsigned maskEnabledBufData)
 
 	// create VAO
 	glGenVertexArrays(1, &m_idVAO);
-	glBindVertexArray(m_idVAO);
+	C3dglState::bindVertexArray(m_idVAO);
 
 	// generate a vertex buffer, than bind it and send data to OpenGL
 	if (attribVertex != (GLuint)-1)
@@ -90,7 +93,7 @@ void C3dglModel::MESH::create(const aiMesh *pMesh, unsigned maskEnabledBufData)
 
 			if (pProgram)
 			{
-				glEnableVertexAttribArray(attribVertex);
+				C3dglState::enableVertexAttribArray(attribVertex);
 				glVertexAttribPointer(attribVertex, 3, GL_FLOAT, GL_FALSE, 0, 0);
 			}
 			else
@@ -112,7 +115,7 @@ void C3dglModel::MESH::create(const aiMesh *pMesh, unsigned maskEnabledBufData)
 
 			if (pProgram)
 			{
-				glEnableVertexAttribArray(attribNormal);
+				C3dglState::enableVertexAttribArray(attribNormal);
 				glVertexAttribPointer(attribNormal, 3, GL_FLOAT, GL_FALSE, 0, 0);
 			}
 			else
@@ -150,7 +153,7 @@ void C3dglModel::MESH::create(const aiMesh *pMesh, unsigned maskEnabledBufData)
 
 			if (pProgram)
 			{
-				glEnableVertexAttribArray(attribTexCoord);
+				C3dglState::enableVertexAttribArray(attribTexCoord);
 				glVertexAttribPointer(attribTexCoord, m_nUVComponents, GL_FLOAT, GL_FALSE, 0, 0);
 			}
 			else
@@ -171,7 +174,7 @@ void C3dglModel::MESH::create(const aiMesh *pMesh, unsigned maskEnabledBufData)
 
 			if (pProgram)
 			{
-				glEnableVertexAttribArray(attribTangent);
+				C3dglState::enableVertexAttribArray(attribTangent);
 				glVertexAttribPointer(attribTangent, 3, GL_FLOAT, GL_FALSE, 0, 0);
 			}
 		}
@@ -188,7 +191,7 @@ void C3dglModel::MESH::create(const aiMesh *pMesh, unsigned maskEnabledBufData)
 
 			if (pProgram)
 			{
-				glEnableVertexAttribArray(attribBitangent);
+				C3dglState::enableVertexAttribArray(attribBitangent);
 				glVertexAttribPointer(attribBitangent, 3, GL_FLOAT, GL_FALSE, 0, 0);
 			}
 		}
@@ -205,8 +208,8 @@ void C3dglModel::MESH::create(const aiMesh *pMesh, unsigned maskEnabledBufData)
 
 			if (pProgram)
 			{
-				glEnableVertexAttribArray(attribColor);
-				glVertexAttribPointer(attribColor, 3, GL_FLOAT, GL_FALSE, 0, 0);
+				C3dglState::enableVertexAttribArray(attribColor);
+				glVertexAttribPointer(attribColor, 4, GL_FLOAT, GL_FALSE, 0, 0);	// aiColor4D
 			}
 		}
 		else
@@ -278,9 +281,9 @@ void C3dglModel::MESH::create(const aiMesh *pMesh, unsigned maskEnabledBufData)
 
 		if (pProgram)
 		{
-			glEnableVertexAttribArray(attribBoneId);
+			C3dglState::enableVertexAttribArray(attribBoneId);
 			glVertexAttribIPointer(attribBoneId, 4, GL_INT, sizeof(VertexBoneData), (const GLvoid*)0);
-			glEnableVertexAttribArray(attribBoneWeight); 
+			C3dglState::enableVertexAttribArray(attribBoneWeight); 
 			glVertexAttribPointer(attribBoneWeight, 4, GL_FLOAT, GL_FALSE, sizeof(VertexBoneData), (const GLvoid*)sizeof(bones[0].ids));
 		}
 	}
@@ -299,10 +302,49 @@ void C3dglModel::MESH::create(const aiMesh *pMesh, unsigned maskEnabledBufData)
 
 	m_nMaterialIndex = pMesh->mMaterialIndex;
 
+	// triangle BVH - the triangle indices are the face indices
+	if (m_pOwner && m_pOwner->m_bEnableBVH)
+	{
+		for (const aiFace &face : vector<aiFace>(pMesh->mFaces, pMesh->mFaces + pMesh->mNumFaces))
+		{
+			const aiVector3D *v[3] = { &pMesh->mVertices[face.mIndices[0]], &pMesh->mVertices[face.mIndices[1]], &pMesh->mVertices[face.mIndices[2]] };
+			m_bvh.addTriangle(glm::vec3(v[0]->x, v[0]->y, v[0]->z), glm::vec3(v[1]->x, v[1]->y, v[1]->z), glm::vec3(v[2]->x, v[2]->y, v[2]->z));
+		}
+		m_bvh.build();
+	}
+
+	// occluder proxy - from the BVH triangles, if built, as they are the same
+	if (m_pOwner && m_pOwner->m_bEnableOccluderProxy)
+	{
+		if (m_bvh.isBuilt())
+			m_proxy.create(m_bvh.getTriangle(0), m_bvh.getTriangleCount());
+		else
+		{
+			vector<glm::vec3> vertices;
+			for (const aiFace &face : vector<aiFace>(pMesh->mFaces, pMesh->mFaces + pMesh->mNumFaces))
+				for (unsigned i = 0; i < 3; i++)
+					vertices.push_back(glm::vec3(pMesh->mVertices[face.mIndices[i]].x, pMesh->mVertices[face.mIndices[i]].y, pMesh->mVertices[face.mIndices[i]].z));
+			if (!vertices.empty())
+				m_proxy.create(&vertices[0], vertices.size() / 3);
+		}
+	}
+
+	// the second VAO: the positions only, for the depth passes - shares the vertex and the index buffers
+	m_idVAODepth = 0;
+	if (pProgram && attribVertex != (GLuint)-1 && m_buf[BUF_VERTEX].m_id != (unsigned)-1)
+	{
+		glGenVertexArrays(1, &m_idVAODepth);
+		C3dglState::bindVertexArray(m_idVAODepth);
+		C3dglState::bindBuffer(GL_ARRAY_BUFFER, m_buf[BUF_VERTEX].m_id);
+		C3dglState::enableVertexAttribArray(attribVertex);
+		glVertexAttribPointer(attribVertex, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		C3dglState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_buf[BUF_INDEX].m_id);
+	}
+
 	// Reset VAO & buffers
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	C3dglState::bindVertexArray(0);
+	C3dglState::bindBuffer(GL_ARRAY_BUFFER, 0);
+	C3dglState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
 void C3dglModel::MESH::destroy()
@@ -315,13 +357,54 @@ void C3dglModel::MESH::destroy()
 	m_buf[BUF_COLOR].release();
 	m_buf[BUF_BONE].release();
 	m_buf[BUF_INDEX].release();
+	if (m_idVAO) C3dglState::deleteVertexArrays(1, &m_idVAO);
+	if (m_idVAODepth) C3dglState::deleteVertexArrays(1, &m_idVAODepth);
+	m_idVAO = m_idVAODepth = 0;
+	m_bvh.clear();
+	m_proxy.clear();
+}
+
+bool C3dglModel::MESH::intersect(const glm::mat4 &matrix, const glm::vec3 &orig, const glm::vec3 &dir, float tMax, C3dglBVH::HIT &hit)
+{
+	if (!m_bvh.isBuilt()) return false;
+
+	// the ray to the mesh space - not normalised, so that the distances remain as they were
+	glm::mat4 inv = glm::inverse(matrix);
+	return m_bvh.intersect(glm::vec3(inv * glm::vec4(orig, 1)), glm::mat3(inv) * dir, tMax, hit);
+}
+
+void C3dglModel::MESH::setColors(const aiColor4D *pColors, unsigned num, GLuint attrib)
+{
+	m_buf[BUF_COLOR].release();
+	if (num == 0 || pColors == NULL) return;
+
+	C3dglState::bindVertexArray(m_idVAO);
+	m_buf[BUF_COLOR].populate(sizeof(pColors[0]), num, pColors);
+	if (m_pOwner && (m_pOwner->m_maskEnabledBufData & (1 << BUF_COLOR)))
+		m_buf[BUF_COLOR].storeData(sizeof(pColors[0]), num, pColors);
+	C3dglState::enableVertexAttribArray(attrib);
+	glVertexAttribPointer(attrib, 4, GL_FLOAT, GL_FALSE, 0, 0);
+
+	C3dglState::bindVertexArray(0);
+	C3dglState::bindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 void C3dglModel::MESH::render() 
 {
-	glBindVertexArray(m_idVAO);
+	// the VAO is left bound - the next mesh will likely replace it anyway
+	C3dglState::bindVertexArray(m_idVAO);
+	glDrawElements(GL_TRIANGLES, m_indexSize, GL_UNSIGNED_INT, 0);
+}
+
+void C3dglModel::MESH::renderDepth()
+{
+	if (m_idVAODepth == 0)
+	{
+		render();
+		return;
+	}
+	C3dglState::bindVertexArray(m_idVAODepth);
 	glDrawElements(GL_TRIANGLES, m_indexSize, GL_UNSIGNED_INT, 0);
-	glBindVertexArray(0);
 }
 
 C3dglModel::MATERIAL *C3dglModel::MESH::createNewMaterial()
@@ -340,6 +423,7 @@ C3dglModel::MATERIAL::MATERIAL(C3dglModel *pOwner) : m_pOwner(pOwner)
 	memset(m_spec, 0, sizeof(m_spec));;
 	memset(m_emiss, 0, sizeof(m_emiss));;
 	m_shininess = 0.0f;
+	m_bDirty = true;
 }
 
 void C3dglModel::MATERIAL::create(const aiMaterial *pMat, const char* pDefTexPath)
@@ -385,17 +469,36 @@ void C3dglModel::MATERIAL::create(const aiMaterial *pMat, const char* pDefTexPat
 void C3dglModel::MATERIAL::destroy()
 {
 	if (m_idTexture != 0xffffffff)
-		glDeleteTextures(1, &m_idTexture);
+		C3dglState::deleteTextures(1, &m_idTexture);
+	m_ubo.destroy();
 }
 
 void C3dglModel::MATERIAL::bind()
 {
 	if (m_idTexture != 0xffffffff)
-		glBindTexture(GL_TEXTURE_2D, m_idTexture);
+		C3dglState::bindTexture(GL_TEXTURE_2D, m_idTexture);
 
 	// check if a shading program is active
 	C3dglProgram *pProgram = C3dglProgram::GetCurrentProgram();
-	if (pProgram)
+	if (pProgram && pProgram->HasUniformBlock(UBO_MATERIAL))
+	{
+		// Material uniform block - uploaded only when changed
+		if (m_bDirty || !m_ubo.isCreated())
+		{
+			C3dglMaterialBlock block;
+			memset(&block, 0, sizeof(block));
+			block.ambient = glm::vec3(m_amb[0], m_amb[1], m_amb[2]);
+			block.diffuse = glm::vec3(m_diff[0], m_diff[1], m_diff[2]);
+			block.specular = glm::vec3(m_spec[0], m_spec[1], m_spec[2]);
+			block.emissive = glm::vec3(m_emiss[0], m_emiss[1], m_emiss[2]);
+			block.shininess = m_shininess;
+			if (!m_ubo.isCreated()) m_ubo.create(UBO_MATERIAL, block);
+			else m_ubo.update(block);
+			m_bDirty = false;
+		}
+		m_ubo.bind();
+	}
+	else if (pProgram)
 	{
 		pProgram->SendStandardUniform(C3dglProgram::UNI_MAT_AMBIENT, m_amb[0], m_amb[1], m_amb[2]);	
 		pProgram->SendStandardUniform(C3dglProgram::UNI_MAT_DIFFUSE, m_diff[0], m_diff[1], m_diff[2]);
@@ -433,7 +536,7 @@ void C3dglModel::MATERIAL::loadTexture(string strDefTexPath, string strPath)
 		glGenTextures(1, &m_idTexture);
 
 		// load texture
-		glBindTexture(GL_TEXTURE_2D, m_idTexture); 
+		C3dglState::bindTexture(GL_TEXTURE_2D, m_idTexture); 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bm.getWidth(), bm.getHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, bm.getBits()); 
@@ -445,7 +548,7 @@ void C3dglModel::MATERIAL::loadBlankTexture()
 	if (c_idTexBlank == 0xffffffff)
 	{
 		glGenTextures(1, &c_idTexBlank);
-		glBindTexture(GL_TEXTURE_2D, c_idTexBlank);
+		C3dglState::bindTexture(GL_TEXTURE_2D, c_idTexBlank);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		unsigned char bytes[] = { 255, 255, 255 };
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_BGR, GL_UNSIGNED_BYTE, &bytes);
@@ -479,7 +582,7 @@ void C3dglModel::destroy()
 {
 	if (m_pScene) 
 	{
-		for (MESH mesh : m_meshes)
+		for (MESH &mesh : m_meshes)
 			mesh.destroy();
 		for (MATERIAL mat : m_materials)
 			mat.destroy();
@@ -547,16 +650,106 @@ void C3dglModel::render(unsigned iNode, glm::mat4 matrix)
 
 void C3dglModel::render()
 {
-	glm::mat4 m;
-	glGetFloatv(GL_MODELVIEW_MATRIX, (GLfloat*)&m);
-	render(m);
+	render(C3dglState::getModelViewMatrix());
 }
 
 void C3dglModel::render(unsigned iNode)
 {
-	glm::mat4 m;
-	glGetFloatv(GL_MODELVIEW_MATRIX, (GLfloat*)&m);
-	render(iNode, m);
+	render(iNode, C3dglState::getModelViewMatrix());
+}
+
+bool C3dglModel::intersectNode(aiNode *pNode, glm::mat4 m, const glm::vec3 &orig, const glm::vec3 &dir, RAYHIT &hit)
+{
+	aiMatrix4x4 mx = pNode->mTransformation;
+	aiTransposeMatrix4(&mx);
+	m *= glm::make_mat4((GLfloat*)&mx);
+
+	bool bHit = false;
+	for (unsigned iMesh : vector<unsigned>(pNode->mMeshes, pNode->mMeshes + pNode->mNumMeshes))
+	{
+		C3dglBVH::HIT h;
+		if (m_meshes[iMesh].intersect(m, orig, dir, hit.t, h))
+		{
+			hit.iMesh = iMesh;
+			hit.iTriangle = h.iTriangle;
+			hit.u = h.u;
+			hit.v = h.v;
+			hit.t = h.t;
+			bHit = true;
+		}
+	}
+
+	for (aiNode *p : vector<aiNode*>(pNode->mChildren, pNode->mChildren + pNode->mNumChildren))
+		bHit |= intersectNode(p, m, orig, dir, hit);
+	return bHit;
+}
+
+bool C3dglModel::intersect(glm::mat4 matrix, const glm::vec3 &orig, const glm::vec3 &dir, RAYHIT &hit, float tMax)
+{
+	hit.iMesh = (unsigned)-1;
+	hit.t = tMax;
+	return m_pScene && m_pScene->mRootNode && intersectNode(m_pScene->mRootNode, matrix, orig, dir, hit);
+}
+
+bool C3dglModel::intersect(unsigned iNode, glm::mat4 matrix, const glm::vec3 &orig, const glm::vec3 &dir, RAYHIT &hit, float tMax)
+{
+	hit.iMesh = (unsigned)-1;
+	hit.t = tMax;
+	if (!m_pScene || !m_pScene->mRootNode || iNode >= m_pScene->mRootNode->mNumChildren)
+		return false;
+
+	aiMatrix4x4 m = m_pScene->mRootNode->mTransformation;
+	aiTransposeMatrix4(&m);
+	matrix *= glm::make_mat4((GLfloat*)&m);
+	return intersectNode(m_pScene->mRootNode->mChildren[iNode], matrix, orig, dir, hit);
+}
+
+unsigned C3dglModel::intersect(glm::mat4 matrix, const glm::vec3 *orig, const glm::vec3 *dir, unsigned n, RAYHIT *hits, float tMax)
+{
+	// chunks of 64 rays
+	const unsigned nChunk = 64;
+	vector<unsigned> nHits((n + nChunk - 1) / nChunk, 0);
+	C3dglThreadPool::get().parallelFor((unsigned)nHits.size(), [&](unsigned iChunk)
+	{
+		for (unsigned i = iChunk * nChunk; i < min(n, (iChunk + 1) * nChunk); i++)
+			if (intersect(matrix, orig[i], dir[i], hits[i], tMax))
+				nHits[iChunk]++;
+	});
+	unsigned nTotal = 0;
+	for (unsigned nHit : nHits)
+		nTotal += nHit;
+	return nTotal;
+}
+
+void C3dglModel::submitNode(C3dglRenderQueue &queue, aiNode *pNode, glm::mat4 m)
+{
+	aiMatrix4x4 mx = pNode->mTransformation;;
+	aiTransposeMatrix4(&mx);
+	m *= glm::make_mat4((GLfloat*)&mx);
+
+	for (unsigned iMesh : vector<unsigned>(pNode->mMeshes, pNode->mMeshes + pNode->mNumMeshes))
+		queue.submit(&m_meshes[iMesh], NULL, m);
+
+	// submit all children
+	for (aiNode *p : vector<aiNode*>(pNode->mChildren, pNode->mChildren + pNode->mNumChildren))
+		submitNode(queue, p, m);
+}
+
+void C3dglModel::submit(C3dglRenderQueue &queue, glm::mat4 matrix)
+{
+	if (m_pScene && m_pScene->mRootNode)
+		submitNode(queue, m_pScene->mRootNode, matrix);
+}
+
+void C3dglModel::submit(C3dglRenderQueue &queue, unsigned iNode, glm::mat4 matrix)
+{
+	if (!m_pScene || !m_pScene->mRootNode || iNode >= m_pScene->mRootNode->mNumChildren)
+		return;
+
+	aiMatrix4x4 m = m_pScene->mRootNode->mTransformation;
+	aiTransposeMatrix4(&m);
+	matrix *= glm::make_mat4((GLfloat*)&m);
+	submitNode(queue, m_pScene->mRootNode->mChildren[iNode], matrix);
 }
 
 void C3dglModel::getNodeTransform(aiNode *pNode, float pMatrix[16], bool bRecursive)
@@ -592,16 +785,19 @@ bool C3dglModel::getBBNode(aiNode *pNode, aiVector3D BB[2], aiMatrix4x4* trafo)
 
 	for (unsigned iMesh : vector<unsigned>(pNode->mMeshes, pNode->mMeshes + pNode->mNumMeshes))
 	{
-		aiVector3D bb[2];
-		memcpy(bb, m_meshes[iMesh].getBB(), sizeof(bb));
-		aiTransformVecByMatrix4(&bb[0], trafo);
-		aiTransformVecByMatrix4(&bb[1], trafo);
-		if (bb[0].x < BB[0].x) BB[0].x = bb[0].x;
-		if (bb[0].y < BB[0].y) BB[0].y = bb[0].y;
-		if (bb[0].z < BB[0].z) BB[0].z = bb[0].z;
-		if (bb[1].x > BB[0].x) BB[1].x = bb[1].x;
-		if (bb[1].y > BB[0].y) BB[1].y = bb[1].y;
-		if (bb[1].z > BB[0].z) BB[1].z = bb[1].z;
+		// all eight corners - under a rotation, the transformed min and max are not the corners of the new box
+		aiVector3D *bb = m_meshes[iMesh].getBB();
+		for (unsigned iCorner = 0; iCorner < 8; iCorner++)
+		{
+			aiVector3D vec((iCorner & 1) ? bb[1].x : bb[0].x, (iCorner & 2) ? bb[1].y : bb[0].y, (iCorner & 4) ? bb[1].z : bb[0].z);
+			aiTransformVecByMatrix4(&vec, trafo);
+			if (vec.x < BB[0].x) BB[0].x = vec.x;
+			if (vec.y < BB[0].y) BB[0].y = vec.y;
+			if (vec.z < BB[0].z) BB[0].z = vec.z;
+			if (vec.x > BB[1].x) BB[1].x = vec.x;
+			if (vec.y > BB[1].y) BB[1].y = vec.y;
+			if (vec.z > BB[1].z) BB[1].z = vec.z;
+		}
 	}
 
 	for (aiNode *pNode : vector<aiNode*>(pNode->mChildren, pNode->mChildren + pNode->mNumChildren))
@@ -1,4 +1,4 @@
-#include "../GL/3dglObject.h"
+#include "../gl/3dglObject.h"
 
 #include <iostream>
 
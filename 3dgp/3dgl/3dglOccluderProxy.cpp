@@ -0,0 +1,203 @@
+#include "../GL/glew.h"
+#include "../GL/3dglOccluderProxy.h"
+
+// standard libraries
+#include <cmath>
+#include <algorithm>
+
+// GLM include files
+#include "../glm/geometric.hpp"
+#include "../glm/common.hpp"
+
+using namespace std;
+using namespace _3dgl;
+
+// voxel states
+enum { VOXEL_INSIDE = 0, VOXEL_SURFACE = 1, VOXEL_OUTSIDE = 2, VOXEL_USED = 4 };
+
+// triangle - box overlap, by the separating axes (Akenine-Moller): the box axes, the triangle normal and the 9 cross products
+static bool overlap(const glm::vec3 &centre, const glm::vec3 &half, const glm::vec3 *pTriangle)
+{
+	glm::vec3 v[3] = { pTriangle[0] - centre, pTriangle[1] - centre, pTriangle[2] - centre };
+	glm::vec3 e[3] = { v[1] - v[0], v[2] - v[1], v[0] - v[2] };
+
+	for (unsigned a = 0; a < 3; a++)
+		if (min(v[0][a], min(v[1][a], v[2][a])) > half[a] || max(v[0][a], max(v[1][a], v[2][a])) < -half[a])
+			return false;
+
+	glm::vec3 axes[10];
+	axes[0] = glm::cross(e[0], e[1]);
+	for (unsigned i = 0; i < 3; i++)
+		for (unsigned a = 0; a < 3; a++)
+		{
+			glm::vec3 u(0);
+			u[a] = 1;
+			axes[1 + 3 * i + a] = glm::cross(u, e[i]);
+		}
+	for (const glm::vec3 &axis : axes)
+	{
+		float p0 = glm::dot(v[0], axis), p1 = glm::dot(v[1], axis), p2 = glm::dot(v[2], axis);
+		float r = glm::dot(half, glm::abs(axis));
+		if (min(p0, min(p1, p2)) > r || max(p0, max(p1, p2)) < -r)
+			return false;
+	}
+	return true;
+}
+
+void C3dglOccluderProxy::clear()
+{
+	m_bbMin.clear();
+	m_bbMax.clear();
+	m_vertices.clear();
+}
+
+bool C3dglOccluderProxy::create(const glm::vec3 *pVertices, unsigned nTriangles, unsigned nResolution, unsigned nMaxBoxes)
+{
+	clear();
+	if (nTriangles == 0 || nResolution == 0) return false;
+
+	// the grid: cubic voxels, with a border of two voxels all around - the enlarged triangles may touch the first one
+	glm::vec3 bbMin = pVertices[0], bbMax = pVertices[0];
+	for (unsigned i = 1; i < 3 * nTriangles; i++)
+	{
+		bbMin = glm::min(bbMin, pVertices[i]);
+		bbMax = glm::max(bbMax, pVertices[i]);
+	}
+	glm::vec3 size = bbMax - bbMin;
+	float voxel = max(size.x, max(size.y, size.z)) / nResolution;
+	if (voxel <= 0) return false;
+	int n[3];
+	for (unsigned a = 0; a < 3; a++)
+	{
+		n[a] = max((int)ceil(size[a] / voxel), 1) + 4;
+		if (n[a] < 7) return false;		// too thin for an interior
+	}
+	glm::vec3 origin = bbMin - glm::vec3(2 * voxel);
+	vector<unsigned char> grid(n[0] * n[1] * n[2], VOXEL_INSIDE);
+	auto index = [&n](int x, int y, int z) { return x + n[0] * (y + n[1] * z); };
+
+	// the surface: the voxels touched by the triangles (slightly enlarged, not to leak through the cracks)
+	glm::vec3 half(voxel * 0.5f * 1.001f);
+	for (unsigned i = 0; i < nTriangles; i++)
+	{
+		const glm::vec3 *v = &pVertices[3 * i];
+		glm::ivec3 c0 = glm::ivec3(glm::floor((glm::min(v[0], glm::min(v[1], v[2])) - origin) / voxel)) - 1;
+		glm::ivec3 c1 = glm::ivec3(glm::floor((glm::max(v[0], glm::max(v[1], v[2])) - origin) / voxel)) + 1;
+		c0 = glm::max(c0, glm::ivec3(0));
+		c1 = glm::min(c1, glm::ivec3(n[0] - 1, n[1] - 1, n[2] - 1));
+		for (int z = c0.z; z <= c1.z; z++)
+			for (int y = c0.y; y <= c1.y; y++)
+				for (int x = c0.x; x <= c1.x; x++)
+				{
+					unsigned char &cell = grid[index(x, y, z)];
+					if (cell == VOXEL_INSIDE && overlap(origin + (glm::vec3(x, y, z) + 0.5f) * voxel, half, v))
+						cell = VOXEL_SURFACE;
+				}
+	}
+
+	// the outside: flood fill from the border
+	static const int d[6][3] = { { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 } };
+	vector<glm::ivec3> stack(1, glm::ivec3(0));
+	grid[0] = VOXEL_OUTSIDE;
+	while (!stack.empty())
+	{
+		glm::ivec3 c = stack.back();
+		stack.pop_back();
+		for (unsigned i = 0; i < 6; i++)
+		{
+			glm::ivec3 c1(c.x + d[i][0], c.y + d[i][1], c.z + d[i][2]);
+			if (c1.x < 0 || c1.y < 0 || c1.z < 0 || c1.x >= n[0] || c1.y >= n[1] || c1.z >= n[2]) continue;
+			unsigned char &cell = grid[index(c1.x, c1.y, c1.z)];
+			if (cell != VOXEL_INSIDE) continue;
+			cell = VOXEL_OUTSIDE;
+			stack.push_back(c1);
+		}
+	}
+
+	// the depth of each interior voxel: its distance (in steps) from the surface, by a flood from all the other voxels
+	vector<unsigned short> depth(grid.size(), 0);
+	vector<unsigned> queue, seeds;
+	for (unsigned i = 0; i < grid.size(); i++)
+		if (grid[i] != VOXEL_INSIDE)
+			queue.push_back(i);
+	for (unsigned head = 0; head < queue.size(); head++)
+	{
+		unsigned i = queue[head];
+		int x = i % n[0], y = (i / n[0]) % n[1], z = i / (n[0] * n[1]);
+		for (unsigned k = 0; k < 6; k++)
+		{
+			glm::ivec3 c1(x + d[k][0], y + d[k][1], z + d[k][2]);
+			if (c1.x < 0 || c1.y < 0 || c1.z < 0 || c1.x >= n[0] || c1.y >= n[1] || c1.z >= n[2]) continue;
+			unsigned j = index(c1.x, c1.y, c1.z);
+			if (grid[j] != VOXEL_INSIDE || depth[j]) continue;
+			depth[j] = depth[i] + 1;
+			queue.push_back(j);
+			seeds.push_back(j);
+		}
+	}
+
+	// the interior, merged into boxes: seeded from the deepest voxels, each grown a layer at a time on all six sides
+	// in turn, as long as the whole layer is inside and not taken yet
+	struct BOX { glm::ivec3 c0, c1; int volume; };
+	vector<BOX> boxes;
+	auto inside = [&](const glm::ivec3 &c0, const glm::ivec3 &c1)
+	{
+		for (int z = c0.z; z <= c1.z; z++)
+			for (int y = c0.y; y <= c1.y; y++)
+				for (int x = c0.x; x <= c1.x; x++)
+					if (grid[index(x, y, z)] != VOXEL_INSIDE)
+						return false;
+		return true;
+	};
+	for (auto i = seeds.rbegin(); i != seeds.rend() && boxes.size() < 4 * nMaxBoxes; i++)
+	{
+		if (grid[*i] != VOXEL_INSIDE) continue;
+		BOX box;
+		box.c0 = box.c1 = glm::ivec3(*i % n[0], (*i / n[0]) % n[1], *i / (n[0] * n[1]));
+		for (bool bGrown = true; bGrown; )
+		{
+			bGrown = false;
+			for (unsigned a = 0; a < 3; a++)
+			{
+				glm::ivec3 c0 = box.c0, c1 = box.c1;
+				c0[a] = c1[a] = box.c0[a] - 1;
+				if (inside(c0, c1)) { box.c0[a]--; bGrown = true; }
+				c0 = box.c0; c1 = box.c1;
+				c0[a] = c1[a] = box.c1[a] + 1;
+				if (inside(c0, c1)) { box.c1[a]++; bGrown = true; }
+			}
+		}
+		for (int z = box.c0.z; z <= box.c1.z; z++)
+			for (int y = box.c0.y; y <= box.c1.y; y++)
+				for (int x = box.c0.x; x <= box.c1.x; x++)
+					grid[index(x, y, z)] = VOXEL_USED;
+		glm::ivec3 size = box.c1 - box.c0 + 1;
+		box.volume = size.x * size.y * size.z;
+		boxes.push_back(box);
+	}
+
+	// the biggest boxes
+	sort(boxes.begin(), boxes.end(), [](const BOX &a, const BOX &b) { return a.volume > b.volume; });
+	if (boxes.size() > nMaxBoxes)
+		boxes.resize(nMaxBoxes);
+	for (const BOX &box : boxes)
+		addBox(origin + glm::vec3(box.c0) * voxel, origin + glm::vec3(box.c1 + 1) * voxel);
+	return isBuilt();
+}
+
+void C3dglOccluderProxy::addBox(const glm::vec3 &bbMin, const glm::vec3 &bbMax)
+{
+	m_bbMin.push_back(bbMin);
+	m_bbMax.push_back(bbMax);
+
+	// corner i has the max x for bit 0, y for bit 1, z for bit 2; each face listed counter-clockwise from the outside
+	static const unsigned faces[6][4] = { { 0, 4, 6, 2 }, { 1, 3, 7, 5 }, { 0, 1, 5, 4 }, { 2, 6, 7, 3 }, { 0, 2, 3, 1 }, { 4, 5, 7, 6 } };
+	glm::vec3 corners[8];
+	for (unsigned i = 0; i < 8; i++)
+		corners[i] = glm::vec3((i & 1) ? bbMax.x : bbMin.x, (i & 2) ? bbMax.y : bbMin.y, (i & 4) ? bbMax.z : bbMin.z);
+	for (const unsigned *f : faces)
+	{
+		m_vertices.push_back(corners[f[0]]); m_vertices.push_back(corners[f[1]]); m_vertices.push_back(corners[f[2]]);
+		m_vertices.push_back(corners[f[0]]); m_vertices.push_back(corners[f[2]]); m_vertices.push_back(corners[f[3]]);
+	}
+}
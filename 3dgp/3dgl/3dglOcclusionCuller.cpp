@@ -0,0 +1,221 @@
+#include "../GL/glew.h"
+#include "../GL/3dglOcclusionCuller.h"
+#include "../GL/3dglThreadPool.h"
+
+// standard libraries
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include <emmintrin.h>
+
+// GLM include files
+#include "../glm/geometric.hpp"
+#include "../glm/common.hpp"
+#include "../glm/matrix.hpp"
+
+using namespace std;
+using namespace _3dgl;
+
+C3dglOcclusionCuller::C3dglOcclusionCuller() : C3dglObject()
+{
+	m_nWidth = m_nHeight = m_nTilesX = m_nTilesY = 0;
+	m_nMaxOccluders = 16;
+	m_nMaxTriangles = 10000;
+	m_fMinOccluderSize = 0.2f;
+}
+
+bool C3dglOcclusionCuller::create(unsigned nWidth, unsigned nHeight)
+{
+	if (nWidth == 0 || nHeight == 0)
+		return logError("Occlusion buffer cannot be empty");
+	m_nTilesX = (nWidth + TILE_WIDTH - 1) / TILE_WIDTH;
+	m_nTilesY = (nHeight + TILE_HEIGHT - 1) / TILE_HEIGHT;
+	m_nWidth = m_nTilesX * TILE_WIDTH;
+	m_nHeight = m_nTilesY * TILE_HEIGHT;
+	m_tiles.resize(m_nTilesX * m_nTilesY);
+	begin(glm::mat4(1));
+	return logSuccess("occlusion buffer: " + to_string(m_nWidth) + "x" + to_string(m_nHeight));
+}
+
+void C3dglOcclusionCuller::begin(const glm::mat4 &matrixViewProj)
+{
+	m_matrixViewProj = matrixViewProj;
+	m_triangles.clear();
+	for (TILE &tile : m_tiles)
+	{
+		memset(tile.mask, 0, sizeof(tile.mask));
+		tile.z0 = FLT_MAX;
+		tile.z1 = 0;
+	}
+}
+
+void C3dglOcclusionCuller::addOccluder(const glm::vec3 *pVertices, unsigned nTriangles, const glm::mat4 &matrix)
+{
+	glm::mat4 m = m_matrixViewProj * matrix;
+	bool bMirrored = glm::determinant(matrix) < 0;	// reverses the winding
+	for (unsigned i = 0; i < nTriangles; i++)
+	{
+		TRIANGLE tri;
+		float z[3];
+		bool bClipped = false;
+		for (unsigned j = 0; j < 3 && !bClipped; j++)
+		{
+			glm::vec4 clip = m * glm::vec4(pVertices[3 * i + (bMirrored ? (3 - j) % 3 : j)], 1);
+			if (clip.w < 1e-5f || clip.z < -clip.w)
+				bClipped = true;	// crossing the near plane
+			else
+			{
+				tri.x[j] = (clip.x / clip.w * 0.5f + 0.5f) * m_nWidth;
+				tri.y[j] = (clip.y / clip.w * 0.5f + 0.5f) * m_nHeight;
+				z[j] = clip.z / clip.w * 0.5f + 0.5f;
+			}
+		}
+		if (bClipped) continue;
+
+		// back faces and degenerate triangles
+		float area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.x[2] - tri.x[0]) * (tri.y[1] - tri.y[0]);
+		if (area <= 0) continue;
+
+		float xMin = min(tri.x[0], min(tri.x[1], tri.x[2])), xMax = max(tri.x[0], max(tri.x[1], tri.x[2]));
+		float yMin = min(tri.y[0], min(tri.y[1], tri.y[2])), yMax = max(tri.y[0], max(tri.y[1], tri.y[2]));
+		if (xMax < 0 || yMax < 0 || xMin > m_nWidth || yMin > m_nHeight) continue;
+
+		tri.za = ((z[1] - z[0]) * (tri.y[2] - tri.y[0]) - (z[2] - z[0]) * (tri.y[1] - tri.y[0])) / area;
+		tri.zb = ((z[2] - z[0]) * (tri.x[1] - tri.x[0]) - (z[1] - z[0]) * (tri.x[2] - tri.x[0])) / area;
+		tri.zc = z[0] - tri.za * tri.x[0] - tri.zb * tri.y[0];
+		tri.zMax = max(z[0], max(z[1], z[2]));
+		tri.tyMin = max((int)yMin, 0) / TILE_HEIGHT;
+		tri.tyMax = min((int)yMax / TILE_HEIGHT, (int)m_nTilesY - 1);
+		m_triangles.push_back(tri);
+	}
+}
+
+void C3dglOcclusionCuller::rasterize()
+{
+	C3dglThreadPool::get().parallelFor(m_nTilesY, [this](unsigned ty) { rasterizeRow(ty); });
+}
+
+void C3dglOcclusionCuller::rasterizeRow(unsigned ty)
+{
+	TILE *pRow = &m_tiles[ty * m_nTilesX];
+	float yBase = (float)(ty * TILE_HEIGHT) + 0.5f;		// pixel centres
+	__m128 yRows[2] = { _mm_setr_ps(yBase, yBase + 1, yBase + 2, yBase + 3), _mm_setr_ps(yBase + 4, yBase + 5, yBase + 6, yBase + 7) };
+	__m128 zero = _mm_setzero_ps(), width = _mm_set1_ps((float)m_nWidth), half = _mm_set1_ps(0.5f);
+	__m128i one = _mm_set1_epi32(1);
+
+	for (const TRIANGLE &tri : m_triangles)
+	{
+		if ((int)ty < tri.tyMin || (int)ty > tri.tyMax)
+			continue;
+
+		// the span of each of the 8 rows: the intersection of the three half-planes - with y up and
+		// counter-clockwise order, the edges going up bound the triangle on the right, those going down on the left
+		int spanBegin[TILE_HEIGHT], spanEnd[TILE_HEIGHT];
+		for (unsigned h = 0; h < 2; h++)
+		{
+			__m128 left = _mm_set1_ps(-FLT_MAX), right = _mm_set1_ps(FLT_MAX);
+			for (unsigned i = 0; i < 3; i++)
+			{
+				unsigned j = (i + 1) % 3;
+				float dy = tri.y[j] - tri.y[i];
+				if (dy == 0)
+				{
+					// horizontal: the rows on the wrong side are empty
+					__m128 yEdge = _mm_set1_ps(tri.y[i]);
+					__m128 out = tri.x[j] > tri.x[i] ? _mm_cmple_ps(yRows[h], yEdge) : _mm_cmpge_ps(yRows[h], yEdge);
+					left = _mm_or_ps(_mm_and_ps(out, _mm_set1_ps(FLT_MAX)), _mm_andnot_ps(out, left));
+					continue;
+				}
+				__m128 x = _mm_add_ps(_mm_set1_ps(tri.x[i]), _mm_mul_ps(_mm_sub_ps(yRows[h], _mm_set1_ps(tri.y[i])), _mm_set1_ps((tri.x[j] - tri.x[i]) / dy)));
+				if (dy > 0)
+					right = _mm_min_ps(right, x);
+				else
+					left = _mm_max_ps(left, x);
+			}
+
+			// the pixels with the centres within [left, right]: from ceil(left - 0.5) to floor(right + 0.5), exclusive
+			__m128 b = _mm_min_ps(_mm_max_ps(_mm_sub_ps(left, half), zero), width);
+			__m128i ib = _mm_cvttps_epi32(b);
+			ib = _mm_add_epi32(ib, _mm_and_si128(_mm_castps_si128(_mm_cmplt_ps(_mm_cvtepi32_ps(ib), b)), one));
+			__m128i ie = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(right, half), zero), width));
+			_mm_storeu_si128((__m128i*)&spanBegin[4 * h], ib);
+			_mm_storeu_si128((__m128i*)&spanEnd[4 * h], ie);
+		}
+
+		int txMin = max((int)min(tri.x[0], min(tri.x[1], tri.x[2])), 0) / TILE_WIDTH;
+		int txMax = min((int)max(tri.x[0], max(tri.x[1], tri.x[2])) / TILE_WIDTH, (int)m_nTilesX - 1);
+		for (int tx = txMin; tx <= txMax; tx++)
+		{
+			TILE &tile = pRow[tx];
+
+			// the far bound of the triangle in the tile: its depth plane at the farthest corner, but no farther than its vertices
+			float xFar = (float)(tri.za > 0 ? (tx + 1) * TILE_WIDTH : tx * TILE_WIDTH);
+			float yFar = (float)(tri.zb > 0 ? (ty + 1) * TILE_HEIGHT : ty * TILE_HEIGHT);
+			float z = min(tri.zMax, tri.za * xFar + tri.zb * yFar + tri.zc);
+			if (z >= tile.z0)
+				continue;		// behind the whole tile
+
+			unsigned mask[TILE_HEIGHT];
+			unsigned any = 0;
+			int x0 = tx * TILE_WIDTH;
+			for (unsigned r = 0; r < TILE_HEIGHT; r++)
+			{
+				int b = max(spanBegin[r] - x0, 0), e = min(spanEnd[r] - x0, (int)TILE_WIDTH);
+				mask[r] = e > b ? (e == TILE_WIDTH ? 0xFFFFFFFFu : (1u << e) - 1) & ~((1u << b) - 1) : 0;
+				any |= mask[r];
+			}
+			if (!any) continue;
+
+			// merge into the working layer; once it covers the tile, it bounds the tile - unless the old bound is nearer
+			tile.z1 = max(tile.z1, z);
+			unsigned full = 0xFFFFFFFFu;
+			for (unsigned r = 0; r < TILE_HEIGHT; r++)
+			{
+				tile.mask[r] |= mask[r];
+				full &= tile.mask[r];
+			}
+			if (full == 0xFFFFFFFFu)
+			{
+				tile.z0 = min(tile.z0, tile.z1);
+				tile.z1 = 0;
+				memset(tile.mask, 0, sizeof(tile.mask));
+			}
+		}
+	}
+}
+
+bool C3dglOcclusionCuller::testBox(const glm::vec3 &bbMin, const glm::vec3 &bbMax) const
+{
+	if (m_tiles.empty()) return true;
+
+	// the screen rectangle and the nearest depth of the box
+	float xMin = FLT_MAX, yMin = FLT_MAX, xMax = -FLT_MAX, yMax = -FLT_MAX, zMin = FLT_MAX;
+	for (unsigned i = 0; i < 8; i++)
+	{
+		glm::vec4 clip = m_matrixViewProj * glm::vec4((i & 1) ? bbMax.x : bbMin.x, (i & 2) ? bbMax.y : bbMin.y, (i & 4) ? bbMax.z : bbMin.z, 1);
+		if (clip.w < 1e-5f)
+			return true;	// crossing the camera plane
+		float x = (clip.x / clip.w * 0.5f + 0.5f) * m_nWidth;
+		float y = (clip.y / clip.w * 0.5f + 0.5f) * m_nHeight;
+		xMin = min(xMin, x); xMax = max(xMax, x);
+		yMin = min(yMin, y); yMax = max(yMax, y);
+		zMin = min(zMin, clip.z / clip.w * 0.5f + 0.5f);
+	}
+	if (xMax < 0 || yMax < 0 || xMin > m_nWidth || yMin > m_nHeight)
+		return true;	// off the screen - left to the frustum culling
+
+	int txMin = max((int)xMin, 0) / TILE_WIDTH, txMax = min((int)xMax / TILE_WIDTH, (int)m_nTilesX - 1);
+	int tyMin = max((int)yMin, 0) / TILE_HEIGHT, tyMax = min((int)yMax / TILE_HEIGHT, (int)m_nTilesY - 1);
+	for (int ty = tyMin; ty <= tyMax; ty++)
+		for (int tx = txMin; tx <= txMax; tx++)
+			if (zMin <= m_tiles[ty * m_nTilesX + tx].z0)
+				return true;
+	return false;
+}
+
+float C3dglOcclusionCuller::getDepth(unsigned x, unsigned y) const
+{
+	if (x >= m_nWidth || y >= m_nHeight) return FLT_MAX;
+	return m_tiles[(y / TILE_HEIGHT) * m_nTilesX + x / TILE_WIDTH].z0;
+}
@@ -0,0 +1,270 @@
+#include "../GL/glew.h"
+#include "../GL/3dglPointShadows.h"
+#include "../GL/3dglDrawList.h"
+#include "../GL/3dglState.h"
+
+// standard libraries
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+// GLM include files
+#include "../glm/geometric.hpp"
+#include "../glm/matrix.hpp"
+#include "../glm/gtc/matrix_transform.hpp"
+
+using namespace std;
+using namespace _3dgl;
+
+// the cube faces - must match c_pointShadowDir and c_pointShadowUp in pointshadows.glsl
+static const glm::vec3 c_faceDir[6] = { glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1) };
+static const glm::vec3 c_faceUp[6] = { glm::vec3(0, -1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1), glm::vec3(0, -1, 0), glm::vec3(0, -1, 0) };
+
+C3dglPointShadows::C3dglPointShadows() : C3dglObject()
+{
+	m_idTex = m_idTexCube = 0;
+	m_idFBO = m_idFBOCopy = 0;
+	m_size = 0;
+	m_near = 0.05f;
+	m_nBudget = 1;
+	for (SLOT &slot : m_slots)
+	{
+		slot.iLight = -1;
+		slot.position = glm::vec3(0);
+		slot.range = 0;
+		slot.signature = 0;
+		slot.bValid = false;
+	}
+	m_locFaces = (GLuint)-1;
+	memset(&m_block, 0, sizeof(m_block));
+	m_nLightsUpdated = m_nLightsPending = m_nPacketsDrawn = 0;
+}
+
+bool C3dglPointShadows::create(int size, std::string pathShaders)
+{
+	destroy();
+	m_size = size;
+
+	// programs linked from now on find the shadow maps at their unit
+	C3dglProgram::SetSamplerUnit("pointShadowMap", UNIT_POINT_SHADOW_MAP);
+
+	// depth only, six faces at once
+	if (!m_vertexShader.Create(GL_VERTEX_SHADER)) return false;
+	if (!m_vertexShader.LoadFromFile(pathShaders + "shadow.vert")) return false;
+	if (!m_vertexShader.Compile()) return false;
+	if (!m_geometryShader.Create(GL_GEOMETRY_SHADER)) return false;
+	if (!m_geometryShader.LoadFromFile(pathShaders + "shadow_point.geom")) return false;
+	if (!m_geometryShader.Compile()) return false;
+	if (!m_fragmentShader.Create(GL_FRAGMENT_SHADER)) return false;
+	if (!m_fragmentShader.LoadFromFile(pathShaders + "shadow.frag")) return false;
+	if (!m_fragmentShader.Compile()) return false;
+	if (!m_program.Create() || !m_program.Attach(m_vertexShader) || !m_program.Attach(m_geometryShader) || !m_program.Attach(m_fragmentShader) || !m_program.Link()) return false;
+	m_locFaces = m_program.GetUniformLocation("matrixFaces");
+
+	// the slots are sampled with the hardware compare; the cube is only rendered to
+	GLuint ids[2];
+	glGenTextures(2, ids);
+	m_idTex = ids[0];
+	m_idTexCube = ids[1];
+	for (unsigned i = 0; i < 2; i++)
+	{
+		C3dglState::bindTexture(UNIT_POINT_SHADOW_MAP, GL_TEXTURE_2D_ARRAY, ids[i]);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size, size, i == 0 ? 6 * C3dglPointShadowsBlock::MAX_POINT_SHADOWS : 6, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, i == 0 ? GL_LINEAR : GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, i == 0 ? GL_LINEAR : GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		if (i == 0)
+		{
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+		}
+	}
+
+	// the cube is attached layered - gl_Layer selects the face; the copy target is attached layer by layer
+	GLuint fbos[2];
+	glGenFramebuffers(2, fbos);
+	m_idFBO = fbos[0];
+	m_idFBOCopy = fbos[1];
+	glBindFramebuffer(GL_FRAMEBUFFER, m_idFBO);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_idTexCube, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_idFBOCopy);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_idTex, 0, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	GLenum statusCopy = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE || statusCopy != GL_FRAMEBUFFER_COMPLETE)
+		return logError("point shadow map incomplete: status " + to_string(status) + ", " + to_string(statusCopy));
+
+	if (!m_ubo.create(UBO_POINT_SHADOWS, sizeof(C3dglPointShadowsBlock), &m_block)) return false;
+
+	invalidate();
+	return logSuccess("created: " + to_string((long long)C3dglPointShadowsBlock::MAX_POINT_SHADOWS) + " x 6 x " + to_string(size) + " x " + to_string(size));
+}
+
+void C3dglPointShadows::destroy()
+{
+	if (m_idFBO) glDeleteFramebuffers(1, &m_idFBO);
+	if (m_idFBOCopy) glDeleteFramebuffers(1, &m_idFBOCopy);
+	if (m_idTex) C3dglState::deleteTextures(1, &m_idTex);
+	if (m_idTexCube) C3dglState::deleteTextures(1, &m_idTexCube);
+	m_ubo.destroy();
+	m_idTex = m_idTexCube = 0;
+	m_idFBO = m_idFBOCopy = 0;
+	m_size = 0;
+}
+
+void C3dglPointShadows::invalidate()
+{
+	for (SLOT &slot : m_slots)
+		slot.bValid = false;
+}
+
+void C3dglPointShadows::render(C3dglDrawList &drawList, C3dglPointLightBlock *pLights, unsigned nLights, const glm::mat4 &matrixView, const glm::mat4 &matrixProjection)
+{
+	m_nLightsUpdated = m_nLightsPending = m_nPacketsDrawn = 0;
+	if (m_idFBO == 0) return;
+
+	// a light needs a finite range to be shadowed - the far plane of its faces
+	auto isShadowed = [&](unsigned i) { return !pLights[i].isDark() && pLights[i].getRange() < FLT_MAX; };
+
+	// the slots follow their lights for as long as they are on; the new lights take the free slots
+	vector<int> slotOf(nLights, -1);
+	for (unsigned s = 0; s < C3dglPointShadowsBlock::MAX_POINT_SHADOWS; s++)
+	{
+		SLOT &slot = m_slots[s];
+		if (slot.iLight < 0) continue;
+		if ((unsigned)slot.iLight >= nLights || !isShadowed(slot.iLight))
+		{
+			slot.iLight = -1;
+			slot.bValid = false;
+		}
+		else
+			slotOf[slot.iLight] = s;
+	}
+	for (unsigned i = 0; i < nLights; i++)
+	{
+		if (slotOf[i] >= 0 || !isShadowed(i)) continue;
+		for (unsigned s = 0; s < C3dglPointShadowsBlock::MAX_POINT_SHADOWS; s++)
+			if (m_slots[s].iLight < 0)
+			{
+				m_slots[s].iLight = i;
+				m_slots[s].bValid = false;
+				slotOf[i] = s;
+				break;
+			}
+	}
+
+	// the lights changed since rendered - their casters, the position or the range - ranked by the share of the
+	// screen covered by their projected sphere, a tenth of it when off the screen; never rendered go first
+	unsigned signatures[C3dglPointShadowsBlock::MAX_POINT_SHADOWS];
+	vector<pair<float, unsigned> > stale;
+	for (unsigned s = 0; s < C3dglPointShadowsBlock::MAX_POINT_SHADOWS; s++)
+	{
+		SLOT &slot = m_slots[s];
+		if (slot.iLight < 0) continue;
+		const C3dglPointLightBlock &light = pLights[slot.iLight];
+		float range = light.getRange();
+		signatures[s] = drawList.getSignature(light.position, range);
+		if (slot.bValid && slot.position == light.position && slot.range == range && slot.signature == signatures[s])
+			continue;
+
+		float importance = 1;		// the camera within the range - covers the screen
+		glm::vec3 p = glm::vec3(matrixView * glm::vec4(light.position, 1));
+		float distance = glm::length(p);
+		if (distance > range)
+		{
+			// the half-extents of the sphere in the normalised device coordinates: the tangent of its angular
+			// radius, scaled by the projection
+			float t = range / sqrt(distance * distance - range * range);
+			float sx = matrixProjection[0][0] * t, sy = matrixProjection[1][1] * t;
+			importance = min(3.14159265f * sx * sy / 4, 1.0f);
+
+			glm::vec4 c = matrixProjection * glm::vec4(p, 1);
+			if (-p.z + range < 0 || (-p.z > range && (fabs(c.x) > (1 + sx) * c.w || fabs(c.y) > (1 + sy) * c.w)))
+				importance *= 0.1f;
+		}
+		if (!slot.bValid) importance += 1;
+		stale.push_back(make_pair(importance, s));
+	}
+	sort(stale.begin(), stale.end(), greater<pair<float, unsigned> >());
+	unsigned nUpdate = min((unsigned)stale.size(), m_nBudget);
+	m_nLightsPending = (unsigned)stale.size() - nUpdate;
+
+	if (nUpdate)
+	{
+		GLint viewport[4];
+		C3dglState::getViewport(viewport);
+		C3dglProgram *pProgram = C3dglProgram::GetCurrentProgram();
+		m_program.Use();
+		C3dglState::viewport(0, 0, m_size, m_size);
+		C3dglState::enable(GL_DEPTH_TEST);
+		C3dglState::enable(GL_POLYGON_OFFSET_FILL);
+		C3dglState::depthMask(GL_TRUE);
+		glPolygonOffset(2, 4);
+
+		for (unsigned k = 0; k < nUpdate; k++)
+		{
+			unsigned s = stale[k].second;
+			SLOT &slot = m_slots[s];
+			slot.position = pLights[slot.iLight].position;
+			slot.range = pLights[slot.iLight].getRange();
+			slot.signature = signatures[s];
+			renderSlot(drawList, s);
+			slot.bValid = true;
+			m_nLightsUpdated++;
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		C3dglState::viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+		C3dglState::disable(GL_POLYGON_OFFSET_FILL);
+		if (pProgram) pProgram->Use();
+	}
+
+	// tell the lights their shadows - as long as rendered at least once
+	for (unsigned i = 0; i < nLights; i++)
+		pLights[i].shadow = (slotOf[i] >= 0 && m_slots[slotOf[i]].bValid) ? slotOf[i] + 1 : 0;
+
+	m_block.matrixViewToWorld = glm::mat4(glm::inverse(glm::mat3(matrixView)));
+	for (unsigned s = 0; s < C3dglPointShadowsBlock::MAX_POINT_SHADOWS; s++)
+		m_block.far[s] = m_slots[s].range;
+	m_block.params = glm::vec4(m_near, 1.0f / m_size, 0, 0);
+	m_ubo.update(&m_block, sizeof(m_block));
+}
+
+void C3dglPointShadows::renderSlot(C3dglDrawList &drawList, unsigned iSlot)
+{
+	SLOT &slot = m_slots[iSlot];
+
+	// the six faces in one pass - see shadow_point.geom
+	glm::mat4 matrixProjection = glm::perspective(glm::radians(90.0f), 1.0f, m_near, slot.range);
+	glm::mat4 matrixFaces[6];
+	for (unsigned f = 0; f < 6; f++)
+		matrixFaces[f] = matrixProjection * glm::lookAt(slot.position, slot.position + c_faceDir[f], c_faceUp[f]);
+	m_program.SendUniformMatrixv(m_locFaces, &matrixFaces[0][0][0], 6);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, m_idFBO);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	m_nPacketsDrawn += drawList.renderDepth(slot.position, slot.range);
+
+	// then into the slot, face by face
+	for (unsigned f = 0; f < 6; f++)
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, m_idFBO);
+		glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_idTexCube, 0, f);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_idFBOCopy);
+		glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_idTex, 0, iSlot * 6 + f);
+		glBlitFramebuffer(0, 0, m_size, m_size, 0, 0, m_size, m_size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	}
+
+	// layered again, for the next light
+	glBindFramebuffer(GL_FRAMEBUFFER, m_idFBO);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_idTexCube, 0);
+}
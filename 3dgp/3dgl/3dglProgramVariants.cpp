@@ -0,0 +1,137 @@
+#include "../GL/glew.h"
+#include "../GL/3dglProgramVariants.h"
+#include "../GL/3dglMaterial.h"
+
+using namespace std;
+using namespace _3dgl;
+
+std::string C3dglProgramVariants::getDefines(unsigned key)
+{
+	// PERMUTATION tells the shaders that the features are selected explicitly
+	string defines = "PERMUTATION=" + to_string(key);
+	if (key & KEY_EMISSIVE_ONLY)
+		return defines + ";EMISSIVE_ONLY;POINT_LIGHTS=0";
+	if (key & KEY_GBUFFER)
+		return defines + ";GBUFFER;POINT_LIGHTS=0" + ((key & KEY_NORMAL_MAP) ? ";NORMAL_MAP" : "") + ((key & KEY_VERTEX_AO) ? ";VERTEX_AO" : "");
+	if (key & KEY_SH_PROBES)
+		defines += ";SH_PROBES";
+	if (key & KEY_LIGHTMAP)
+		defines += ";LIGHTMAP";
+	defines += ";POINT_LIGHTS=" + to_string(key & KEY_POINT_LIGHTS);
+	if (key & KEY_DIR_LIGHT) defines += ";DIR_LIGHT";
+	if ((key & KEY_DIR_LIGHT) && (key & KEY_SHADOWS)) defines += ";SHADOWS";
+	if ((key & (KEY_POINT_LIGHTS | KEY_CLUSTERED)) && (key & KEY_POINT_SHADOWS)) defines += ";POINT_SHADOWS";
+	if (key & KEY_NORMAL_MAP) defines += ";NORMAL_MAP";
+	if (key & KEY_VERTEX_AO) defines += ";VERTEX_AO";
+	if (key & KEY_CLUSTERED) defines += ";CLUSTERED";
+	return defines;
+}
+
+bool C3dglProgramVariants::create(std::string fnameVertex, std::string fnameFragment)
+{
+	destroy();
+	m_fnameVertex = fnameVertex;
+	m_fnameFragment = fnameFragment;
+	return true;
+}
+
+void C3dglProgramVariants::destroy()
+{
+	for (auto &pair : m_variants)
+	{
+		pair.second.program.Destroy();
+		pair.second.vertexShader.Destroy();
+		pair.second.fragmentShader.Destroy();
+	}
+	m_variants.clear();
+}
+
+C3dglProgram *C3dglProgramVariants::get(unsigned key)
+{
+	auto it = m_variants.find(key);
+	if (it != m_variants.end())
+	{
+		// asynchronous variants release their shaders on the first request after the link completes
+		VARIANT &variant = it->second;
+		if (variant.vertexShader.getId() && !variant.program.IsLinking())
+			releaseShaders(variant);
+		return variant.bValid ? &variant.program : NULL;
+	}
+
+	// build a new variant; with the binary cache enabled, it is compiled only once ever
+	string defines = getDefines(key);
+	VARIANT &variant = m_variants[key];
+	C3dglProgram &program = variant.program;
+	program.SetFallback(m_pFallback);
+	variant.bValid = variant.vertexShader.Create(GL_VERTEX_SHADER) && variant.vertexShader.LoadFromFile(m_fnameVertex, defines)
+		&& variant.fragmentShader.Create(GL_FRAGMENT_SHADER) && variant.fragmentShader.LoadFromFile(m_fnameFragment, defines)
+		&& program.Create() && program.Attach(variant.vertexShader) && program.Attach(variant.fragmentShader)
+		&& (m_bAsync ? program.LinkAsync() : program.Link());
+	if (!program.IsLinking())
+		releaseShaders(variant);
+
+	if (!variant.bValid)
+	{
+		logError("cannot build the variant: " + defines);
+		return NULL;
+	}
+	logInfo("variant requested: " + defines);
+	return &program;
+}
+
+void C3dglProgramVariants::releaseShaders(VARIANT &variant)
+{
+	variant.program.DetachShaders();
+	variant.vertexShader.Destroy();
+	variant.fragmentShader.Destroy();
+}
+
+void C3dglProgramVariants::setLights(const C3dglLightsBlock &lights, bool bClustered, bool bShadows, bool bPointShadows)
+{
+	unsigned nPointLights = 0;
+	for (unsigned i = 0; i < C3dglLightsBlock::MAX_POINT_LIGHTS && !bClustered; i++)
+		if (lights.lightPoint[i].on)
+			nPointLights = i + 1;
+	m_keyLights = makeKey(nPointLights, lights.lightDirectional.on != 0, false, false, bClustered);
+	if (bShadows && lights.lightDirectional.on)
+		m_keyLights |= KEY_SHADOWS;
+	if (bPointShadows && (nPointLights || bClustered))
+		m_keyLights |= KEY_POINT_SHADOWS;
+}
+
+unsigned C3dglProgramVariants::selectKey(C3dglMaterial *pMaterial)
+{
+	// no lights - only the emissive colour is left
+	if (m_keyLights == 0)
+		return KEY_EMISSIVE_ONLY;
+
+	// materials without a normal map do not need to sample one; mesh own materials (NULL) are not inspected
+	bool bNormalMap = !pMaterial || pMaterial->getNormalMap() != 0xFFFFFFFF;
+	return m_keyLights | (bNormalMap ? KEY_NORMAL_MAP : 0);
+}
+
+unsigned C3dglProgramVariants::selectKey(C3dglMaterial *pMaterial, unsigned nPointLights)
+{
+	// clustered and G-buffer variants do not read the point lights from the Lights block
+	if (m_keyLights & (KEY_CLUSTERED | KEY_GBUFFER))
+		return selectKey(pMaterial);
+
+	unsigned keyLights = (m_keyLights & ~KEY_POINT_LIGHTS) | (nPointLights & KEY_POINT_LIGHTS);
+	if (nPointLights == 0)
+		keyLights &= ~KEY_POINT_SHADOWS;
+	if (keyLights == 0)
+		return KEY_EMISSIVE_ONLY;
+
+	bool bNormalMap = !pMaterial || pMaterial->getNormalMap() != 0xFFFFFFFF;
+	return keyLights | (bNormalMap ? KEY_NORMAL_MAP : 0);
+}
+
+unsigned C3dglProgramVariants::selectKeyProbeLit(C3dglMaterial *pMaterial)
+{
+	// the G-buffer has no room for the probes - deferred objects are lit as all the others
+	if (m_keyLights & KEY_GBUFFER)
+		return selectKey(pMaterial);
+
+	bool bNormalMap = !pMaterial || pMaterial->getNormalMap() != 0xFFFFFFFF;
+	return (m_keyLights & (KEY_DIR_LIGHT | KEY_SHADOWS)) | KEY_SH_PROBES | (bNormalMap ? KEY_NORMAL_MAP : 0);
+}
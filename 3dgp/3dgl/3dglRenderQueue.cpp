@@ -0,0 +1,280 @@
+#include "../GL/glew.h"
+#include "../GL/3dglRenderQueue.h"
+#include "../GL/3dglShader.h"
+#include "../GL/3dglLightSets.h"
+#include "../GL/3dglLightProbes.h"
+#include "../GL/3dglState.h"
+
+// GLM include files
+#include "../glm/vec4.hpp"
+
+#include <algorithm>
+
+using namespace std;
+using namespace _3dgl;
+
+C3dglRenderQueue::C3dglRenderQueue() : C3dglObject()
+{
+	m_matrixView = glm::mat4(1);
+	m_fNear = 0.02f;
+	m_fFar = 1000.0f;
+	m_pDepthPrepass = NULL;
+	m_idQuery = 0;
+	m_bQueryPending = false;
+	m_nSamplesShaded = 0;
+	m_nDraws = m_nProgramBinds = m_nMaterialBinds = m_nTextureBinds = m_nPrepassDraws = 0;
+}
+
+void C3dglRenderQueue::destroy()
+{
+	if (m_idQuery) glDeleteQueries(1, &m_idQuery);
+	m_idQuery = 0;
+	m_bQueryPending = false;
+}
+
+unsigned C3dglRenderQueue::getId(unsigned nType, const void *p)
+{
+	auto it = m_ids[nType].find(p);
+	if (it != m_ids[nType].end())
+		return it->second;
+	unsigned id = m_ids[nType].size();
+	m_ids[nType][p] = id;
+	return id;
+}
+
+void C3dglRenderQueue::begin(glm::mat4 matrixView)
+{
+	m_matrixView = matrixView;
+	m_packets.clear();
+	m_items.clear();
+
+	// the ids are dense for the packets of this frame - no stale pointers, and no growth past the key fields
+	for (unsigned i = 0; i < ID_LAST; i++)
+		m_ids[i].clear();
+}
+
+void C3dglRenderQueue::submit(C3dglModel::MESH *pMesh, C3dglMaterial *pMaterial, glm::mat4 matrix, PASS pass, C3dglProgram *pProgram, C3dglLightSets *pLightSets, unsigned iLightSet, const C3dglSHProbe *pProbe, int iLightmap)
+{
+	if (!pMesh) return;
+
+	// view space depth of the mesh centre, quantized to 24 bits
+	aiVector3D c = pMesh->getCentre();
+	glm::vec4 v = m_matrixView * matrix * glm::vec4(c.x, c.y, c.z, 1);
+	float t = (-v.z - m_fNear) / (m_fFar - m_fNear);
+	t = std::min(std::max(t, 0.0f), 1.0f);
+	unsigned depth = (unsigned)(t * 0xFFFFFF);
+	if (pass == PASS_TRANSPARENT)
+		depth = 0xFFFFFF - depth;		// back-to-front
+
+	// material and texture ids
+	const void *pMat = pMaterial;
+	unsigned idTexture = 0;
+	if (pMaterial)
+		idTexture = pMaterial->getTexture();
+	else if (pMesh->getMaterial())
+	{
+		pMat = pMesh->getMaterial();
+		idTexture = pMesh->getMaterial()->getTexture();
+	}
+
+	ITEM item;
+	item.key = makeKey(pass,
+		getId(ID_PROGRAM, pProgram),
+		getId(ID_MATERIAL, pMat),
+		getId(ID_TEXTURE, (const void*)(size_t)idTexture),
+		depth);
+	item.index = m_packets.size();
+	m_items.push_back(item);
+
+	PACKET packet;
+	packet.pMesh = pMesh;
+	packet.pMaterial = pMaterial;
+	packet.pProgram = pProgram;
+	packet.matrix = matrix;
+	packet.pLightSets = pLightSets;
+	packet.iLightSet = iLightSet;
+	packet.pProbe = pProbe;
+	packet.iLightmap = iLightmap;
+	m_packets.push_back(packet);
+}
+
+void C3dglRenderQueue::sort()
+{
+	size_t n = m_items.size();
+	if (n < 2) return;
+	m_temp.resize(n);
+
+	// build all eight histograms in a single pass
+	unsigned hist[8][256];
+	memset(hist, 0, sizeof(hist));
+	for (ITEM &item : m_items)
+		for (unsigned b = 0; b < 8; b++)
+			hist[b][(item.key >> (b * 8)) & 0xFF]++;
+
+	ITEM *pSrc = &m_items[0], *pDst = &m_temp[0];
+	for (unsigned b = 0; b < 8; b++)
+	{
+		// skip the pass if all keys share the same byte
+		if (hist[b][(pSrc[0].key >> (b * 8)) & 0xFF] == n)
+			continue;
+
+		unsigned offs = 0;
+		for (unsigned i = 0; i < 256; i++)
+		{
+			unsigned c = hist[b][i];
+			hist[b][i] = offs;
+			offs += c;
+		}
+
+		for (size_t i = 0; i < n; i++)
+			pDst[hist[b][(pSrc[i].key >> (b * 8)) & 0xFF]++] = pSrc[i];
+		std::swap(pSrc, pDst);
+	}
+
+	// the result is in pSrc
+	if (pSrc != &m_items[0])
+		m_items.swap(m_temp);
+}
+
+bool C3dglRenderQueue::depthPrepass(size_t nOpaque)
+{
+	C3dglProgram *pProgram = m_pDepthPrepass->Resolve();
+	if (!pProgram) return false;
+	C3dglProgram *pPrevProgram = C3dglProgram::GetCurrentProgram();
+	pProgram->Use();
+
+	// front-to-back, regardless of the programs and materials - only the depth part of the key
+	m_prepass.assign(m_items.begin(), m_items.begin() + nOpaque);
+	std::sort(m_prepass.begin(), m_prepass.end(), [](const ITEM &a, const ITEM &b) { return (a.key & 0xFFFFFF0) < (b.key & 0xFFFFFF0); });
+
+	C3dglState::colorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	C3dglState::depthMask(GL_TRUE);
+	for (ITEM &item : m_prepass)
+	{
+		PACKET &packet = m_packets[item.index];
+		pProgram->SendStandardUniform(C3dglProgram::UNI_MODELVIEW, m_matrixView * packet.matrix);
+		packet.pMesh->renderDepth();
+		m_nPrepassDraws++;
+	}
+	C3dglState::colorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+	// packets without a program use the current one
+	if (pPrevProgram) pPrevProgram->Use();
+	return true;
+}
+
+void C3dglRenderQueue::flush()
+{
+	sort();
+
+	m_nDraws = m_nProgramBinds = m_nMaterialBinds = m_nTextureBinds = m_nPrepassDraws = 0;
+
+	// the opaque packets come first - the pass is the most significant part of the key
+	size_t nOpaque = 0;
+	while (nOpaque < m_items.size() && (m_items[nOpaque].key >> 60) == PASS_OPAQUE)
+		nOpaque++;
+
+	// the result of the last query - if ready, otherwise it is left for the next frames
+	if (m_bQueryPending)
+	{
+		GLuint available = 0;
+		glGetQueryObjectuiv(m_idQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available)
+		{
+			glGetQueryObjectuiv(m_idQuery, GL_QUERY_RESULT, &m_nSamplesShaded);
+			m_bQueryPending = false;
+		}
+	}
+	if (m_idQuery == 0)
+		glGenQueries(1, &m_idQuery);
+	bool bQuery = !m_bQueryPending && nOpaque > 0;
+
+	// with the pre-pass, the opaque packets only pass where they are the nearest
+	GLenum depthFunc = C3dglState::getDepthFunc();
+	bool bPrepass = m_pDepthPrepass && nOpaque > 0 && depthPrepass(nOpaque);
+	if (bPrepass)
+	{
+		C3dglState::depthFunc(GL_EQUAL);
+		C3dglState::depthMask(GL_FALSE);
+	}
+	if (bQuery)
+		glBeginQuery(GL_SAMPLES_PASSED, m_idQuery);
+
+	C3dglProgram *pCurProgram = NULL;
+	const void *pCurMaterial = NULL;
+	unsigned idCurTexture = 0, idCurNormalMap = 0;
+	bool bTexturesValid = false;
+
+	for (size_t i = 0; i <= m_items.size(); i++)
+	{
+		// the end of the opaque packets
+		if (i == nOpaque)
+		{
+			if (bQuery)
+			{
+				glEndQuery(GL_SAMPLES_PASSED);
+				m_bQueryPending = true;
+			}
+			if (bPrepass)
+			{
+				C3dglState::depthFunc(depthFunc);
+				C3dglState::depthMask(GL_TRUE);
+			}
+		}
+		if (i == m_items.size())
+			break;
+
+		PACKET &packet = m_packets[m_items[i].index];
+
+		// program - or its fallback while it is still being linked
+		C3dglProgram *pProgram = packet.pProgram ? packet.pProgram->Resolve() : C3dglProgram::GetCurrentProgram();
+		if (!pProgram) continue;
+		if (pProgram != pCurProgram)
+		{
+			if (!pProgram->IsUsed()) pProgram->Use();
+			pCurProgram = pProgram;
+			pCurMaterial = NULL;			// material uniforms are per program
+			bTexturesValid = false;
+			m_nProgramBinds++;
+		}
+
+		// material
+		if (packet.pMaterial)
+		{
+			if (pCurMaterial != packet.pMaterial)
+			{
+				packet.pMaterial->applyColours(pProgram);
+				pCurMaterial = packet.pMaterial;
+				m_nMaterialBinds++;
+			}
+			if (!bTexturesValid || idCurTexture != packet.pMaterial->getTexture() || idCurNormalMap != packet.pMaterial->getNormalMap())
+			{
+				packet.pMaterial->applyTextures(pProgram);
+				idCurTexture = packet.pMaterial->getTexture();
+				idCurNormalMap = packet.pMaterial->getNormalMap();
+				bTexturesValid = true;
+				m_nTextureBinds++;
+			}
+		}
+		else if (packet.pMesh->getMaterial() && pCurMaterial != packet.pMesh->getMaterial())
+		{
+			packet.pMesh->getMaterial()->bind();
+			pCurMaterial = packet.pMesh->getMaterial();
+			bTexturesValid = false;
+			m_nMaterialBinds++;
+			m_nTextureBinds++;
+		}
+
+		// per-object lights - redundant binds are filtered by C3dglState
+		if (packet.pLightSets)
+			packet.pLightSets->bind(packet.iLightSet);
+		if (packet.pProbe)
+			packet.pProbe->apply(pProgram);
+		if (packet.iLightmap >= 0)
+			pProgram->SendStandardUniform(C3dglProgram::UNI_LIGHTMAP_BASE, (GLint)packet.iLightmap);
+
+		pProgram->SendStandardUniform(C3dglProgram::UNI_MODELVIEW, m_matrixView * packet.matrix);
+		packet.pMesh->render();
+		m_nDraws++;
+	}
+}
@@ -0,0 +1,427 @@
+#include "../GL/glew.h"
+#include "../GL/3dglSceneBVH.h"
+
+// standard libraries
+#include <algorithm>
+#include <utility>
+
+// GLM include files
+#include "../glm/geometric.hpp"
+
+using namespace std;
+using namespace _3dgl;
+
+// half of the surface area of a box - the SAH cost
+static float area(const glm::vec3 &bbMin, const glm::vec3 &bbMax)
+{
+	glm::vec3 d = bbMax - bbMin;
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+C3dglSceneBVH::C3dglSceneBVH() : C3dglObject()
+{
+	m_root = m_free = -1;
+	m_nProxies = 0;
+	m_fMargin = 0.1f;
+	m_bPending = m_bQuit = false;
+}
+
+void C3dglSceneBVH::destroy()
+{
+	if (!m_worker.joinable()) return;
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_bQuit = true;
+	}
+	m_cvWork.notify_one();
+	m_worker.join();
+	m_bQuit = m_bPending = false;
+}
+
+void C3dglSceneBVH::clear()
+{
+	wait();
+	m_nodes.clear();
+	m_root = m_free = -1;
+	m_nProxies = 0;
+}
+
+int C3dglSceneBVH::allocNode()
+{
+	int i = m_free;
+	if (i >= 0)
+		m_free = m_nodes[i].parent;
+	else
+	{
+		i = (int)m_nodes.size();
+		m_nodes.push_back(NODE());
+	}
+	NODE &node = m_nodes[i];
+	node.parent = node.child[0] = node.child[1] = -1;
+	node.height = 0;
+	node.userData = 0;
+	return i;
+}
+
+void C3dglSceneBVH::freeNode(int iNode)
+{
+	m_nodes[iNode].parent = m_free;
+	m_nodes[iNode].height = -1;
+	m_free = iNode;
+}
+
+unsigned C3dglSceneBVH::insert(const glm::vec3 &bbMin, const glm::vec3 &bbMax, unsigned userData)
+{
+	wait();
+	int i = allocNode();
+	m_nodes[i].bbMin = bbMin - glm::vec3(m_fMargin);
+	m_nodes[i].bbMax = bbMax + glm::vec3(m_fMargin);
+	m_nodes[i].userData = userData;
+	insertLeaf(i);
+	m_nProxies++;
+	return (unsigned)i;
+}
+
+void C3dglSceneBVH::remove(unsigned proxy)
+{
+	if (proxy >= m_nodes.size() || m_nodes[proxy].height != 0) return;
+	wait();
+	removeLeaf(proxy);
+	freeNode(proxy);
+	m_nProxies--;
+}
+
+bool C3dglSceneBVH::move(unsigned proxy, const glm::vec3 &bbMin, const glm::vec3 &bbMax)
+{
+	if (proxy >= m_nodes.size() || m_nodes[proxy].height != 0) return false;
+	NODE &node = m_nodes[proxy];
+	if (glm::all(glm::greaterThanEqual(bbMin, node.bbMin)) && glm::all(glm::lessThanEqual(bbMax, node.bbMax)))
+		return false;	// still within the fat box
+
+	wait();
+	removeLeaf(proxy);
+	m_nodes[proxy].bbMin = bbMin - glm::vec3(m_fMargin);
+	m_nodes[proxy].bbMax = bbMax + glm::vec3(m_fMargin);
+	insertLeaf(proxy);
+	return true;
+}
+
+void C3dglSceneBVH::refit(int iNode)
+{
+	NODE &node = m_nodes[iNode];
+	NODE &a = m_nodes[node.child[0]];
+	NODE &b = m_nodes[node.child[1]];
+	node.bbMin = glm::min(a.bbMin, b.bbMin);
+	node.bbMax = glm::max(a.bbMax, b.bbMax);
+	node.height = 1 + max(a.height, b.height);
+}
+
+void C3dglSceneBVH::insertLeaf(int iLeaf)
+{
+	if (m_root < 0)
+	{
+		m_root = iLeaf;
+		m_nodes[iLeaf].parent = -1;
+		return;
+	}
+
+	// the best sibling: descend while a child is cheaper than pairing with the node itself
+	glm::vec3 leafMin = m_nodes[iLeaf].bbMin, leafMax = m_nodes[iLeaf].bbMax;
+	int i = m_root;
+	while (m_nodes[i].height > 0)
+	{
+		NODE &node = m_nodes[i];
+		float areaCombined = area(glm::min(node.bbMin, leafMin), glm::max(node.bbMax, leafMax));
+		float cost = 2 * areaCombined;
+		float costInherited = 2 * (areaCombined - area(node.bbMin, node.bbMax));	// the growth of the ancestors
+
+		float costChild[2];
+		for (unsigned c = 0; c < 2; c++)
+		{
+			NODE &child = m_nodes[node.child[c]];
+			costChild[c] = area(glm::min(child.bbMin, leafMin), glm::max(child.bbMax, leafMax)) + costInherited;
+			if (child.height > 0)
+				costChild[c] -= area(child.bbMin, child.bbMax);
+		}
+		if (cost < costChild[0] && cost < costChild[1])
+			break;
+		i = node.child[costChild[0] < costChild[1] ? 0 : 1];
+	}
+
+	// a new parent of the sibling and the leaf
+	int iSibling = i;
+	int iOldParent = m_nodes[iSibling].parent;
+	int iNewParent = allocNode();	// may reallocate the nodes
+	NODE &newParent = m_nodes[iNewParent];
+	newParent.parent = iOldParent;
+	newParent.child[0] = iSibling;
+	newParent.child[1] = iLeaf;
+	m_nodes[iSibling].parent = iNewParent;
+	m_nodes[iLeaf].parent = iNewParent;
+	if (iOldParent >= 0)
+		m_nodes[iOldParent].child[m_nodes[iOldParent].child[0] == iSibling ? 0 : 1] = iNewParent;
+	else
+		m_root = iNewParent;
+
+	// refit and rebalance the ancestors
+	for (i = iNewParent; i >= 0; i = m_nodes[i].parent)
+	{
+		i = balance(i);
+		refit(i);
+	}
+}
+
+void C3dglSceneBVH::removeLeaf(int iLeaf)
+{
+	if (iLeaf == m_root)
+	{
+		m_root = -1;
+		return;
+	}
+
+	int iParent = m_nodes[iLeaf].parent;
+	int iGrandParent = m_nodes[iParent].parent;
+	int iSibling = m_nodes[iParent].child[m_nodes[iParent].child[0] == iLeaf ? 1 : 0];
+	freeNode(iParent);
+	m_nodes[iSibling].parent = iGrandParent;
+	if (iGrandParent < 0)
+	{
+		m_root = iSibling;
+		return;
+	}
+
+	m_nodes[iGrandParent].child[m_nodes[iGrandParent].child[0] == iParent ? 0 : 1] = iSibling;
+	for (int i = iGrandParent; i >= 0; i = m_nodes[i].parent)
+	{
+		i = balance(i);
+		refit(i);
+	}
+}
+
+// a rotation if the subtrees of iNode differ in height by more than one; returns the new root of the subtree
+int C3dglSceneBVH::balance(int iA)
+{
+	NODE &a = m_nodes[iA];
+	if (a.height < 2)
+		return iA;
+
+	int iB = a.child[0], iC = a.child[1];
+	int diff = m_nodes[iC].height - m_nodes[iB].height;
+	if (diff >= -1 && diff <= 1)
+		return iA;
+
+	// the higher child goes up, A takes its place and its lower grandchild
+	int side = diff > 1 ? 1 : 0;		// the higher child of A
+	int iUp = a.child[side];
+	NODE &up = m_nodes[iUp];
+	int iF = up.child[0], iG = up.child[1];
+
+	up.child[0] = iA;
+	up.parent = a.parent;
+	a.parent = iUp;
+	if (up.parent >= 0)
+		m_nodes[up.parent].child[m_nodes[up.parent].child[0] == iA ? 0 : 1] = iUp;
+	else
+		m_root = iUp;
+
+	// the higher grandchild stays with the node going up
+	if (m_nodes[iF].height > m_nodes[iG].height)
+		swap(iF, iG);
+	up.child[1] = iG;
+	a.child[side] = iF;
+	m_nodes[iF].parent = iA;
+
+	refit(iA);
+	refit(iUp);
+	return iUp;
+}
+
+void C3dglSceneBVH::queryFrustum(const glm::vec4 *planes, unsigned nPlanes, std::vector<unsigned> &results) const
+{
+	if (m_root < 0) return;
+	nPlanes = min(nPlanes, 31u);
+
+	// the planes still crossing a node are passed to its children; with none left, the whole subtree is inside
+	vector<pair<int, unsigned> > stack;
+	stack.push_back(make_pair(m_root, (1u << nPlanes) - 1));
+	while (!stack.empty())
+	{
+		int i = stack.back().first;
+		unsigned mask = stack.back().second;
+		stack.pop_back();
+		const NODE &node = m_nodes[i];
+
+		glm::vec3 c = 0.5f * (node.bbMin + node.bbMax);
+		glm::vec3 e = 0.5f * (node.bbMax - node.bbMin);
+		bool bOutside = false;
+		for (unsigned p = 0; p < nPlanes && !bOutside; p++)
+		{
+			if ((mask & (1u << p)) == 0) continue;
+			float d = glm::dot(glm::vec3(planes[p]), c) + planes[p].w;
+			float r = glm::dot(glm::abs(glm::vec3(planes[p])), e);
+			if (d + r < 0)
+				bOutside = true;
+			else if (d - r >= 0)
+				mask &= ~(1u << p);
+		}
+		if (bOutside) continue;
+
+		if (node.height == 0)
+			results.push_back(node.userData);
+		else
+		{
+			stack.push_back(make_pair(node.child[0], mask));
+			stack.push_back(make_pair(node.child[1], mask));
+		}
+	}
+}
+
+void C3dglSceneBVH::querySphere(const glm::vec3 &centre, float radius, std::vector<unsigned> &results) const
+{
+	if (m_root < 0) return;
+	vector<int> stack;
+	stack.push_back(m_root);
+	while (!stack.empty())
+	{
+		const NODE &node = m_nodes[stack.back()];
+		stack.pop_back();
+
+		glm::vec3 d = centre - glm::clamp(centre, node.bbMin, node.bbMax);
+		if (glm::dot(d, d) > radius * radius) continue;
+
+		if (node.height == 0)
+			results.push_back(node.userData);
+		else
+		{
+			stack.push_back(node.child[0]);
+			stack.push_back(node.child[1]);
+		}
+	}
+}
+
+void C3dglSceneBVH::queryRay(const glm::vec3 &orig, const glm::vec3 &dir, float tMax, std::vector<unsigned> &results, std::vector<float> &distances) const
+{
+	if (m_root < 0) return;
+	glm::vec3 invDir = 1.0f / dir;	// infinities are fine for the slab test
+
+	vector<pair<float, unsigned> > hits;
+	vector<int> stack;
+	stack.push_back(m_root);
+	while (!stack.empty())
+	{
+		const NODE &node = m_nodes[stack.back()];
+		stack.pop_back();
+
+		glm::vec3 t0 = (node.bbMin - orig) * invDir, t1 = (node.bbMax - orig) * invDir;
+		glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+		float tEnter = max(max(tNear.x, tNear.y), max(tNear.z, 0.0f));
+		float tExit = min(min(tFar.x, tFar.y), min(tFar.z, tMax));
+		if (tEnter > tExit) continue;
+
+		if (node.height == 0)
+			hits.push_back(make_pair(tEnter, node.userData));
+		else
+		{
+			stack.push_back(node.child[0]);
+			stack.push_back(node.child[1]);
+		}
+	}
+
+	sort(hits.begin(), hits.end());
+	for (pair<float, unsigned> &hit : hits)
+	{
+		results.push_back(hit.second);
+		distances.push_back(hit.first);
+	}
+}
+
+unsigned C3dglSceneBVH::addFrustumQuery(const glm::vec4 *planes, unsigned nPlanes)
+{
+	wait();
+	QUERY query;
+	query.type = QUERY::FRUSTUM;
+	query.nPlanes = min(nPlanes, 6u);
+	for (unsigned i = 0; i < query.nPlanes; i++)
+		query.planes[i] = planes[i];
+	query.radius = 0;
+	m_queries.push_back(query);
+	return (unsigned)m_queries.size() - 1;
+}
+
+unsigned C3dglSceneBVH::addSphereQuery(const glm::vec3 &centre, float radius)
+{
+	wait();
+	QUERY query;
+	query.type = QUERY::SPHERE;
+	query.nPlanes = 0;
+	query.pos = centre;
+	query.radius = radius;
+	m_queries.push_back(query);
+	return (unsigned)m_queries.size() - 1;
+}
+
+unsigned C3dglSceneBVH::addRayQuery(const glm::vec3 &orig, const glm::vec3 &dir, float tMax)
+{
+	wait();
+	QUERY query;
+	query.type = QUERY::RAY;
+	query.nPlanes = 0;
+	query.pos = orig;
+	query.dir = dir;
+	query.radius = tMax;
+	m_queries.push_back(query);
+	return (unsigned)m_queries.size() - 1;
+}
+
+void C3dglSceneBVH::runQuery(QUERY &query) const
+{
+	query.results.clear();
+	query.distances.clear();
+	switch (query.type)
+	{
+	case QUERY::FRUSTUM: queryFrustum(query.planes, query.nPlanes, query.results); break;
+	case QUERY::SPHERE: querySphere(query.pos, query.radius, query.results); break;
+	case QUERY::RAY: queryRay(query.pos, query.dir, query.radius, query.results, query.distances); break;
+	}
+}
+
+void C3dglSceneBVH::dispatch()
+{
+	if (m_queries.empty()) return;
+	wait();
+	if (!m_worker.joinable())
+		m_worker = thread(&C3dglSceneBVH::run, this);
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_bPending = true;
+	}
+	m_cvWork.notify_one();
+}
+
+void C3dglSceneBVH::wait()
+{
+	unique_lock<mutex> lock(m_mutex);
+	m_cvDone.wait(lock, [this] { return !m_bPending; });
+}
+
+void C3dglSceneBVH::run()
+{
+	for (;;)
+	{
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_cvWork.wait(lock, [this] { return m_bQuit || m_bPending; });
+			if (m_bQuit) break;
+		}
+
+		// the tree and the queries are not changed until the batch is done - see wait
+		for (QUERY &query : m_queries)
+			runQuery(query);
+
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_bPending = false;
+		}
+		m_cvDone.notify_all();
+	}
+}
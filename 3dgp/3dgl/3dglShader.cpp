@@ -1,8 +1,15 @@
 #include "../GL/glew.h"
 #include "../GL/3dglShader.h"
+#include "../GL/3dglState.h"
+#include "../GL/3dglUniform.h"
+#include "../GL/3dglAsyncCompiler.h"
 
 #include <fstream>
+#include <sstream>
+#include <iomanip>
 #include <vector>
+#include <memory>
+#include <algorithm>
 
 using namespace std;
 using namespace _3dgl;
@@ -97,31 +104,125 @@ bool C3dglShader::Create(GLenum type)
 	return logSuccess("created successfully.");
 }
 
-bool C3dglShader::Load(std::string source)
+void C3dglShader::Destroy()
+{
+	if (m_id) glDeleteShader(m_id);
+	m_id = 0;
+	m_bPending = false;
+}
+
+bool C3dglShader::Load(std::string source, std::string defines)
 {
 	if (m_id == 0) return logError("Shader creation error. Wrong type of shader.");
-	m_source = source;
-	if (m_source.empty()) return false;
+	if (source.empty()) return false;
+
+	// resolve #include directives and inject the defines
+	m_defines = defines;
+	m_includes.clear();
+	m_source.clear();
+	if (!_preprocess(source, m_fname.substr(0, m_fname.find_last_of("/\\") + 1), 0, m_source))
+		return false;
+
 	const GLchar *pSource = static_cast<const GLchar*>(m_source.c_str());
 	glShaderSource(m_id, 1, &pSource, NULL);
-	return logSuccess("source code loaded.");		// always successful
+	m_bPending = true;
+	return logSuccess("source code loaded.");
 }
 
-bool C3dglShader::LoadFromFile(std::string fname)
+bool C3dglShader::LoadFromFile(std::string fname, std::string defines)
 {
 	m_fname = fname;
 	ifstream file(m_fname.c_str());
 	string source(istreambuf_iterator<char>(file), (istreambuf_iterator<char>()));
-	return Load(source);
+	return Load(source, defines);
+}
+
+bool C3dglShader::_preprocess(const std::string &source, const std::string &path, GLuint idString, std::string &out)
+{
+	// the defines go after #version - or at the very top if there is none
+	bool bInject = (idString == 0);
+	string strDefines;
+	if (bInject)
+	{
+		string str = m_defines + ";";
+		size_t nstart = 0, nend = 0;
+		while ((nend = str.find(";", nstart)) != string::npos)
+		{
+			string def = str.substr(nstart, nend - nstart);
+			nstart = nend + 1;
+			if (def.empty()) continue;
+			size_t nEq = def.find('=');
+			if (nEq != string::npos) def[nEq] = ' ';
+			strDefines += "#define " + def + "\n";
+		}
+		if (source.find("#version") == string::npos)
+		{
+			out += strDefines + "#line 1 0\n";
+			bInject = false;
+		}
+	}
+
+	istringstream in(source);
+	string line;
+	for (unsigned nLine = 1; getline(in, line); nLine++)
+	{
+		size_t i = line.find_first_not_of(" \t");
+		if (i == string::npos || line[i] != '#')
+		{
+			out += line + "\n";
+			continue;
+		}
+
+		if (bInject && line.compare(i, 8, "#version") == 0)
+		{
+			out += line + "\n" + strDefines + "#line " + to_string(nLine + 1) + " 0\n";
+			bInject = false;
+			continue;
+		}
+
+		if (line.compare(i, 8, "#include") != 0)
+		{
+			out += line + "\n";
+			continue;
+		}
+
+		size_t q0 = line.find('"', i + 8);
+		size_t q1 = (q0 == string::npos) ? string::npos : line.find('"', q0 + 1);
+		if (q1 == string::npos)
+			return logError("malformed #include in line " + to_string(nLine) + ": " + line);
+		string fname = path + line.substr(q0 + 1, q1 - q0 - 1);
+
+		if (find(m_includes.begin(), m_includes.end(), fname) == m_includes.end())
+		{
+			ifstream file(fname.c_str());
+			if (!file) return logError("cannot open the included file: " + fname);
+			string include((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+			m_includes.push_back(fname);
+			GLuint idInclude = m_includes.size();
+			out += "#line 1 " + to_string(idInclude) + "\n";
+			if (!_preprocess(include, fname.substr(0, fname.find_last_of("/\\") + 1), idInclude, out))
+				return false;
+		}
+		out += "#line " + to_string(nLine + 1) + " " + to_string(idString) + "\n";
+	}
+	return true;
 }
 
-bool C3dglShader::Compile()
+bool C3dglShader::Compile(bool bDeferrable)
 {
 	if (m_id == 0) return logError("Shader creation error. Wrong type of shader.");
 
+	// the program may be found in the binary cache - then there is nothing to compile
+	if (bDeferrable && !C3dglProgram::GetBinaryCache().empty())
+		return logSuccess("compilation deferred until the program is linked.");
+
 	// compile
 	glCompileShader(m_id);
+	return CheckStatus();
+}
 
+bool C3dglShader::CheckStatus()
+{
 	// check status
 	GLint result = 0;
 	glGetShaderiv(m_id, GL_COMPILE_STATUS, &result);
@@ -133,8 +234,12 @@ bool C3dglShader::Compile()
 		if (infoLen < 1) return logError("unknown compilation error");
 		vector<char> log(infoLen);
 		glGetShaderInfoLog(m_id, log.size(), &infoLen, &log[0]);
-		return logError(string(log.begin(), log.end()));
+		string strLog(log.begin(), log.end());
+		for (GLuint i = 0; i < m_includes.size(); i++)
+			strLog += "\nsource string " + to_string(i + 1) + ": " + m_includes[i];
+		return logError(strLog);
 	}
+	m_bPending = false;
 	return logSuccess("compiled successfully.");
 }
 
@@ -147,7 +252,7 @@ std::string C3dglShader::getName()
 	//case GL_COMPUTE_SHADER: return "Compute Shader";
 	//case GL_TESS_CONTROL_SHADER: return "Tesselation Control Shader";
 	//case GL_TESS_EVALUATION_SHADER: return "Tesselation Evaluation Shader";
-	//case GL_GEOMETRY_SHADER: return "Geometry Shader";
+	case GL_GEOMETRY_SHADER: return "Geometry Shader";
 	default: return "Shader";
 	}
 }
@@ -156,12 +261,19 @@ std::string C3dglShader::getName()
 // C3dglProgram
 
 C3dglProgram *C3dglProgram::c_pCurrentProgram = NULL;
+std::string C3dglProgram::c_binaryCache;
+std::map<std::string, GLint> C3dglProgram::c_samplerUnits;
 
 C3dglProgram::C3dglProgram() : C3dglObject()
 {
 	m_id = 0;
 	memset(m_stdAttr, -1, sizeof(m_stdAttr));
 	memset(m_stdUni, -1, sizeof(m_stdUni));
+	for (GLuint i = 0; i < UBO_LAST; i++)
+		m_stdBlock[i] = GL_INVALID_INDEX;
+	m_nUniformsIssued = m_nUniformsSaved = 0;
+	m_state = STATE_NONE;
+	m_pFallback = NULL;
 }
 
 bool C3dglProgram::Create()
@@ -171,21 +283,117 @@ bool C3dglProgram::Create()
 	return logSuccess("created successfully.");
 }
 
+void C3dglProgram::Destroy()
+{
+	if (m_id == 0) return;
+	if (c_pCurrentProgram == this)
+		c_pCurrentProgram = NULL;
+	C3dglState::deleteProgram(m_id);
+	m_id = 0;
+	m_state = STATE_NONE;
+}
+
 bool C3dglProgram::Attach(C3dglShader &shader)
 {
 	if (m_id == 0) return logError("not created.");
 	if (shader.getId() == 0) return logError("cannot attach shader: Shader not created.");
 
 	glAttachShader(m_id, shader.getId());
+	m_shaders.push_back(&shader);
 	return logSuccess("has successfully attached a " + shader.getName());
 }
 
+void C3dglProgram::DetachShaders()
+{
+	for (C3dglShader *pShader : m_shaders)
+		if (m_id && pShader->getId())
+			glDetachShader(m_id, pShader->getId());
+	m_shaders.clear();
+}
+
 bool C3dglProgram::Link(std::string std_attrib_names, std::string std_uni_names)
 {
 	if (m_id == 0) return logError("not created.");
+	m_stdAttribNames = std_attrib_names;
+	m_stdUniNames = std_uni_names;
+
+	// program binary cache
+	if (_loadCached()) return m_state == STATE_READY;
+
+	// cache miss: compile the deferred shaders
+	for (C3dglShader *pShader : m_shaders)
+		if (pShader->IsPending() && !pShader->Compile(false))
+		{
+			m_state = STATE_FAILED;
+			return logError("linking error: " + pShader->getName() + " failed to compile.");
+		}
 
 	// link
 	glLinkProgram(m_id);
+	return _endLink();
+}
+
+bool C3dglProgram::LinkAsync(std::string std_attrib_names, std::string std_uni_names)
+{
+	if (m_id == 0) return logError("not created.");
+	m_stdAttribNames = std_attrib_names;
+	m_stdUniNames = std_uni_names;
+
+	// binaries from the cache load fast enough not to bother
+	if (_loadCached()) return m_state == STATE_READY;
+
+	// hand the pending shaders and the program over to the driver or the worker
+	vector<GLuint> shaders;
+	for (C3dglShader *pShader : m_shaders)
+		if (pShader->IsPending())
+			shaders.push_back(pShader->getId());
+	C3dglAsyncCompiler::submit(m_id, shaders);
+	m_state = STATE_LINKING;
+	return logSuccess("linking in the background.");
+}
+
+bool C3dglProgram::Poll()
+{
+	if (m_state != STATE_LINKING) return m_state == STATE_READY;
+	if (!C3dglAsyncCompiler::isComplete(m_id)) return false;
+
+	// compilation status of the shaders - they are complete by now
+	for (C3dglShader *pShader : m_shaders)
+		if (pShader->IsPending() && !pShader->CheckStatus())
+		{
+			m_state = STATE_FAILED;
+			return logError("linking error: " + pShader->getName() + " failed to compile.");
+		}
+	return _endLink();
+}
+
+bool C3dglProgram::_loadCached()
+{
+	// program binary cache - only if the driver supports at least one binary format
+	GLint nFormats = 0;
+	m_fnameBinary.clear();
+	if (!c_binaryCache.empty())
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nFormats);
+	if (nFormats <= 0) return false;
+
+	m_fnameBinary = c_binaryCache + "/" + _binaryKey() + ".bin";
+	if (!_loadBinary(m_fnameBinary))
+	{
+		// the binary will be retrieved after linking
+		glProgramParameteri(m_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		return false;
+	}
+
+	m_state = STATE_FAILED;
+	if (!_reflect(m_stdAttribNames, m_stdUniNames)) return true;
+	m_state = STATE_READY;
+	logSuccess("loaded from the binary cache.");
+	return true;
+}
+
+bool C3dglProgram::_endLink()
+{
+	m_state = STATE_FAILED;
 
 	// check status
 	GLint result = 0;
@@ -201,16 +409,291 @@ bool C3dglProgram::Link(std::string std_attrib_names, std::string std_uni_names)
 		return logError("linking error: " + string(log.begin(), log.end()));
 	}
 
+	if (!m_fnameBinary.empty())
+		_saveBinary(m_fnameBinary);
+
+	if (!_reflect(m_stdAttribNames, m_stdUniNames)) return false;
+	m_state = STATE_READY;
+	return logSuccess("linked successfully.");
+}
+
+std::string C3dglProgram::_binaryKey()
+{
+	// 64-bit FNV-1a over the shader sources and the driver identification
+	unsigned long long h = 14695981039346656037ull;
+	auto hash = [&h](const void *p, size_t size)
+	{
+		for (const unsigned char *q = (const unsigned char*)p; size--; q++)
+			h = (h ^ *q) * 1099511628211ull;
+	};
+	for (C3dglShader *pShader : m_shaders)
+	{
+		GLenum type = pShader->getType();
+		string source = pShader->getSource();
+		hash(&type, sizeof(type));
+		hash(source.c_str(), source.size() + 1);
+	}
+	GLenum DRIVER_STRINGS[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	for (GLenum name : DRIVER_STRINGS)
+	{
+		const char *p = (const char*)glGetString(name);
+		if (p) hash(p, strlen(p) + 1);
+	}
+
+	ostringstream str;
+	str << hex << setw(16) << setfill('0') << h;
+	return str.str();
+}
+
+bool C3dglProgram::_loadBinary(std::string fname)
+{
+	ifstream file(fname.c_str(), ios::binary);
+	if (!file) return false;
+
+	GLenum format = 0;
+	file.read((char*)&format, sizeof(format));
+	vector<char> binary((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	if (binary.empty()) return false;
+
+	glProgramBinary(m_id, format, &binary[0], (GLsizei)binary.size());
+
+	// drivers reject binaries they cannot use - the program is then linked from the source code
+	GLint result = 0;
+	glGetProgramiv(m_id, GL_LINK_STATUS, &result);
+	if (!result) logWarning("cached binary rejected by the driver: " + fname);
+	return result != 0;
+}
+
+void C3dglProgram::_saveBinary(std::string fname)
+{
+	GLint size = 0;
+	glGetProgramiv(m_id, GL_PROGRAM_BINARY_LENGTH, &size);
+	if (size <= 0) return;
+
+	GLenum format = 0;
+	vector<char> binary(size);
+	glGetProgramBinary(m_id, size, &size, &format, &binary[0]);
+
+	ofstream file(fname.c_str(), ios::binary);
+	file.write((const char*)&format, sizeof(format));
+	file.write(&binary[0], size);
+	if (!file) logWarning("cannot write the binary cache: " + fname);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////
+// Standard attribute and uniform names
+
+static const char *STD_ATTRIB_NAMES[] = {
+	"a_vertex|a_Vertex|aVertex|avertex|vertex|Vertex",
+	"a_normal|a_Normal|aNormal|anormal|normal|Normal",
+	"a_texcoord|a_TexCoord|aTexCoord|atexcoord|texcoord|TexCoord",
+	"a_tangent|a_Tangent|aTangent|atangent|tangent|Tangent",
+	"a_bitangent|a_Bitangent|aBitangent|abitangent|bitangent|Bitangent|a_biTangent|a_BiTangent|aBiTangent|abiTangent|biTangent|BiTangent",
+	"a_color|a_Color|aColor|acolor|color|Color",
+	"a_boneid|a_Boneid|aBoneid|aboneid|boneid|Boneid|a_boneId|a_BoneId|aBoneId|aboneId|boneId|BoneId|"
+	"a_boneids|a_Boneids|aBoneids|aboneids|boneids|Boneids|a_boneIds|a_BoneIds|aBoneIds|aboneIds|boneIds|BoneIds",
+	"a_boneweight|a_Boneweight|aBoneweight|aboneweight|boneweight|Boneweight|a_boneWeight|a_BoneWeight|aBoneWeight|aboneWeight|boneWeight|BoneWeight|a_weight|aweight|weight|a_Weight|aWeight|Weight|"
+	"a_boneweights|a_Boneweights|aBoneweights|aboneweights|boneweights|Boneweights|a_boneWeights|a_BoneWeights|aBoneWeights|aboneWeights|boneWeights|BoneWeights|a_weights|aweights|weights|a_Weights|aWeights|Weights",
+};
+
+static const char *STD_UNI_NAMES[] = {
+	"modelview_matrix|modelView_matrix|ModelView_matrix|Modelview_matrix|modelview_Matrix|modelView_Matrix|ModelView_Matrix|Modelview_Matrix|"
+	"matrix_modelview|matrix_modelView|matrix_ModelView|matrix_Modelview|Matrix_modelview|Matrix_modelView|Matrix_ModelView|Matrix_Modelview|"
+	"modelviewmatrix|modelViewmatrix|ModelViewmatrix|Modelviewmatrix|modelviewMatrix|modelViewMatrix|ModelViewMatrix|ModelviewMatrix|"
+	"matrixmodelview|matrixmodelView|matrixModelView|matrixModelview|Matrixmodelview|MatrixmodelView|MatrixModelView|MatrixModelview|",
+	"mat_ambient|material_ambient|mat_Ambient|material_Ambient|matambient|materialambient|matAmbient|materialAmbient|material.ambient",
+	"mat_diffuse|material_diffuse|mat_Diffuse|material_Diffuse|matdiffuse|materialdiffuse|matDiffuse|materialDiffuse|material.diffuse",
+	"mat_specular|material_specular|mat_Specular|material_Specular|matspecular|materialspecular|matSpecular|materialSpecular|material.specular",
+	"mat_emissive|material_emissive|mat_Emissive|material_Emissive|matemissive|materialemissive|matEmissive|materialEmissive|material.emissive",
+	"shininess|Shininess|mat_shininess|material_shininess|mat_Shininess|material_Shininess|matshininess|materialshininess|matShininess|materialShininess|material.shininess",
+	"texture0|textureDiffuse|diffuseTexture|material.diffuseTexture|material.texture",
+	"textureNormal|normalTexture|normalMap|material.normalTexture|material.normalMap",
+	"shCoeffs|shCoefficients|sh_coeffs",
+	"shAmbient|sh_ambient",
+	"lightmapBase|lightmap_base"
+};
+
+// Perfect hash table of the alias names (hash and displace).
+// Names are hashed into buckets; each bucket gets its own seed, chosen when the table is built
+// so that no two names share a slot. A look-up is then two hashes, one probe and one string compare.
+class CAliasTable
+{
+	struct ENTRY
+	{
+		ENTRY() : index(-1), priority(0) { }
+		string name;
+		int index;			// standard attribute/uniform id
+		int priority;		// position on the alias list - the lower, the better
+	};
+	vector<ENTRY> m_slots;
+	vector<unsigned> m_seeds;
+
+public:
+	// custom is a ';' separated list of '|' separated alias lists; empty entries take the defaults
+	CAliasTable(string custom, const char *defaults[], unsigned n);
+
+	// returns the standard id, or -1 if the name is not an alias
+	int find(const char *name, int &priority) const
+	{
+		unsigned seed = m_seeds[C3dglHash(name) & (m_seeds.size() - 1)];
+		const ENTRY &entry = m_slots[C3dglHash(name, seed) & (m_slots.size() - 1)];
+		if (entry.index < 0 || entry.name != name) return -1;
+		priority = entry.priority;
+		return entry.index;
+	}
+};
+
+CAliasTable::CAliasTable(string custom, const char *defaults[], unsigned n)
+{
+	// split the alias lists
+	vector<ENTRY> entries;
+	set<string> known;
+	size_t lstart = 0, lend = 0;
+	custom += ";";
+	for (unsigned i = 0; i < n; i++)
+	{
+		string str = "";
+		lend = custom.find(";", lstart);
+		if (lend != string::npos)
+		{
+			str = custom.substr(lstart, lend - lstart);
+			lstart = lend + 1;
+		}
+		if (str.empty()) str = defaults[i];
+		str += "|";
+
+		int priority = 0;
+		size_t nstart = 0, nend = 0;
+		while ((nend = str.find("|", nstart)) != string::npos)
+		{
+			ENTRY entry;
+			entry.name = str.substr(nstart, nend - nstart);
+			nstart = nend + 1;
+			if (entry.name.empty() || !known.insert(entry.name).second) continue;
+			entry.index = i;
+			entry.priority = priority++;
+			entries.push_back(entry);
+		}
+	}
+
+	// sizes are powers of two: slots at most half full, about four names per bucket
+	size_t nSlots = 8, nBuckets = 1;
+	while (nSlots < 2 * entries.size()) nSlots *= 2;
+	while (nBuckets * 4 < entries.size()) nBuckets *= 2;
+
+	vector<vector<size_t> > buckets(nBuckets);
+	for (size_t i = 0; i < entries.size(); i++)
+		buckets[C3dglHash(entries[i].name.c_str()) & (nBuckets - 1)].push_back(i);
+	vector<size_t> order(nBuckets);
+	for (size_t b = 0; b < nBuckets; b++)
+		order[b] = b;
+	sort(order.begin(), order.end(), [&buckets](size_t a, size_t b) { return buckets[a].size() > buckets[b].size(); });
+
+	for (bool bDone = false; !bDone; nSlots *= 2)
+	{
+		// place the largest buckets first
+		m_slots.assign(nSlots, ENTRY());
+		m_seeds.assign(nBuckets, 0);
+		bDone = true;
+		for (size_t b : order)
+		{
+			// find a seed that takes all names in the bucket to distinct free slots
+			vector<size_t> slots;
+			unsigned seed;
+			for (seed = 1; seed < 0x10000 && slots.size() < buckets[b].size(); seed++)
+			{
+				slots.clear();
+				for (size_t i : buckets[b])
+				{
+					size_t slot = C3dglHash(entries[i].name.c_str(), seed) & (nSlots - 1);
+					if (m_slots[slot].index >= 0 || std::find(slots.begin(), slots.end(), slot) != slots.end()) break;
+					slots.push_back(slot);
+				}
+			}
+			if (slots.size() < buckets[b].size())
+			{
+				bDone = false;		// very unlikely - try a sparser table
+				break;
+			}
+			m_seeds[b] = seed - 1;
+			for (size_t k = 0; k < slots.size(); k++)
+				m_slots[slots[k]] = entries[buckets[b][k]];
+		}
+		if (bDone) break;
+	}
+}
+
+bool C3dglProgram::_reflect(std::string std_attrib_names, std::string std_uni_names)
+{
+	// linking resets all uniforms to their defaults
+	m_shadow.clear();
+
+	// alias tables: the default ones are built once, custom names need tables of their own
+	static const CAliasTable c_attribTable("", STD_ATTRIB_NAMES, ATTR_LAST);
+	static const CAliasTable c_uniTable("", STD_UNI_NAMES, UNI_LAST);
+	unique_ptr<CAliasTable> pCustomAttribs, pCustomUnis;
+	if (!std_attrib_names.empty()) pCustomAttribs.reset(new CAliasTable(std_attrib_names, STD_ATTRIB_NAMES, ATTR_LAST));
+	if (!std_uni_names.empty()) pCustomUnis.reset(new CAliasTable(std_uni_names, STD_UNI_NAMES, UNI_LAST));
+	const CAliasTable &attribTable = pCustomAttribs ? *pCustomAttribs : c_attribTable;
+	const CAliasTable &uniTable = pCustomUnis ? *pCustomUnis : c_uniTable;
+
 	// create type mappings
 	unsigned i = 0;
 	for (auto type : c_uniTypes)
 		m_types[type.glType] = i++;
 
-	// register active variables
-	GLint nUniforms, maxLen;
+	// register active attributes; standard attributes are matched against the alias table
+	string attribNames[ATTR_LAST];
+	int attribPriority[ATTR_LAST];
+	memset(m_stdAttr, -1, sizeof(m_stdAttr));
+	m_attribs.clear();
+	GLint nAttribs, maxLen;
+	glGetProgramiv(m_id, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLen);
+	glGetProgramiv(m_id, GL_ACTIVE_ATTRIBUTES, &nAttribs);
+	GLchar *buf = new GLchar[maxLen + 1];
+	for (GLint i = 0; i < nAttribs; i++)
+	{
+		GLsizei written;
+		GLint size;
+		GLenum type;
+		glGetActiveAttrib(m_id, i, maxLen + 1, &written, &size, &type, buf);
+		GLuint location = glGetAttribLocation(m_id, buf);
+		m_attribs[buf] = location;
+
+		int priority, id = attribTable.find(buf, priority);
+		if (id >= 0 && (m_stdAttr[id] == (GLuint)-1 || priority < attribPriority[id]))
+		{
+			m_stdAttr[id] = location;
+			attribNames[id] = buf;
+			attribPriority[id] = priority;
+		}
+	}
+	delete[] buf;
+	for (GLuint i = 0; i < ATTR_LAST; i++)
+		if (m_stdAttr[i] != (GLuint)-1)
+			logSuccess("attribute location found: " + attribNames[i] + " = " + to_string(m_stdAttr[i]));
+
+	// register active uniforms; standard uniforms are matched against the alias table
+	string uniNames[UNI_LAST];
+	int uniPriority[UNI_LAST];
+	for (GLuint i = 0; i < UNI_LAST; i++)
+		m_stdUni[i] = UNIFORM();
+	auto matchStdUniform = [&](const string &name, const UNIFORM &uni)
+	{
+		int priority, id = uniTable.find(name.c_str(), priority);
+		if (id >= 0 && (uniNames[id].empty() || priority < uniPriority[id]))
+		{
+			m_stdUni[id] = uni;
+			uniNames[id] = name;
+			uniPriority[id] = priority;
+		}
+	};
+
+	m_uniforms.clear();
+	GLint nUniforms;
 	glGetProgramiv(GetId(), GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLen);
 	glGetProgramiv(GetId(), GL_ACTIVE_UNIFORMS, &nUniforms);
-	GLchar *buf = new GLchar[maxLen];
+	buf = new GLchar[maxLen];
 	for (int i = 0; i < nUniforms; ++i) 
 	{
 		GLsizei written;
@@ -220,6 +703,7 @@ bool C3dglProgram::Link(std::string std_attrib_names, std::string std_uni_names)
 		location = glGetUniformLocation(GetId(), buf);
 		string name = buf;
 		m_uniforms[name] = UNIFORM(location, m_types[type]);
+		matchStdUniform(name, m_uniforms[name]);
 
 		// special entry for arrays...
 		size_t nPos = name.find('[');
@@ -228,9 +712,36 @@ bool C3dglProgram::Link(std::string std_attrib_names, std::string std_uni_names)
 			string nameArray = name.substr(0, nPos);
 			location = glGetUniformLocation(GetId(), nameArray.c_str());
 			m_uniforms[nameArray] = UNIFORM(location, m_types[type]);
+			matchStdUniform(nameArray, m_uniforms[nameArray]);
 		}
 	}
 	delete[] buf;
+	for (GLuint i = 0; i < UNI_LAST; i++)
+		if (!uniNames[i].empty())
+			logSuccess("uniform location found: " + uniNames[i] + " = " + to_string(m_stdUni[i].location));
+
+	// hashed names for C3dglUniform handles; colliding names are left to the string look-up
+	m_hashedUniforms.clear();
+	set<unsigned> collisions;
+	for (auto &pair : m_uniforms)
+	{
+		unsigned hash = C3dglHash(pair.first.c_str());
+		if (!m_hashedUniforms.insert(make_pair(hash, pair.second)).second)
+			collisions.insert(hash);
+	}
+	for (unsigned hash : collisions)
+		m_hashedUniforms.erase(hash);
+
+	// fixed sampler units - the program has to be current for glUniform
+	GLuint idPrev = C3dglState::getProgram();
+	for (auto &pair : c_samplerUnits)
+	{
+		auto it = m_uniforms.find(pair.first);
+		if (it == m_uniforms.end()) continue;
+		C3dglState::useProgram(m_id);
+		SendUniform(it->second.location, pair.second);
+	}
+	if (idPrev != 0xFFFFFFFF) C3dglState::useProgram(idPrev);
 
 	//for (auto pair : m_uniforms)
 	//{
@@ -241,99 +752,63 @@ bool C3dglProgram::Link(std::string std_attrib_names, std::string std_uni_names)
 	//	printf(" %-8d | %s %s\n", location, type.c_str(), name.c_str());
 	//}
 
-	// Collect Standard Attribute Locations
-	string STD_ATTRIB_NAMES[] = {
-		"a_vertex|a_Vertex|aVertex|avertex|vertex|Vertex",
-		"a_normal|a_Normal|aNormal|anormal|normal|Normal",
-		"a_texcoord|a_TexCoord|aTexCoord|atexcoord|texcoord|TexCoord",
-		"a_tangent|a_Tangent|aTangent|atangent|tangent|Tangent",
-		"a_bitangent|a_Bitangent|aBitangent|abitangent|bitangent|Bitangent|a_biTangent|a_BiTangent|aBiTangent|abiTangent|biTangent|BiTangent",
-		"a_color|a_Color|aColor|acolor|color|Color",
-		"a_boneid|a_Boneid|aBoneid|aboneid|boneid|Boneid|a_boneId|a_BoneId|aBoneId|aboneId|boneId|BoneId|"
-		"a_boneids|a_Boneids|aBoneids|aboneids|boneids|Boneids|a_boneIds|a_BoneIds|aBoneIds|aboneIds|boneIds|BoneIds",
-		"a_boneweight|a_Boneweight|aBoneweight|aboneweight|boneweight|Boneweight|a_boneWeight|a_BoneWeight|aBoneWeight|aboneWeight|boneWeight|BoneWeight|a_weight|aweight|weight|a_Weight|aWeight|Weight|"
-		"a_boneweights|a_Boneweights|aBoneweights|aboneweights|boneweights|Boneweights|a_boneWeights|a_BoneWeights|aBoneWeights|aboneWeights|boneWeights|BoneWeights|a_weights|aweights|weights|a_Weights|aWeights|Weights",
-	};
-	int astart = 0, aend = 0;
-	std_attrib_names += ";";
-	for (GLuint i = 0; i < ATTR_LAST; i++)
+	// Collect Uniform Blocks
+	m_blocks.clear();
+	GLint nBlocks = 0;
+	glGetProgramiv(m_id, GL_ACTIVE_UNIFORM_BLOCKS, &nBlocks);
+	glGetProgramiv(m_id, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLen);
+	buf = new GLchar[maxLen + 1];
+	for (GLint i = 0; i < nBlocks; i++)
 	{
-		string str = "";
-		aend = std_attrib_names.find(";", astart);
-		if (aend != string::npos)
-		{
-			str = std_attrib_names.substr(astart, aend - astart);
-			astart = aend + 1;
-		}
-		if (str.empty()) str = STD_ATTRIB_NAMES[i];
-		str += "|";
-
-		int nstart = 0, nend = 0;
-		while ((nend = str.find("|", nstart)) != string::npos)
-		{
-			string name = str.substr(nstart, nend - nstart);
-			nstart = nend + 1;
-			if (name.empty()) continue;
-			
-			m_stdAttr[i] = glGetAttribLocation(m_id, name.c_str());
-			if (m_stdAttr[i] != (GLuint)-1)
-			{
-				logSuccess("attribute location found: " + name + " = " + to_string(m_stdAttr[i]));
-				break;
-			}
-		}
+		GLsizei written;
+		GLint size;
+		glGetActiveUniformBlockName(m_id, i, maxLen + 1, &written, buf);
+		glGetActiveUniformBlockiv(m_id, i, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+		m_blocks[buf] = BLOCK(i, size);
 	}
-	
-	// Collect Standard Uniform Locations
-	string STD_UNI_NAMES[] = {
-		"modelview_matrix|modelView_matrix|ModelView_matrix|Modelview_matrix|modelview_Matrix|modelView_Matrix|ModelView_Matrix|Modelview_Matrix|"
-		"matrix_modelview|matrix_modelView|matrix_ModelView|matrix_Modelview|Matrix_modelview|Matrix_modelView|Matrix_ModelView|Matrix_Modelview|" 
-		"modelviewmatrix|modelViewmatrix|ModelViewmatrix|Modelviewmatrix|modelviewMatrix|modelViewMatrix|ModelViewMatrix|ModelviewMatrix|" 
-		"matrixmodelview|matrixmodelView|matrixModelView|matrixModelview|Matrixmodelview|MatrixmodelView|MatrixModelView|MatrixModelview|",
-		"mat_ambient|material_ambient|mat_Ambient|material_Ambient|matambient|materialambient|matAmbient|materialAmbient",
-		"mat_diffuse|material_diffuse|mat_Diffuse|material_Diffuse|matdiffuse|materialdiffuse|matDiffuse|materialDiffuse",
-		"mat_specular|material_specular|mat_Specular|material_Specular|matspecular|materialspecular|matSpecular|materialSpecular",
-		"mat_emissive|material_emissive|mat_Emissive|material_Emissive|matemissive|materialemissive|matEmissive|materialEmissive",
-		"shininess|Shininess|mat_shininess|material_shininess|mat_Shininess|material_Shininess|matshininess|materialshininess|matShininess|materialShininess"
-	};
-	int lstart = 0, lend = 0;
-	std_uni_names += ";";
-	for (GLuint i = 0; i < UNI_LAST; i++)
-	{
-		string str = "";
-		lend = std_uni_names.find(";", lstart);
-		if (lend != string::npos)
-		{
-			str = std_uni_names.substr(lstart, lend - lstart);
-			lstart = lend + 1;
-		}
-		if (str.empty()) str = STD_UNI_NAMES[i];
-		str += "|";
+	delete[] buf;
 
+	// Bind Standard Uniform Blocks to their binding points and verify the std140 sizes
+	string STD_UBO_NAMES[] = { "Camera|camera|CAMERA", "Lights|lights|LIGHTS", "Material|material|MATERIAL", "Clusters|clusters|CLUSTERS", "Shadows|shadows|SHADOWS", "PointShadows|pointShadows|POINT_SHADOWS" };
+	GLint STD_UBO_SIZES[] = { sizeof(C3dglCameraBlock), sizeof(C3dglLightsBlock), sizeof(C3dglMaterialBlock), sizeof(C3dglClustersBlock), sizeof(C3dglShadowsBlock), sizeof(C3dglPointShadowsBlock) };
+	for (GLuint i = 0; i < UBO_LAST; i++)
+	{
+		m_stdBlock[i] = GL_INVALID_INDEX;
+		string str = STD_UBO_NAMES[i] + "|";
 		int nstart = 0, nend = 0;
 		while ((nend = str.find("|", nstart)) != string::npos)
 		{
 			string name = str.substr(nstart, nend - nstart);
 			nstart = nend + 1;
-			if (name.empty()) continue;
-
-			// find the name among the registered variables
-			std::map<std::string, UNIFORM>::iterator it = m_uniforms.find(name.c_str());
-			if (it != m_uniforms.end())
-			{
-				m_stdUni[i] = it->second;
-				logSuccess("uniform location found: " + name + " = " + to_string(m_stdUni[i].location));
-			}
+			auto it = m_blocks.find(name);
+			if (it == m_blocks.end()) continue;
+
+			// drivers may or may not round the size up to a multiple of vec4
+			if (((it->second.size + 15) & ~15) != STD_UBO_SIZES[i])
+				return logError("uniform block " + name + " has " + to_string(it->second.size) + " bytes, expected " + to_string(STD_UBO_SIZES[i]) + " (std140 layout mismatch)");
+			m_stdBlock[i] = it->second.index;
+			glUniformBlockBinding(m_id, m_stdBlock[i], i);
+			logSuccess("uniform block found: " + name + " = " + to_string(i));
+			break;
 		}
 	}
 
-	return logSuccess("linked successfully.");
+	return true;
+}
+
+bool C3dglProgram::BindUniformBlock(std::string name, GLuint binding)
+{
+	GLuint index = GetUniformBlockIndex(name);
+	if (index == GL_INVALID_INDEX) return logError("uniform block not found: " + name);
+	glUniformBlockBinding(m_id, index, binding);
+	return true;
 }
 
 bool C3dglProgram::Use(bool bValidate)
 {
 	if (m_id == 0) return logError("not created.");
-	glUseProgram(m_id);
+	if (m_state == STATE_LINKING && !Poll()) return logError("still linking - use Resolve to draw with the fallback.");
+	C3dglState::useProgram(m_id);
 
 	c_pCurrentProgram = this;
 
@@ -407,6 +882,16 @@ void C3dglProgram::GetUniformLocation(std::string idUniform, GLuint &location, G
 	else logWarning("unregistered uniform used: " + idUniform);
 }
 
+bool C3dglProgram::GetUniformByHash(unsigned hash, GLuint &location, GLenum &targetType)
+{
+	auto i = m_hashedUniforms.find(hash);
+	if (i == m_hashedUniforms.end())
+		return false;
+	location = i->second.location;
+	targetType = c_uniTypes[i->second.type].targetType;
+	return true;
+}
+
 void C3dglProgram::GetUniformLocation(UNI_STD uniId, GLuint &location, GLenum &type, GLenum &targetType)
 {
 	location = -1;
@@ -454,6 +939,34 @@ bool C3dglProgram::_error(string name, GLenum actual, GLenum expected)
 	}
 }
 
+bool C3dglProgram::_shadow(GLuint location, const void *p, size_t size, GLuint count)
+{
+	// location not found - nothing to send
+	if (location == (GLuint)-1) return false;
+
+	if (count > 1)
+	{
+		// array upload - it overwrites the following locations as well
+		m_shadow.clear();
+	}
+	else if (location < 4096 && size <= sizeof(SHADOW::data))
+	{
+		if (location >= m_shadow.size()) m_shadow.resize(location + 1);
+		SHADOW &shadow = m_shadow[location];
+		if (shadow.size == size && memcmp(shadow.data, p, size) == 0)
+		{
+			m_nUniformsSaved++;
+			return false;
+		}
+		memcpy(shadow.data, p, size);
+		shadow.size = size;
+	}
+
+	m_nUniformsIssued++;
+	if (!IsUsed()) Use();
+	return true;
+}
+
 bool C3dglProgram::SendUniform(std::string name, GLint v0)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(name, location, _t, t);
@@ -726,6 +1239,13 @@ bool C3dglProgram::SendUniformMatrixv(std::string name, GLfloat *pMatrix, GLuint
 	return true;
 }
 
+bool C3dglProgram::SendStandardUniform(enum UNI_STD loc, GLint v0)
+{
+	GLuint location; GLenum _t, t; GetUniformLocation(loc, location, _t, t);
+	SendUniform(location, v0);
+	return true;
+}
+
 bool C3dglProgram::SendStandardUniform(enum UNI_STD loc, GLfloat v0)
 {
 	GLuint location; GLenum _t, t; GetUniformLocation(loc, location, _t, t);
@@ -0,0 +1,262 @@
+#include "../GL/glew.h"
+#include "../GL/3dglShadowCascades.h"
+#include "../GL/3dglDrawList.h"
+#include "../GL/3dglState.h"
+
+// standard libraries
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+// GLM include files
+#include "../glm/geometric.hpp"
+#include "../glm/matrix.hpp"
+#include "../glm/gtc/matrix_transform.hpp"
+
+using namespace std;
+using namespace _3dgl;
+
+C3dglShadowCascades::C3dglShadowCascades() : C3dglObject()
+{
+	m_idTex = m_idTexStatic = 0;
+	m_idFBO = m_idFBOStatic = 0;
+	m_size = 0;
+	m_nCascades = 0;
+	m_iFirstCached = 2;
+	m_distance = 100;
+	m_lambda = 0.75f;
+	memset(m_cascades, 0, sizeof(m_cascades));
+	m_lightDir = glm::vec3(0);
+	m_pDrawList = NULL;
+	m_nStaticRevision = 0;
+	memset(&m_block, 0, sizeof(m_block));
+	m_nPacketsDrawn = m_nCascadesRefreshed = 0;
+}
+
+bool C3dglShadowCascades::create(unsigned nCascades, int size, std::string pathShaders)
+{
+	destroy();
+	if (nCascades == 0 || nCascades > C3dglShadowsBlock::MAX_CASCADES)
+		return logError("Between 1 and " + to_string((long long)C3dglShadowsBlock::MAX_CASCADES) + " cascades supported (the shaders' MAX_CASCADES)");
+	m_nCascades = nCascades;
+	m_size = size;
+
+	// programs linked from now on find the shadow maps at their unit
+	C3dglProgram::SetSamplerUnit("shadowMap", UNIT_SHADOW_MAP);
+
+	// depth only
+	if (!m_vertexShader.Create(GL_VERTEX_SHADER)) return false;
+	if (!m_vertexShader.LoadFromFile(pathShaders + "shadow.vert")) return false;
+	if (!m_vertexShader.Compile()) return false;
+	if (!m_fragmentShader.Create(GL_FRAGMENT_SHADER)) return false;
+	if (!m_fragmentShader.LoadFromFile(pathShaders + "shadow.frag")) return false;
+	if (!m_fragmentShader.Compile()) return false;
+	if (!m_program.Create() || !m_program.Attach(m_vertexShader) || !m_program.Attach(m_fragmentShader) || !m_program.Link()) return false;
+
+	// the live array is sampled with the hardware compare - outside of the map is lit
+	static const GLfloat border[] = { 1, 1, 1, 1 };
+	GLuint ids[2];
+	glGenTextures(2, ids);
+	m_idTex = ids[0];
+	m_idTexStatic = ids[1];
+	for (unsigned i = 0; i < 2; i++)
+	{
+		C3dglState::bindTexture(UNIT_SHADOW_MAP, GL_TEXTURE_2D_ARRAY, ids[i]);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size, size, nCascades, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, i == 0 ? GL_LINEAR : GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, i == 0 ? GL_LINEAR : GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+		glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+		if (i == 0)
+		{
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+		}
+	}
+
+	// the layers are attached as they are rendered
+	GLuint fbos[2];
+	glGenFramebuffers(2, fbos);
+	m_idFBO = fbos[0];
+	m_idFBOStatic = fbos[1];
+	GLenum status[2];
+	for (unsigned i = 0; i < 2; i++)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, fbos[i]);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, ids[i], 0, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		status[i] = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status[0] != GL_FRAMEBUFFER_COMPLETE || status[1] != GL_FRAMEBUFFER_COMPLETE)
+		return logError("shadow map incomplete: status " + to_string(status[0]) + ", " + to_string(status[1]));
+
+	if (!m_ubo.create(UBO_SHADOWS, sizeof(C3dglShadowsBlock), &m_block)) return false;
+
+	invalidate();
+	return logSuccess("created: " + to_string(nCascades) + " x " + to_string(size) + " x " + to_string(size));
+}
+
+void C3dglShadowCascades::destroy()
+{
+	if (m_idFBO) glDeleteFramebuffers(1, &m_idFBO);
+	if (m_idFBOStatic) glDeleteFramebuffers(1, &m_idFBOStatic);
+	if (m_idTex) C3dglState::deleteTextures(1, &m_idTex);
+	if (m_idTexStatic) C3dglState::deleteTextures(1, &m_idTexStatic);
+	m_ubo.destroy();
+	m_idTex = m_idTexStatic = 0;
+	m_idFBO = m_idFBOStatic = 0;
+	m_size = 0;
+	m_nCascades = 0;
+}
+
+void C3dglShadowCascades::invalidate()
+{
+	for (CASCADE &cascade : m_cascades)
+		cascade.bValid = false;
+}
+
+void C3dglShadowCascades::render(C3dglDrawList &drawList, const glm::vec3 &lightDir, const glm::mat4 &matrixView, const glm::mat4 &matrixProjection)
+{
+	m_nPacketsDrawn = m_nCascadesRefreshed = 0;
+	if (m_idFBO == 0) return;
+
+	// the camera: near and far planes and the field of view, from the projection matrix
+	float zNear = matrixProjection[3][2] / (matrixProjection[2][2] - 1);
+	float zFar = matrixProjection[3][2] / (matrixProjection[2][2] + 1);
+	zFar = min(zFar, max(m_distance, zNear * 2));
+	float tanX = 1 / matrixProjection[0][0];
+	float tanY = 1 / matrixProjection[1][1];
+	glm::mat4 matrixInvView = glm::inverse(matrixView);
+
+	// the light space - all the cascades share the orientation; the cache is void if the light
+	// or the static geometry has changed
+	glm::vec3 dir = glm::normalize(lightDir);
+	if (dir != m_lightDir || &drawList != m_pDrawList || drawList.getStaticRevision() != m_nStaticRevision)
+	{
+		m_lightDir = dir;
+		m_pDrawList = &drawList;
+		m_nStaticRevision = drawList.getStaticRevision();
+		invalidate();
+	}
+	glm::mat4 matrixLight = glm::lookAt(glm::vec3(0), dir, fabs(dir.y) > 0.99f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0));
+
+	// the depth only pass
+	GLint viewport[4];
+	C3dglState::getViewport(viewport);
+	C3dglProgram *pProgram = C3dglProgram::GetCurrentProgram();
+	m_program.Use();
+	C3dglState::viewport(0, 0, m_size, m_size);
+	C3dglState::enable(GL_DEPTH_TEST);
+	C3dglState::enable(GL_DEPTH_CLAMP);				// the casters in front of the cascade are flattened onto its near plane
+	C3dglState::enable(GL_POLYGON_OFFSET_FILL);
+	C3dglState::depthMask(GL_TRUE);
+	glPolygonOffset(2, 4);
+
+	float splitNear = zNear;
+	for (unsigned i = 0; i < m_nCascades; i++)
+	{
+		// practical split scheme - a blend of the uniform and the logarithmic splits
+		float t = (float)(i + 1) / m_nCascades;
+		float splitFar = glm::mix(zNear + (zFar - zNear) * t, zNear * pow(zFar / zNear, t), m_lambda);
+
+		// bounding sphere of the slice - in view space it does not depend on the camera orientation,
+		// so neither does the size of the cascade; the radius is rounded up to keep it steady
+		glm::vec3 corners[8];
+		glm::vec3 centre(0);
+		for (unsigned c = 0; c < 8; c++)
+		{
+			float z = (c & 4) ? splitFar : splitNear;
+			corners[c] = glm::vec3(((c & 1) ? 1 : -1) * z * tanX, ((c & 2) ? 1 : -1) * z * tanY, -z);
+			centre += corners[c] / 8.0f;
+		}
+		float radius = 0;
+		for (unsigned c = 0; c < 8; c++)
+			radius = max(radius, glm::length(corners[c] - centre));
+		radius = ceil(radius * 16) / 16;
+		centre = glm::vec3(matrixInvView * glm::vec4(centre, 1));
+
+		// cached cascades cover more than the slice, and are refit only when the slice leaves them
+		CASCADE &cascade = m_cascades[i];
+		bool bCached = i >= m_iFirstCached;
+		bool bRefresh = !bCached || !cascade.bValid || glm::length(centre - cascade.centre) + radius > cascade.radius || cascade.radius > radius * 2;
+		if (bRefresh)
+		{
+			float r = bCached ? radius * 1.25f : radius;
+			float texelSize = 2 * r / m_size;
+
+			// the centre is snapped to whole texels in the light space - the shadows do not shimmer
+			glm::vec3 c = glm::vec3(matrixLight * glm::vec4(centre, 1));
+			c.x = floor(c.x / texelSize) * texelSize;
+			c.y = floor(c.y / texelSize) * texelSize;
+			glm::mat4 matrixOrtho = glm::ortho(c.x - r, c.x + r, c.y - r, c.y + r, -c.z - r, -c.z + r);
+
+			cascade.matrix = matrixOrtho * matrixLight;
+			cascade.centre = centre;
+			cascade.radius = r;
+			cascade.texelSize = texelSize;
+		}
+
+		renderCascade(drawList, i, bCached && bRefresh);
+
+		// view space to the shadow map texture coordinates and depth
+		static const glm::mat4 matrixBias(0.5f, 0, 0, 0, 0, 0.5f, 0, 0, 0, 0, 0.5f, 0, 0.5f, 0.5f, 0.5f, 1);
+		m_block.matrixShadow[i] = matrixBias * cascade.matrix * matrixInvView;
+		m_block.splits[i] = splitFar;
+		m_block.texelSize[i] = cascade.texelSize;
+
+		splitNear = splitFar;
+	}
+	m_block.params.x = m_nCascades;
+	m_ubo.update(&m_block, sizeof(m_block));
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	C3dglState::viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	C3dglState::disable(GL_DEPTH_CLAMP);
+	C3dglState::disable(GL_POLYGON_OFFSET_FILL);
+	if (pProgram) pProgram->Use();
+}
+
+void C3dglShadowCascades::renderCascade(C3dglDrawList &drawList, unsigned i, bool bRefresh)
+{
+	CASCADE &cascade = m_cascades[i];
+
+	// not cached: everything, straight into the live layer
+	if (i < m_iFirstCached)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, m_idFBO);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_idTex, 0, i);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		m_nPacketsDrawn += drawList.renderDepth(cascade.matrix, C3dglDrawList::DRAW_ALL);
+		return;
+	}
+
+	// cached: the static geometry only when needed...
+	if (bRefresh)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, m_idFBOStatic);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_idTexStatic, 0, i);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		m_nPacketsDrawn += drawList.renderDepth(cascade.matrix, C3dglDrawList::DRAW_STATIC);
+		cascade.bValid = true;
+		m_nCascadesRefreshed++;
+	}
+
+	// ...then copied into the live layer, and the dynamic objects on top
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_idFBOStatic);
+	glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_idTexStatic, 0, i);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_idFBO);
+	glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_idTex, 0, i);
+	glBlitFramebuffer(0, 0, m_size, m_size, 0, 0, m_size, m_size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_idFBO);
+	m_nPacketsDrawn += drawList.renderDepth(cascade.matrix, C3dglDrawList::DRAW_DYNAMIC);
+}
+
+void C3dglShadowCascades::bind()
+{
+	if (m_idTex == 0) return;
+	C3dglState::bindTexture(UNIT_SHADOW_MAP, GL_TEXTURE_2D_ARRAY, m_idTex);
+	m_ubo.bind();
+}
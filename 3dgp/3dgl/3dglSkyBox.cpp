@@ -2,6 +2,7 @@
 #include "../GL/3dglShader.h"
 #include "../GL/3dglBitmap.h"
 #include "../GL/3dglSkyBox.h"
+#include "../GL/3dglState.h"
 
 using namespace _3dgl;
 using namespace std;
@@ -15,13 +16,13 @@ bool C3dglSkyBox::load(const char* pFd, const char* pRt, const char* pBk, const
 	glGenTextures(6, m_idTex);
 
 	// load six textures
-	glActiveTexture(GL_TEXTURE0);
+	C3dglState::activeTexture(GL_TEXTURE0);
 	const char*pFilenames[] = { pBk, pRt, pFd, pLt, pUp, pDn };
 	for (int i = 0; i < 6; ++i)
 	{
 		C3dglBitmap bm(pFilenames[i], GL_RGBA);
 		glGenTextures(1, &m_idTex[i]);
-		glBindTexture(GL_TEXTURE_2D, m_idTex[i]);
+		C3dglState::bindTexture(GL_TEXTURE_2D, m_idTex[i]);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -60,32 +61,37 @@ bool C3dglSkyBox::load(const char* pFd, const char* pRt, const char* pBk, const
 	};
 
 	glGenBuffers(1, &m_vertexBuffer); //Generate a buffer for the vertices
-	glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer); //Bind the vertex buffer
+	C3dglState::bindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer); //Bind the vertex buffer
 	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), &vertices[0], GL_STATIC_DRAW); //Send the data to OpenGL
 
 	glGenBuffers(1, &m_normalBuffer); //Generate a buffer for the normals
-	glBindBuffer(GL_ARRAY_BUFFER, m_normalBuffer); //Bind the normal buffer
+	C3dglState::bindBuffer(GL_ARRAY_BUFFER, m_normalBuffer); //Bind the normal buffer
 	glBufferData(GL_ARRAY_BUFFER, sizeof(normals), &normals[0], GL_STATIC_DRAW); //Send the data to OpenGL
 
 	glGenBuffers(1, &m_texCoordBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, m_texCoordBuffer); //Bind the tex coord buffer
+	C3dglState::bindBuffer(GL_ARRAY_BUFFER, m_texCoordBuffer); //Bind the tex coord buffer
 	glBufferData(GL_ARRAY_BUFFER, sizeof(textCoord), &textCoord[0], GL_STATIC_DRAW); //Send the data to OpenGL
 
 	return true;
 }
 
 void C3dglSkyBox::render()
+{
+	render(C3dglState::getModelViewMatrix());
+}
+
+void C3dglSkyBox::render(glm::mat4 matrix)
 {
 	// check if a shading program is active
 	C3dglProgram *pProgram = C3dglProgram::GetCurrentProgram();
 	if (!pProgram) return;
 
-	glPushMatrix();
+	// legacy vertex arrays are set up on the default VAO
+	C3dglState::bindVertexArray(0);
 
 	// disable depth-buffer write cycles - so that the skybox cannot obscure anything
-	GLboolean bDepthMask;
-	::glGetBooleanv(GL_DEPTH_WRITEMASK, &bDepthMask);
-	glDepthMask(GL_FALSE);
+	GLboolean bDepthMask = C3dglState::getDepthMask();
+	C3dglState::depthMask(GL_FALSE);
 
 	// get shader configuration
 	GLuint attribVertex = pProgram->GetAttribLocation(C3dglProgram::ATTR_VERTEX);
@@ -93,38 +99,41 @@ void C3dglSkyBox::render()
 	GLuint attribTexCoord = pProgram->GetAttribLocation(C3dglProgram::ATTR_TEXCOORD);
 	GLuint locationMatrixModelView = pProgram->GetUniformLocation(C3dglProgram::UNI_MODELVIEW);
 
-	// send model view matrix
-	float modelviewMatrix[16];
-	glGetFloatv(GL_MODELVIEW_MATRIX, modelviewMatrix);
-	modelviewMatrix[12] = modelviewMatrix[13] = modelviewMatrix[14] = 0;
-	glUniformMatrix4fv(locationMatrixModelView, 1, false, modelviewMatrix);
-
-	glEnableVertexAttribArray(attribVertex);
-	glEnableVertexAttribArray(attribNormal);
-	glEnableVertexAttribArray(attribTexCoord);
+	// send model view matrix - without translation
+	matrix[3] = glm::vec4(0, 0, 0, 1);
+	pProgram->SendUniform(locationMatrixModelView, matrix);
 
-	glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
-	glVertexAttribPointer(attribVertex, 3, GL_FLOAT, GL_FALSE, 0, 0);
-	
-	glBindBuffer(GL_ARRAY_BUFFER, m_normalBuffer);
-	glVertexAttribPointer(attribNormal, 3, GL_FLOAT, GL_FALSE, 0, 0);
-	
-	glBindBuffer(GL_ARRAY_BUFFER, m_texCoordBuffer);
-	glVertexAttribPointer(attribTexCoord, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	// the attributes not used by the program are not found (-1)
+	if (attribVertex != (GLuint)-1)
+	{
+		C3dglState::enableVertexAttribArray(attribVertex);
+		C3dglState::bindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+		glVertexAttribPointer(attribVertex, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	}
+	if (attribNormal != (GLuint)-1)
+	{
+		C3dglState::enableVertexAttribArray(attribNormal);
+		C3dglState::bindBuffer(GL_ARRAY_BUFFER, m_normalBuffer);
+		glVertexAttribPointer(attribNormal, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	}
+	if (attribTexCoord != (GLuint)-1)
+	{
+		C3dglState::enableVertexAttribArray(attribTexCoord);
+		C3dglState::bindBuffer(GL_ARRAY_BUFFER, m_texCoordBuffer);
+		glVertexAttribPointer(attribTexCoord, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	}
 
-	glActiveTexture(GL_TEXTURE0);
+	C3dglState::activeTexture(GL_TEXTURE0);
 	for (int i = 0; i < 6; ++i)
 	{
-		glBindTexture(GL_TEXTURE_2D, m_idTex[i]);
+		C3dglState::bindTexture(GL_TEXTURE_2D, m_idTex[i]);
 		glDrawArrays(GL_TRIANGLE_FAN, i * 4, 4);
 	}
 
-	glDisableVertexAttribArray(attribVertex);
-	glDisableVertexAttribArray(attribNormal);
-	glDisableVertexAttribArray(attribTexCoord);
+	if (attribVertex != (GLuint)-1) C3dglState::disableVertexAttribArray(attribVertex);
+	if (attribNormal != (GLuint)-1) C3dglState::disableVertexAttribArray(attribNormal);
+	if (attribTexCoord != (GLuint)-1) C3dglState::disableVertexAttribArray(attribTexCoord);
 	
 	// enable depth-buffer write cycle
-	glDepthMask(bDepthMask);
-	
-	glPopMatrix();
+	C3dglState::depthMask(bDepthMask);
 }
\ No newline at end of file
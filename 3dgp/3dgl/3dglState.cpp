@@ -0,0 +1,303 @@
+#include "../GL/glew.h"
+#include "../GL/3dglState.h"
+
+using namespace std;
+using namespace _3dgl;
+
+#define UNKNOWN 0xFFFFFFFF
+
+GLuint C3dglState::c_idProgram = UNKNOWN;
+GLuint C3dglState::c_idVAO = UNKNOWN;
+C3dglState::VAO *C3dglState::c_pVAO = NULL;
+std::map<GLuint, C3dglState::VAO> C3dglState::c_vaos;
+std::map<GLenum, GLuint> C3dglState::c_buffers;
+std::map<std::pair<GLenum, GLuint>, C3dglState::BINDING> C3dglState::c_bufferBases;
+GLenum C3dglState::c_activeTexture = UNKNOWN;
+GLuint C3dglState::c_textures[MAX_TEXTURE_UNITS][TEX_TARGET_LAST];
+int C3dglState::c_nDepthMask = -1;
+GLenum C3dglState::c_depthFunc = UNKNOWN;
+int C3dglState::c_nColorMask = -1;
+GLenum C3dglState::c_blendSrc = UNKNOWN;
+GLenum C3dglState::c_blendDst = UNKNOWN;
+GLint C3dglState::c_viewport[4] = { 0, 0, -1, -1 };
+std::map<GLenum, int> C3dglState::c_caps;
+std::vector<glm::mat4> C3dglState::c_matrixStack(1, glm::mat4(1));
+unsigned C3dglState::c_nIssued = 0;
+unsigned C3dglState::c_nFiltered = 0;
+unsigned C3dglState::c_nLastIssued = 0;
+unsigned C3dglState::c_nLastFiltered = 0;
+
+// static initialisation of the texture cache
+static struct _INIT { _INIT() { C3dglState::invalidate(); } } _init;
+
+unsigned C3dglState::getTargetIndex(GLenum target)
+{
+	switch (target)
+	{
+	case GL_TEXTURE_2D: return 0;
+	case GL_TEXTURE_CUBE_MAP: return 1;
+	case GL_TEXTURE_2D_ARRAY: return 2;
+	case GL_TEXTURE_CUBE_MAP_ARRAY: return 3;
+	case GL_TEXTURE_BUFFER: return 4;
+	case GL_TEXTURE_3D: return 5;
+	case GL_TEXTURE_1D: return 6;
+	default: return 7;	// GL_TEXTURE_2D_MULTISAMPLE and others share a slot
+	}
+}
+
+void C3dglState::useProgram(GLuint id)
+{
+	if (c_idProgram == id) { c_nFiltered++; return; }
+	glUseProgram(id);
+	c_idProgram = id;
+	c_nIssued++;
+}
+
+void C3dglState::deleteProgram(GLuint id)
+{
+	if (c_idProgram == id || c_idProgram == UNKNOWN)
+	{
+		glUseProgram(0);
+		c_idProgram = 0;
+		c_nIssued++;
+	}
+	glDeleteProgram(id);
+}
+
+void C3dglState::bindVertexArray(GLuint id)
+{
+	if (c_idVAO == id) { c_nFiltered++; return; }
+	glBindVertexArray(id);
+	c_idVAO = id;
+	c_pVAO = &c_vaos[id];
+	c_nIssued++;
+}
+
+void C3dglState::deleteVertexArrays(GLsizei n, const GLuint *ids)
+{
+	// GL reverts the binding to zero when the bound VAO is deleted
+	for (GLsizei i = 0; i < n; i++)
+	{
+		if (ids[i] == 0) continue;
+		if (c_idVAO == ids[i])
+		{
+			c_idVAO = 0;
+			c_pVAO = &c_vaos[0];
+		}
+		c_vaos.erase(ids[i]);
+	}
+	glDeleteVertexArrays(n, ids);
+}
+
+void C3dglState::bindBuffer(GLenum target, GLuint id)
+{
+	// element array buffer binding is a part of the VAO state
+	GLuint &idBound = (target == GL_ELEMENT_ARRAY_BUFFER && c_pVAO) ? c_pVAO->idElementBuffer : c_buffers.insert(make_pair(target, UNKNOWN)).first->second;
+	if (idBound == id) { c_nFiltered++; return; }
+	glBindBuffer(target, id);
+	idBound = id;
+	c_nIssued++;
+}
+
+void C3dglState::bindBufferBase(GLenum target, GLuint index, GLuint id)
+{
+	BINDING &bound = c_bufferBases[make_pair(target, index)];
+	if (bound.id == id && bound.offset == -1) { c_nFiltered++; return; }
+	glBindBufferBase(target, index, id);
+	bound.id = id;
+	bound.offset = -1;
+	c_buffers[target] = id;		// also binds the generic binding point
+	c_nIssued++;
+}
+
+void C3dglState::bindBufferRange(GLenum target, GLuint index, GLuint id, GLintptr offset, GLsizeiptr size)
+{
+	BINDING &bound = c_bufferBases[make_pair(target, index)];
+	if (bound.id == id && bound.offset == offset) { c_nFiltered++; return; }
+	glBindBufferRange(target, index, id, offset, size);
+	bound.id = id;
+	bound.offset = offset;
+	c_buffers[target] = id;
+	c_nIssued++;
+}
+
+void C3dglState::deleteBuffers(GLsizei n, const GLuint *ids)
+{
+	// GL unbinds deleted buffers - so the cache has to forget them
+	for (GLsizei i = 0; i < n; i++)
+	{
+		for (auto &p : c_buffers)
+			if (p.second == ids[i]) p.second = 0;
+		for (auto &p : c_bufferBases)
+			if (p.second.id == ids[i]) p.second = BINDING();
+		for (auto &p : c_vaos)
+			if (p.second.idElementBuffer == ids[i]) p.second.idElementBuffer = UNKNOWN;
+	}
+	glDeleteBuffers(n, ids);
+}
+
+void C3dglState::activeTexture(GLenum texture)
+{
+	if (c_activeTexture == texture) { c_nFiltered++; return; }
+	glActiveTexture(texture);
+	c_activeTexture = texture;
+	c_nIssued++;
+}
+
+void C3dglState::bindTexture(GLenum target, GLuint id)
+{
+	unsigned unit = (c_activeTexture == UNKNOWN) ? UNKNOWN : c_activeTexture - GL_TEXTURE0;
+	if (unit >= MAX_TEXTURE_UNITS)
+	{
+		// active unit unknown - cannot cache
+		glBindTexture(target, id);
+		c_nIssued++;
+		return;
+	}
+	GLuint &idBound = c_textures[unit][getTargetIndex(target)];
+	if (idBound == id) { c_nFiltered++; return; }
+	glBindTexture(target, id);
+	idBound = id;
+	c_nIssued++;
+}
+
+void C3dglState::bindTexture(GLuint unit, GLenum target, GLuint id)
+{
+	if (unit < MAX_TEXTURE_UNITS && c_textures[unit][getTargetIndex(target)] == id) { c_nFiltered++; return; }
+	activeTexture(GL_TEXTURE0 + unit);
+	bindTexture(target, id);
+}
+
+void C3dglState::deleteTextures(GLsizei n, const GLuint *ids)
+{
+	for (GLsizei i = 0; i < n; i++)
+		for (unsigned unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+			for (unsigned t = 0; t < TEX_TARGET_LAST; t++)
+				if (c_textures[unit][t] == ids[i]) c_textures[unit][t] = 0;
+	glDeleteTextures(n, ids);
+}
+
+void C3dglState::enableVertexAttribArray(GLuint index)
+{
+	// beyond the mask (or -1, an attribute not found) - not cached
+	if (index >= 32) { glEnableVertexAttribArray(index); c_nIssued++; return; }
+	unsigned mask = 1u << index;
+	if (c_pVAO && (c_pVAO->maskKnown & mask) && (c_pVAO->maskAttribs & mask)) { c_nFiltered++; return; }
+	glEnableVertexAttribArray(index);
+	if (c_pVAO) { c_pVAO->maskKnown |= mask; c_pVAO->maskAttribs |= mask; }
+	c_nIssued++;
+}
+
+void C3dglState::disableVertexAttribArray(GLuint index)
+{
+	if (index >= 32) { glDisableVertexAttribArray(index); c_nIssued++; return; }
+	unsigned mask = 1u << index;
+	if (c_pVAO && (c_pVAO->maskKnown & mask) && !(c_pVAO->maskAttribs & mask)) { c_nFiltered++; return; }
+	glDisableVertexAttribArray(index);
+	if (c_pVAO) { c_pVAO->maskKnown |= mask; c_pVAO->maskAttribs &= ~mask; }
+	c_nIssued++;
+}
+
+void C3dglState::depthMask(GLboolean flag)
+{
+	int n = flag ? 1 : 0;
+	if (c_nDepthMask == n) { c_nFiltered++; return; }
+	glDepthMask(flag);
+	c_nDepthMask = n;
+	c_nIssued++;
+}
+
+void C3dglState::depthFunc(GLenum func)
+{
+	if (c_depthFunc == func) { c_nFiltered++; return; }
+	glDepthFunc(func);
+	c_depthFunc = func;
+	c_nIssued++;
+}
+
+void C3dglState::colorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha)
+{
+	int n = (red ? 1 : 0) | (green ? 2 : 0) | (blue ? 4 : 0) | (alpha ? 8 : 0);
+	if (c_nColorMask == n) { c_nFiltered++; return; }
+	glColorMask(red, green, blue, alpha);
+	c_nColorMask = n;
+	c_nIssued++;
+}
+
+void C3dglState::blendFunc(GLenum sfactor, GLenum dfactor)
+{
+	if (c_blendSrc == sfactor && c_blendDst == dfactor) { c_nFiltered++; return; }
+	glBlendFunc(sfactor, dfactor);
+	c_blendSrc = sfactor;
+	c_blendDst = dfactor;
+	c_nIssued++;
+}
+
+void C3dglState::enable(GLenum cap)
+{
+	int &n = c_caps.insert(make_pair(cap, -1)).first->second;
+	if (n == 1) { c_nFiltered++; return; }
+	glEnable(cap);
+	n = 1;
+	c_nIssued++;
+}
+
+void C3dglState::disable(GLenum cap)
+{
+	int &n = c_caps.insert(make_pair(cap, -1)).first->second;
+	if (n == 0) { c_nFiltered++; return; }
+	glDisable(cap);
+	n = 0;
+	c_nIssued++;
+}
+
+void C3dglState::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	if (c_viewport[0] == x && c_viewport[1] == y && c_viewport[2] == width && c_viewport[3] == height) { c_nFiltered++; return; }
+	glViewport(x, y, width, height);
+	c_viewport[0] = x; c_viewport[1] = y; c_viewport[2] = width; c_viewport[3] = height;
+	c_nIssued++;
+}
+
+void C3dglState::getViewport(GLint viewport[4])
+{
+	if (c_viewport[2] < 0)
+		glGetIntegerv(GL_VIEWPORT, c_viewport);
+	for (unsigned i = 0; i < 4; i++)
+		viewport[i] = c_viewport[i];
+}
+
+void C3dglState::invalidate()
+{
+	c_idProgram = UNKNOWN;
+	c_idVAO = UNKNOWN;
+	c_pVAO = NULL;
+	c_vaos.clear();
+	c_buffers.clear();
+	c_bufferBases.clear();
+	c_activeTexture = UNKNOWN;
+	for (unsigned unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+		for (unsigned t = 0; t < TEX_TARGET_LAST; t++)
+			c_textures[unit][t] = UNKNOWN;
+	c_nDepthMask = -1;
+	c_depthFunc = UNKNOWN;
+	c_nColorMask = -1;
+	c_blendSrc = c_blendDst = UNKNOWN;
+	c_viewport[2] = c_viewport[3] = -1;
+	c_caps.clear();
+}
+
+void C3dglState::invalidateVertexArray()
+{
+	if (c_pVAO) *c_pVAO = VAO();
+	c_idVAO = UNKNOWN;
+	c_pVAO = NULL;
+	c_buffers.erase(GL_ARRAY_BUFFER);
+}
+
+void C3dglState::beginFrame()
+{
+	c_nLastIssued = c_nIssued;
+	c_nLastFiltered = c_nFiltered;
+	c_nIssued = c_nFiltered = 0;
+}
@@ -6,6 +6,7 @@
 #include "../GL/3dglShader.h"
 #include "../GL/3dglTerrain.h"
 #include "../GL/3dglBitmap.h"
+#include "../GL/3dglState.h"
 
 using std::vector;
 using namespace _3dgl;
@@ -160,22 +161,22 @@ bool C3dglTerrain::loadHeightmap(const std::string filename, float scaleHeight)
 
 	// Prepare Vertex Buffer
     glGenBuffers(1, &m_vertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    C3dglState::bindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
     glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
 
 	// Prepare Normal Buffer
     glGenBuffers(1, &m_normalBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, m_normalBuffer);
+    C3dglState::bindBuffer(GL_ARRAY_BUFFER, m_normalBuffer);
     glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * normals.size(), &normals[0], GL_STATIC_DRAW);
 
 	// Prepare TexCoords Buffer
 	glGenBuffers(1, &m_texCoordBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, m_texCoordBuffer);
+	C3dglState::bindBuffer(GL_ARRAY_BUFFER, m_texCoordBuffer);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * texCoords.size(), &texCoords[0], GL_STATIC_DRAW);
 
 	// Prepare Vertex Buffer for Visualisation of Normal Vectors
     glGenBuffers(1, &m_linesBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, m_linesBuffer);
+    C3dglState::bindBuffer(GL_ARRAY_BUFFER, m_linesBuffer);
     glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * lines.size(), &lines[0], GL_STATIC_DRAW);
 
 	// Generate Indices
@@ -206,7 +207,7 @@ bool C3dglTerrain::loadHeightmap(const std::string filename, float scaleHeight)
 
 	// Prepare Index Buffer
     glGenBuffers(1, &m_indexBuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+    C3dglState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), &indices[0], GL_STATIC_DRAW);
 
     return true;
@@ -214,6 +215,9 @@ bool C3dglTerrain::loadHeightmap(const std::string filename, float scaleHeight)
 
 void C3dglTerrain::render()
 {
+	// legacy vertex arrays are set up on the default VAO
+	C3dglState::bindVertexArray(0);
+
 	// check if a shading program is active
 	C3dglProgram *pProgram = C3dglProgram::GetCurrentProgram();
 	if (pProgram)
@@ -222,30 +226,38 @@ void C3dglTerrain::render()
 		GLuint attribNormal = pProgram->GetAttribLocation(C3dglProgram::ATTR_NORMAL);
 		GLuint attribTexCoord = pProgram->GetAttribLocation(C3dglProgram::ATTR_TEXCOORD);
 
-		// programmable pipeline
-		glEnableVertexAttribArray(attribVertex);
-		glEnableVertexAttribArray(attribNormal);
-		glEnableVertexAttribArray(attribTexCoord);
-
+		// programmable pipeline - the attributes not used by the program are not found (-1)
 		//Bind the vertex array and set the vertex pointer to point at it
-		glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
-		glVertexAttribPointer(attribVertex, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		if (attribVertex != (GLuint)-1)
+		{
+			C3dglState::enableVertexAttribArray(attribVertex);
+			C3dglState::bindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+			glVertexAttribPointer(attribVertex, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		}
 
 		// Bind the normal array and set the normal pointer to point at it
-		glBindBuffer(GL_ARRAY_BUFFER, m_normalBuffer);
-		glVertexAttribPointer(attribNormal, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		if (attribNormal != (GLuint)-1)
+		{
+			C3dglState::enableVertexAttribArray(attribNormal);
+			C3dglState::bindBuffer(GL_ARRAY_BUFFER, m_normalBuffer);
+			glVertexAttribPointer(attribNormal, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		}
 
 		// Bind the tex coord array and set the tex coord pointer to point at it
-		glBindBuffer(GL_ARRAY_BUFFER, m_texCoordBuffer);
-		glVertexAttribPointer(attribTexCoord, 2, GL_FLOAT, GL_FALSE, 0, 0);
+		if (attribTexCoord != (GLuint)-1)
+		{
+			C3dglState::enableVertexAttribArray(attribTexCoord);
+			C3dglState::bindBuffer(GL_ARRAY_BUFFER, m_texCoordBuffer);
+			glVertexAttribPointer(attribTexCoord, 2, GL_FLOAT, GL_FALSE, 0, 0);
+		}
 
 		//Bind the index array and draw triangles
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+		C3dglState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
 		glDrawElements(GL_TRIANGLES, (m_nSizeX - 1) * (m_nSizeZ - 1) * 6, GL_UNSIGNED_INT, 0);
 
-		glDisableVertexAttribArray(attribVertex);
-		glDisableVertexAttribArray(attribNormal);
-		glDisableVertexAttribArray(attribTexCoord);
+		if (attribVertex != (GLuint)-1) C3dglState::disableVertexAttribArray(attribVertex);
+		if (attribNormal != (GLuint)-1) C3dglState::disableVertexAttribArray(attribNormal);
+		if (attribTexCoord != (GLuint)-1) C3dglState::disableVertexAttribArray(attribTexCoord);
 	}
 	else
 	{
@@ -254,19 +266,19 @@ void C3dglTerrain::render()
 		glEnableClientState(GL_NORMAL_ARRAY);
 
 		//Bind the vertex array and set the vertex pointer to point at it
-		glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+		C3dglState::bindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
 		glVertexPointer(3, GL_FLOAT, 0, 0);
 
 		// Bind the normal array and set the normal pointer to point at it
-		glBindBuffer(GL_ARRAY_BUFFER, m_normalBuffer);
+		C3dglState::bindBuffer(GL_ARRAY_BUFFER, m_normalBuffer);
 		glNormalPointer(GL_FLOAT, 0, 0);
 
 		// Bind the tex coord array and set the tex coord pointer to point at it
-		glBindBuffer(GL_ARRAY_BUFFER, m_texCoordBuffer);
+		C3dglState::bindBuffer(GL_ARRAY_BUFFER, m_texCoordBuffer);
 		glTexCoordPointer(2, GL_FLOAT, 0, 0);
 
 		//Bind the index array and draw triangles
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+		C3dglState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
 		glDrawElements(GL_TRIANGLES, (m_nSizeX - 1) * (m_nSizeZ - 1) * 6, GL_UNSIGNED_INT, 0);
 
 		glDisableClientState(GL_VERTEX_ARRAY);
@@ -276,31 +288,35 @@ void C3dglTerrain::render()
 
 void C3dglTerrain::renderNormals()
 {
+	// legacy vertex arrays are set up on the default VAO
+	C3dglState::bindVertexArray(0);
+
 	// check if a shading program is active
 	C3dglProgram *pProgram = C3dglProgram::GetCurrentProgram();
 	if (pProgram)
 	{
 		GLuint attribVertex = pProgram->GetAttribLocation(C3dglProgram::ATTR_VERTEX);
+		if (attribVertex == (GLuint)-1) return;
 
 		// programmable pipeline
-		glDisable(GL_LIGHTING);
-		glEnableVertexAttribArray(attribVertex);
-		glBindBuffer(GL_ARRAY_BUFFER, m_linesBuffer);
+		C3dglState::disable(GL_LIGHTING);
+		C3dglState::enableVertexAttribArray(attribVertex);
+		C3dglState::bindBuffer(GL_ARRAY_BUFFER, m_linesBuffer);
 		glVertexAttribPointer(attribVertex, 3, GL_FLOAT, GL_FALSE, 0, 0);
 		glDrawArrays(GL_LINES, 0, m_nSizeX * m_nSizeZ * 2);
-		glDisableVertexAttribArray(attribVertex);
-		glEnable(GL_LIGHTING);
+		C3dglState::disableVertexAttribArray(attribVertex);
+		C3dglState::enable(GL_LIGHTING);
 	}
 	else
 	{
 		// fixed pipeline rendering
-		glDisable(GL_LIGHTING);
+		C3dglState::disable(GL_LIGHTING);
 		glEnableClientState(GL_VERTEX_ARRAY);
-		glBindBuffer(GL_ARRAY_BUFFER, m_linesBuffer);
+		C3dglState::bindBuffer(GL_ARRAY_BUFFER, m_linesBuffer);
 		glVertexPointer(3, GL_FLOAT, 0, 0);
 		glDrawArrays(GL_LINES, 0, m_nSizeX * m_nSizeZ * 2);
 		glDisableClientState(GL_VERTEX_ARRAY);
-		glEnable(GL_LIGHTING);
+		C3dglState::enable(GL_LIGHTING);
 	}
 }
 
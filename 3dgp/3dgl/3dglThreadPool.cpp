@@ -0,0 +1,91 @@
+#include "../gl/glew.h"
+#include "../gl/3dglThreadPool.h"
+
+using namespace std;
+using namespace _3dgl;
+
+C3dglThreadPool::C3dglThreadPool(unsigned nThreads)
+{
+	m_next = 0;
+	m_nJobs = m_nBusy = m_nBatch = 0;
+	m_bQuit = false;
+
+	if (nThreads == 0xFFFFFFFF)
+	{
+		unsigned nCores = thread::hardware_concurrency();
+		nThreads = nCores > 1 ? nCores - 1 : 0;
+	}
+	for (unsigned i = 0; i < nThreads; i++)
+		m_threads.push_back(thread(&C3dglThreadPool::run, this));
+}
+
+C3dglThreadPool::~C3dglThreadPool()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_bQuit = true;
+	}
+	m_cvWork.notify_all();
+	for (thread &t : m_threads)
+		t.join();
+}
+
+C3dglThreadPool &C3dglThreadPool::get()
+{
+	static C3dglThreadPool pool;
+	return pool;
+}
+
+void C3dglThreadPool::parallelFor(unsigned n, std::function<void(unsigned)> job)
+{
+	if (n == 0) return;
+	if (m_threads.empty() || n == 1)
+	{
+		for (unsigned i = 0; i < n; i++)
+			job(i);
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_job = job;
+		m_nJobs = n;
+		m_next = 0;
+		m_nBusy = m_threads.size();
+		m_nBatch++;
+	}
+	m_cvWork.notify_all();
+
+	// the calling thread takes part
+	work();
+
+	unique_lock<mutex> lock(m_mutex);
+	m_cvDone.wait(lock, [this] { return m_nBusy == 0; });
+	m_job = nullptr;
+}
+
+void C3dglThreadPool::work()
+{
+	for (unsigned i = m_next++; i < m_nJobs; i = m_next++)
+		m_job(i);
+}
+
+void C3dglThreadPool::run()
+{
+	unsigned nBatch = 0;
+	for (;;)
+	{
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_cvWork.wait(lock, [this, nBatch] { return m_bQuit || m_nBatch != nBatch; });
+			if (m_bQuit) return;
+			nBatch = m_nBatch;
+		}
+
+		work();
+
+		lock_guard<mutex> lock(m_mutex);
+		if (--m_nBusy == 0)
+			m_cvDone.notify_one();
+	}
+}
@@ -0,0 +1,81 @@
+#include "../GL/glew.h"
+#include "../GL/3dglUniformBuffer.h"
+#include "../GL/3dglState.h"
+
+// standard libraries
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+// GLM include files
+#include "../glm/mat3x3.hpp"
+#include "../glm/vec4.hpp"
+
+using namespace std;
+using namespace _3dgl;
+
+bool C3dglUniformBuffer::create(GLuint binding, GLsizeiptr size, const void *pData)
+{
+	if (m_id) destroy();
+	m_binding = binding;
+	m_size = size;
+	glGenBuffers(1, &m_id);
+	C3dglState::bindBuffer(GL_UNIFORM_BUFFER, m_id);
+	glBufferData(GL_UNIFORM_BUFFER, size, pData, GL_DYNAMIC_DRAW);
+	bind();
+	return true;
+}
+
+void C3dglUniformBuffer::destroy()
+{
+	if (m_id == 0) return;
+	C3dglState::deleteBuffers(1, &m_id);
+	m_id = 0;
+	m_size = 0;
+}
+
+void C3dglUniformBuffer::update(const void *pData, GLsizeiptr size, GLintptr offset)
+{
+	if (m_id == 0)
+		create(m_binding, offset + size);	// first use
+	else if (offset + size > m_size)
+	{
+		// the data outgrew the buffer - the new one keeps the old contents below the offset
+		GLuint idOld = m_id;
+		GLsizeiptr sizeKept = min((GLsizeiptr)offset, m_size);
+		glGenBuffers(1, &m_id);
+		m_size = offset + size;
+		C3dglState::bindBuffer(GL_UNIFORM_BUFFER, m_id);
+		glBufferData(GL_UNIFORM_BUFFER, m_size, NULL, GL_DYNAMIC_DRAW);
+		if (sizeKept > 0)
+		{
+			C3dglState::bindBuffer(GL_COPY_READ_BUFFER, idOld);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_UNIFORM_BUFFER, 0, 0, sizeKept);
+		}
+		C3dglState::deleteBuffers(1, &idOld);
+		bind();
+	}
+	C3dglState::bindBuffer(GL_UNIFORM_BUFFER, m_id);
+	glBufferSubData(GL_UNIFORM_BUFFER, offset, size, pData);
+}
+
+C3dglLightsBlock C3dglLightsBlock::toViewSpace(const glm::mat4 &matrixView) const
+{
+	C3dglLightsBlock block = *this;
+	block.lightDirectional.direction = glm::mat3(matrixView) * lightDirectional.direction;
+	for (unsigned i = 0; i < MAX_POINT_LIGHTS; i++)
+		block.lightPoint[i].position = glm::vec3(matrixView * glm::vec4(lightPoint[i].position, 1));
+	return block;
+}
+
+void C3dglUniformBuffer::bind()
+{
+	if (m_id == 0) return;
+	C3dglState::bindBufferBase(GL_UNIFORM_BUFFER, m_binding, m_id);
+}
+
+void C3dglUniformBuffer::bindRange(GLintptr offset, GLsizeiptr size)
+{
+	if (m_id == 0) return;
+	C3dglState::bindBufferRange(GL_UNIFORM_BUFFER, m_binding, m_id, offset, size);
+}
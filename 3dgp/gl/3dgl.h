@@ -33,6 +33,28 @@ freely, subject to the following restrictions:
 #include "3dglTerrain.h"
 #include "3dglSkyBox.h"
 #include "3dglBitmap.h"
+#include "3dglMaterial.h"
+#include "3dglRenderQueue.h"
+#include "3dglDrawList.h"
+#include "3dglState.h"
+#include "3dglUniform.h"
+#include "3dglUniformBuffer.h"
+#include "3dglProgramVariants.h"
+#include "3dglAsyncCompiler.h"
+#include "3dglThreadPool.h"
+#include "3dglClusteredLights.h"
+#include "3dglDeferredRenderer.h"
+#include "3dglLightSets.h"
+#include "3dglLightProbes.h"
+#include "3dglBVH.h"
+#include "3dglLightmap.h"
+#include "3dglAmbientOcclusion.h"
+#include "3dglShadowCascades.h"
+#include "3dglPointShadows.h"
+#include "3dglFrustumCuller.h"
+#include "3dglSceneBVH.h"
+#include "3dglOccluderProxy.h"
+#include "3dglOcclusionCuller.h"
 
 // link with AssImp and DevIL libraries
 #pragma comment (lib, "assimp.lib") 
@@ -0,0 +1,121 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+Per-vertex Ambient Occlusion.
+C3dglAmbientOcclusion bakes the ambient occlusion of each vertex of the meshes added
+into their colour streams (see C3dglModel::MESH::setColors): cosine weighted rays are
+cast from each vertex against a BVH of all the meshes added - a single model, or the
+whole scene - in SSE packets of 4, on the thread pool. Meshes drawn more than once
+get the average of their instances.
+Shaders built with VERTEX_AO scale the lighting by the interpolated occlusion - no
+per-pixel cost. The bake can be saved, and loaded the next time.
+Usage:
+add the models (or their main nodes) with their world transforms
+bake and save - or load the occlusion baked before (the same scene is required)
+apply - to upload the colour streams
+intersect for the closest hit, occluded for shadow rays - both are thread safe
+occluded4 tests packets of 4 rays with SSE - for coherent rays, such as the AO rays of a vertex
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglAmbientOcclusion_h_
+#define __3dglAmbientOcclusion_h_
+
+#include "3dglObject.h"
+#include "3dglModel.h"
+#include "3dglBVH.h"
+
+// standard libraries
+#include <vector>
+#include <map>
+
+#include "../glm/mat4x4.hpp"
+
+namespace _3dgl
+{
+
+class C3dglAmbientOcclusion : public C3dglObject
+{
+public:
+	// attribute location of the colour stream - aColor in the shaders
+	enum { ATTRIB_COLOR = 5 };
+
+private:
+	// a mesh instance - an occluder, and a receiver
+	struct ENTRY
+	{
+		unsigned iMesh;					// in m_meshes
+		glm::mat4 matrix;				// model (world) transform
+	};
+
+	// a mesh to bake
+	struct MESH
+	{
+		C3dglModel::MESH *pMesh;
+		const aiMesh *pAiMesh;
+		unsigned nInstances;
+		std::vector<float> occlusion;	// per vertex: 1 - open, 0 - fully occluded
+	};
+
+	std::vector<ENTRY> m_entries;
+	std::vector<MESH> m_meshes;
+	std::map<C3dglModel::MESH*, unsigned> m_index;
+
+	unsigned m_nSamples;				// rays per vertex and instance - rounded up to 4
+	float m_distance;					// the longest ray; 0 - a tenth of the scene size
+
+	C3dglBVH m_bvh;
+
+public:
+	C3dglAmbientOcclusion() : C3dglObject()	{ m_nSamples = 64; m_distance = 0; }
+
+	// iNode is one of the main nodes of the model or -1 for the entire model
+	void add(C3dglModel &model, glm::mat4 matrix = glm::mat4(1), int iNode = -1);
+	void clear();
+
+	void setSamples(unsigned nSamples)		{ m_nSamples = nSamples; }
+	void setDistance(float distance)		{ m_distance = distance; }
+
+	bool bake();
+	// binary file - the occlusion of all the vertices, in the order the meshes were added
+	bool save(const std::string &fileName);
+	bool load(const std::string &fileName);
+
+	// the colour streams: (occlusion, occlusion, occlusion, 1)
+	void apply();
+
+	unsigned getMeshCount()					{ return (unsigned)m_meshes.size(); }
+
+	std::string getName()	{ return "Ambient Occlusion"; }
+
+private:
+	void addNode(C3dglModel &model, aiNode *pNode, glm::mat4 m);
+	float bakeVertex(const glm::vec3 &pos, const glm::vec3 &normal, float distance, unsigned seed);
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglAmbientOcclusion_h_
@@ -0,0 +1,71 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+Background shader compilation.
+C3dglAsyncCompiler compiles shaders and links programs without blocking the
+render thread. It uses KHR_parallel_shader_compile (or the ARB version) when
+the driver supports it; otherwise a worker thread with a shared GL context
+does the job (Windows only). Without either, compilation is synchronous.
+See C3dglProgram::LinkAsync, C3dglProgram::Poll and C3dglProgram::Resolve.
+Usage:
+init once, with the main GL context current
+C3dglProgram::LinkAsync instead of Link, then Resolve every frame
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglAsyncCompiler_h_
+#define __3dglAsyncCompiler_h_
+
+// standard libraries
+#include <vector>
+
+namespace _3dgl
+{
+
+class C3dglAsyncCompiler
+{
+public:
+	enum MODE { MODE_SYNC, MODE_PARALLEL, MODE_WORKER };
+
+private:
+	static MODE c_mode;
+
+public:
+	// picks the mode; nThreads limits the driver compiler threads (0xFFFFFFFF - driver default)
+	static MODE init(bool bAllowWorker = true, GLuint nThreads = 0xFFFFFFFF);
+	static void shutdown();
+	static MODE getMode()									{ return c_mode; }
+
+	// compile the shaders and link the program - returns immediately
+	static void submit(GLuint idProgram, const std::vector<GLuint> &shaders);
+
+	// true once the program is linked; never blocks
+	static bool isComplete(GLuint idProgram);
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglAsyncCompiler_h_
@@ -0,0 +1,136 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+Bounding Volume Hierarchy.
+C3dglBVH is a binary BVH over a triangle soup, built with the binned surface area
+heuristic (SAH), for ray casting on the CPU. It does not need a GL context.
+The triangles of each leaf are also stored in packs of 4 (SoA), so that
+a ray is tested against 4 triangles at once with SSE.
+Usage:
+addTriangle for all the triangles, then build
+intersect for the closest hit, occluded for shadow rays - both are thread safe
+occluded4 tests packets of 4 rays with SSE - for coherent rays, such as the AO rays of a vertex
+intersect and occluded with arrays of rays - batches, spread over the thread pool
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglBVH_h_
+#define __3dglBVH_h_
+
+#include "3dglObject.h"
+
+// standard libraries
+#include <vector>
+
+#include "../glm/vec3.hpp"
+
+namespace _3dgl
+{
+
+class C3dglBVH : public C3dglObject
+{
+public:
+	struct HIT
+	{
+		float t;						// ray parameter
+		unsigned iTriangle;				// as returned by addTriangle
+		float u, v;						// barycentric coordinates of the 2nd and 3rd vertex
+	};
+
+private:
+	struct NODE
+	{
+		glm::vec3 bbMin;
+		unsigned first;					// inner node: the left child (the right one follows it); leaf: the first triangle
+		glm::vec3 bbMax;
+		unsigned count;					// 0 for inner nodes
+	};
+
+	struct TRIANGLE
+	{
+		glm::vec3 a, e1, e2;			// a vertex and two edges - as used by the intersection test
+		unsigned index;					// the original triangle index
+	};
+
+	// 4 triangles in SoA form; the leaves start at a pack boundary and are padded with degenerate triangles
+	struct TRIANGLE4
+	{
+		float ax[4], ay[4], az[4];
+		float e1x[4], e1y[4], e1z[4];
+		float e2x[4], e2y[4], e2z[4];
+	};
+
+	std::vector<glm::vec3> m_vertices;	// as added - 3 per triangle
+	std::vector<TRIANGLE> m_triangles;	// in the leaf order, padded
+	std::vector<TRIANGLE4> m_packs;		// m_triangles in packs of 4
+	std::vector<NODE> m_nodes;
+	unsigned m_nMaxLeaf;
+
+	// build data
+	struct BUILD { glm::vec3 bbMin, bbMax, centroid; };
+	std::vector<BUILD> m_build;
+	std::vector<unsigned> m_order;
+
+public:
+	C3dglBVH() : C3dglObject()		{ m_nMaxLeaf = 4; }
+
+	void clear();
+
+	// returns the triangle index
+	unsigned addTriangle(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c);
+
+	// builds the hierarchy - call after all the triangles are added
+	void build(unsigned nMaxLeaf = 4);
+
+	// the closest hit with t in (0, tMax)
+	bool intersect(const glm::vec3 &orig, const glm::vec3 &dir, float tMax, HIT &hit) const;
+	// any hit with t in (0, tMax)
+	bool occluded(const glm::vec3 &orig, const glm::vec3 &dir, float tMax) const;
+	// as above, for a packet of 4 rays traversed together; returns the mask of the occluded rays (bit i - ray i)
+	unsigned occluded4(const glm::vec3 orig[4], const glm::vec3 dir[4], float tMax) const;
+
+	// batches of n rays, on the thread pool: the closest hits (a miss has t == tMax and iTriangle == -1),
+	// or the occlusion of each ray. Both return the number of the rays that hit
+	unsigned intersect(const glm::vec3 *orig, const glm::vec3 *dir, unsigned n, float tMax, HIT *hits) const;
+	unsigned occluded(const glm::vec3 *orig, const glm::vec3 *dir, unsigned n, float tMax, bool *pOccluded) const;
+
+	unsigned getTriangleCount()		{ return (unsigned)(m_vertices.size() / 3); }
+	const glm::vec3 *getTriangle(unsigned i) const	{ return &m_vertices[3 * i]; }
+	unsigned getNodeCount()			{ return (unsigned)m_nodes.size(); }
+	bool isBuilt()					{ return !m_nodes.empty(); }
+
+	std::string getName()	{ return "BVH"; }
+
+private:
+	void buildNode(unsigned iNode, unsigned first, unsigned count, unsigned depth);
+	void addLeafTriangles(NODE &node);
+	template <bool bAnyHit>
+	bool traverse(const glm::vec3 &orig, const glm::vec3 &dir, float tMax, HIT &hit) const;
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglBVH_h_
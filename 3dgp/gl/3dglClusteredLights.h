@@ -0,0 +1,119 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+Clustered forward lighting.
+C3dglClusteredLights splits the view frustum into a grid of clusters (froxels):
+screen space tiles, exponentially sliced in depth. Every frame, the point lights
+are binned into the clusters they reach - the range follows from the light
+radius and cutoff (see CalculateAttenuation in basic.frag). The lights, the
+per-cluster ranges and the light index list go to the GPU as texture buffers,
+so that each fragment only evaluates the lights of its own cluster.
+Usage:
+create once (before the programs are linked - it registers the sampler units)
+every frame: clear, add the point lights (world space), update, bind
+shaders: #include "clusters.glsl" and call CalculateClusteredLightsColour
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglClusteredLights_h_
+#define __3dglClusteredLights_h_
+
+#include "3dglObject.h"
+#include "3dglUniformBuffer.h"
+
+// standard libraries
+#include <vector>
+
+#include "../glm/vec4.hpp"
+#include "../glm/mat4x4.hpp"
+
+namespace _3dgl
+{
+
+class C3dglClusteredLights : public C3dglObject
+{
+public:
+	// texture units of the light lists - must not be used by the materials
+	enum { UNIT_LIGHTS = 5, UNIT_RANGES = 6, UNIT_INDICES = 7 };
+	// RGBA32F texels of each light in the light buffer - must match FetchClusterLight in clusters.glsl
+	enum { TEXELS_PER_LIGHT = 5 };
+
+private:
+	unsigned m_nx, m_ny, m_nz;			// grid size
+	std::vector<C3dglPointLightBlock> m_lights;		// as added - world space
+
+	// view space bounds of the clusters, SoA for the SIMD tests; rebuilt when the projection changes
+	std::vector<float> m_minX, m_minY, m_minZ, m_maxX, m_maxY, m_maxZ;
+	glm::mat4 m_matrixProjection;
+	float m_near, m_far;
+
+	// per frame data
+	struct LIGHT { glm::vec3 pos; float range; int x0, y0, x1, y1; };	// x, y - the range of tiles
+	std::vector<LIGHT> m_viewLights;				// active lights only - view space
+	std::vector<std::vector<unsigned> > m_sliceLights;	// lights reaching each depth slice
+	struct SLICE { std::vector<unsigned> counts, first, tiles, lights, indices; };
+	std::vector<SLICE> m_slices;					// light lists of each slice, sorted by tile
+	std::vector<glm::vec4> m_gpuLights;
+	std::vector<GLuint> m_ranges, m_indices;
+
+	C3dglClustersBlock m_block;
+	C3dglUniformBuffer m_ubo;
+	GLuint m_idBuffer[3], m_idTexture[3];
+	GLint m_maxTexels;
+
+public:
+	C3dglClusteredLights();
+
+	// grid size: tiles along x and y, slices along z
+	bool create(unsigned nx = 16, unsigned ny = 9, unsigned nz = 24);
+	void destroy();
+
+	// the lights for the current frame - in world space, as in C3dglLightsBlock
+	void clear()								{ m_lights.clear(); }
+	void add(const C3dglPointLightBlock &light)	{ m_lights.push_back(light); }
+	size_t getLightCount()						{ return m_lights.size(); }
+
+	// bins the lights and uploads the lists; width and height are the viewport size.
+	// Perspective projections only
+	void update(const glm::mat4 &matrixView, const glm::mat4 &matrixProjection, int width, int height);
+
+	// binds the light lists to their texture units and the Clusters block to its binding point
+	void bind();
+
+	// statistics of the last update
+	unsigned getActiveLightCount()				{ return (unsigned)m_viewLights.size(); }
+	unsigned getIndexCount()					{ return (unsigned)m_indices.size(); }
+
+	std::string getName()	{ return "Clustered Lights"; }
+
+private:
+	void _buildClusters(const glm::mat4 &matrixProjection);
+	void _binSlice(unsigned z);
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglClusteredLights_h_
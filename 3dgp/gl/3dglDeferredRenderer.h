@@ -0,0 +1,115 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+Deferred shading.
+C3dglDeferredRenderer is an alternative to the forward path of basic.frag.
+The geometry pass writes albedo, normals, material parameters and depth into
+a G-buffer (the GBUFFER variants of basic.frag). Each point light is then
+accumulated within its screen-space bounds, sized by the range of its
+attenuation; a final pass composes the image into the default framebuffer.
+The cost of lighting no longer depends on the geometric complexity.
+Usage:
+create once (before the programs are linked - it registers the sampler units),
+resize when the viewport changes
+every frame: clear and add the point lights (world space), then
+beginGeometry, draw the opaque geometry with the GBUFFER variants (see
+C3dglProgramVariants::setGBuffer), and render
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglDeferredRenderer_h_
+#define __3dglDeferredRenderer_h_
+
+#include "3dglObject.h"
+#include "3dglShader.h"
+#include "3dglUniformBuffer.h"
+
+// standard libraries
+#include <vector>
+
+#include "../glm/mat4x4.hpp"
+
+namespace _3dgl
+{
+
+class C3dglDeferredRenderer : public C3dglObject
+{
+public:
+	// G-buffer render targets - the outputs of basic.frag with GBUFFER
+	enum RT { RT_ALBEDO, RT_NORMAL, RT_DIFFUSE, RT_AMBIENT, RT_LIGHT, RT_LAST };
+	// texture units of the G-buffer: UNIT_GBUFFER + RT, the depth is UNIT_GBUFFER + RT_LAST
+	enum { UNIT_GBUFFER = 8 };
+
+private:
+	GLuint m_idFBO;					// all render targets and the depth - the geometry pass
+	GLuint m_idFBOLight;			// RT_LIGHT only - the depth is sampled by the light passes
+	GLuint m_idTex[RT_LAST], m_idDepth;
+	GLuint m_idVAO;					// empty - the full screen triangle is generated in the vertex shader
+	int m_width, m_height;
+
+	C3dglShader m_vertexShader, m_fragDirLight, m_fragPointLight, m_fragCompose;
+	C3dglProgram m_programDirLight, m_programPointLight, m_programCompose;
+	GLuint m_locLightData;
+
+	std::vector<C3dglPointLightBlock> m_lights;		// as added - world space
+	unsigned m_nLightsDrawn, m_nLightsCulled;
+
+public:
+	C3dglDeferredRenderer();
+
+	// pathShaders is the directory of deferred.vert, deferred_light.frag and deferred_compose.frag
+	bool create(int width, int height, std::string pathShaders = "shaders/");
+	bool resize(int width, int height);
+	void destroy();
+
+	// the point lights for the current frame - in world space, as in C3dglLightsBlock
+	void clear()								{ m_lights.clear(); }
+	void add(const C3dglPointLightBlock &light)	{ m_lights.push_back(light); }
+	size_t getLightCount()						{ return m_lights.size(); }
+
+	// binds and clears the G-buffer - draw the opaque geometry next
+	void beginGeometry();
+
+	// accumulates the lights and composes the image into the default framebuffer; the depth is restored too,
+	// so that forward rendered objects can follow. The directional light is taken from the Lights block
+	void render(const glm::mat4 &matrixView, const glm::mat4 &matrixProjection, bool bDirLight = true);
+
+	// statistics of the last render
+	unsigned getLightsDrawn()					{ return m_nLightsDrawn; }
+	unsigned getLightsCulled()					{ return m_nLightsCulled; }
+
+	int getWidth()								{ return m_width; }
+	int getHeight()								{ return m_height; }
+
+	std::string getName()	{ return "Deferred Renderer"; }
+
+private:
+	bool _getScreenBounds(const glm::vec3 &pos, float range, const glm::mat4 &matrixProjection, int &x0, int &y0, int &x1, int &y1);
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglDeferredRenderer_h_
@@ -0,0 +1,221 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+Retained-mode draw list.
+Objects (model + material + transform) are registered once. The list compiles
+them into a flat array of draw packets which is re-executed every frame through
+a C3dglRenderQueue (sorted by program, material, texture and depth).
+Changing a transform only patches the packets of the affected object.
+The world space bounds of the packets are kept in a C3dglFrustumCuller, so
+that only the packets within the view frustum are submitted, and in a
+C3dglSceneBVH for the scene queries: the objects touched by a light, the ray
+picks, and the frustum culling in the background (beginCull).
+Given a C3dglOcclusionCuller, the packets passing the frustum test are also
+tested against the depth of the biggest meshes on the screen, rasterized on
+the CPU (the meshes need the occluder proxies or the BVHs - see
+C3dglModel::enableOccluderProxy and C3dglModel::enableBVH).
+Usage:
+add to register an object - returns the object id
+setMatrix, setMaterial to update an object
+render to draw all the objects (or the visible ones, given the projection)
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglDrawList_h_
+#define __3dglDrawList_h_
+
+#include "3dglObject.h"
+#include "3dglModel.h"
+#include "3dglMaterial.h"
+#include "3dglRenderQueue.h"
+#include "3dglProgramVariants.h"
+#include "3dglLightSets.h"
+#include "3dglLightProbes.h"
+#include "3dglLightmap.h"
+#include "3dglFrustumCuller.h"
+#include "3dglSceneBVH.h"
+#include "3dglOcclusionCuller.h"
+
+// standard libraries
+#include <vector>
+
+#include "../glm/mat4x4.hpp"
+
+namespace _3dgl
+{
+
+class C3dglDrawList : public C3dglObject
+{
+	struct OBJECT
+	{
+		C3dglModel *pModel;
+		C3dglMaterial *pMaterial;
+		int iNode;						// -1 for the entire model
+		glm::mat4 matrix;				// model (world) transform
+		bool bAlive;
+		bool bProbeLit;					// lit by the light probes, if set
+		bool bDynamic;					// moved every frame, if set - kept out of cached shadows
+		bool bCastShadows;				// drawn by renderDepth, if set
+		unsigned revision;				// of the last change - see getSignature
+		std::vector<unsigned> packets;	// indices of the packets in m_packets
+	};
+
+	struct PACKET
+	{
+		unsigned idObject;
+		C3dglModel::MESH *pMesh;
+		C3dglMaterial *pMaterial;
+		glm::mat4 matrixNode;			// node transform, relative to the object
+		glm::mat4 matrix;				// final world transform = object matrix * node transform
+		glm::vec3 bbMin, bbMax;			// world space AABB
+		unsigned proxy;					// in m_bvh
+		C3dglSHProbe probe;				// interpolated in submit, for probe lit objects
+	};
+
+	std::vector<OBJECT> m_objects;
+	std::vector<PACKET> m_packets;
+	bool m_bCompiled;
+	unsigned m_nStaticRevision;				// changes whenever any static object does - see getStaticRevision
+	unsigned m_nRevision;					// counts all the changes
+	unsigned m_nRevisionRemoved;			// of the last object removed
+
+	C3dglRenderQueue m_queue;
+	C3dglProgramVariants *m_pVariants;		// if NULL, the current program is used
+	C3dglLightSets *m_pLightSets;			// if NULL, all objects share the Lights block currently bound
+	C3dglLightProbes *m_pLightProbes;		// if NULL, probe lit objects are lit as all the others
+	C3dglLightmap *m_pLightmap;				// if NULL, no object is lightmapped
+
+	C3dglFrustumCuller m_culler;			// world bounds of the packets, in the packet order
+	bool m_bCulled;							// if set, submit skips the packets culled by the last cull
+	const std::vector<unsigned> *m_pVisible;	// if set, submit takes these packets only - found by the BVH or the occlusion culler
+	unsigned m_nVisible;					// packets visible in the last render (with the projection) or renderDepth
+	C3dglSceneBVH m_bvh;					// world bounds of the packets - user data is the packet index
+	int m_iCullQuery;						// the frustum query started by beginCull, -1 if none
+	std::vector<unsigned> m_found;			// scratch for the queries
+	C3dglOcclusionCuller *m_pOcclusionCuller;	// if NULL, no occlusion culling
+	unsigned m_nOccluded;					// packets occluded in the last render
+
+public:
+	C3dglDrawList() : C3dglObject()		{ m_bCompiled = true; m_bCulled = false; m_pVisible = NULL; m_nVisible = 0; m_iCullQuery = -1; m_pOcclusionCuller = NULL; m_nOccluded = 0; m_nStaticRevision = m_nRevision = m_nRevisionRemoved = 0; m_pVariants = NULL; m_pLightSets = NULL; m_pLightProbes = NULL; m_pLightmap = NULL; }
+
+	void destroy()									{ m_bvh.destroy(); m_queue.destroy(); }
+
+	// register an object; iNode is one of the main nodes of the model or -1 for the entire model. Returns the object id
+	unsigned add(C3dglModel &model, C3dglMaterial *pMaterial, glm::mat4 matrix, int iNode = -1);
+	void remove(unsigned id);
+	void clear();
+
+	// patch an object
+	void setMatrix(unsigned id, glm::mat4 matrix);
+	void setMaterial(unsigned id, C3dglMaterial *pMaterial);
+	void setProbeLit(unsigned id, bool bProbeLit)	{ if (id < m_objects.size()) m_objects[id].bProbeLit = bProbeLit; }
+	void setCastShadows(unsigned id, bool bCast)	{ if (id < m_objects.size()) { m_objects[id].bCastShadows = bCast; m_objects[id].revision = ++m_nRevision; m_nStaticRevision++; } }
+	void setDynamic(unsigned id, bool bDynamic)		{ if (id < m_objects.size()) { m_objects[id].bDynamic = bDynamic; m_nStaticRevision++; } }
+
+	glm::mat4 getMatrix(unsigned id)				{ return m_objects[id].matrix; }
+	C3dglMaterial *getMaterial(unsigned id)			{ return m_objects[id].pMaterial; }
+	C3dglModel *getModel(unsigned id)				{ return m_objects[id].pModel; }
+	int getNode(unsigned id)						{ return m_objects[id].iNode; }
+	unsigned getObjectCount()						{ return m_objects.size(); }
+	unsigned getPacketCount()						{ return m_packets.size(); }
+	// changes when a static object is added, removed or moved - caches of the static geometry (such as the shadows) are stale then
+	unsigned getStaticRevision()					{ return m_nStaticRevision; }
+	// a signature of the objects within the sphere and of their last changes - it changes when anything moves
+	// in, out or within the sphere (or when any object is removed)
+	unsigned getSignature(const glm::vec3 &centre, float radius);
+
+	// (re)builds the packet array - called automatically by render when needed
+	void compile();
+
+	// shader permutations: each packet is drawn with the cheapest variant covering its material
+	void setVariants(C3dglProgramVariants *pVariants)	{ m_pVariants = pVariants; }
+	C3dglProgramVariants *getVariants()				{ return m_pVariants; }
+
+	// per-object lights: each packet gets the most important lights reaching its bounding sphere
+	void setLightSets(C3dglLightSets *pLightSets)	{ m_pLightSets = pLightSets; }
+	C3dglLightSets *getLightSets()					{ return m_pLightSets; }
+
+	// light probes: probe lit objects (see setProbeLit) take their point lights from the probes - at a constant cost
+	void setLightProbes(C3dglLightProbes *pLightProbes)	{ m_pLightProbes = pLightProbes; }
+	C3dglLightProbes *getLightProbes()				{ return m_pLightProbes; }
+
+	// lightmap: the packets found in the lightmap take the baked directional light from it (requires the variants)
+	void setLightmap(C3dglLightmap *pLightmap)		{ m_pLightmap = pLightmap; }
+	C3dglLightmap *getLightmap()					{ return m_pLightmap; }
+
+	// occlusion culling: render with the projection selects the occluders among the visible packets, rasterizes them
+	// and tests the rest against them
+	void setOcclusionCuller(C3dglOcclusionCuller *pOcclusionCuller)	{ m_pOcclusionCuller = pOcclusionCuller; }
+	C3dglOcclusionCuller *getOcclusionCuller()		{ return m_pOcclusionCuller; }
+
+	// submit all objects to a render queue; the queue refers to the draw list probes - flush before the next submit
+	void submit(C3dglRenderQueue &queue);
+
+	// render all objects using the current program (or the variants, if set)
+	void render(glm::mat4 matrixView);
+	// render the objects within the view frustum only - as found by beginCull, if called, or by the SIMD culler
+	void render(glm::mat4 matrixView, glm::mat4 matrixProjection);
+	// starts the frustum culling on the scene BVH worker thread; call after the objects are moved for the frame,
+	// any later setMatrix waits for it
+	void beginCull(const glm::mat4 &matrixViewProj);
+
+	// the object hit first by the ray, or -1; the triangles are tested if the model has the BVHs (C3dglModel::enableBVH),
+	// otherwise the world boxes of its meshes
+	int pick(const glm::vec3 &orig, const glm::vec3 &dir, float tMax = 1e10f, float *pDistance = NULL);
+
+	// frustum culling statistics of the last render (with the projection) or renderDepth(matrixViewProj) - in packets
+	unsigned getVisibleCount()						{ return m_nVisible; }
+	unsigned getCulledCount()						{ return (unsigned)m_packets.size() - m_nVisible; }
+	// of the culled ones, the packets occluded in the last render - 0 without the occlusion culler
+	unsigned getOccludedCount()						{ return m_nOccluded; }
+
+	// depth only (shadow maps), with the current program and no materials, the shadow casters only; culled against the sides
+	// and the far plane of matrixViewProj - not the near plane: use GL_DEPTH_CLAMP. Returns the number of packets drawn
+	enum { DRAW_STATIC = 1, DRAW_DYNAMIC = 2, DRAW_ALL = 3 };
+	unsigned renderDepth(const glm::mat4 &matrixViewProj, unsigned filter = DRAW_ALL);
+	// depth only, the objects whose world boxes touch the sphere - in world space, the projection is left to the shaders (point shadows)
+	unsigned renderDepth(const glm::vec3 &centre, float radius, unsigned filter = DRAW_ALL);
+
+	C3dglRenderQueue &getQueue()					{ return m_queue; }
+	C3dglSceneBVH &getSceneBVH()					{ return m_bvh; }
+
+	std::string getName()	{ return "Draw List"; }
+
+private:
+	void compileNode(unsigned idObject, aiNode *pNode, glm::mat4 m);
+	void getBoundingSphere(PACKET &packet, glm::vec3 &centre, float &radius);
+	void updateBounds(unsigned iPacket);
+	void submitPacket(C3dglRenderQueue &queue, unsigned iPacket);
+	// the packets whose world boxes touch the sphere, in the packet order - in m_found
+	void findPackets(const glm::vec3 &centre, float radius);
+	// occlusion culling of the packets passing the frustum culling - listed in pVisible or, if NULL, marked in m_culler;
+	// the packets not occluded go to m_found
+	void cullOccluded(const glm::mat4 &matrixView, const glm::mat4 &matrixProjection, const std::vector<unsigned> *pVisible);
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglDrawList_h_
@@ -0,0 +1,104 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+SIMD frustum culling.
+C3dglFrustumCuller keeps the world space bounding volumes of the drawn meshes
+in SoA arrays (structure of arrays: one array per coordinate) - the AABB as its
+centre and extents, and the bounding sphere around the same centre. The
+volumes are tested against the frustum planes eight at a time (SSE, or AVX if
+enabled); a volume is culled if it is entirely behind any of the planes, using
+the tighter of the box and the sphere for each plane.
+Usage:
+resize to set the number of volumes, set to update them
+getPlanes to extract the planes of a view-projection matrix
+cull to test all the volumes, then isVisible for each
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglFrustumCuller_h_
+#define __3dglFrustumCuller_h_
+
+#include "3dglObject.h"
+
+// standard libraries
+#include <vector>
+
+#include "../glm/vec3.hpp"
+#include "../glm/vec4.hpp"
+#include "../glm/mat4x4.hpp"
+
+// assimp include file
+#include "assimp/types.h"
+
+namespace _3dgl
+{
+
+class C3dglFrustumCuller : public C3dglObject
+{
+	// SoA bounding volumes - padded to a multiple of 8
+	std::vector<float> m_cx, m_cy, m_cz;	// centres
+	std::vector<float> m_ex, m_ey, m_ez;	// AABB half extents
+	std::vector<float> m_r;				// sphere radii
+	unsigned m_n;
+
+	// results of the last cull: one bit per volume, a byte per 8 volumes
+	std::vector<unsigned char> m_mask;
+	unsigned m_nVisible;
+
+public:
+	C3dglFrustumCuller() : C3dglObject()	{ m_n = m_nVisible = 0; }
+
+	// the number of the volumes; the new ones are empty (never visible) until set
+	void resize(unsigned n);
+	unsigned size()							{ return m_n; }
+
+	// a volume in world space
+	void set(unsigned i, const glm::vec3 &centre, const glm::vec3 &extent, float radius);
+	// a local space bounding box (as C3dglModel::MESH::getBB) under a model transform
+	void set(unsigned i, const aiVector3D bb[2], const glm::mat4 &matrix);
+	// the world space volumes of a local space bounding box under a model transform, as used by set
+	static void getBounds(const aiVector3D bb[2], const glm::mat4 &matrix, glm::vec3 &centre, glm::vec3 &extent, float &radius);
+
+	// marks visible the volumes listed, all the others culled - when found by other means (see C3dglSceneBVH)
+	unsigned cull(const std::vector<unsigned> &visible);
+
+	// the normalised planes of the frustum (Gribb-Hartmann), pointing inwards: left, right, bottom, top, far, near -
+	// the near plane is the last one, so that the first five may be used with GL_DEPTH_CLAMP
+	static void getPlanes(const glm::mat4 &matrixViewProj, glm::vec4 planes[6]);
+
+	// tests all the volumes against the planes; returns the number of the visible ones
+	unsigned cull(const glm::vec4 *planes, unsigned nPlanes = 6);
+	bool isVisible(unsigned i)				{ return i < m_n && (m_mask[i >> 3] >> (i & 7)) & 1; }
+
+	unsigned getVisibleCount()				{ return m_nVisible; }
+	unsigned getCulledCount()				{ return m_n - m_nVisible; }
+
+	std::string getName()	{ return "Frustum Culler"; }
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglFrustumCuller_h_
@@ -0,0 +1,110 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+Light Probes.
+C3dglLightProbes bakes the point lights into a regular grid of L2 spherical
+harmonics irradiance probes. Probes are interpolated per object on the CPU and
+sent with each draw, as nine coefficients (and the ambient terms); shaders built
+with SH_PROBES then light the object at a constant cost, whatever the number of
+lights. Meant for small or distant dynamic objects - the lights are not occluded
+and their specular highlights are lost.
+Usage:
+create once, with the grid bounds (world space)
+every frame: clear and add the point lights, then update - rebakes only if the lights changed
+sample to interpolate a probe, C3dglSHProbe::apply to send it to a program
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglLightProbes_h_
+#define __3dglLightProbes_h_
+
+#include "3dglObject.h"
+#include "3dglUniformBuffer.h"
+
+// standard libraries
+#include <vector>
+
+#include "../glm/vec3.hpp"
+#include "../glm/vec4.hpp"
+
+namespace _3dgl
+{
+
+class C3dglProgram;
+
+// SH irradiance probe - see probes.glsl
+struct C3dglSHProbe
+{
+	// L2 coefficients, convolved with the cosine lobe and premultiplied by the basis constants:
+	// irradiance(n) = sh[0] + sh[1] y + sh[2] z + sh[3] x + sh[4] xy + sh[5] yz + sh[6] (3z^2 - 1) + sh[7] xz + sh[8] (x^2 - y^2)
+	glm::vec3 sh[9];
+	// rgb - the lights' ambient terms; a - the weight of material.diffuse (see CalculateDiffuse)
+	glm::vec4 ambient;
+
+	// sends the probe to the program (shCoeffs, shAmbient)
+	void apply(C3dglProgram *pProgram) const;
+};
+
+class C3dglLightProbes : public C3dglObject
+{
+	glm::vec3 m_min, m_max;							// grid bounds
+	unsigned m_nx, m_ny, m_nz;
+	std::vector<C3dglSHProbe> m_probes;				// x fastest, then y, then z
+
+	std::vector<C3dglPointLightBlock> m_lights;		// as added
+	std::vector<C3dglPointLightBlock> m_lightsBaked;	// as of the last bake
+	bool m_bBaked;
+
+public:
+	C3dglLightProbes();
+
+	bool create(const glm::vec3 &minBound, const glm::vec3 &maxBound, unsigned nx = 8, unsigned ny = 4, unsigned nz = 8);
+	void destroy()								{ m_probes.clear(); m_lightsBaked.clear(); m_bBaked = false; }
+
+	// the point lights - world space, as in C3dglLightsBlock
+	void clear()								{ m_lights.clear(); }
+	void add(const C3dglPointLightBlock &light)	{ m_lights.push_back(light); }
+
+	// rebakes the grid if the lights changed since the last bake; returns true if rebaked
+	bool update();
+	// unconditional bake
+	void bake();
+
+	// trilinear interpolation of the probes; positions outside the grid are clamped to it
+	void sample(const glm::vec3 &pos, C3dglSHProbe &probe);
+
+	unsigned getProbeCount()					{ return (unsigned)m_probes.size(); }
+	glm::vec3 getProbePos(unsigned x, unsigned y, unsigned z);
+
+	std::string getName()	{ return "Light Probes"; }
+
+private:
+	void bakeProbe(unsigned i);
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglLightProbes_h_
@@ -0,0 +1,106 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+Per-object light sets.
+C3dglLightSets assigns point lights to the drawn objects on the CPU: the world
+bounding sphere of an object is tested against the influence sphere of each
+light (its attenuation range), the surviving lights are ranked by their
+estimated contribution and only the top K are kept. Each distinct set is stored
+as a Lights block in one uniform buffer and bound per object, so the shaders
+loop over the lights of the object only - and objects out of reach of all the
+lamps evaluate no point lights at all.
+Usage:
+create once
+every frame: setDirectional, clear and add the point lights (world space);
+C3dglDrawList::render does the rest (begin, assign, upload, and bind per packet).
+The Lights binding point is left at the last set - rebind the per-frame Lights buffer afterwards
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglLightSets_h_
+#define __3dglLightSets_h_
+
+#include "3dglObject.h"
+#include "3dglUniformBuffer.h"
+
+// standard libraries
+#include <vector>
+#include <map>
+
+#include "../glm/vec3.hpp"
+#include "../glm/mat4x4.hpp"
+
+namespace _3dgl
+{
+
+class C3dglLightSets : public C3dglObject
+{
+	unsigned m_nMaxLights;								// K - up to C3dglLightsBlock::MAX_POINT_LIGHTS
+	C3dglDirLightBlock m_lightDirectional;
+	std::vector<C3dglPointLightBlock> m_lights;		// as added - world space
+
+	// per frame data
+	struct LIGHT { glm::vec3 pos; float range; float intensity; unsigned index; };
+	std::vector<LIGHT> m_candidates;					// lights switched on
+	std::vector<std::pair<float, unsigned> > m_ranked;	// contribution, candidate - scratch for assign
+	std::vector<unsigned> m_key;						// scratch for assign
+	std::map<std::vector<unsigned>, unsigned> m_sets;	// distinct sets (sorted candidates) and their ids
+	std::vector<unsigned char> m_data;					// uniform buffer image - one Lights block per set
+	glm::mat4 m_matrixView;
+
+	C3dglUniformBuffer m_ubo;
+	GLsizeiptr m_stride;								// Lights block size rounded up to the offset alignment
+
+public:
+	C3dglLightSets();
+
+	bool create(unsigned nMaxLights = C3dglLightsBlock::MAX_POINT_LIGHTS);
+	void destroy()								{ m_ubo.destroy(); }
+
+	// the lights for the current frame - in world space, as in C3dglLightsBlock
+	void setDirectional(const C3dglDirLightBlock &light)	{ m_lightDirectional = light; }
+	void clear()								{ m_lights.clear(); }
+	void add(const C3dglPointLightBlock &light)	{ m_lights.push_back(light); }
+	size_t getLightCount()						{ return m_lights.size(); }
+
+	// starts the assignment for a frame
+	void begin(const glm::mat4 &matrixView);
+	// the set of lights reaching a bounding sphere (world space); nLights is the number of point lights in the set
+	unsigned assign(const glm::vec3 &centre, float radius, unsigned &nLights);
+	// uploads all the sets assigned since begin
+	void upload();
+	// binds a set to the Lights binding point
+	void bind(unsigned iSet);
+
+	unsigned getMaxLights()						{ return m_nMaxLights; }
+	unsigned getSetCount()						{ return (unsigned)m_sets.size(); }
+
+	std::string getName()	{ return "Light Sets"; }
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglLightSets_h_
@@ -0,0 +1,203 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+Lightmaps.
+C3dglLightmap bakes the static lights of static geometry into a texture atlas, on
+the CPU: the meshes are split into planar charts, packed into the atlas, and each
+texel is path traced (direct light with shadows, and the diffuse bounces) against
+a BVH of the scene, in parallel on the thread pool. The result is denoised within
+the charts and dilated over their borders.
+The second UV set is not stored in the meshes: each triangle gets the affine map of
+its chart (model space position to lightmap UV), kept in a texture buffer and
+fetched with gl_PrimitiveID - so the vertex buffers stay as AssImp made them.
+Shaders built with LIGHTMAP sample the lightmap instead of the directional light.
+Baking needs no GL context and no GL library: it lives in 3dglLightmapBake.cpp,
+apart from the GL side, and runs headless - from an aiScene, or from a bake job
+file saved by the application, with the lightmapbaker tool (tools/lightmapbaker,
+built with CMake). The saved lightmap carries a hash of its inputs (the meshes,
+their transforms and colours, the lights and the settings); load rejects
+a lightmap baked from anything else.
+Usage:
+add the static meshes, setDirectional (and add the baked point lights, if any)
+bake and save - or load a lightmap baked before; saveJob to bake it elsewhere
+upload, then bind every frame; C3dglDrawList::setLightmap finds the lightmapped packets
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglLightmap_h_
+#define __3dglLightmap_h_
+
+#include "3dglObject.h"
+#include "3dglUniformBuffer.h"
+#include "3dglBVH.h"
+
+// AssImp Scene include
+#include "assimp/scene.h"
+
+// standard libraries
+#include <vector>
+#include <map>
+
+#include "../glm/vec2.hpp"
+#include "../glm/vec3.hpp"
+#include "../glm/vec4.hpp"
+#include "../glm/mat4x4.hpp"
+
+namespace _3dgl
+{
+
+class C3dglModel;
+class C3dglMaterial;
+
+class C3dglLightmap : public C3dglObject
+{
+public:
+	// texture units of the lightmap and the chart maps
+	enum { UNIT_LIGHTMAP = 14, UNIT_CHARTS = 15 };
+
+private:
+	// a mesh instance
+	struct ENTRY
+	{
+		const void *pKey;				// C3dglModel::MESH - if added from a model
+		const aiMesh *pMesh;
+		glm::mat4 matrix;				// model (world) transform
+		glm::vec3 ambient, diffuse;		// material colours
+		unsigned firstTriangle;			// in m_maps and the BVH
+	};
+
+	// a planar chart - projected along one of the main axes
+	struct CHART
+	{
+		unsigned iEntry;
+		unsigned axis;					// 0, 1, 2 - x, y, z
+		glm::vec2 uvMin, uvMax;			// world space extent in the projection plane
+		unsigned x, y, w, h;			// texels in the atlas, with the padding
+	};
+
+	// a texel to bake
+	struct TEXEL
+	{
+		glm::vec3 pos, normal;			// world space
+		unsigned iEntry, iChart;
+	};
+
+	std::vector<ENTRY> m_entries;
+	std::multimap<const void*, unsigned> m_keys;	// entries of each model mesh
+	std::vector<aiMesh*> m_meshesOwned;			// the meshes read by loadJob
+	unsigned m_nTriangles;
+
+	// charts
+	std::vector<CHART> m_charts;
+	std::vector<unsigned> m_triChart;	// chart of each triangle
+	std::vector<glm::vec4> m_maps;		// two rows per triangle: model space position to lightmap UV
+	unsigned m_size;					// atlas size (texels)
+	float m_density;					// texels per world unit; 0 - fit the atlas
+	float m_densityUsed;
+
+	// lights and settings
+	C3dglDirLightBlock m_lightDirectional;
+	std::vector<C3dglPointLightBlock> m_lights;
+	unsigned m_nSamples, m_nBounces;
+	float m_reflectance;				// of all the surfaces, for the bounces
+	glm::vec3 m_sky;					// radiance of the rays leaving the scene
+
+	// baking
+	C3dglBVH m_bvh;
+	std::vector<TEXEL> m_texels;		// m_size * m_size
+	std::vector<bool> m_valid;
+	std::vector<glm::vec3> m_direct, m_indirect;
+	std::vector<glm::vec3> m_lightmap;	// the result
+
+	// GL
+	GLuint m_idTexture, m_idBuffer, m_idCharts;
+
+public:
+	C3dglLightmap();
+	~C3dglLightmap()										{ clear(); }
+
+	// static meshes; iNode is one of the main nodes of the model or -1 for the entire model
+	// the material colours are baked in - with pMaterial NULL, the mesh own materials are used
+	void add(C3dglModel &model, C3dglMaterial *pMaterial, glm::mat4 matrix, int iNode = -1);
+	void add(const aiScene *pScene, C3dglMaterial *pMaterial, glm::mat4 matrix, int iNode = -1);
+	void clear();
+
+	// the static lights - world space, as in C3dglLightsBlock
+	void setDirectional(const C3dglDirLightBlock &light)	{ m_lightDirectional = light; }
+	void clearLights()										{ m_lights.clear(); }
+	void addLight(const C3dglPointLightBlock &light)		{ m_lights.push_back(light); }
+
+	// settings
+	void setSize(unsigned size)								{ m_size = size; }
+	void setDensity(float texelsPerUnit)					{ m_density = texelsPerUnit; }
+	void setSamples(unsigned nSamples, unsigned nBounces = 2)	{ m_nSamples = nSamples; m_nBounces = nBounces; }
+	void setReflectance(float reflectance)					{ m_reflectance = reflectance; }
+	void setSky(const glm::vec3 &sky)						{ m_sky = sky; }
+
+	// charts and their atlas layout - deterministic for the same scene and settings
+	bool unwrap();
+	// unwrap and bake
+	bool bake();
+	// TGA files - 8 bits per channel, the lighting divided by RANGE
+	enum { RANGE = 4 };
+	bool save(const std::string &fileName);
+	bool load(const std::string &fileName);
+
+	// bake jobs: the meshes with their transforms and colours, the lights and the settings - everything bake needs,
+	// in a binary file, to bake with the lightmapbaker tool; loadJob replaces the meshes, lights and settings
+	bool saveJob(const std::string &fileName);
+	bool loadJob(const std::string &fileName);
+	// FNV-1a of all the bake inputs - stored in the saved lightmap
+	unsigned long long getHash();
+
+	// GL side: the lightmap texture and the chart maps
+	bool upload();
+	void destroy();
+	void bind();
+
+	// the first triangle of a mesh instance, for the lightmapBase uniform; -1 if not lightmapped (or not uploaded)
+	int find(const void *pKey, const glm::mat4 &matrix);
+
+	unsigned getSize()										{ return m_size; }
+	unsigned getChartCount()								{ return (unsigned)m_charts.size(); }
+	unsigned getTriangleCount()								{ return m_nTriangles; }
+
+	std::string getName()	{ return "Lightmap"; }
+
+private:
+	void addScene(const aiScene *pScene, const void *const *pKeys, C3dglMaterial *pMaterial, glm::mat4 matrix, int iNode);
+	void addNode(const aiScene *pScene, const void *const *pKeys, C3dglMaterial *pMaterial, aiNode *pNode, glm::mat4 m);
+	bool pack(float density);
+	void rasterize();
+	glm::vec3 lightDirect(const glm::vec3 &pos, const glm::vec3 &normal, const ENTRY *pEntry);
+	glm::vec3 lightIndirect(const glm::vec3 &pos, const glm::vec3 &normal, unsigned &seed);
+	void denoise();
+	void dilate(unsigned nPasses);
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglLightmap_h_
@@ -0,0 +1,99 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+A simple material class.
+Holds solid colours, shininess and up to two textures (diffuse & normal map)
+and sends them to the current shader program using the standard uniforms.
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglMaterial_h_
+#define __3dglMaterial_h_
+
+#include "3dglUniformBuffer.h"
+
+namespace _3dgl
+{
+
+class C3dglProgram;
+
+class C3dglMaterial
+{
+	// materials
+	float m_amb[3];
+	float m_diff[3];
+	float m_spec[3];
+	float m_emiss[3];
+	float m_shininess;
+
+	// texture ids (0xFFFFFFFF if not used)
+	unsigned m_idTexture;
+	unsigned m_idNormalMap;
+
+	static unsigned c_idTexBlank;
+
+	// uniform buffer for programs with the Material block - uploaded only when the colours change
+	C3dglUniformBuffer m_ubo;
+	bool m_bDirty;
+
+public:
+	C3dglMaterial();
+
+	void getAmbient(float &r, float &g, float &b)		{ r = m_amb[0];   g = m_amb[1];   b = m_amb[2]; }
+	void getDiffuse(float &r, float &g, float &b)		{ r = m_diff[0];  g = m_diff[1];  b = m_diff[2]; }
+	void getSpecular(float &r, float &g, float &b)		{ r = m_spec[0];  g = m_spec[1];  b = m_spec[2]; }
+	void getEmissive(float &r, float &g, float &b)		{ r = m_emiss[0]; g = m_emiss[1]; b = m_emiss[2]; }
+	float getShininess()								{ return m_shininess; }
+	unsigned getTexture()								{ return m_idTexture; }
+	unsigned getNormalMap()								{ return m_idNormalMap; }
+
+	void setAmbient(float r, float g, float b)			{ m_amb[0] = r;   m_amb[1] = g;   m_amb[2] = b; m_bDirty = true; }
+	void setDiffuse(float r, float g, float b)			{ m_diff[0] = r;  m_diff[1] = g;  m_diff[2] = b; m_bDirty = true; }
+	void setSpecular(float r, float g, float b)			{ m_spec[0] = r;  m_spec[1] = g;  m_spec[2] = b; m_bDirty = true; }
+	void setEmissive(float r, float g, float b)			{ m_emiss[0] = r; m_emiss[1] = g; m_emiss[2] = b; m_bDirty = true; }
+	void setShininess(float s)							{ m_shininess = s; m_bDirty = true; }
+	void setTexture(unsigned idTexture)					{ m_idTexture = idTexture; }
+	void setNormalMap(unsigned idTexture)				{ m_idNormalMap = idTexture; }
+
+	// sends the material to the program (or the current program if NULL)
+	// colours go through the Material uniform block if the program has one
+	// diffuse texture is bound to the texture unit 0, normal map to the unit 1
+	void apply(C3dglProgram *pProgram = NULL)			{ applyColours(pProgram); applyTextures(pProgram); }
+	void applyColours(C3dglProgram *pProgram = NULL);
+	void applyTextures(C3dglProgram *pProgram = NULL);
+
+	// fills in the std140 Material block
+	void getBlock(C3dglMaterialBlock &block);
+
+	void destroy()										{ m_ubo.destroy(); }
+
+private:
+	static unsigned getBlankTexture();
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglMaterial_h_
@@ -0,0 +1,83 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+Occluder proxy.
+C3dglOccluderProxy is a low polygon stand-in of a mesh, for the occlusion
+culling: a few boxes lying entirely inside it. The mesh is voxelized (the
+voxels touched by the triangles are the surface), the outside is flood-filled
+from the grid border, and what is left is the interior - then merged greedily
+into boxes, the biggest kept. The boxes never stick out of a closed mesh, so
+the proxy only ever hides less than the mesh would; open or thin meshes have
+no interior and get no proxy. The cost of rasterizing it does not depend on
+the mesh density. It does not need a GL context.
+Usage:
+create from the triangles of a mesh (C3dglModel builds one per mesh - see
+C3dglModel::enableOccluderProxy), then getTriangle / getTriangleCount
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglOccluderProxy_h_
+#define __3dglOccluderProxy_h_
+
+#include "3dglObject.h"
+
+// standard libraries
+#include <vector>
+
+#include "../glm/vec3.hpp"
+
+namespace _3dgl
+{
+
+class C3dglOccluderProxy : public C3dglObject
+{
+	std::vector<glm::vec3> m_bbMin, m_bbMax;	// the boxes, biggest first
+	std::vector<glm::vec3> m_vertices;			// their triangles, 3 vertices each, counter-clockwise from the outside
+
+public:
+	C3dglOccluderProxy() : C3dglObject()	{ }
+
+	void clear();
+
+	// builds the proxy of nTriangles triangles (3 vertices each): nResolution voxels along the longest side of
+	// the mesh, at most nMaxBoxes boxes. Returns false if the mesh has no interior
+	bool create(const glm::vec3 *pVertices, unsigned nTriangles, unsigned nResolution = 32, unsigned nMaxBoxes = 8);
+
+	unsigned getBoxCount()						{ return (unsigned)m_bbMin.size(); }
+	void getBox(unsigned i, glm::vec3 &bbMin, glm::vec3 &bbMax)	{ bbMin = m_bbMin[i]; bbMax = m_bbMax[i]; }
+	unsigned getTriangleCount()					{ return (unsigned)(m_vertices.size() / 3); }
+	const glm::vec3 *getTriangle(unsigned i) const	{ return &m_vertices[3 * i]; }
+	bool isBuilt()								{ return !m_vertices.empty(); }
+
+	std::string getName()	{ return "Occluder Proxy"; }
+
+private:
+	void addBox(const glm::vec3 &bbMin, const glm::vec3 &bbMax);
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglOccluderProxy_h_
@@ -0,0 +1,131 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+Software occlusion culling.
+C3dglOcclusionCuller rasterizes a few large occluders on the CPU into a low
+resolution, tiled depth buffer, and tests the bounding boxes of the occludees
+against it before their draws are issued. In the style of the Masked
+Occlusion Culling: each tile of 32x8 pixels keeps a coverage mask (a bit per
+pixel) and two conservative depths - the far bound of the whole tile (z0) and
+the far bound of the pixels covered so far (z1); once the mask is full, z1
+becomes the new z0, if nearer. The spans of the triangle rows are found with SSE and
+turned into the coverage masks with shifts; the tile rows are rasterized in
+parallel on the thread pool. No GL context is needed.
+The depths are the window space depths (0 - near, 1 - far) of the view-
+projection given to begin. Occluder triangles crossing the near plane, and
+back faces, are skipped - which is always conservative.
+Usage:
+create with the buffer size
+begin each frame, addOccluder for the occluders, then rasterize
+testBox for each occludee - true if (possibly) visible; thread safe
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglOcclusionCuller_h_
+#define __3dglOcclusionCuller_h_
+
+#include "3dglObject.h"
+
+// standard libraries
+#include <vector>
+
+#include "../glm/vec3.hpp"
+#include "../glm/mat4x4.hpp"
+
+namespace _3dgl
+{
+
+class C3dglOcclusionCuller : public C3dglObject
+{
+public:
+	enum { TILE_WIDTH = 32, TILE_HEIGHT = 8 };
+
+private:
+	struct TILE
+	{
+		unsigned mask[TILE_HEIGHT];		// coverage of the working layer - a row of 32 pixels per item
+		float z0;						// far bound of the tile
+		float z1;						// far bound of the working layer
+	};
+
+	// a screen space triangle, set up for the rasterizer
+	struct TRIANGLE
+	{
+		float x[3], y[3];				// window coordinates, counter-clockwise
+		float za, zb, zc;				// depth plane: z = za * x + zb * y + zc
+		float zMax;						// max depth of the vertices
+		int tyMin, tyMax;				// tile rows covered
+	};
+
+	unsigned m_nWidth, m_nHeight;
+	unsigned m_nTilesX, m_nTilesY;
+	std::vector<TILE> m_tiles;
+	std::vector<TRIANGLE> m_triangles;
+	glm::mat4 m_matrixViewProj;
+
+	// automatic occluder selection limits - see C3dglDrawList::setOcclusionCuller
+	unsigned m_nMaxOccluders;
+	unsigned m_nMaxTriangles;			// per occluder - more detailed meshes are not worth rasterizing
+	float m_fMinOccluderSize;			// radius over distance
+
+public:
+	C3dglOcclusionCuller();
+
+	// the buffer size, rounded up to whole tiles
+	bool create(unsigned nWidth = 256, unsigned nHeight = 128);
+
+	// starts a frame: clears the buffer
+	void begin(const glm::mat4 &matrixViewProj);
+	// an occluder: nTriangles triangles (3 vertices each, counter-clockwise) in model space, placed with matrix
+	void addOccluder(const glm::vec3 *pVertices, unsigned nTriangles, const glm::mat4 &matrix);
+	// rasterizes all the occluders added since begin
+	void rasterize();
+
+	// true unless the world space box is certainly hidden by the occluders
+	bool testBox(const glm::vec3 &bbMin, const glm::vec3 &bbMax) const;
+
+	// occluder selection, used by C3dglDrawList: at most nMaxOccluders meshes with up to nMaxTriangles each,
+	// looking bigger than fMinSize (bounding radius over distance), the biggest first
+	void setOccluderLimits(unsigned nMaxOccluders, unsigned nMaxTriangles, float fMinSize)	{ m_nMaxOccluders = nMaxOccluders; m_nMaxTriangles = nMaxTriangles; m_fMinOccluderSize = fMinSize; }
+	unsigned getMaxOccluders()			{ return m_nMaxOccluders; }
+	unsigned getMaxTriangles()			{ return m_nMaxTriangles; }
+	float getMinOccluderSize()			{ return m_fMinOccluderSize; }
+
+	unsigned getWidth()					{ return m_nWidth; }
+	unsigned getHeight()				{ return m_nHeight; }
+	unsigned getTriangleCount()			{ return (unsigned)m_triangles.size(); }
+	// the far bound depth of a pixel (for debugging)
+	float getDepth(unsigned x, unsigned y) const;
+
+	std::string getName()	{ return "Occlusion Culler"; }
+
+private:
+	void rasterizeRow(unsigned ty);
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglOcclusionCuller_h_
@@ -0,0 +1,129 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+Point light shadows.
+C3dglPointShadows keeps the shadows of a few point lights in the layers of one
+depth texture array - six per light, the faces of a world aligned cube. A light
+is rendered in a single pass: the geometry shader sends each triangle to the
+faces it touches, and only the objects within the range of the light are drawn;
+the six layers are then copied into the slot of the light.
+The lights are updated only when their casters (or themselves) have moved, most
+important on the screen first, within a budget of lights per frame.
+Usage:
+create once, after the GL context
+render once per frame, with the point lights - it tells the lights their shadows, before they are uploaded
+bind, and setLights(lights, bClustered, bShadows, true) on the program variants
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglPointShadows_h_
+#define __3dglPointShadows_h_
+
+#include "3dglObject.h"
+#include "3dglShader.h"
+#include "3dglUniformBuffer.h"
+
+#include "../glm/vec3.hpp"
+#include "../glm/mat4x4.hpp"
+
+namespace _3dgl
+{
+
+class C3dglDrawList;
+
+class C3dglPointShadows : public C3dglObject
+{
+public:
+	// texture unit of the shadow map array
+	enum { UNIT_POINT_SHADOW_MAP = 17 };
+
+private:
+	struct SLOT
+	{
+		int iLight;						// the light using the slot; -1 if free
+		glm::vec3 position;				// of the light, as rendered
+		float range;
+		unsigned signature;				// of the casters, as rendered - see C3dglDrawList::getSignature
+		bool bValid;					// rendered at least once
+	};
+
+	GLuint m_idTex;					// all the slots - sampled by the shaders
+	GLuint m_idTexCube;				// six layers - a light is rendered here, then copied into its slot
+	GLuint m_idFBO, m_idFBOCopy;
+	int m_size;
+	float m_near;
+	unsigned m_nBudget;				// lights updated per frame
+
+	SLOT m_slots[C3dglPointShadowsBlock::MAX_POINT_SHADOWS];
+
+	C3dglShader m_vertexShader, m_geometryShader, m_fragmentShader;
+	C3dglProgram m_program;
+	GLuint m_locFaces;
+	C3dglUniformBuffer m_ubo;
+	C3dglPointShadowsBlock m_block;
+
+	unsigned m_nLightsUpdated, m_nLightsPending, m_nPacketsDrawn;
+
+public:
+	C3dglPointShadows();
+
+	// pathShaders is the directory of shadow.vert, shadow_point.geom and shadow.frag
+	bool create(int size = 512, std::string pathShaders = "shaders/");
+	void destroy();
+
+	void setBudget(unsigned nBudget)			{ m_nBudget = nBudget; }
+	unsigned getBudget()						{ return m_nBudget; }
+	void setNear(float zNear)					{ m_near = zNear; }
+	float getNear()								{ return m_near; }
+
+	// re-renders all the lights on the next render
+	void invalidate();
+
+	// assigns the slots to the lights (in world space, as in C3dglLightsBlock) and sets their shadow field;
+	// lights without a free slot, or with no range, are not shadowed. Then updates, within the budget, the
+	// lights whose casters have moved - the largest on the screen first, their spheres projected with
+	// matrixProjection. Restores the viewport and the program, and binds the default framebuffer
+	void render(C3dglDrawList &drawList, C3dglPointLightBlock *pLights, unsigned nLights, const glm::mat4 &matrixView, const glm::mat4 &matrixProjection);
+
+	// binds the shadow maps to UNIT_POINT_SHADOW_MAP and the PointShadows block to its binding point
+	void bind();
+
+	// statistics of the last render
+	unsigned getLightsUpdated()					{ return m_nLightsUpdated; }
+	unsigned getLightsPending()					{ return m_nLightsPending; }	// changed, but left for the next frames
+	unsigned getPacketsDrawn()					{ return m_nPacketsDrawn; }
+
+	int getSize()								{ return m_size; }
+
+	std::string getName()	{ return "Point Shadows"; }
+
+private:
+	void renderSlot(C3dglDrawList &drawList, unsigned iSlot);
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglPointShadows_h_
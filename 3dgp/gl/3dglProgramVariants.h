@@ -0,0 +1,139 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+Shader permutations.
+C3dglProgramVariants builds specialised versions of a vertex/fragment shader pair.
+Each variant is compiled with a set of injected defines (see C3dglShader::Load),
+derived from a permutation key: the number of point lights, the directional light,
+the normal map, the emissive-only mode, clustered lights (see C3dglClusteredLights),
+shadows of the directional light (see C3dglShadowCascades) and of the point lights
+(see C3dglPointShadows), and the G-buffer output of the deferred path (see C3dglDeferredRenderer). Variants are built on the first request
+and kept for the lifetime of the object.
+Usage:
+create with the shader file names
+setLights once per frame, after the Lights block is filled in
+select to find the cheapest variant covering a material and the active lights
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglProgramVariants_h_
+#define __3dglProgramVariants_h_
+
+#include "3dglObject.h"
+#include "3dglShader.h"
+#include "3dglUniformBuffer.h"
+
+// standard libraries
+#include <map>
+
+namespace _3dgl
+{
+
+class C3dglMaterial;
+
+class C3dglProgramVariants : public C3dglObject
+{
+public:
+	// Permutation key layout (least significant first):
+	// | point lights: 4 | directional light: 1 | normal map: 1 | emissive only: 1 | clustered: 1 | G-buffer: 1 | SH probes: 1 | lightmap: 1 | vertex AO: 1 | shadows: 1 | point shadows: 1 |
+	enum { KEY_POINT_LIGHTS = 0xF, KEY_DIR_LIGHT = 0x10, KEY_NORMAL_MAP = 0x20, KEY_EMISSIVE_ONLY = 0x40, KEY_CLUSTERED = 0x80, KEY_GBUFFER = 0x100, KEY_SH_PROBES = 0x200, KEY_LIGHTMAP = 0x400, KEY_VERTEX_AO = 0x800, KEY_SHADOWS = 0x1000, KEY_POINT_SHADOWS = 0x2000 };
+	static unsigned makeKey(unsigned nPointLights, bool bDirLight, bool bNormalMap, bool bEmissiveOnly, bool bClustered = false)
+	{
+		return (nPointLights & KEY_POINT_LIGHTS)
+			| (bDirLight ? KEY_DIR_LIGHT : 0)
+			| (bNormalMap ? KEY_NORMAL_MAP : 0)
+			| (bEmissiveOnly ? KEY_EMISSIVE_ONLY : 0)
+			| (bClustered ? KEY_CLUSTERED : 0);
+	}
+
+	// a lightmapped object (see C3dglLightmap): the directional light is baked, the point lights stay dynamic
+	static unsigned getLightmappedKey(unsigned key)
+	{
+		if (!(key & KEY_DIR_LIGHT) || (key & (KEY_GBUFFER | KEY_EMISSIVE_ONLY))) return key;
+		return (key & ~(KEY_DIR_LIGHT | KEY_SHADOWS)) | KEY_LIGHTMAP;
+	}
+	// a mesh with the ambient occlusion baked into its colour stream (see C3dglAmbientOcclusion)
+	static unsigned getVertexAOKey(unsigned key)	{ return (key & KEY_EMISSIVE_ONLY) ? key : key | KEY_VERTEX_AO; }
+
+	// defines injected into the shaders for a given key
+	static std::string getDefines(unsigned key);
+
+private:
+	std::string m_fnameVertex, m_fnameFragment;
+	struct VARIANT
+	{
+		C3dglShader vertexShader, fragmentShader;	// kept until linked - then released by get
+		C3dglProgram program;
+		bool bValid;				// false if failed to build - not retried
+	};
+	std::map<unsigned, VARIANT> m_variants;
+	unsigned m_keyLights;							// lights part of the key - see setLights
+	bool m_bAsync;
+	C3dglProgram *m_pFallback;
+
+	// detaches and deletes the shaders of a variant no longer linking
+	void releaseShaders(VARIANT &variant);
+
+public:
+	C3dglProgramVariants() : C3dglObject()			{ m_keyLights = 0; m_bAsync = false; m_pFallback = NULL; }
+	~C3dglProgramVariants()							{ destroy(); }
+
+	bool create(std::string fnameVertex, std::string fnameFragment);
+	void destroy();
+
+	// asynchronous build (see C3dglProgram::LinkAsync); the fallback is drawn with until a variant is ready
+	void setAsync(bool bAsync, C3dglProgram *pFallback)	{ m_bAsync = bAsync; m_pFallback = pFallback; }
+
+	// the variant for the given key - built on the first request; NULL if it fails to build
+	// asynchronous variants may not be ready yet - draw with C3dglProgram::Resolve
+	C3dglProgram *get(unsigned key);
+
+	// call once per frame: the point lights are counted up to the last one switched on;
+	// with bClustered, the point lights come from C3dglClusteredLights instead of the Lights block;
+	// with bShadows, the directional light is shadowed (the Shadows block must be bound - see C3dglShadowCascades);
+	// with bPointShadows, the point lights are (the PointShadows block must be bound - see C3dglPointShadows)
+	void setLights(const C3dglLightsBlock &lights, bool bClustered = false, bool bShadows = false, bool bPointShadows = false);
+	// instead of setLights: the deferred geometry pass - no lights, the G-buffer is written instead
+	void setGBuffer()								{ m_keyLights = KEY_GBUFFER; }
+
+	// the cheapest variant covering the material and the lights set by setLights
+	unsigned selectKey(C3dglMaterial *pMaterial);
+	C3dglProgram *select(C3dglMaterial *pMaterial)	{ return get(selectKey(pMaterial)); }
+	// as above, for an object with its own light set (see C3dglLightSets) of nPointLights point lights
+	unsigned selectKey(C3dglMaterial *pMaterial, unsigned nPointLights);
+	C3dglProgram *select(C3dglMaterial *pMaterial, unsigned nPointLights)	{ return get(selectKey(pMaterial, nPointLights)); }
+	// as above, for an object lit by the light probes (see C3dglLightProbes) - the directional light is kept
+	unsigned selectKeyProbeLit(C3dglMaterial *pMaterial);
+	C3dglProgram *selectProbeLit(C3dglMaterial *pMaterial)	{ return get(selectKeyProbeLit(pMaterial)); }
+
+	unsigned getVariantCount()						{ return m_variants.size(); }
+
+	std::string getName()	{ return "Program Variants"; }
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglProgramVariants_h_
@@ -0,0 +1,162 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+Render queue with 64-bit sort keys.
+Draw packets are collected during the frame, each with a key built of
+(pass, program, material, texture, depth). The keys are radix-sorted,
+then the packets are executed in order, skipping program, material and
+texture binds that would be redundant between consecutive packets.
+Opaque packets are ordered front-to-back, transparent back-to-front.
+With the depth pre-pass, the opaque packets are first laid down in the depth
+buffer with a trivial program, then shaded with GL_EQUAL - once per pixel.
+Usage:
+begin to start a new frame
+submit to add draw packets (or use C3dglModel::submit)
+flush to sort and render
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglRenderQueue_h_
+#define __3dglRenderQueue_h_
+
+#include "3dglObject.h"
+#include "3dglModel.h"
+#include "3dglMaterial.h"
+
+// standard libraries
+#include <vector>
+#include <map>
+
+#include "../glm/mat4x4.hpp"
+
+namespace _3dgl
+{
+
+class C3dglProgram;
+class C3dglLightSets;
+struct C3dglSHProbe;
+
+class C3dglRenderQueue : public C3dglObject
+{
+public:
+	enum PASS { PASS_OPAQUE, PASS_TRANSPARENT, PASS_LAST };
+
+	// Sort key layout (most significant first):
+	// | pass: 4 | program: 8 | material: 12 | texture: 12 | depth: 24 | unused: 4 |
+	static unsigned long long makeKey(unsigned pass, unsigned program, unsigned material, unsigned texture, unsigned depth)
+	{
+		return ((unsigned long long)(pass & 0xF) << 60)
+			| ((unsigned long long)(program & 0xFF) << 52)
+			| ((unsigned long long)(material & 0xFFF) << 40)
+			| ((unsigned long long)(texture & 0xFFF) << 28)
+			| ((unsigned long long)(depth & 0xFFFFFF) << 4);
+	}
+
+private:
+	struct PACKET
+	{
+		C3dglModel::MESH *pMesh;
+		C3dglMaterial *pMaterial;		// if NULL, the mesh own material is bound
+		C3dglProgram *pProgram;			// if NULL, the current program is used; the fallback if not ready
+		glm::mat4 matrix;				// model (world) transform
+		C3dglLightSets *pLightSets;		// if not NULL, the set iLightSet is bound to the Lights binding point
+		unsigned iLightSet;
+		const C3dglSHProbe *pProbe;		// if not NULL, sent to the program - must stay valid until flush
+		int iLightmap;					// if not negative, sent as lightmapBase
+	};
+
+	struct ITEM
+	{
+		unsigned long long key;
+		unsigned index;					// index to m_packets
+	};
+
+	std::vector<PACKET> m_packets;
+	std::vector<ITEM> m_items, m_temp;
+
+	// compact ids for programs, materials and textures - they are used to build the sort keys; renumbered by begin
+	enum { ID_PROGRAM, ID_MATERIAL, ID_TEXTURE, ID_LAST };
+	std::map<const void*, unsigned> m_ids[ID_LAST];
+
+	glm::mat4 m_matrixView;
+	float m_fNear, m_fFar;
+
+	// depth pre-pass - if not NULL
+	C3dglProgram *m_pDepthPrepass;
+	std::vector<ITEM> m_prepass;
+
+	// samples shaded by the opaque packets - an occlusion query, read back when available (a frame or two later)
+	GLuint m_idQuery;
+	bool m_bQueryPending;
+	GLuint m_nSamplesShaded;
+
+	// statistics of the last flush
+	unsigned m_nDraws, m_nProgramBinds, m_nMaterialBinds, m_nTextureBinds, m_nPrepassDraws;
+
+public:
+	C3dglRenderQueue();
+
+	// depth range used to quantize the depth part of the sort key
+	void setDepthRange(float fNear, float fFar)		{ m_fNear = fNear; m_fFar = fFar; }
+
+	// start a new frame
+	void begin(glm::mat4 matrixView);
+
+	// add a draw packet
+	void submit(C3dglModel::MESH *pMesh, C3dglMaterial *pMaterial, glm::mat4 matrix, PASS pass = PASS_OPAQUE, C3dglProgram *pProgram = NULL, C3dglLightSets *pLightSets = NULL, unsigned iLightSet = 0, const C3dglSHProbe *pProbe = NULL, int iLightmap = -1);
+
+	// sort the packets by their keys (LSD radix sort)
+	void sort();
+
+	// sort and render all packets
+	void flush();
+
+	// depth pre-pass: the opaque packets are drawn front-to-back with pProgram (depth.vert - positions only)
+	// before they are shaded with GL_EQUAL and no depth writes; NULL switches it off
+	void setDepthPrepass(C3dglProgram *pProgram)	{ m_pDepthPrepass = pProgram; }
+	C3dglProgram *getDepthPrepass()					{ return m_pDepthPrepass; }
+
+	void destroy();
+
+	unsigned getPacketCount()						{ return m_packets.size(); }
+	unsigned getDrawCount()							{ return m_nDraws; }
+	unsigned getProgramBindCount()					{ return m_nProgramBinds; }
+	unsigned getMaterialBindCount()					{ return m_nMaterialBinds; }
+	unsigned getTextureBindCount()					{ return m_nTextureBinds; }
+	unsigned getPrepassDrawCount()					{ return m_nPrepassDraws; }
+	// samples shaded by the opaque packets, as last known - over the number of pixels, it is the overdraw
+	unsigned getSamplesShaded()						{ return m_nSamplesShaded; }
+
+	std::string getName()	{ return "Render Queue"; }
+
+private:
+	unsigned getId(unsigned nType, const void *p);
+	bool depthPrepass(size_t nOpaque);
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglRenderQueue_h_
@@ -0,0 +1,157 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+Dynamic scene BVH.
+C3dglSceneBVH is a dynamic AABB tree of the scene objects (proxies), for the
+spatial queries of the whole scene: frustum culling, the objects touched by a
+light (sphere) and ray picks - O(log n) each instead of a scan of all objects.
+The proxies are stored with fat boxes (enlarged by a margin): a moving object
+is reinserted only when it leaves its fat box, and the boxes of the ancestors
+are refitted on the way up, with AVL-like rotations keeping the tree balanced.
+Queries can be queued and run in a batch on a worker thread, in the background
+of the render thread.
+Usage:
+insert, remove and move to keep the proxies up to date
+queryFrustum, querySphere, queryRay - immediate (thread safe, read only)
+addFrustumQuery, addSphereQuery, addRayQuery, then dispatch - later wait and
+getResults; any changes to the tree or the queries wait for the batch first
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglSceneBVH_h_
+#define __3dglSceneBVH_h_
+
+#include "3dglObject.h"
+
+// standard libraries
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "../glm/vec3.hpp"
+#include "../glm/vec4.hpp"
+
+namespace _3dgl
+{
+
+class C3dglSceneBVH : public C3dglObject
+{
+	struct NODE
+	{
+		glm::vec3 bbMin;
+		int parent;						// also the next free node, in the free list
+		glm::vec3 bbMax;
+		int child[2];					// -1 for leaves
+		int height;						// 0 for leaves, -1 for free nodes
+		unsigned userData;
+	};
+
+	std::vector<NODE> m_nodes;
+	int m_root;
+	int m_free;							// free list
+	unsigned m_nProxies;
+	float m_fMargin;					// fat boxes margin
+
+	// batch queries
+	struct QUERY
+	{
+		enum TYPE { FRUSTUM, SPHERE, RAY } type;
+		glm::vec4 planes[6];
+		unsigned nPlanes;
+		glm::vec3 pos, dir;				// sphere centre or ray origin; ray direction
+		float radius;					// sphere radius or ray length
+		std::vector<unsigned> results;
+		std::vector<float> distances;	// of the ray hits
+	};
+	std::vector<QUERY> m_queries;
+
+	// the worker thread - started with the first dispatch
+	std::thread m_worker;
+	std::mutex m_mutex;
+	std::condition_variable m_cvWork, m_cvDone;
+	bool m_bPending;					// dispatched and not done yet
+	bool m_bQuit;
+
+public:
+	C3dglSceneBVH();
+	~C3dglSceneBVH()					{ destroy(); }
+
+	// stops the worker thread
+	void destroy();
+	void clear();
+
+	// fat boxes are enlarged by the margin - the distance an object may move without being reinserted
+	void setMargin(float fMargin)		{ m_fMargin = fMargin; }
+	float getMargin()					{ return m_fMargin; }
+
+	// the proxy of an object with a world space box; userData is returned by the queries. Returns the proxy id
+	unsigned insert(const glm::vec3 &bbMin, const glm::vec3 &bbMax, unsigned userData);
+	void remove(unsigned proxy);
+	// updates the box of a proxy; returns true if the proxy had to be reinserted
+	bool move(unsigned proxy, const glm::vec3 &bbMin, const glm::vec3 &bbMax);
+
+	// immediate queries - the user data of the proxies found are appended to results. The fat boxes are tested:
+	// the results are conservative, by up to the margin
+	// frustum: planes as from C3dglFrustumCuller::getPlanes, pointing inwards
+	void queryFrustum(const glm::vec4 *planes, unsigned nPlanes, std::vector<unsigned> &results) const;
+	void querySphere(const glm::vec3 &centre, float radius, std::vector<unsigned> &results) const;
+	// ray: the proxies hit within tMax, sorted by the distance of the entry points (returned in distances)
+	void queryRay(const glm::vec3 &orig, const glm::vec3 &dir, float tMax, std::vector<unsigned> &results, std::vector<float> &distances) const;
+
+	// batch queries - return the query index
+	unsigned addFrustumQuery(const glm::vec4 *planes, unsigned nPlanes);
+	unsigned addSphereQuery(const glm::vec3 &centre, float radius);
+	unsigned addRayQuery(const glm::vec3 &orig, const glm::vec3 &dir, float tMax);
+	// runs the batch on the worker thread
+	void dispatch();
+	// waits for the batch to complete
+	void wait();
+	// the results of a query of the last batch (valid after wait, until clearQueries)
+	const std::vector<unsigned> &getResults(unsigned iQuery)		{ return m_queries[iQuery].results; }
+	const std::vector<float> &getDistances(unsigned iQuery)		{ return m_queries[iQuery].distances; }
+	unsigned getQueryCount()			{ return (unsigned)m_queries.size(); }
+	void clearQueries()					{ wait(); m_queries.clear(); }
+
+	unsigned getProxyCount()			{ return m_nProxies; }
+	int getHeight()						{ return m_root < 0 ? 0 : m_nodes[m_root].height; }
+
+	std::string getName()	{ return "Scene BVH"; }
+
+private:
+	int allocNode();
+	void freeNode(int iNode);
+	void insertLeaf(int iLeaf);
+	void removeLeaf(int iLeaf);
+	int balance(int iNode);
+	void refit(int iNode);
+	void run();
+	void runQuery(QUERY &query) const;
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglSceneBVH_h_
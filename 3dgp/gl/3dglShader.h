@@ -40,9 +40,11 @@ freely, subject to the following restrictions:
 #define __3dglShader_h_
 
 #include "3dglObject.h"
+#include "3dglUniformBuffer.h"
 #include <string>
 #include <map>
 #include <set>
+#include <vector>
 
 #include "../glm/mat4x4.hpp"
 
@@ -63,19 +65,34 @@ class C3dglShader : public C3dglObject
 	GLuint m_id;
 	std::string m_source;
 	std::string m_fname;
+	std::string m_defines;
+	std::vector<std::string> m_includes;	// included files - source string numbers 1, 2, ... in the compiler log
+	bool m_bPending;		// loaded but not compiled yet - C3dglProgram::Link compiles pending shaders
 public:
-	C3dglShader() : C3dglObject()		{ m_type = 0; m_id = 0; }
+	C3dglShader() : C3dglObject()		{ m_type = 0; m_id = 0; m_bPending = false; }
 
 	bool Create(GLenum type);
-	bool Load(std::string source);
-	bool LoadFromFile(std::string fname);
-	bool Compile();
+	// deletes the shader - GL frees it once detached from all the programs
+	void Destroy();
+	// defines: ';' separated list of NAME or NAME=VALUE, injected after the #version line
+	// #include "file" is resolved relative to the including file; each file is included only once
+	bool Load(std::string source, std::string defines = "");
+	bool LoadFromFile(std::string fname, std::string defines = "");
+	// with the program binary cache enabled, compilation is deferred until Link - unless bDeferrable is false
+	bool Compile(bool bDeferrable = true);
+	// compilation status and log - waits for the compilation if still in progress
+	bool CheckStatus();
+	bool IsPending()		{ return m_bPending; }
 
 	GLenum getType()		{ return m_type; }
 	GLuint getId()			{ return m_id; }
 	std::string getSource()	{ return m_source; }
 	std::string getFName()	{ return m_fname; }
+	std::string getDefines()	{ return m_defines; }
 	std::string getName();	// "Vertex Shader", "Fragment Shader" etc
+
+private:
+	bool _preprocess(const std::string &source, const std::string &path, GLuint idString, std::string &out);
 };
 
 class C3dglProgram : public C3dglObject
@@ -83,11 +100,19 @@ class C3dglProgram : public C3dglObject
 public:
 	// Standard attribute and uniform locations
 	enum ATTRIB_STD { ATTR_VERTEX, ATTR_NORMAL, ATTR_TEXCOORD, ATTR_TANGENT, ATTR_BITANGENT, ATTR_COLOR, ATTR_BONE_ID, ATTR_BONE_WEIGHT, ATTR_LAST };
-	enum UNI_STD { UNI_MODELVIEW, UNI_MAT_AMBIENT, UNI_MAT_DIFFUSE, UNI_MAT_SPECULAR, UNI_MAT_EMISSIVE, UNI_MAT_SHININESS, UNI_LAST };
+	enum UNI_STD { UNI_MODELVIEW, UNI_MAT_AMBIENT, UNI_MAT_DIFFUSE, UNI_MAT_SPECULAR, UNI_MAT_EMISSIVE, UNI_MAT_SHININESS, UNI_MAT_TEXTURE, UNI_MAT_NORMALMAP, UNI_SH_COEFFS, UNI_SH_AMBIENT, UNI_LIGHTMAP_BASE, UNI_LAST };
 
 
 private:
 	static C3dglProgram *c_pCurrentProgram;
+	static std::string c_binaryCache;
+	static std::map<std::string, GLint> c_samplerUnits;
+
+	enum STATE { STATE_NONE, STATE_LINKING, STATE_READY, STATE_FAILED };
+	STATE m_state;
+	C3dglProgram *m_pFallback;					// used while linking asynchronously (see Resolve)
+	std::string m_fnameBinary;					// binary cache file of the current link, empty if none
+	std::string m_stdAttribNames, m_stdUniNames;	// kept for the asynchronous link
 
 	struct UNIFORM
 	{
@@ -97,8 +122,29 @@ private:
 	};
 
 	GLuint m_id;
+	std::vector<C3dglShader*> m_shaders;		// attached shaders: the binary cache key and deferred compilation
 	std::map<std::string, GLuint> m_attribs;
 	std::map<std::string, UNIFORM> m_uniforms;
+	std::map<unsigned, UNIFORM> m_hashedUniforms;		// hashed names, for C3dglUniform handles
+
+	struct BLOCK
+	{
+		BLOCK(GLuint _index = GL_INVALID_INDEX, GLint _size = 0) : index(_index), size(_size) { }
+		GLuint index;
+		GLint size;
+	};
+	std::map<std::string, BLOCK> m_blocks;
+	GLuint m_stdBlock[UBO_LAST];
+
+	// last values sent, per location; size == 0 means unknown
+	struct SHADOW
+	{
+		SHADOW() : size(0) { }
+		size_t size;
+		unsigned char data[64];
+	};
+	std::vector<SHADOW> m_shadow;
+	unsigned m_nUniformsIssued, m_nUniformsSaved;
 
 	GLuint m_stdAttr[ATTR_LAST];
 	UNIFORM m_stdUni[UNI_LAST];
@@ -109,15 +155,40 @@ public:
 	C3dglProgram();
 
 	bool Create();
+	// deletes the program; if it is in use, it is unbound first
+	void Destroy();
 	bool Attach(C3dglShader &shader);
+	// detaches all the shaders - once linked, the program does not need them
+	void DetachShaders();
 	bool Link(std::string std_attrib_names = "", std::string std_uni_names = "");
 	bool Use(bool bValidate = false);
 
+	// asynchronous linking (see C3dglAsyncCompiler): pending shaders are compiled and the program linked
+	// in the background; Poll (or Resolve) completes the link once the driver is done - neither of them blocks
+	bool LinkAsync(std::string std_attrib_names = "", std::string std_uni_names = "");
+	bool Poll();
+	bool IsReady()			{ return m_state == STATE_READY; }
+	bool IsLinking()		{ return m_state == STATE_LINKING; }
+
+	// the program to draw with: this one if ready, otherwise the fallback (recursively); may be NULL
+	void SetFallback(C3dglProgram *pFallback)		{ m_pFallback = pFallback; }
+	C3dglProgram *GetFallback()						{ return m_pFallback; }
+	C3dglProgram *Resolve()							{ if (m_state == STATE_LINKING) Poll(); return m_state == STATE_READY ? this : m_pFallback ? m_pFallback->Resolve() : NULL; }
+
 	GLuint GetId()			{ return m_id; }
 	bool IsUsed()			{ return c_pCurrentProgram == this; }
 
 	static C3dglProgram *GetCurrentProgram()		{ return c_pCurrentProgram; }
 
+	// program binary cache: linked programs are stored in the given directory, keyed by the source code and the driver.
+	// Set before compiling the shaders; an empty path disables the cache
+	static void SetBinaryCache(std::string path)	{ c_binaryCache = path; }
+	static std::string GetBinaryCache()				{ return c_binaryCache; }
+
+	// fixed texture units for samplers shared by many programs (such as the cluster light lists);
+	// Link assigns them once, so that they never have to be sent per draw call
+	static void SetSamplerUnit(std::string name, GLint unit)	{ c_samplerUnits[name] = unit; }
+
 	// numerical locations for attributes
 	void GetAttribLocation(std::string idUniform, GLuint &location);
 	GLuint GetAttribLocation(std::string idUniform)							{ GLuint location; GetAttribLocation(idUniform, location); return location; }
@@ -129,40 +200,49 @@ public:
 	GLuint GetUniformLocation(std::string idUniform)						{ GLuint location; GLenum type, targetType; GetUniformLocation(idUniform, location, type, targetType); return location; }
 	void GetUniformLocation(UNI_STD uniId, GLuint &location, GLenum &type, GLenum &targetType);
 	GLuint GetUniformLocation(UNI_STD uniId)								{ GLuint location; GLenum type, targetType; GetUniformLocation(uniId, location, type, targetType); return location; }
+	// look-up by a hashed name (see C3dglUniform); returns false if not found
+	bool GetUniformByHash(unsigned hash, GLuint &location, GLenum &targetType);
+
+	// uniform blocks; the standard blocks (see UBO_STD) are bound to their binding points by Link
+	GLuint GetUniformBlockIndex(std::string name)								{ auto i = m_blocks.find(name); return i == m_blocks.end() ? GL_INVALID_INDEX : i->second.index; }
+	GLint GetUniformBlockSize(std::string name)									{ auto i = m_blocks.find(name); return i == m_blocks.end() ? 0 : i->second.size; }
+	bool HasUniformBlock(UBO_STD ubo)											{ return m_stdBlock[ubo] != GL_INVALID_INDEX; }
+	bool BindUniformBlock(std::string name, GLuint binding);
 
 	// send uniform using numerical location
-	void SendUniform(GLuint location, GLint v0)													{ if (!IsUsed()) Use(); glUniform1i(location, v0); }
-	void SendUniform(GLuint location, GLint v0, GLint v1)										{ if (!IsUsed()) Use(); glUniform2i(location, v0, v1); }
-	void SendUniform(GLuint location, GLint v0, GLint v1, GLint v2)								{ if (!IsUsed()) Use(); glUniform3i(location, v0, v1, v2); }
-	void SendUniform(GLuint location, GLint v0, GLint v1, GLint v2, GLint v3)					{ if (!IsUsed()) Use(); glUniform4i(location, v0, v1, v2, v3); }
-	void SendUniform(GLuint location, GLuint v0)												{ if (!IsUsed()) Use(); glUniform1ui(location, v0); }
-	void SendUniform(GLuint location, GLuint v0, GLuint v1)										{ if (!IsUsed()) Use(); glUniform2ui(location, v0, v1); }
-	void SendUniform(GLuint location, GLuint v0, GLuint v1, GLuint v2)							{ if (!IsUsed()) Use(); glUniform3ui(location, v0, v1, v2); }
-	void SendUniform(GLuint location, GLuint v0, GLuint v1, GLuint v2, GLuint v3)				{ if (!IsUsed()) Use(); glUniform4ui(location, v0, v1, v2, v3); }
-	void SendUniform(GLuint location, GLfloat v0)												{ if (!IsUsed()) Use(); glUniform1f(location, v0); }
-	void SendUniform(GLuint location, GLfloat v0, GLfloat v1)									{ if (!IsUsed()) Use(); glUniform2f(location, v0, v1); }
-	void SendUniform(GLuint location, GLfloat v0, GLfloat v1, GLfloat v2)						{ if (!IsUsed()) Use(); glUniform3f(location, v0, v1, v2); }
-	void SendUniform(GLuint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3)			{ if (!IsUsed()) Use(); glUniform4f(location, v0, v1, v2, v3); }
-	void SendUniform(GLuint location, double v0)												{ if (!IsUsed()) Use(); glUniform1f(location, (float)v0); }
-	void SendUniform(GLuint location, double v0, double v1)										{ if (!IsUsed()) Use(); glUniform2f(location, (float)v0, (float)v1); }
-	void SendUniform(GLuint location, double v0, double v1, double v2)							{ if (!IsUsed()) Use(); glUniform3f(location, (float)v0, (float)v1, (float)v2); }
-	void SendUniform(GLuint location, double v0, double v1, double v2, double v3)				{ if (!IsUsed()) Use(); glUniform4f(location, (float)v0, (float)v1, (float)v2, (float)v3); }
-	void SendUniform(GLuint location, GLfloat pMatrix[16])										{ if (!IsUsed()) Use(); glUniformMatrix4fv(location, 1, GL_FALSE, pMatrix); }
-	void SendUniform(GLuint location, glm::mat4 matrix)											{ if (!IsUsed()) Use(); glUniformMatrix4fv(location, 1, GL_FALSE, &matrix[0][0]); }
-
-	void SendUniform1v(GLuint location, GLint *p, GLuint count = 1)								{ if (!IsUsed()) Use(); glUniform1iv(location, count, p); }
-	void SendUniform2v(GLuint location, GLint *p, GLuint count = 1)								{ if (!IsUsed()) Use(); glUniform2iv(location, count, p); }
-	void SendUniform3v(GLuint location, GLint *p, GLuint count = 1)								{ if (!IsUsed()) Use(); glUniform3iv(location, count, p); }
-	void SendUniform4v(GLuint location, GLint *p, GLuint count = 1)								{ if (!IsUsed()) Use(); glUniform4iv(location, count, p); }
-	void SendUniform1v(GLuint location, GLuint *p, GLuint count = 1)							{ if (!IsUsed()) Use(); glUniform1uiv(location, count, p); }
-	void SendUniform2v(GLuint location, GLuint *p, GLuint count = 1)							{ if (!IsUsed()) Use(); glUniform2uiv(location, count, p); }
-	void SendUniform3v(GLuint location, GLuint *p, GLuint count = 1)							{ if (!IsUsed()) Use(); glUniform3uiv(location, count, p); }
-	void SendUniform4v(GLuint location, GLuint *p, GLuint count = 1)							{ if (!IsUsed()) Use(); glUniform4uiv(location, count, p); }
-	void SendUniform1v(GLuint location, GLfloat *p, GLuint count = 1)							{ if (!IsUsed()) Use(); glUniform1fv(location, count, p); }
-	void SendUniform2v(GLuint location, GLfloat *p, GLuint count = 1)							{ if (!IsUsed()) Use(); glUniform2fv(location, count, p); }
-	void SendUniform3v(GLuint location, GLfloat *p, GLuint count = 1)							{ if (!IsUsed()) Use(); glUniform3fv(location, count, p); }
-	void SendUniform4v(GLuint location, GLfloat *p, GLuint count = 1)							{ if (!IsUsed()) Use(); glUniform4fv(location, count, p); }
-	void SendUniformMatrixv(GLuint location, GLfloat *pMatrix, GLuint count = 1)				{ if (!IsUsed()) Use(); glUniformMatrix4fv(location, count, GL_FALSE, pMatrix); }
+	// the last value sent to each location is shadowed - unchanged values are not sent again
+	void SendUniform(GLuint location, GLint v0)													{ GLint v[] = { v0 }; if (_shadow(location, v, sizeof(v))) glUniform1i(location, v0); }
+	void SendUniform(GLuint location, GLint v0, GLint v1)										{ GLint v[] = { v0, v1 }; if (_shadow(location, v, sizeof(v))) glUniform2i(location, v0, v1); }
+	void SendUniform(GLuint location, GLint v0, GLint v1, GLint v2)								{ GLint v[] = { v0, v1, v2 }; if (_shadow(location, v, sizeof(v))) glUniform3i(location, v0, v1, v2); }
+	void SendUniform(GLuint location, GLint v0, GLint v1, GLint v2, GLint v3)					{ GLint v[] = { v0, v1, v2, v3 }; if (_shadow(location, v, sizeof(v))) glUniform4i(location, v0, v1, v2, v3); }
+	void SendUniform(GLuint location, GLuint v0)												{ GLuint v[] = { v0 }; if (_shadow(location, v, sizeof(v))) glUniform1ui(location, v0); }
+	void SendUniform(GLuint location, GLuint v0, GLuint v1)										{ GLuint v[] = { v0, v1 }; if (_shadow(location, v, sizeof(v))) glUniform2ui(location, v0, v1); }
+	void SendUniform(GLuint location, GLuint v0, GLuint v1, GLuint v2)							{ GLuint v[] = { v0, v1, v2 }; if (_shadow(location, v, sizeof(v))) glUniform3ui(location, v0, v1, v2); }
+	void SendUniform(GLuint location, GLuint v0, GLuint v1, GLuint v2, GLuint v3)				{ GLuint v[] = { v0, v1, v2, v3 }; if (_shadow(location, v, sizeof(v))) glUniform4ui(location, v0, v1, v2, v3); }
+	void SendUniform(GLuint location, GLfloat v0)												{ GLfloat v[] = { v0 }; if (_shadow(location, v, sizeof(v))) glUniform1f(location, v0); }
+	void SendUniform(GLuint location, GLfloat v0, GLfloat v1)									{ GLfloat v[] = { v0, v1 }; if (_shadow(location, v, sizeof(v))) glUniform2f(location, v0, v1); }
+	void SendUniform(GLuint location, GLfloat v0, GLfloat v1, GLfloat v2)						{ GLfloat v[] = { v0, v1, v2 }; if (_shadow(location, v, sizeof(v))) glUniform3f(location, v0, v1, v2); }
+	void SendUniform(GLuint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3)			{ GLfloat v[] = { v0, v1, v2, v3 }; if (_shadow(location, v, sizeof(v))) glUniform4f(location, v0, v1, v2, v3); }
+	void SendUniform(GLuint location, double v0)												{ GLfloat v[] = { (float)v0 }; if (_shadow(location, v, sizeof(v))) glUniform1f(location, (float)v0); }
+	void SendUniform(GLuint location, double v0, double v1)										{ GLfloat v[] = { (float)v0, (float)v1 }; if (_shadow(location, v, sizeof(v))) glUniform2f(location, (float)v0, (float)v1); }
+	void SendUniform(GLuint location, double v0, double v1, double v2)							{ GLfloat v[] = { (float)v0, (float)v1, (float)v2 }; if (_shadow(location, v, sizeof(v))) glUniform3f(location, (float)v0, (float)v1, (float)v2); }
+	void SendUniform(GLuint location, double v0, double v1, double v2, double v3)				{ GLfloat v[] = { (float)v0, (float)v1, (float)v2, (float)v3 }; if (_shadow(location, v, sizeof(v))) glUniform4f(location, (float)v0, (float)v1, (float)v2, (float)v3); }
+	void SendUniform(GLuint location, GLfloat pMatrix[16])										{ if (_shadow(location, pMatrix, 16 * sizeof(GLfloat))) glUniformMatrix4fv(location, 1, GL_FALSE, pMatrix); }
+	void SendUniform(GLuint location, glm::mat4 matrix)											{ if (_shadow(location, &matrix[0][0], sizeof(matrix))) glUniformMatrix4fv(location, 1, GL_FALSE, &matrix[0][0]); }
+
+	void SendUniform1v(GLuint location, GLint *p, GLuint count = 1)								{ if (_shadow(location, p, count * 1 * sizeof(*p), count)) glUniform1iv(location, count, p); }
+	void SendUniform2v(GLuint location, GLint *p, GLuint count = 1)								{ if (_shadow(location, p, count * 2 * sizeof(*p), count)) glUniform2iv(location, count, p); }
+	void SendUniform3v(GLuint location, GLint *p, GLuint count = 1)								{ if (_shadow(location, p, count * 3 * sizeof(*p), count)) glUniform3iv(location, count, p); }
+	void SendUniform4v(GLuint location, GLint *p, GLuint count = 1)								{ if (_shadow(location, p, count * 4 * sizeof(*p), count)) glUniform4iv(location, count, p); }
+	void SendUniform1v(GLuint location, GLuint *p, GLuint count = 1)							{ if (_shadow(location, p, count * 1 * sizeof(*p), count)) glUniform1uiv(location, count, p); }
+	void SendUniform2v(GLuint location, GLuint *p, GLuint count = 1)							{ if (_shadow(location, p, count * 2 * sizeof(*p), count)) glUniform2uiv(location, count, p); }
+	void SendUniform3v(GLuint location, GLuint *p, GLuint count = 1)							{ if (_shadow(location, p, count * 3 * sizeof(*p), count)) glUniform3uiv(location, count, p); }
+	void SendUniform4v(GLuint location, GLuint *p, GLuint count = 1)							{ if (_shadow(location, p, count * 4 * sizeof(*p), count)) glUniform4uiv(location, count, p); }
+	void SendUniform1v(GLuint location, GLfloat *p, GLuint count = 1)							{ if (_shadow(location, p, count * 1 * sizeof(*p), count)) glUniform1fv(location, count, p); }
+	void SendUniform2v(GLuint location, GLfloat *p, GLuint count = 1)							{ if (_shadow(location, p, count * 2 * sizeof(*p), count)) glUniform2fv(location, count, p); }
+	void SendUniform3v(GLuint location, GLfloat *p, GLuint count = 1)							{ if (_shadow(location, p, count * 3 * sizeof(*p), count)) glUniform3fv(location, count, p); }
+	void SendUniform4v(GLuint location, GLfloat *p, GLuint count = 1)							{ if (_shadow(location, p, count * 4 * sizeof(*p), count)) glUniform4fv(location, count, p); }
+	void SendUniformMatrixv(GLuint location, GLfloat *pMatrix, GLuint count = 1)				{ if (_shadow(location, pMatrix, count * 16 * sizeof(*pMatrix), count)) glUniformMatrix4fv(location, count, GL_FALSE, pMatrix); }
 
 	// send uniform using a name. Internally uses a look-up list to speed up and provide additional control
 	bool SendUniform(std::string name, GLint v0);
@@ -219,17 +299,32 @@ public:
 	void SendUniform(std::string name, GLuint i, glm::mat4 matrix)								{ SendUniform(name + "[" + std::to_string(i) + "]", matrix); }
 
 	// send a standard uniform using one of the UNI_STD values
+	bool SendStandardUniform(enum UNI_STD loc, GLint v0);
 	bool SendStandardUniform(enum UNI_STD loc, GLfloat v0);
 	bool SendStandardUniform(enum UNI_STD loc, GLfloat v0, GLfloat v1, GLfloat v2);
 	bool SendStandardUniform(enum UNI_STD loc, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3);
 	bool SendStandardUniform(enum UNI_STD loc, GLfloat pMatrix[16]);
 	bool SendStandardUniform(enum UNI_STD loc, glm::mat4 matrix);
 
+	// uniform value shadowing: returns true if the value differs from the last one sent (and calls Use if so)
+	bool ShadowUniform(GLuint location, const void *p, size_t size)			{ return _shadow(location, p, size); }
+	void InvalidateUniforms()													{ m_shadow.clear(); }
+	unsigned GetUniformIssuedCount()											{ return m_nUniformsIssued; }
+	unsigned GetUniformSavedCount()												{ return m_nUniformsSaved; }
+	void ResetUniformCounters()													{ m_nUniformsIssued = m_nUniformsSaved = 0; }
+
 	std::string getName()	{ return "GLSL Program"; }
 
 private:
 	std::set<std::string> m_errlookup;
 	bool _error(std::string name, GLenum actual, GLenum expected);
+	bool _shadow(GLuint location, const void *p, size_t size, GLuint count = 1);
+	std::string _binaryKey();
+	bool _loadCached();
+	bool _endLink();
+	bool _loadBinary(std::string fname);
+	void _saveBinary(std::string fname);
+	bool _reflect(std::string std_attrib_names, std::string std_uni_names);
 };
 
 }; // namespace _3dgl
@@ -0,0 +1,136 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+Cascaded shadow maps.
+C3dglShadowCascades renders the shadows of the directional light into the layers
+of a depth texture array, one per slice of the view frustum. Each cascade is fit
+to the bounding sphere of its slice and snapped to whole texels, so the shadows
+do not shimmer as the camera moves. The far cascades are cached: the static
+geometry is rendered into a separate array only when the light or the static
+content changes, or the camera leaves the cached area; each frame the cache is
+copied and the dynamic objects (see C3dglDrawList::setDynamic) drawn on top.
+Usage:
+create once, after the GL context
+render once per frame, before the scene - then bind
+setLights(lights, bClustered, true) on the program variants to use the SHADOWS variants
+invalidate when a static mesh is edited
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglShadowCascades_h_
+#define __3dglShadowCascades_h_
+
+#include "3dglObject.h"
+#include "3dglShader.h"
+#include "3dglUniformBuffer.h"
+
+#include "../glm/vec3.hpp"
+#include "../glm/mat4x4.hpp"
+
+namespace _3dgl
+{
+
+class C3dglDrawList;
+
+class C3dglShadowCascades : public C3dglObject
+{
+public:
+	// texture unit of the shadow map array
+	enum { UNIT_SHADOW_MAP = 16 };
+
+private:
+	struct CASCADE
+	{
+		glm::mat4 matrix;				// world space to light clip space
+		glm::vec3 centre;				// the area covered - world space
+		float radius;
+		float texelSize;				// world size of a texel
+		bool bValid;					// cached cascades: the static layer is up to date
+	};
+
+	GLuint m_idTex;					// the live shadow maps - sampled by the shaders
+	GLuint m_idTexStatic;			// the static geometry of the cached cascades
+	GLuint m_idFBO, m_idFBOStatic;
+	int m_size;
+	unsigned m_nCascades;
+	unsigned m_iFirstCached;		// cascades from this one on are cached
+	float m_distance;				// shadow distance - the far end of the last cascade
+	float m_lambda;					// split scheme: 0 - uniform, 1 - logarithmic
+
+	CASCADE m_cascades[C3dglShadowsBlock::MAX_CASCADES];
+	glm::vec3 m_lightDir;			// as the cached cascades were rendered
+	C3dglDrawList *m_pDrawList;
+	unsigned m_nStaticRevision;		// see C3dglDrawList::getStaticRevision
+
+	C3dglShader m_vertexShader, m_fragmentShader;
+	C3dglProgram m_program;
+	C3dglUniformBuffer m_ubo;
+	C3dglShadowsBlock m_block;
+
+	unsigned m_nPacketsDrawn, m_nCascadesRefreshed;
+
+public:
+	C3dglShadowCascades();
+
+	// pathShaders is the directory of shadow.vert and shadow.frag
+	bool create(unsigned nCascades = 4, int size = 2048, std::string pathShaders = "shaders/");
+	void destroy();
+
+	void setDistance(float distance)			{ m_distance = distance; }
+	float getDistance()							{ return m_distance; }
+	void setLambda(float lambda)				{ m_lambda = lambda; }
+	float getLambda()							{ return m_lambda; }
+	// the first cached cascade; nCascades or more for none
+	void setCached(unsigned iFirstCached)		{ m_iFirstCached = iFirstCached; invalidate(); }
+	unsigned getCached()						{ return m_iFirstCached; }
+
+	// re-renders the cached cascades on the next render - changes of the static objects in the draw list
+	// are detected anyway; call for changes the draw list does not know of (such as an edited mesh)
+	void invalidate();
+
+	// renders the cascades for the camera and uploads the Shadows block; lightDir is the world space direction
+	// of the light (where it goes). The viewport and the program are restored, the default framebuffer is bound
+	void render(C3dglDrawList &drawList, const glm::vec3 &lightDir, const glm::mat4 &matrixView, const glm::mat4 &matrixProjection);
+
+	// binds the shadow maps to UNIT_SHADOW_MAP and the Shadows block to its binding point
+	void bind();
+
+	// statistics of the last render
+	unsigned getPacketsDrawn()					{ return m_nPacketsDrawn; }
+	unsigned getCascadesRefreshed()				{ return m_nCascadesRefreshed; }
+
+	unsigned getCascadeCount()					{ return m_nCascades; }
+	int getSize()								{ return m_size; }
+
+	std::string getName()	{ return "Shadow Cascades"; }
+
+private:
+	void renderCascade(C3dglDrawList &drawList, unsigned i, bool bRefresh);
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglShadowCascades_h_
@@ -30,6 +30,8 @@ freely, subject to the following restrictions:
 #ifndef _3dglSkyBox_H
 #define _3dglSkyBox_H
 
+#include "../glm/mat4x4.hpp"
+
 namespace _3dgl
 {
 class C3dglSkyBox
@@ -38,7 +40,8 @@ public:
     C3dglSkyBox();
 
 	bool load(const char* pFd, const char* pRt, const char* pBk, const char* pLt, const char* pUp, const char* pDn);
-    void render();
+    void render();						// uses the current model-view matrix (see C3dglState)
+	void render(glm::mat4 matrix);
 
 private:
     unsigned int  m_idTex[6];
@@ -0,0 +1,163 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+GL state shadowing layer.
+A thin cache of the most frequently changed OpenGL state: bound program,
+VAO, buffers, texture units, depth mask and function, colour mask, blending,
+enabled capabilities, vertex attribute arrays and the viewport. All 3DGL classes route their state changes
+through it, so that redundant calls never reach the driver.
+Calls issued to GL and calls filtered out are counted per frame.
+Also provides a CPU-side model-view matrix stack, which replaces the legacy
+GL matrix stack, so that nothing on the render path needs to query GL.
+Usage:
+call beginFrame at the beginning of each frame to reset the counters
+call invalidate after any third-party code changed the GL state directly, or
+invalidateVertexArray if it only changed the vertex arrays (glutSolidTeapot)
+use loadMatrix/pushMatrix/popMatrix instead of glLoadMatrix/glPushMatrix/glPopMatrix
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglState_h_
+#define __3dglState_h_
+
+// standard libraries
+#include <map>
+#include <vector>
+
+#include "../glm/mat4x4.hpp"
+
+namespace _3dgl
+{
+
+class C3dglState
+{
+	enum { MAX_TEXTURE_UNITS = 32, TEX_TARGET_LAST = 8 };
+
+	// per-VAO state: element buffer binding and enabled attribute arrays
+	struct VAO
+	{
+		VAO() : idElementBuffer(0xFFFFFFFF), maskAttribs(0), maskKnown(0) { }
+		GLuint idElementBuffer;
+		unsigned maskAttribs;
+		unsigned maskKnown;
+	};
+
+	static GLuint c_idProgram;
+	static GLuint c_idVAO;
+	static VAO *c_pVAO;
+	static std::map<GLuint, VAO> c_vaos;
+	static std::map<GLenum, GLuint> c_buffers;
+	// indexed bindings (uniform buffers); offset is -1 for the whole buffer
+	struct BINDING
+	{
+		BINDING() : id(0xFFFFFFFF), offset(-1) { }
+		GLuint id;
+		GLintptr offset;
+	};
+	static std::map<std::pair<GLenum, GLuint>, BINDING> c_bufferBases;
+	static GLenum c_activeTexture;
+	static GLuint c_textures[MAX_TEXTURE_UNITS][TEX_TARGET_LAST];
+	static int c_nDepthMask;
+	static GLenum c_depthFunc;
+	static int c_nColorMask;			// RGBA bits, -1 if not known
+	static GLenum c_blendSrc, c_blendDst;
+	static GLint c_viewport[4];			// width -1 if not known
+	static std::map<GLenum, int> c_caps;
+
+	// model-view matrix stack - the last element is the current matrix
+	static std::vector<glm::mat4> c_matrixStack;
+
+	// statistics
+	static unsigned c_nIssued, c_nFiltered;
+	static unsigned c_nLastIssued, c_nLastFiltered;
+
+public:
+	// programs & VAOs
+	static void useProgram(GLuint id);
+	static void deleteProgram(GLuint id);			// unbinds it first if in use - GL would keep it alive until then
+	static void bindVertexArray(GLuint id);
+	static void deleteVertexArrays(GLsizei n, const GLuint *ids);
+
+	// buffers
+	static void bindBuffer(GLenum target, GLuint id);
+	static void bindBufferBase(GLenum target, GLuint index, GLuint id);
+	static void bindBufferRange(GLenum target, GLuint index, GLuint id, GLintptr offset, GLsizeiptr size);	// size is assumed constant per buffer
+	static void deleteBuffers(GLsizei n, const GLuint *ids);
+
+	// textures
+	static void activeTexture(GLenum texture);		// GL_TEXTURE0 + unit
+	static void bindTexture(GLenum target, GLuint id);	// binds to the active unit
+	static void bindTexture(GLuint unit, GLenum target, GLuint id);
+	static void deleteTextures(GLsizei n, const GLuint *ids);
+
+	// vertex attribute arrays - of the currently bound VAO
+	static void enableVertexAttribArray(GLuint index);
+	static void disableVertexAttribArray(GLuint index);
+
+	// raster state
+	static void depthMask(GLboolean flag);
+	static void depthFunc(GLenum func);
+	static void colorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha);
+	static void blendFunc(GLenum sfactor, GLenum dfactor);
+	static void enable(GLenum cap);
+	static void disable(GLenum cap);
+	static void setEnabled(GLenum cap, bool bEnable)	{ if (bEnable) enable(cap); else disable(cap); }
+	static void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+	// model-view matrix stack
+	static void loadMatrix(const glm::mat4 &m)		{ c_matrixStack.back() = m; }
+	static void multMatrix(const glm::mat4 &m)		{ c_matrixStack.back() *= m; }
+	static void pushMatrix()						{ c_matrixStack.push_back(c_matrixStack.back()); }
+	static void popMatrix()							{ if (c_matrixStack.size() > 1) c_matrixStack.pop_back(); }
+	static const glm::mat4 &getModelViewMatrix()	{ return c_matrixStack.back(); }
+
+	// cached values
+	static GLuint getProgram()						{ return c_idProgram; }
+	static GLuint getVertexArray()					{ return c_idVAO; }
+	static GLboolean getDepthMask()					{ return c_nDepthMask != 0; }	// GL default (true) if not known
+	static GLenum getDepthFunc()					{ return c_depthFunc == 0xFFFFFFFF ? GL_LESS : c_depthFunc; }	// GL default if not known
+	static void getViewport(GLint viewport[4]);		// queried from GL only if not known - set it with viewport
+
+	// forget all cached values - the next calls will always be issued
+	static void invalidate();
+	// forget the vertex array state only: the VAO binding, the array buffer binding and the element buffer
+	// and the attribute arrays of the VAO bound
+	static void invalidateVertexArray();
+
+	// statistics
+	static void beginFrame();						// resets the counters
+	static unsigned getIssuedCount()				{ return c_nIssued; }
+	static unsigned getFilteredCount()				{ return c_nFiltered; }
+	static unsigned getLastFrameIssuedCount()		{ return c_nLastIssued; }
+	static unsigned getLastFrameFilteredCount()		{ return c_nLastFiltered; }
+
+private:
+	static unsigned getTargetIndex(GLenum target);
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglState_h_
@@ -0,0 +1,83 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+Thread pool.
+C3dglThreadPool runs a loop body in parallel on a set of persistent worker
+threads; the calling thread takes part in the work. Used by 3DGL for per-frame
+CPU work such as light clustering.
+Usage:
+C3dglThreadPool::get().parallelFor(n, [&](unsigned i) { ... });
+parallelFor returns when all n calls are complete. Call it from one thread only.
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglThreadPool_h_
+#define __3dglThreadPool_h_
+
+// standard libraries
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+namespace _3dgl
+{
+
+class C3dglThreadPool
+{
+	std::vector<std::thread> m_threads;
+	std::mutex m_mutex;
+	std::condition_variable m_cvWork, m_cvDone;
+	std::function<void(unsigned)> m_job;
+	std::atomic<unsigned> m_next;	// next job index to take
+	unsigned m_nJobs;
+	unsigned m_nBusy;				// workers still running the current batch
+	unsigned m_nBatch;				// incremented with every parallelFor
+	bool m_bQuit;
+
+public:
+	// nThreads is the number of worker threads; by default one less than the number of cores
+	C3dglThreadPool(unsigned nThreads = 0xFFFFFFFF);
+	~C3dglThreadPool();
+
+	// calls job(i) for each i in [0, n) - returns when all are done
+	void parallelFor(unsigned n, std::function<void(unsigned)> job);
+
+	unsigned getThreadCount()						{ return m_threads.size() + 1; }
+
+	// the shared pool
+	static C3dglThreadPool &get();
+
+private:
+	void run();
+	void work();
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglThreadPool_h_
@@ -0,0 +1,143 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+Precompiled uniform handles.
+C3dglUniform<T> is a typed handle to a uniform variable. Uniform names are
+hashed at compile time (FNV-1a) and resolved to locations once, after the
+program is linked. Sending a value then involves no string operations and
+no map look-ups. Type checks are only performed in debug builds.
+Usage:
+C3dglUniform<vec3> uniColour = UNIFORM_HANDLE(vec3, "material.diffuse");
+after Link:		uniColour.resolve(program);
+every frame:	uniColour.set(vec3(1, 0, 0));
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglUniform_h_
+#define __3dglUniform_h_
+
+#include "3dglShader.h"
+
+// standard libraries
+#include <string>
+#include <type_traits>
+
+#include "../glm/vec2.hpp"
+#include "../glm/vec3.hpp"
+#include "../glm/vec4.hpp"
+#include "../glm/mat3x3.hpp"
+#include "../glm/mat4x4.hpp"
+
+// compile-time hash of a uniform name
+#define UNIFORM_HASH(name)	(std::integral_constant<unsigned, _3dgl::C3dglHash(name)>::value)
+
+// typed uniform handle with a compile-time hashed name
+#define UNIFORM_HANDLE(T, name)	(_3dgl::C3dglUniform<T>(UNIFORM_HASH(name), name))
+
+namespace _3dgl
+{
+
+// FNV-1a hash (32-bit); usable both at compile time and at run time
+constexpr unsigned C3dglHash(const char *p, unsigned h = 2166136261u)
+{
+	return *p ? C3dglHash(p + 1, (h ^ (unsigned char)*p) * 16777619u) : h;
+}
+
+// type traits: GL type of the uniform and the function used to send it
+template <class T> struct C3dglUniformTraits;
+
+#define __3DGL_UNIFORM_TRAITS(T, glType, altType, call) \
+	template <> struct C3dglUniformTraits<T> \
+	{ \
+		static bool accepts(GLenum t)					{ return t == glType || t == altType; } \
+		static void send(GLint l, const T &v)			{ call; } \
+	};
+
+__3DGL_UNIFORM_TRAITS(GLint, GL_INT, GL_BOOL, glUniform1i(l, v))
+__3DGL_UNIFORM_TRAITS(GLuint, GL_UNSIGNED_INT, GL_BOOL, glUniform1ui(l, v))
+__3DGL_UNIFORM_TRAITS(bool, GL_BOOL, GL_INT, glUniform1i(l, v ? 1 : 0))
+__3DGL_UNIFORM_TRAITS(GLfloat, GL_FLOAT, GL_FLOAT, glUniform1f(l, v))
+__3DGL_UNIFORM_TRAITS(glm::vec2, GL_FLOAT_VEC2, GL_FLOAT_VEC2, glUniform2f(l, v.x, v.y))
+__3DGL_UNIFORM_TRAITS(glm::vec3, GL_FLOAT_VEC3, GL_FLOAT_VEC3, glUniform3f(l, v.x, v.y, v.z))
+__3DGL_UNIFORM_TRAITS(glm::vec4, GL_FLOAT_VEC4, GL_FLOAT_VEC4, glUniform4f(l, v.x, v.y, v.z, v.w))
+__3DGL_UNIFORM_TRAITS(glm::ivec2, GL_INT_VEC2, GL_BOOL_VEC2, glUniform2i(l, v.x, v.y))
+__3DGL_UNIFORM_TRAITS(glm::ivec3, GL_INT_VEC3, GL_BOOL_VEC3, glUniform3i(l, v.x, v.y, v.z))
+__3DGL_UNIFORM_TRAITS(glm::ivec4, GL_INT_VEC4, GL_BOOL_VEC4, glUniform4i(l, v.x, v.y, v.z, v.w))
+__3DGL_UNIFORM_TRAITS(glm::mat3, GL_FLOAT_MAT3, GL_FLOAT_MAT3, glUniformMatrix3fv(l, 1, GL_FALSE, &v[0][0]))
+__3DGL_UNIFORM_TRAITS(glm::mat4, GL_FLOAT_MAT4, GL_FLOAT_MAT4, glUniformMatrix4fv(l, 1, GL_FALSE, &v[0][0]))
+
+#undef __3DGL_UNIFORM_TRAITS
+
+template <class T>
+class C3dglUniform
+{
+	C3dglProgram *m_pProgram;
+	GLint m_location;
+	unsigned m_hash;
+	std::string m_name;		// only used by resolve - for the fallback look-up and diagnostics
+
+public:
+	C3dglUniform() : m_pProgram(NULL), m_location(-1), m_hash(0)	{ }
+	C3dglUniform(unsigned hash, std::string name) : m_pProgram(NULL), m_location(-1), m_hash(hash), m_name(name)	{ }
+	// names built at run time (such as indexed array elements) are hashed here - do it once, not every frame
+	explicit C3dglUniform(std::string name) : m_pProgram(NULL), m_location(-1), m_hash(C3dglHash(name.c_str())), m_name(name)	{ }
+
+	// find the location in a linked program - call once, after C3dglProgram::Link
+	bool resolve(C3dglProgram &program)
+	{
+		m_pProgram = &program;
+		GLuint location;
+		GLenum type;
+		if (!program.GetUniformByHash(m_hash, location, type))
+		{
+			GLenum _t;
+			program.GetUniformLocation(m_name, location, _t, type);
+		}
+		m_location = (GLint)location;
+#ifdef _DEBUG
+		if (m_location >= 0 && type != 0 && !C3dglUniformTraits<T>::accepts(type))
+			return program.logError("type mismatch in uniform handle: " + m_name);
+#endif
+		return m_location >= 0;
+	}
+
+	// send the value - no string operations, no look-ups; unchanged values are skipped
+	void set(const T &value) const
+	{
+		if (m_location < 0) return;
+		if (m_pProgram->ShadowUniform(m_location, &value, sizeof(T)))
+			C3dglUniformTraits<T>::send(m_location, value);
+	}
+
+	bool isValid() const				{ return m_location >= 0; }
+	GLint getLocation() const			{ return m_location; }
+	unsigned getHash() const			{ return m_hash; }
+	C3dglProgram *getProgram() const	{ return m_pProgram; }
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglUniform_h_
@@ -0,0 +1,193 @@
+/*********************************************************************************
+3DGL 3D Graphics Library created by Jarek Francik for Kingston University students
+Version 2.2 23/03/15
+
+Copyright (C) 2013-15 Jarek Francik, Kingston University, London, UK
+
+Uniform Buffer Objects.
+C3dglUniformBuffer wraps a GL uniform buffer attached to a binding point.
+The standard uniform blocks (Camera, Lights, Material, Clusters, Shadows, PointShadows) are mirrored by C++
+structs with std140 layout, verified at compile time; C3dglProgram::Link
+assigns the standard binding points and checks the block sizes.
+Usage:
+create to allocate the buffer for a given binding point
+update to upload the data - once per frame (camera, lights) or once per material
+bind to (re)attach the buffer to its binding point
+----------------------------------------------------------------------------------
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+   Jarek Francik
+   jarek@kingston.ac.uk
+*********************************************************************************/
+
+#ifndef __3dglUniformBuffer_h_
+#define __3dglUniformBuffer_h_
+
+#include "3dglObject.h"
+
+// standard libraries
+#include <cstddef>
+#include <cmath>
+#include <cfloat>
+
+#include "../glm/vec3.hpp"
+#include "../glm/vec4.hpp"
+#include "../glm/mat4x4.hpp"
+
+namespace _3dgl
+{
+
+// Standard uniform blocks and their binding points
+enum UBO_STD { UBO_CAMERA, UBO_LIGHTS, UBO_MATERIAL, UBO_CLUSTERS, UBO_SHADOWS, UBO_POINT_SHADOWS, UBO_LAST };
+
+//////////////////////////////////////////////////////////
+// std140 mirrors of the standard uniform blocks.
+// vec3 members are followed by a scalar or explicit padding,
+// so that every vec3 starts at a 16-byte boundary.
+
+// layout(std140) uniform Camera
+struct C3dglCameraBlock
+{
+	glm::mat4 matrixView;
+	glm::mat4 matrixProjection;
+};
+
+// DIRECTIONAL_LIGHT
+struct C3dglDirLightBlock
+{
+	glm::vec3 direction;	GLint on;
+	glm::vec3 ambient;		float _pad0;
+	glm::vec3 diffuse;		float diffuseStrength;
+	glm::vec3 specular;		float specularPower;
+};
+
+// POINT_LIGHT
+struct C3dglPointLightBlock
+{
+	glm::vec3 position;		GLint on;
+	glm::vec3 ambient;		float radius;
+	glm::vec3 diffuse;		float diffuseStrength;
+	glm::vec3 specular;		float specularPower;
+	float cutoff;			GLint shadow;			// shadow: 1 + the slot in C3dglPointShadows; 0 - not shadowed
+	float _pad0[2];
+
+	// the distance where the attenuation (see CalculateAttenuation) falls to the cutoff - FLT_MAX if it never does
+	// (1 / (d / radius + 1)^2 == cutoff at d + radius == radius / sqrt(cutoff)); inline - the lightmap baker runs without GL
+	float getRange() const	{ return (radius > 0 && cutoff > 0 && cutoff < 1) ? radius / sqrt(cutoff) : FLT_MAX; }
+	// true if switched off or contributing no light at all
+	bool isDark() const		{ return on == 0 || (ambient == glm::vec3(0) && diffuseStrength == 0 && (specularPower <= 0 || specular == glm::vec3(0))); }
+};
+
+// layout(std140) uniform Lights
+// the shaders expect view space directions and positions - see toViewSpace
+struct C3dglLightsBlock
+{
+	enum { MAX_POINT_LIGHTS = 2 };	// must match MAX_POINT_LIGHTS in the shaders
+	C3dglDirLightBlock lightDirectional;
+	C3dglPointLightBlock lightPoint[MAX_POINT_LIGHTS];
+
+	// a copy with world space lights transformed to view space - once per frame, instead of per fragment
+	C3dglLightsBlock toViewSpace(const glm::mat4 &matrixView) const;
+};
+
+// layout(std140) uniform Material
+struct C3dglMaterialBlock
+{
+	glm::vec3 ambient;		float shininess;
+	glm::vec3 diffuse;		float _pad0;
+	glm::vec3 specular;		float _pad1;
+	glm::vec3 emissive;		float _pad2;
+};
+
+// layout(std140) uniform Clusters - see C3dglClusteredLights
+struct C3dglClustersBlock
+{
+	glm::ivec4 grid;		// number of clusters along x, y, z; w - number of lights
+	glm::vec4 params;		// x, y - clusters per pixel; z, w - depth slice = log(view depth) * z + w
+};
+
+// layout(std140) uniform Shadows - see C3dglShadowCascades
+struct C3dglShadowsBlock
+{
+	enum { MAX_CASCADES = 4 };		// must match MAX_CASCADES in the shaders
+	glm::mat4 matrixShadow[MAX_CASCADES];	// view space to shadow map space (xy - texture coords, z - depth)
+	glm::vec4 splits;				// view depth where each cascade ends
+	glm::vec4 texelSize;			// world size of a shadow map texel, per cascade
+	glm::ivec4 params;				// x - number of cascades
+};
+
+// layout(std140) uniform PointShadows - see C3dglPointShadows
+struct C3dglPointShadowsBlock
+{
+	enum { MAX_POINT_SHADOWS = 4 };	// must match MAX_POINT_SHADOWS in the shaders
+	glm::mat4 matrixViewToWorld;	// view space to world space directions - the cube faces are world aligned
+	glm::vec4 far;					// far plane of each slot - the range of its light
+	glm::vec4 params;				// x - near plane, y - 1 / size of a face
+};
+
+// compile-time verification of the std140 layout
+static_assert(sizeof(glm::vec3) == 12 && sizeof(glm::mat4) == 64, "unexpected glm type sizes");
+static_assert(sizeof(C3dglCameraBlock) == 128, "std140 layout mismatch: Camera");
+static_assert(offsetof(C3dglDirLightBlock, ambient) == 16 && offsetof(C3dglDirLightBlock, diffuse) == 32 && offsetof(C3dglDirLightBlock, specular) == 48, "std140 layout mismatch: DIRECTIONAL_LIGHT");
+static_assert(sizeof(C3dglDirLightBlock) == 64, "std140 layout mismatch: DIRECTIONAL_LIGHT");
+static_assert(offsetof(C3dglPointLightBlock, ambient) == 16 && offsetof(C3dglPointLightBlock, diffuse) == 32 && offsetof(C3dglPointLightBlock, specular) == 48 && offsetof(C3dglPointLightBlock, cutoff) == 64 && offsetof(C3dglPointLightBlock, shadow) == 68, "std140 layout mismatch: POINT_LIGHT");
+static_assert(sizeof(C3dglPointLightBlock) % 16 == 0, "std140 layout mismatch: POINT_LIGHT array stride");
+static_assert(offsetof(C3dglLightsBlock, lightPoint) % 16 == 0, "std140 layout mismatch: Lights");
+static_assert(offsetof(C3dglMaterialBlock, diffuse) == 16 && offsetof(C3dglMaterialBlock, specular) == 32 && offsetof(C3dglMaterialBlock, emissive) == 48, "std140 layout mismatch: Material");
+static_assert(sizeof(C3dglMaterialBlock) == 64, "std140 layout mismatch: Material");
+static_assert(sizeof(C3dglClustersBlock) == 32, "std140 layout mismatch: Clusters");
+static_assert(offsetof(C3dglShadowsBlock, splits) == 256 && sizeof(C3dglShadowsBlock) == 304, "std140 layout mismatch: Shadows");
+static_assert(sizeof(C3dglPointShadowsBlock) == 96, "std140 layout mismatch: PointShadows");
+
+class C3dglUniformBuffer : public C3dglObject
+{
+	GLuint m_id;
+	GLuint m_binding;
+	GLsizeiptr m_size;
+
+public:
+	C3dglUniformBuffer() : C3dglObject()			{ m_id = 0; m_binding = 0; m_size = 0; }
+
+	// allocate the buffer and attach it to the binding point
+	bool create(GLuint binding, GLsizeiptr size, const void *pData = NULL);
+	template <class T>
+	bool create(GLuint binding, const T &data)		{ return create(binding, sizeof(T), &data); }
+	void destroy();
+
+	// upload the data (the buffer is created on the first use if necessary)
+	void update(const void *pData, GLsizeiptr size, GLintptr offset = 0);
+	template <class T>
+	void update(const T &data)						{ update(&data, sizeof(T)); }
+
+	// attach to the binding point - filtered if already attached
+	void bind();
+	// attach a part of the buffer - offset must be a multiple of GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+	void bindRange(GLintptr offset, GLsizeiptr size);
+
+	GLuint getId()									{ return m_id; }
+	GLuint getBinding()								{ return m_binding; }
+	GLsizeiptr getSize()							{ return m_size; }
+	bool isCreated()								{ return m_id != 0; }
+
+	std::string getName()	{ return "Uniform Buffer"; }
+};
+
+}; // namespace _3dgl
+
+#endif // __3dglUniformBuffer_h_
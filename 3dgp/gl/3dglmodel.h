@@ -41,6 +41,10 @@ freely, subject to the following restrictions:
 #define __3dglModel_h_
 
 #include "3dglObject.h"
+#include "3dglState.h"
+#include "3dglUniformBuffer.h"
+#include "3dglBVH.h"
+#include "3dglOccluderProxy.h"
 
 // AssImp Scene include
 #include "assimp/scene.h"
@@ -57,10 +61,13 @@ namespace _3dgl
 
 #define MAX_BONES_PER_VEREX 4
 
+class C3dglRenderQueue;
+
 	enum ATTRIB_STD	{ BUF_VERTEX, BUF_NORMAL, BUF_TEXCOORD, BUF_TANGENT, BUF_BITANGENT, BUF_COLOR, BUF_BONE, BUF_INDEX, BUF_LAST };
 
 class C3dglModel : public C3dglObject
 {
+public:
 	struct MESH;
 	struct MATERIAL;
 
@@ -72,6 +79,7 @@ class C3dglModel : public C3dglObject
 
 		// VAO (Vertex Array Object) id
 		unsigned m_idVAO;
+		unsigned m_idVAODepth;		// the position stream only - see renderDepth
 
 		struct BUFFER
 		{
@@ -84,7 +92,7 @@ class C3dglModel : public C3dglObject
 			void populate(unsigned size, unsigned num, const void *pData, GLenum target = GL_ARRAY_BUFFER, GLenum usage = GL_STATIC_DRAW)
 			{
 				glGenBuffers(1, &m_id);
-				glBindBuffer(target, m_id);
+				C3dglState::bindBuffer(target, m_id);
 				glBufferData(target, size * num, pData, usage);
 			}
 			void storeData(unsigned size, unsigned num, const void *pData)
@@ -96,7 +104,7 @@ class C3dglModel : public C3dglObject
 				memcpy(m_pData, pData, m_size * m_num);
 			}
 			void getData(void **p, unsigned &size, unsigned &num)	{ if (p) *p = m_pData; size = m_size; num = m_num; }
-			void release()		{ glDeleteBuffers(1, &m_id); if (m_pData) delete[] m_pData; m_size = m_num = 0; }
+			void release()		{ C3dglState::deleteBuffers(1, &m_id); if (m_pData) delete[] m_pData; m_id = (unsigned)-1; m_pData = NULL; m_size = m_num = 0; }
 		};
 
 		// Buffers
@@ -115,21 +123,40 @@ class C3dglModel : public C3dglObject
 		aiVector3D bb[2];
 		aiVector3D centre;
 
+		// triangle BVH, in the mesh space - see C3dglModel::enableBVH
+		C3dglBVH m_bvh;
+
+		// occluder proxy, in the mesh space - see C3dglModel::enableOccluderProxy
+		C3dglOccluderProxy m_proxy;
+
 	public:
-		MESH(C3dglModel *pOwner) : m_pOwner(pOwner) { }
+		MESH(C3dglModel *pOwner) : m_pOwner(pOwner), m_idVAO(0), m_idVAODepth(0) { }
 
 		void create(const aiMesh *pMesh, unsigned maskEnabledBufData = 0);
 		void destroy();
 		void render();
+		void renderDepth();			// depth only passes - fetches the positions only (attribute 0 / aVertex)
 
 		MATERIAL *getMaterial()		{ return m_pOwner ? m_pOwner->getMaterial(m_nMaterialIndex) : NULL; }
 		MATERIAL *createNewMaterial();
 
 		// get buffer binary data - call C3dglModel::enableBufferData before loading!
 		void getBufferData(ATTRIB_STD bufId, void **p, unsigned &size, unsigned &num)	{ m_buf[bufId].getData(p, size, num); }
+
+		// (re)places the colour stream after loading, bound to the attribute location given - see C3dglAmbientOcclusion
+		void setColors(const aiColor4D *pColors, unsigned num, GLuint attrib);
+		bool hasColors()			{ return m_buf[BUF_COLOR].m_id != (unsigned)-1; }
 		
 		aiVector3D *getBB()			{ return bb; }
 		aiVector3D getCentre()		{ return centre; } 
+
+		// ray casting - call C3dglModel::enableBVH before loading! The ray is in the space of matrix (the mesh placement);
+		// the hit distance is measured along dir, as given
+		C3dglBVH *getBVH()			{ return m_bvh.isBuilt() ? &m_bvh : NULL; }
+		bool intersect(const glm::mat4 &matrix, const glm::vec3 &orig, const glm::vec3 &dir, float tMax, C3dglBVH::HIT &hit);
+
+		// occlusion culling - call C3dglModel::enableOccluderProxy before loading! NULL if the mesh has no interior
+		C3dglOccluderProxy *getOccluderProxy()	{ return m_proxy.isBuilt() ? &m_proxy : NULL; }
 	};
 
 	struct MATERIAL
@@ -149,6 +176,10 @@ class C3dglModel : public C3dglObject
 		float m_shininess;
 		static unsigned c_idTexBlank;
 
+		// uniform buffer for programs with the Material block
+		C3dglUniformBuffer m_ubo;
+		bool m_bDirty;
+
 	public:
 		MATERIAL(C3dglModel *pOwner);
 		void create(const aiMaterial *pMat, const char* pDefTexPath);
@@ -160,23 +191,27 @@ class C3dglModel : public C3dglObject
 		void getSpecularMaterial(float &r, float &g, float &b)		{ r = m_spec[0];  g = m_spec[1];  b = m_spec[2]; }
 		void getEmissiveMaterial(float &r, float &g, float &b)		{ r = m_emiss[0]; g = m_emiss[1]; b = m_emiss[2]; }
 		float getShininess()										{ return m_shininess; }
+		unsigned getTexture()										{ return m_idTexture; }
 
-		void setAmbientMaterial(float r, float g, float b)			{ m_amb[0] = r;   m_amb[1] = g;   m_amb[2] = b; }
-		void setDiffuseMaterial(float r, float g, float b)			{ m_diff[0] = r;  m_diff[1] = g;  m_diff[2] = b; }
-		void setSpecularMaterial(float r, float g, float b)			{ m_spec[0] = r;  m_spec[1] = g;  m_spec[2] = b; }
-		void setEmissiveMaterial(float r, float g, float b)			{ m_emiss[0] = r; m_emiss[1] = g; m_emiss[2] = b; }
-		void setShininess(float s)									{ m_shininess = s; }
+		void setAmbientMaterial(float r, float g, float b)			{ m_amb[0] = r;   m_amb[1] = g;   m_amb[2] = b; m_bDirty = true; }
+		void setDiffuseMaterial(float r, float g, float b)			{ m_diff[0] = r;  m_diff[1] = g;  m_diff[2] = b; m_bDirty = true; }
+		void setSpecularMaterial(float r, float g, float b)			{ m_spec[0] = r;  m_spec[1] = g;  m_spec[2] = b; m_bDirty = true; }
+		void setEmissiveMaterial(float r, float g, float b)			{ m_emiss[0] = r; m_emiss[1] = g; m_emiss[2] = b; m_bDirty = true; }
+		void setShininess(float s)									{ m_shininess = s; m_bDirty = true; }
 
 		void loadTexture(std::string strTexRootPath, std::string strPath);
 		void loadBlankTexture();
 	};
 
+private:
 	const aiScene *m_pScene;
 	std::vector<MESH> m_meshes;
 	std::vector<MATERIAL> m_materials;
 	std::string m_name;
 
 	unsigned m_maskEnabledBufData;
+	bool m_bEnableBVH;
+	bool m_bEnableOccluderProxy;
 
 	// bone related
 	std::map<std::string, unsigned> m_mapBones;		// map of bone names
@@ -184,7 +219,7 @@ class C3dglModel : public C3dglObject
 	aiMatrix4x4 m_GlobalInverseTransform;
 	
 public:
-	C3dglModel() : C3dglObject()			{ m_pScene = NULL; m_maskEnabledBufData = NULL;  }
+	C3dglModel() : C3dglObject()			{ m_pScene = NULL; m_maskEnabledBufData = NULL; m_bEnableBVH = false; m_bEnableOccluderProxy = false; }
 	~C3dglModel()							{ destroy(); }
 
 	const aiScene *GetScene()				{ return m_pScene; }
@@ -200,6 +235,10 @@ public:
 
 	// call before load - to enable buffer binary data access - see MESH::getBufferData
 	void enableBufData(ATTRIB_STD bufId, bool bEnable = true);
+	// call before load - to build the triangle BVH of each mesh, for ray casting - see intersect
+	void enableBVH(bool bEnable = true)		{ m_bEnableBVH = bEnable; }
+	// call before load - to build the occluder proxy of each mesh, for the occlusion culling - see MESH::getOccluderProxy
+	void enableOccluderProxy(bool bEnable = true)	{ m_bEnableOccluderProxy = bEnable; }
 
 	unsigned getMeshCount()					{ return m_meshes.size(); }
 	MESH *getMesh(unsigned i)				{ return (i < m_meshes.size()) ? &m_meshes[i] : NULL; }
@@ -214,6 +253,26 @@ public:
 	void render(unsigned iNode);					// render one of the main nodes
 	void renderNode(aiNode *pNode, glm::mat4 m);	// render a node
 
+	// deferred rendering - submits draw packets to a render queue instead of drawing
+	void submit(C3dglRenderQueue &queue, glm::mat4 matrix);					// submit the entire model
+	void submit(C3dglRenderQueue &queue, unsigned iNode, glm::mat4 matrix);	// submit one of the main nodes
+	void submitNode(C3dglRenderQueue &queue, aiNode *pNode, glm::mat4 m);	// submit a node
+
+	// ray casting - the closest hit of a ray on the model placed with matrix (the ray is in the space of matrix,
+	// usually the world space). Requires enableBVH before load
+	struct RAYHIT
+	{
+		unsigned iMesh;
+		unsigned iTriangle;					// the face index in the mesh
+		float u, v;							// barycentric coordinates of the 2nd and 3rd vertex
+		float t;							// distance along dir
+	};
+	bool intersect(glm::mat4 matrix, const glm::vec3 &orig, const glm::vec3 &dir, RAYHIT &hit, float tMax = 1e10f);				// the entire model
+	bool intersect(unsigned iNode, glm::mat4 matrix, const glm::vec3 &orig, const glm::vec3 &dir, RAYHIT &hit, float tMax = 1e10f);	// one of the main nodes
+	// batch of n rays, on the thread pool; misses have t == tMax and iMesh == -1. Returns the number of hits
+	unsigned intersect(glm::mat4 matrix, const glm::vec3 *orig, const glm::vec3 *dir, unsigned n, RAYHIT *hits, float tMax = 1e10f);
+	bool intersectNode(aiNode *pNode, glm::mat4 m, const glm::vec3 &orig, const glm::vec3 &dir, RAYHIT &hit);	// a node
+
 	// retrieves the transform associated with the given node. If (bRecursive) the transform is recursively combined with parental transform(s)
 	void getNodeTransform(aiNode *pNode, float pMatrix[16], bool bRecursive = true);
 	
@@ -1,4 +1,6 @@
 #include <iostream>
+#include <sstream>
+#include <iomanip>
 #include "GL/glew.h"
 #include "GL/3dgl.h"
 #include "GL/glut.h"
@@ -41,6 +43,23 @@ GLuint chairNormalTexId;
 
 //shader
 C3dglProgram Program;
+C3dglProgramVariants programVariants;	// specialised versions of the same shaders, used by the draw list
+C3dglProgram DepthProgram;	// depth only - the pre-pass of the draw list
+
+// materials
+C3dglMaterial lightbulb1Material;
+C3dglMaterial lightbulb2Material;
+C3dglMaterial chairMaterial;
+C3dglMaterial lampMaterial;
+C3dglMaterial tableMaterial;
+C3dglMaterial vaseMaterial;
+C3dglMaterial dinoMaterial;
+C3dglMaterial teapotMaterial;
+C3dglMaterial pyramidMaterial;
+
+// the scene - objects are registered once, in init()
+C3dglDrawList drawList;
+unsigned dinoId;
 
 // camera position (for first person type camera navigation)
 mat4 matrixView;			// The View Matrix
@@ -64,6 +83,46 @@ unsigned normalBuffer = 0;
 unsigned indexBuffer = 0;
 
 
+// per-frame uniform blocks: camera and lights are uploaded once per frame
+C3dglCameraBlock cameraBlock;
+C3dglLightsBlock lightsBlock;
+C3dglUniformBuffer cameraUBO;
+C3dglUniformBuffer lightsUBO;
+
+// point lights binned into clusters of the view frustum - the draw list variants read them from there
+C3dglClusteredLights clusteredLights;
+int viewportWidth = 1, viewportHeight = 1;
+
+// alternative, deferred path for the draw list
+C3dglDeferredRenderer deferredRenderer;
+
+// alternative forward path: each object gets the most important lights reaching it
+C3dglLightSets lightSets;
+
+// L2 SH irradiance probes of the lamps - the small, moving objects (dino, teapot) are lit by them
+C3dglLightProbes lightProbes;
+
+// the directional light baked with its shadows and bounces - all the static objects
+C3dglLightmap lightmap;
+
+// per-vertex ambient occlusion of the draw list objects - in the mesh colour streams
+C3dglAmbientOcclusion ambientOcclusion;
+
+// real-time shadows of the directional light - the far cascades cache the static objects, the dino is drawn on top
+C3dglShadowCascades shadowCascades;
+
+// shadows of the lamps - a light is updated only when something moves within its range, one per frame
+C3dglPointShadows pointShadows;
+
+// CPU occlusion culling of the draw list - the biggest meshes on the screen hide the objects behind them
+C3dglOcclusionCuller occlusionCuller;
+
+// the draw list lighting path - selectable per frame (g key)
+enum RENDER_MODE { RENDER_CLUSTERED, RENDER_LIGHT_SETS, RENDER_DEFERRED, RENDER_LAST };
+const char *renderModeNames[RENDER_LAST] = { "clustered forward", "per-object lights forward", "deferred" };
+int renderMode = RENDER_CLUSTERED;
+
+
 // structures that represent directional/point lights.
 // They pass parameters to shaders. This way we don't duplicate the uniform setting code,
 // and also are able to will parameters more verbosily.
@@ -118,16 +177,29 @@ struct DirectionalLight
 
     void apply()
     {
-	    Program.SendUniform("lightDirectional.on", on);
-	    Program.SendUniform("lightDirectional.ambient", ambient.x, ambient.y, ambient.z);
-	    Program.SendUniform("lightDirectional.direction", direction.x, direction.y, direction.z);
-	    Program.SendUniform("lightDirectional.diffuse", diffuse.x, diffuse.y, diffuse.z);
-	    Program.SendUniform("lightDirectional.diffuseStrength", diffuseStrength);
-	    Program.SendUniform("lightDirectional.specular", specular.x, specular.y, specular.z);
-	    Program.SendUniform("lightDirectional.specularPower", specularPower);
+        // written to the Lights block - uploaded once per frame
+        C3dglDirLightBlock& b = lightsBlock.lightDirectional;
+        b.on = on;
+        b.ambient = ambient;
+        b.direction = direction;
+        b.diffuse = diffuse;
+        b.diffuseStrength = diffuseStrength;
+        b.specular = specular;
+        b.specularPower = specularPower;
     }
 };
 
+// the directional light - applied every frame, and baked into the lightmap
+DirectionalLight directionalLight(bool on)
+{
+    return DirectionalLight()
+        .enable(on)
+        .withAmbient(0, 0, 0)
+        .withDiffuse(1, 1, 1, 0.2)
+        .withDirection(0, 2, 1)
+        .withSpecular(0.7, 0.7, 0.7, 800);
+}
+
 struct PointLight
 {
     const int index;
@@ -199,92 +271,17 @@ struct PointLight
 
     void apply()
     {
-        string uniformBase = "lightPoint[";
-        uniformBase += to_string(index);
-        uniformBase += "]";
-
-        Program.SendUniform(uniformBase + ".on", on);
-	    Program.SendUniform(uniformBase + ".ambient", ambient.x, ambient.y, ambient.z);
-	    Program.SendUniform(uniformBase + ".position", position.x, position.y, position.z);
-	    Program.SendUniform(uniformBase + ".diffuse", diffuse.x, diffuse.y, diffuse.z);
-	    Program.SendUniform(uniformBase + ".diffuseStrength", diffuseStrength);
-	    Program.SendUniform(uniformBase + ".specular", specular.x, specular.y, specular.z);
-	    Program.SendUniform(uniformBase + ".specularPower", specularPower);
-	    Program.SendUniform(uniformBase + ".radius", radius);
-	    Program.SendUniform(uniformBase + ".cutoff", cutoff);
-    }
-};
-
-// material structure; kind same as above, to avoid duplication of uniforms code.
-struct Material
-{
-    vec3 ambient = vec3(1, 1, 1);
-
-    vec3 diffuse = vec3(1, 1, 1);
-    
-    float shininess = 0.f;
-
-    vec3 emissive = vec3(0, 0, 0);
- 
-    GLuint diffuseTextureId = -1;
-    GLuint normalTextureId = -1;
-
-    Material()
-    { }
-
-    Material& withAmbientColour(float r, float g, float b)
-    {
-        this->ambient = vec3(r, g, b);
-        return *this;
-    }
-
-    Material& withDiffuseColour(float r, float g, float b)
-    {
-        this->diffuse = vec3(r, g, b);
-        return *this;
-    }
-    
-    Material& withShininess(float value)
-    {
-        this->shininess = value;
-        return *this;
-    }
-
-    Material& withEmissiveColour(float r, float g, float b, float intensity)
-    {
-        this->emissive = vec3(r, g, b) * intensity;
-        return *this;
-    }
-
-    Material& withDiffuseTexture(GLuint diffuseTextureId)
-    {
-        this->diffuseTextureId = diffuseTextureId;
-        return *this;
-    }
-
-    Material& withNormalTexture(GLuint normalTextureId)
-    {
-        this->normalTextureId = normalTextureId;
-        return *this;
-    }
-
-    void sendTextureUniform(const std::string& uniform, int index, int id)
-    {
-        GLuint textureIdToBind = (id != -1) ? id : whiteTextureId;
-        glActiveTexture(GL_TEXTURE0 + index);
-        glBindTexture(GL_TEXTURE_2D, textureIdToBind);
-        Program.SendUniform(uniform, index);
-    }
-
-    void apply()
-    {
-	    Program.SendUniform("material.ambient", ambient.x, ambient.y, ambient.z);
-	    Program.SendUniform("material.diffuse", diffuse.x, diffuse.y, diffuse.z);
-	    Program.SendUniform("material.shininess", shininess);
-	    Program.SendUniform("material.emissive", emissive.x, emissive.y, emissive.z);
-
-        sendTextureUniform("material.diffuseTexture", 0, diffuseTextureId);
-        sendTextureUniform("material.normalTexture", 1, normalTextureId);
+        // written to the Lights block - uploaded once per frame
+        C3dglPointLightBlock& b = lightsBlock.lightPoint[index];
+        b.on = on;
+        b.ambient = ambient;
+        b.position = position;
+        b.diffuse = diffuse;
+        b.diffuseStrength = diffuseStrength;
+        b.specular = specular;
+        b.specularPower = specularPower;
+        b.radius = radius;
+        b.cutoff = cutoff;
     }
 };
 
@@ -377,18 +374,10 @@ struct Model
 	    return m;
     }
 
-    void draw(Material& material)
+    // registers the model in the draw list; returns the object id
+    unsigned addTo(C3dglDrawList& list, C3dglMaterial& material)
     {
-        material.apply();
-
-        mat4 m = matrixView * getMatrix();
-
-        if (this->mesh == -1)
-        {
-            for (int i = 0; i < this->model.getMeshCount(); ++i)
-	            this->model.render(i, m);
-        }
-        else this->model.render(this->mesh, m);
+        return list.add(this->model, &material, getMatrix(), this->mesh);
     }
 };
 
@@ -396,11 +385,11 @@ struct Model
 // generate a single pixel texture.
 GLuint generateSingleColorGLTexture(GLubyte r, GLubyte g, GLubyte b, GLubyte a)
 {
-    glActiveTexture(GL_TEXTURE0);
+    C3dglState::activeTexture(GL_TEXTURE0);
 
     GLuint id;
 	glGenTextures(1, &id);
-	glBindTexture(GL_TEXTURE_2D, id);
+	C3dglState::bindTexture(GL_TEXTURE_2D, id);
     
     // single pixel - no need for filtering and always repeat.
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -424,11 +413,11 @@ GLuint generateSingleColorGLTexture(GLubyte r, GLubyte g, GLubyte b, GLubyte a)
 // load texture from bitmap. by default linear/repeating
 GLuint loadGLTexture(C3dglBitmap& bitmap, GLint format = GL_RGBA, GLint filter = GL_LINEAR, GLint repeat = GL_REPEAT)
 {
-    glActiveTexture(GL_TEXTURE0);
+    C3dglState::activeTexture(GL_TEXTURE0);
 
     GLuint id;
 	glGenTextures(1, &id);
-	glBindTexture(GL_TEXTURE_2D, id);
+	C3dglState::bindTexture(GL_TEXTURE_2D, id);
     
     // set texture parameters
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
@@ -452,13 +441,19 @@ GLuint loadGLTexture(C3dglBitmap& bitmap, GLint format = GL_RGBA, GLint filter =
 bool init()
 {
 	// rendering states
-	glEnable(GL_DEPTH_TEST);	// depth test is necessary for most 3D scenes
-	glEnable(GL_NORMALIZE);		// normalization is needed by AssImp library models
-	glEnable(GL_TEXTURE_2D);	// enable texturing
+	C3dglState::enable(GL_DEPTH_TEST);	// depth test is necessary for most 3D scenes
+	C3dglState::enable(GL_NORMALIZE);		// normalization is needed by AssImp library models
+	C3dglState::enable(GL_TEXTURE_2D);	// enable texturing
 	glShadeModel(GL_SMOOTH);	// smooth shading mode is the default one; try GL_FLAT here!
 	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);	// this is the default one; try GL_LINE!
 
-	// Initialise Shaders
+	// Initialise Shaders - linked programs are cached, so that next time they are not compiled again
+	C3dglProgram::SetBinaryCache("shaders/cache");
+	if (!clusteredLights.create()) return false;	// before linking - registers the light list samplers
+	if (!deferredRenderer.create(glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT))) return false;
+	if (!shadowCascades.create()) return false;	// before linking - registers the shadow map sampler
+	shadowCascades.setDistance(20);
+	if (!pointShadows.create()) return false;	// before linking - registers the shadow map sampler
 	C3dglShader VertexShader;
 	C3dglShader FragmentShader;
 
@@ -476,7 +471,43 @@ bool init()
 	if (!Program.Link()) return false;
 	if (!Program.Use(true)) return false;
 
-	// load your 3D models here!
+	// the depth pre-pass: the same position transform as basic.vert (invariant), no colour output
+	C3dglShader DepthVertexShader;
+	C3dglShader DepthFragmentShader;
+	if (!DepthVertexShader.Create(GL_VERTEX_SHADER)) return false;
+	if (!DepthVertexShader.LoadFromFile("shaders/depth.vert")) return false;
+	if (!DepthVertexShader.Compile()) return false;
+	if (!DepthFragmentShader.Create(GL_FRAGMENT_SHADER)) return false;
+	if (!DepthFragmentShader.LoadFromFile("shaders/shadow.frag")) return false;
+	if (!DepthFragmentShader.Compile()) return false;
+	if (!DepthProgram.Create()) return false;
+	if (!DepthProgram.Attach(DepthVertexShader)) return false;
+	if (!DepthProgram.Attach(DepthFragmentShader)) return false;
+	if (!DepthProgram.Link()) return false;
+	Program.Use();
+
+	// the draw list picks the cheapest variant for each material and the active lights;
+	// variants are built in the background - until ready, the main program is used instead
+	C3dglAsyncCompiler::init();
+	if (!programVariants.create("shaders/basic.vert", "shaders/basic.frag")) return false;
+	programVariants.setAsync(true, &Program);
+	drawList.setVariants(&programVariants);
+
+	// per-frame uniform buffers
+	memset(&lightsBlock, 0, sizeof(lightsBlock));
+	if (!lightSets.create()) return false;	// before lightsUBO - both use the Lights binding point
+	if (!lightProbes.create(vec3(-4.0f, 2.5f, 2.0f), vec3(3.0f, 6.0f, 8.0f))) return false;
+	drawList.setLightProbes(&lightProbes);
+	if (!occlusionCuller.create()) return false;
+	cameraUBO.create(UBO_CAMERA, cameraBlock);
+	lightsUBO.create(UBO_LIGHTS, lightsBlock);
+
+	// load your 3D models here! The triangle BVHs (for picking) and the occluder proxies are built at load time
+	for (C3dglModel *pModel : { &table, &vase, &dino, &living, &lamp, &lightbulb })
+	{
+		pModel->enableBVH();
+		pModel->enableOccluderProxy();
+	}
 	if (!table.load("models\\table.obj")) return false;
 	if (!vase.load("models\\vase.obj")) return false;
 	if (!dino.load("models\\Dinosaur_V02.obj")) return false;
@@ -499,6 +530,158 @@ bool init()
     chairAlbedoTexId = loadGLTexture(chairAlbedo);
     chairNormalTexId = loadGLTexture(chairNormal);
 
+	// setup materials
+	lightbulb1Material.setShininess(10);
+	lightbulb1Material.setAmbient(0, 0, 0);
+	lightbulb1Material.setDiffuse(0, 0, 0);
+
+	lightbulb2Material.setShininess(10);
+	lightbulb2Material.setAmbient(0, 0, 0);
+	lightbulb2Material.setDiffuse(0, 0, 0);
+
+	chairMaterial.setShininess(10);
+	chairMaterial.setTexture(chairAlbedoTexId);
+	chairMaterial.setNormalMap(chairNormalTexId);
+
+	lampMaterial.setShininess(1);
+	lampMaterial.setAmbient(0.8f, 0.8f, 0.2f);
+	lampMaterial.setDiffuse(0.4f, 0.4f, 0.2f);
+
+	tableMaterial.setShininess(10);
+	tableMaterial.setTexture(tableAlbedoTexId);
+	tableMaterial.setNormalMap(tableNormalTexId);
+
+	vaseMaterial.setShininess(50);
+	vaseMaterial.setAmbient(0.0f, 1.0f, 0.0f);
+	vaseMaterial.setDiffuse(0.2f, 0.2f, 0.6f);
+
+	dinoMaterial.setShininess(50);
+	dinoMaterial.setAmbient(1.0f, 1.0f, 0.0f);
+	dinoMaterial.setDiffuse(0.2f, 0.2f, 0.6f);
+
+	teapotMaterial.setAmbient(0.2f, 0.2f, 0.8f);
+	teapotMaterial.setDiffuse(0.2f, 0.2f, 0.6f);
+
+	pyramidMaterial.setAmbient(1.0f, 0.0f, 0.0f);
+	pyramidMaterial.setDiffuse(0.2f, 0.2f, 0.6f);
+
+	// register the scene objects
+	//chair 1
+    Model(table)
+        .withPosition(0, 0, 5.5f)
+        .withRotation(180.f)
+        .withScale(0.004f)
+        .withMesh(0)
+        .addTo(drawList, chairMaterial);
+
+	//chair 2
+    Model(table)
+        .withPosition(0.5f, 0, 5.0f)
+        .withRotation(90.f)
+        .withScale(0.004f)
+        .withMesh(0)
+        .addTo(drawList, chairMaterial);
+
+	//chair 3
+    Model(table)
+        .withPosition(0, 0, 4.5f)
+        .withRotation(0)
+        .withScale(0.004f)
+        .withMesh(0)
+        .addTo(drawList, chairMaterial);
+
+	//chair 4
+    Model(table)
+        .withPosition(-0.5f, 0, 5.0f)
+        .withRotation(270.f)
+        .withScale(0.004f)
+        .withMesh(0)
+        .addTo(drawList, chairMaterial);
+
+	//table
+    Model(table)
+        .withPosition(0, 0, 5.0f)
+        .withRotation(0)
+        .withScale(0.004f)
+        .withMesh(1)
+        .addTo(drawList, tableMaterial);
+
+    
+    //lamp 1
+    Model(lamp)
+        .withPosition(-2.0f, 3.045f, 4.0f)
+        .withRotation(60)
+        .withScale(0.025f)
+        .addTo(drawList, lampMaterial);
+    
+    // the bulbs enclose the lamp lights - they must not cast the lamp shadows
+    unsigned bulbId = Model(lightbulb)
+        .withPosition(-2.57f, 4.05f, 5.f)
+      //  .withRotation(155.0)
+      //  .withRotationAxis(0, 0, 1)
+        .withEuler(0, 60, 155)
+        .withScale(0.25f)
+        .addTo(drawList, lightbulb1Material);
+    drawList.setCastShadows(bulbId, false);
+    
+
+    //lamp 2
+    Model(lamp)
+        .withPosition(1.5f, 3.045f, 6.0f)
+        .withRotation(0)
+        .withScale(0.025f)
+        .addTo(drawList, lampMaterial);
+
+    bulbId = Model(lightbulb)
+        .withPosition(0.365f, 4.05f, 6.0f)
+        .withRotation(155.0)
+        .withRotationAxis(0, 0, 1)
+        .withScale(0.25f)
+        .addTo(drawList, lightbulb2Material);
+    drawList.setCastShadows(bulbId, false);
+
+
+	//vase
+    Model(vase)
+        .withPosition(0, 3, 5.0f)
+        .withRotation(0)
+        .withScale(0.1f)
+        .addTo(drawList, vaseMaterial);
+    
+	//dino - animated in render()
+    dinoId = Model(dino)
+        .withPosition(-0.5f, 3.735f, 4.0f)
+        .withRotation(0)
+        .withScale(0.005f)
+        .addTo(drawList, dinoMaterial);
+    drawList.setProbeLit(dinoId, true);
+    drawList.setDynamic(dinoId, true);
+
+    // bake the lightmap of everything but the dino - or load the one baked before, if baked from the same inputs;
+    // the job saved is for baking it headless instead: tools/lightmapbaker models/lightmap.job models/lightmap.tga
+    for (unsigned id = 0; id < drawList.getObjectCount(); id++)
+        if (id != dinoId)
+            lightmap.add(*drawList.getModel(id), drawList.getMaterial(id), drawList.getMatrix(id), drawList.getNode(id));
+    directionalLight(true).apply();
+    lightmap.setDirectional(lightsBlock.lightDirectional);
+    if (!lightmap.load("models/lightmap.tga"))
+    {
+        lightmap.saveJob("models/lightmap.job");
+        if (!lightmap.bake()) return false;
+        lightmap.save("models/lightmap.tga");
+    }
+    if (!lightmap.upload()) return false;
+
+    // bake the ambient occlusion of the draw list objects, all occluding one another - or load it
+    for (unsigned id = 0; id < drawList.getObjectCount(); id++)
+        ambientOcclusion.add(*drawList.getModel(id), drawList.getMatrix(id), drawList.getNode(id));
+    if (!ambientOcclusion.load("models/occlusion.dat"))
+    {
+        if (!ambientOcclusion.bake()) return false;
+        ambientOcclusion.save("models/occlusion.dat");
+    }
+    ambientOcclusion.apply();
+
 	// Initialise the View Matrix (initial position of the camera)
 	matrixView = rotate(mat4(1.f), radians(angleTilt), vec3(1.f, 0.f, 0.f));
 	matrixView *= lookAt(
@@ -515,11 +698,16 @@ bool init()
 	cout << "  QE or PgUp/Dn to move the camera up and down" << endl;
 	cout << "  Shift+AD or arrow key to auto-orbit" << endl;
 	cout << "  Drag the mouse to look around" << endl;
+	cout << "  Right click to pick an object" << endl;
 	cout << "  1, 2 to toggle lamp lights on/off" << endl;
 	cout << "  <, > to toggle lamp light colour" << endl;
 	cout << "  -, + to decrease/increase light intensity" << endl;
 	cout << "  p to toggle lamp lighting mode (1 - default, 2 - low intensity/high specular, 3 - low intensity/high cutoff)" << endl;
 	cout << "  o to toggle directional light on/off" << endl;
+	cout << "  h to switch between real-time shadows and the lightmap" << endl;
+	cout << "  g to switch between clustered forward, per-object lights forward and deferred rendering" << endl;
+	cout << "  z to toggle the depth pre-pass (the frame stats are in the window title)" << endl;
+	cout << "  c to toggle the occlusion culling" << endl;
 	cout << endl;
     
 	glutSetVertexAttribCoord3(Program.GetAttribLocation("aVertex"));
@@ -528,17 +716,17 @@ bool init()
 
 	// prepare vertex data
 	glGenBuffers(1, &vertexBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	C3dglState::bindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
     
 	// prepare normal data
 	glGenBuffers(1, &normalBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
+	C3dglState::bindBuffer(GL_ARRAY_BUFFER, normalBuffer);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(normals), normals, GL_STATIC_DRAW);
 
 	// prepare indices array
 	glGenBuffers(1, &indexBuffer);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	C3dglState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
 	return true;
@@ -546,6 +734,15 @@ bool init()
 
 void done()
 {
+	programVariants.destroy();
+	clusteredLights.destroy();
+	deferredRenderer.destroy();
+	lightSets.destroy();
+	lightmap.destroy();
+	shadowCascades.destroy();
+	pointShadows.destroy();
+	drawList.destroy();
+	C3dglAsyncCompiler::shutdown();
 }
 
 
@@ -590,6 +787,19 @@ int currentLightPreset = 0;
 // whether directional light is on or off
 bool dirLightOn = true;
 
+// whether the static objects take the directional light from the shadow maps (real-time) or from the lightmap (baked)
+bool shadowsOn = true;
+
+// whether the draw list lays the depth down first - the lighting shaders then run once per pixel
+bool prepassOn = true;
+
+// whether the draw list skips the objects hidden behind the big ones
+bool occlusionOn = true;
+
+// frame stats - shown in the window title, once a second
+int statsFrames = 0;
+float statsTime = 0;
+
 // holds state about lamp lights, i.e. whether its on, its colour, intensity, etc.
 // it also manages the time it takes for the lamp to switch intensity/colours.
 // duration - how long it takes to switch
@@ -757,6 +967,9 @@ void render()
 	float theta = glutGet(GLUT_ELAPSED_TIME) * 0.2f;
 	float beta = glutGet(GLUT_ELAPSED_TIME) * 0.015f;
 
+	// reset the GL state statistics
+	C3dglState::beginFrame();
+
 	// clear screen and buffers
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     
@@ -779,21 +992,28 @@ void render()
 	m = m * matrixView;
 	//m = rotate(m, radians(angleRot), vec3(0.f, 1.f, 0.f));				// animate camera orbiting
 	matrixView = m;
-	Program.SendUniform("matrixView", matrixView);
+	C3dglState::loadMatrix(matrixView);	// CPU-side model-view matrix, used by 3DGL instead of querying GL
+	cameraBlock.matrixView = matrixView;
+	cameraUBO.update(cameraBlock);
 
 
 
     // apply directional light
-    DirectionalLight()
-        .enable(dirLightOn)
-        .withAmbient(0, 0, 0)
-        .withDiffuse(1, 1, 1, 0.2)
-        .withDirection(0, 2, 1)
-        .withSpecular(0.7, 0.7, 0.7, 800)
-        .apply();
+    directionalLight(dirLightOn).apply();
 
 
 
+    // the rotating dino - before the shadows, which follow it
+    drawList.setMatrix(dinoId, 
+        Model(dino)
+            .withPosition(-0.5f, 3.735f, 4.0f)
+            .withRotation(theta)
+            .withScale(0.005f)
+            .getMatrix());
+
+    // nothing else moves this frame - the camera frustum is culled on the scene BVH worker meanwhile
+    drawList.beginCull(cameraBlock.matrixProjection * matrixView);
+
     // set lightbulb light positions
     lightState[0].position = vec3(-2.57f, 4.05f, 5.f);
     lightState[1].position = vec3(0.365f, 4.05f, 6.0f);
@@ -801,163 +1021,109 @@ void render()
     // update lightbulb lights...
     updateLights(dt);
 
+    // the lamp shadows - the lights learn their shadow slots here, so before they are uploaded anywhere
+    pointShadows.render(drawList, lightsBlock.lightPoint, C3dglLightsBlock::MAX_POINT_LIGHTS, matrixView, cameraBlock.matrixProjection);
+    pointShadows.bind();
+
+    // upload all lights at once - in view space, so that the shaders do not transform them per fragment
+    lightsUBO.update(lightsBlock.toViewSpace(matrixView));
+
+    // the probes are rebaked only while the lamps change
+    lightProbes.clear();
+    for (unsigned i = 0; i < C3dglLightsBlock::MAX_POINT_LIGHTS; i++)
+        lightProbes.add(lightsBlock.lightPoint[i]);
+    lightProbes.update();
+
+
+    // update the lightbulb materials - everything else is static
+    lightbulb1Material.setEmissive(
+        lightState[0].light.diffuse.x * fmax(lightState[0].light.diffuseStrength, 0.1f),
+        lightState[0].light.diffuse.y * fmax(lightState[0].light.diffuseStrength, 0.1f),
+        lightState[0].light.diffuse.z * fmax(lightState[0].light.diffuseStrength, 0.1f));
+    lightbulb2Material.setEmissive(
+        lightState[1].light.diffuse.x * fmax(lightState[1].light.diffuseStrength, 0.1f),
+        lightState[1].light.diffuse.y * fmax(lightState[1].light.diffuseStrength, 0.1f),
+        lightState[1].light.diffuse.z * fmax(lightState[1].light.diffuseStrength, 0.1f));
+
+    // the lightmap replaces the directional light of the static objects - in the forward modes, without real-time shadows
+    lightmap.bind();
+    drawList.setLightmap(dirLightOn && !shadowsOn && renderMode != RENDER_DEFERRED ? &lightmap : NULL);
+
+    // the shadow maps - the forward modes only, the deferred directional light pass is not shadowed
+    bool shadows = dirLightOn && shadowsOn && renderMode != RENDER_DEFERRED;
+    if (shadows)
+    {
+        shadowCascades.render(drawList, lightsBlock.lightDirectional.direction, matrixView, cameraBlock.matrixProjection);
+        shadowCascades.bind();
+    }
 
-    /////////////////
-    // MATERIALS
-    Material lightbuld1Material =
-        Material()
-            .withShininess(10)
-            .withAmbientColour(0, 0, 0)
-            .withDiffuseColour(0, 0, 0)
-            .withEmissiveColour(
-                lightState[0].light.diffuse.x, lightState[0].light.diffuse.y, lightState[0].light.diffuse.z, 
-                fmax(lightState[0].light.diffuseStrength, 0.1));
-    
-    Material lightbuld2Material =
-        Material()
-            .withShininess(10)
-            .withAmbientColour(0, 0, 0)
-            .withDiffuseColour(0, 0, 0)
-            .withEmissiveColour(
-                lightState[1].light.diffuse.x, lightState[1].light.diffuse.y, lightState[1].light.diffuse.z, 
-                fmax(lightState[1].light.diffuseStrength, 0.1));
-    
-    Material chairMaterial =
-        Material()
-            .withShininess(10)
-            .withDiffuseTexture(chairAlbedoTexId)
-            .withNormalTexture(chairNormalTexId);
-    
-    Material lampMaterial =
-        Material()
-            .withShininess(1)
-            .withAmbientColour(0.8f, 0.8f, 0.2f)
-            .withDiffuseColour(0.4f, 0.4f, 0.2f);
-    
-    Material tableMaterial =
-        Material()
-            .withShininess(10)
-            .withDiffuseTexture(tableAlbedoTexId)
-            .withNormalTexture(tableNormalTexId);
-    
-    Material vaseMaterial =
-        Material()
-            .withShininess(50)
-            .withAmbientColour(0.0f, 1.0f, 0.0f)
-            .withDiffuseColour(0.2f, 0.2f, 0.6f);
-    
-    Material dinoMaterial =
-        Material()
-            .withShininess(50)
-            .withAmbientColour(1.0f, 1.0f, 0.0f)
-            .withDiffuseColour(0.2f, 0.2f, 0.6f);
-
-
-    ////////////////
-    // MODLELS
-	//chair 1
-    Model(table)
-        .withPosition(0, 0, 5.5f)
-        .withRotation(180.f)
-        .withScale(0.004f)
-        .withMesh(0)
-        .draw(chairMaterial);
-
-	//chair 2
-    Model(table)
-        .withPosition(0.5f, 0, 5.0f)
-        .withRotation(90.f)
-        .withScale(0.004f)
-        .withMesh(0)
-        .draw(chairMaterial);
-
-	//chair 3
-    Model(table)
-        .withPosition(0, 0, 4.5f)
-        .withRotation(0)
-        .withScale(0.004f)
-        .withMesh(0)
-        .draw(chairMaterial);
-
-	//chair 4
-    Model(table)
-        .withPosition(-0.5f, 0, 5.0f)
-        .withRotation(270.f)
-        .withScale(0.004f)
-        .withMesh(0)
-        .draw(chairMaterial);
-
-	//table
-    Model(table)
-        .withPosition(0, 0, 5.0f)
-        .withRotation(0)
-        .withScale(0.004f)
-        .withMesh(1)
-        .draw(tableMaterial);
-
-    
-    //lamp 1
-    Model(lamp)
-        .withPosition(-2.0f, 3.045f, 4.0f)
-        .withRotation(60)
-        .withScale(0.025f)
-        .draw(lampMaterial);
-    
-    Model(lightbulb)
-        .withPosition(-2.57f, 4.05f, 5.f)
-      //  .withRotation(155.0)
-      //  .withRotationAxis(0, 0, 1)
-        .withEuler(0, 60, 155)
-        .withScale(0.25f)
-        .draw(lightbuld1Material);
-    
-
-    //lamp 2
-    Model(lamp)
-        .withPosition(1.5f, 3.045f, 6.0f)
-        .withRotation(0)
-        .withScale(0.025f)
-        .draw(lampMaterial);
-
-    Model(lightbulb)
-        .withPosition(0.365f, 4.05f, 6.0f)
-        .withRotation(155.0)
-        .withRotationAxis(0, 0, 1)
-        .withScale(0.25f)
-        .draw(lightbuld2Material);
-
+    // the depth pre-pass - the opaque objects of the draw list, in any of the modes
+    drawList.getQueue().setDepthPrepass(prepassOn ? &DepthProgram : NULL);
+    drawList.setOcclusionCuller(occlusionOn ? &occlusionCuller : NULL);
 
-	//vase
-    Model(vase)
-        .withPosition(0, 3, 5.0f)
-        .withRotation(0)
-        .withScale(0.1f)
-        .draw(vaseMaterial);
-    
-	//dino
-    Model(dino)
-        .withPosition(-0.5f, 3.735f, 4.0f)
-        .withRotation(theta)
-        .withScale(0.005f)
-        .draw(dinoMaterial);
+    if (renderMode == RENDER_DEFERRED)
+    {
+        // deferred: the draw list fills the G-buffer, then the lights are accumulated one by one
+        deferredRenderer.clear();
+        for (unsigned i = 0; i < C3dglLightsBlock::MAX_POINT_LIGHTS; i++)
+            deferredRenderer.add(lightsBlock.lightPoint[i]);
+        programVariants.setGBuffer();
+        deferredRenderer.beginGeometry();
+        drawList.render(matrixView, cameraBlock.matrixProjection);
+        deferredRenderer.render(matrixView, cameraBlock.matrixProjection, lightsBlock.lightDirectional.on != 0);
+    }
+    else if (renderMode == RENDER_LIGHT_SETS)
+    {
+        // forward, per-object: each object is drawn with its own light set and the variant for its light count
+        lightSets.setDirectional(lightsBlock.lightDirectional);
+        lightSets.clear();
+        for (unsigned i = 0; i < C3dglLightsBlock::MAX_POINT_LIGHTS; i++)
+            lightSets.add(lightsBlock.lightPoint[i]);
+        programVariants.setLights(lightsBlock, false, shadows, true);
+        drawList.setLightSets(&lightSets);
+        drawList.render(matrixView, cameraBlock.matrixProjection);
+        drawList.setLightSets(NULL);
+        lightsUBO.bind();    // the light sets leave their own buffer bound
+    }
+    else
+    {
+        // forward: the draw list takes the point lights from the clusters - any number of them
+        clusteredLights.clear();
+        for (unsigned i = 0; i < C3dglLightsBlock::MAX_POINT_LIGHTS; i++)
+            clusteredLights.add(lightsBlock.lightPoint[i]);
+        clusteredLights.update(matrixView, cameraBlock.matrixProjection, viewportWidth, viewportHeight);
+        clusteredLights.bind();
+        programVariants.setLights(lightsBlock, true, shadows, true);
+        drawList.render(matrixView, cameraBlock.matrixProjection);
+    }
 
 
     // cannot update the followin cuz they dont use the model class.
     // just keep them as they were
 	//teapot
 	// setup materials - blue
-	Program.SendUniform("material.ambient", 0.2f, 0.2f, 0.8f);
-	Program.SendUniform("material.diffuse", 0.2, 0.2, 0.6);
+	// lit by the light probes - but not in the deferred mode, drawn after the lights are resolved
+	C3dglProgram *pTeapotProgram = renderMode == RENDER_DEFERRED ? NULL : programVariants.selectProbeLit(&teapotMaterial);
+	pTeapotProgram = pTeapotProgram ? pTeapotProgram->Resolve() : NULL;
+	if (!pTeapotProgram) pTeapotProgram = &Program;
+	pTeapotProgram->Use();		// the draw list leaves one of the variants in use
+	teapotMaterial.apply();
+
+	C3dglSHProbe teapotProbe;
+	lightProbes.sample(vec3(1.2f, 3.3f, 5.15f), teapotProbe);
+	teapotProbe.apply(pTeapotProgram);
 
 	m = matrixView;
 	m = translate(m, vec3(1.2f, 3.3, 5.15f));
 	m = rotate(m, radians(-theta), vec3(0.0f, 1.0f, 0.0f));
-	Program.SendUniform("matrixModelView", m);
+	pTeapotProgram->SendUniform("matrixModelView", m);
+	C3dglState::bindVertexArray(0);
 	glutSolidTeapot(0.4);
+	C3dglState::invalidateVertexArray();	// glut binds its own buffers and attribute arrays behind our back
 
     // pyramid
-	Program.SendUniform("material.ambient", 1.0f, 0.0f, 0.0f);
-	Program.SendUniform("material.diffuse", 0.2, 0.2, 0.6);
+	Program.Use();
+	pyramidMaterial.apply();
 	
 	m = matrixView;
 	m = translate(m, vec3(-0.5f, 3.735, 4.0f));
@@ -969,31 +1135,48 @@ void render()
 	GLuint attribVertex = Program.GetAttribLocation("aVertex");
 	GLuint attribNormal = Program.GetAttribLocation("aNormal");
 
-	// Enable vertex attribute arrays
-	glEnableVertexAttribArray(attribVertex);
+	// Enable vertex attribute arrays - on the default VAO
+	C3dglState::bindVertexArray(0);
+	// (the attributes not used by the program are not found: -1)
+	if (attribVertex != (GLuint)-1) C3dglState::enableVertexAttribArray(attribVertex);
 	// glEnableVertexAttribArray(attribTexCorrds);
-	glEnableVertexAttribArray(attribNormal);
+	if (attribNormal != (GLuint)-1) C3dglState::enableVertexAttribArray(attribNormal);
 
 	// Bind (activate) the vertex buffer and set the pointer to it
-	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-	glVertexAttribPointer(attribVertex, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	C3dglState::bindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	if (attribVertex != (GLuint)-1) glVertexAttribPointer(attribVertex, 3, GL_FLOAT, GL_FALSE, 0, 0);
    
 	// Bind (activate) the normal buffer and set the pointer to it
-	glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-	glVertexAttribPointer(attribNormal, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	C3dglState::bindBuffer(GL_ARRAY_BUFFER, normalBuffer);
+	if (attribNormal != (GLuint)-1) glVertexAttribPointer(attribNormal, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
 	// Draw triangles  using index buffer
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	C3dglState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
 	glDrawElements(GL_TRIANGLES, 18, GL_UNSIGNED_INT, 0);
 
 	// Disable arrays
-	glDisableVertexAttribArray(attribVertex);
-	glDisableVertexAttribArray(attribNormal);
+	if (attribVertex != (GLuint)-1) C3dglState::disableVertexAttribArray(attribVertex);
+	if (attribNormal != (GLuint)-1) C3dglState::disableVertexAttribArray(attribNormal);
 
 
 	// essential for double-buffering technique
 	glutSwapBuffers();
 
+	// frame stats; the overdraw is the number of the opaque samples shaded per pixel (the query lags a frame or two)
+	statsFrames++;
+	if (time - statsTime >= 1)
+	{
+		C3dglRenderQueue &queue = drawList.getQueue();
+		ostringstream title;
+		title << "CI5520 3D Graphics Programming - " << fixed << setprecision(1) << statsFrames / (time - statsTime) << " fps, "
+			<< queue.getDrawCount() << " draws, " << queue.getPrepassDrawCount() << " pre-pass draws, "
+			<< drawList.getVisibleCount() << " visible, " << drawList.getCulledCount() << " culled (" << drawList.getOccludedCount() << " occluded), overdraw "
+			<< setprecision(2) << (float)queue.getSamplesShaded() / std::max(viewportWidth * viewportHeight, 1);
+		glutSetWindowTitle(title.str().c_str());
+		statsFrames = 0;
+		statsTime = time;
+	}
+
 	// proceed the animation
 	glutPostRedisplay();
 }
@@ -1002,11 +1185,15 @@ void render()
 void reshape(int w, int h)
 {
 	float ratio = w * 1.0f / h;      // we hope that h is not zero
-	glViewport(0, 0, w, h);
+	C3dglState::viewport(0, 0, w, h);
+	viewportWidth = w;
+	viewportHeight = h;
+	deferredRenderer.resize(w, h);
 	mat4 matrixProjection = perspective(radians(60.f), ratio, 0.02f, 1000.f);
 	
 	// Setup the Projection Matrix
-	Program.SendUniform("matrixProjection", matrixProjection);
+	cameraBlock.matrixProjection = matrixProjection;
+	cameraUBO.update(cameraBlock);
 
 }
 
@@ -1033,6 +1220,10 @@ void onKeyDown(unsigned char key, int x, int y)
 
     case 'p': currentLightPreset = (currentLightPreset+1) % LIGHT_PRESETS; break;
     case 'o': dirLightOn = !dirLightOn; break;
+    case 'h': shadowsOn = !shadowsOn; cout << (shadowsOn ? "real-time shadows" : "lightmap") << endl; break;
+    case 'g': renderMode = (renderMode + 1) % RENDER_LAST; cout << renderModeNames[renderMode] << " rendering" << endl; break;
+    case 'z': prepassOn = !prepassOn; cout << "depth pre-pass " << (prepassOn ? "on" : "off") << endl; break;
+    case 'c': occlusionOn = !occlusionOn; cout << "occlusion culling " << (occlusionOn ? "on" : "off") << endl; break;
 	}
 	// speed limit
 	cam.x = std::max(-0.15f, std::min(0.15f, cam.x));
@@ -1090,6 +1281,18 @@ void onSpecUp(int key, int x, int y)
 bool bJustClicked = false;
 void onMouse(int button, int state, int x, int y)
 {
+	// right click picks an object of the draw list
+	if (button == GLUT_RIGHT_BUTTON && state == GLUT_DOWN)
+	{
+		mat4 inv = inverse(cameraBlock.matrixProjection * matrixView);
+		float ndcX = 2.0f * x / glutGet(GLUT_WINDOW_WIDTH) - 1, ndcY = 1 - 2.0f * y / glutGet(GLUT_WINDOW_HEIGHT);
+		vec4 pNear = inv * vec4(ndcX, ndcY, -1, 1), pFar = inv * vec4(ndcX, ndcY, 1, 1);
+		vec3 orig = vec3(pNear) / pNear.w;
+		float t;
+		int id = drawList.pick(orig, normalize(vec3(pFar) / pFar.w - orig), 1e10f, &t);
+		if (id >= 0) cout << "picked object " << id << " (" << drawList.getModel(id)->getName() << ") at " << t << endl;
+	}
+
 	bJustClicked = (state == GLUT_DOWN);
 	glutSetCursor(bJustClicked ? GLUT_CURSOR_CROSSHAIR : GLUT_CURSOR_INHERIT);
 	glutWarpPointer(glutGet(GLUT_WINDOW_WIDTH) / 2, glutGet(GLUT_WINDOW_HEIGHT) / 2);
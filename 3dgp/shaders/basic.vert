@@ -1,18 +1,29 @@
 // VERTEX SHADER
 #version 330
 
-// Matrices
-uniform mat4 matrixProjection;
-uniform mat4 matrixView;
+#include "permutation.glsl"
+#include "camera.glsl"
 uniform mat4 matrixModelView;
 
 layout (location = 0) in vec3 aVertex;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoord;
+#ifdef VERTEX_AO
+layout (location = 5) in vec4 aColor;	// the baked ambient occlusion - see C3dglAmbientOcclusion
+#endif
+
+// the depth pre-pass (depth.vert) must produce the very same depth - see C3dglRenderQueue
+invariant gl_Position;
 
 out vec3 vertexPosition;
 out vec3 vertexNormal;
 out vec2 vertexTexCoord;
+#ifdef LIGHTMAP
+out vec3 vertexModelPosition;
+#endif
+#ifdef VERTEX_AO
+out float vertexOcclusion;
+#endif
 
 void main(void) 
 {
@@ -21,9 +32,20 @@ void main(void)
 
 	// normal to model space
 	vertexNormal = mat3(matrixModelView) * aNormal;
+#ifdef NORMAL_MAP
+	// the normal map sample is remapped by * 2 - 1; the constant part is the same for every fragment
+	vertexNormal -= mat3(matrixModelView) * vec3(1, 1, 1);
+#endif
 
 	// just pass tex coords
 	vertexTexCoord = aTexCoord;
+#ifdef LIGHTMAP
+	// the lightmap UV comes from the model space position - see lightmap.glsl
+	vertexModelPosition = aVertex;
+#endif
+#ifdef VERTEX_AO
+	vertexOcclusion = aColor.r;
+#endif
 	
 	// position to model-view-projection space
 	gl_Position = matrixProjection * vec4(vertexPosition, 1.0);
@@ -0,0 +1,6 @@
+// Matrices - view and projection are per-frame data, shared by all programs
+layout (std140) uniform Camera
+{
+	mat4 matrixView;
+	mat4 matrixProjection;
+};
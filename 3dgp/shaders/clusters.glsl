@@ -0,0 +1,41 @@
+// Clustered lights - see C3dglClusteredLights.
+// The view frustum is split into clusters: screen space tiles, exponential slices in depth.
+// Each cluster has a range in the index list; the indices point into the light list.
+// Requires lights.glsl and CalculatePointLightColour.
+
+// Grid parameters - uploaded once per frame (std140, see C3dglClustersBlock)
+layout (std140) uniform Clusters
+{
+	ivec4 clusterGrid;		// x, y, z - number of clusters; w - number of lights
+	vec4 clusterParams;		// x, y - clusters per pixel; z, w - depth slice = log(view depth) * z + w
+};
+
+// Light lists - texture buffers, bound to fixed units by C3dglClusteredLights
+uniform samplerBuffer clusterLights;	// 5 texels per light
+uniform usamplerBuffer clusterRanges;	// offset and count, per cluster
+uniform usamplerBuffer clusterIndices;
+
+// Fetches a light - the layout matches C3dglClusteredLights::update (TEXELS_PER_LIGHT); the fifth texel is the shadow
+POINT_LIGHT FetchClusterLight(int i)
+{
+	POINT_LIGHT light = UnpackPointLight(texelFetch(clusterLights, 5 * i), texelFetch(clusterLights, 5 * i + 1),
+		texelFetch(clusterLights, 5 * i + 2), texelFetch(clusterLights, 5 * i + 3));
+	light.shadow = int(texelFetch(clusterLights, 5 * i + 4).x);
+	return light;
+}
+
+// Calculates total colour of the lights in the cluster of the fragment
+vec3 CalculateClusteredLightsColour(vec3 vertexP, vec3 vertexN)
+{
+	ivec3 cluster;
+	cluster.xy = ivec2(gl_FragCoord.xy * clusterParams.xy);
+	cluster.z = int(log(-vertexP.z) * clusterParams.z + clusterParams.w);
+	cluster = clamp(cluster, ivec3(0), clusterGrid.xyz - 1);
+
+	uvec2 range = texelFetch(clusterRanges, (cluster.z * clusterGrid.y + cluster.y) * clusterGrid.x + cluster.x).xy;
+
+	vec3 finalColour = vec3(0, 0, 0);
+	for (uint i = 0u; i < range.y; ++i)
+		finalColour += CalculatePointLightColour(FetchClusterLight(int(texelFetch(clusterIndices, int(range.x + i)).r)), vertexP, vertexN);
+	return finalColour;
+}
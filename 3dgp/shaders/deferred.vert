@@ -0,0 +1,9 @@
+// VERTEX SHADER - deferred passes (see C3dglDeferredRenderer)
+#version 330
+
+// A full screen triangle, generated from the vertex id - no vertex attributes
+void main(void)
+{
+	vec2 p = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));
+	gl_Position = vec4(p * 2 - 1, 0, 1);
+}
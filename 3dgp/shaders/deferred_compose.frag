@@ -0,0 +1,23 @@
+// FRAGMENT SHADER - deferred compose pass (see C3dglDeferredRenderer)
+#version 330
+
+// G-buffer
+uniform sampler2D gbufferAlbedo;
+uniform sampler2D gbufferLight;
+uniform sampler2D gbufferDepth;
+
+out vec4 outColor;
+
+void main(void)
+{
+	ivec2 p = ivec2(gl_FragCoord.xy);
+	float depth = texelFetch(gbufferDepth, p, 0).r;
+	if (depth == 1)
+		discard;		// background - the clear colour stays
+
+	// albedo * (emissive + all the lights) - the same as the forward path
+	outColor = vec4(texelFetch(gbufferAlbedo, p, 0).rgb * texelFetch(gbufferLight, p, 0).rgb, 1);
+
+	// objects drawn forward after the compose pass are depth tested against the scene
+	gl_FragDepth = depth;
+}
@@ -0,0 +1,57 @@
+// FRAGMENT SHADER - deferred light accumulation (see C3dglDeferredRenderer)
+// DIR_LIGHT: the directional light of the Lights block, over the whole screen.
+// Otherwise: a single point light (lightData), within its screen-space bounds.
+#version 330
+
+#include "lights.glsl"
+
+// G-buffer
+uniform sampler2D gbufferNormal;
+uniform sampler2D gbufferDiffuse;
+uniform sampler2D gbufferAmbient;
+uniform sampler2D gbufferDepth;
+
+// to reconstruct the view space position from the depth
+uniform mat4 matrixInvProjection;
+
+// the Material block fields used by the lighting model - filled in from the G-buffer
+struct MATERIAL
+{
+	vec3 ambient;
+	float shininess;
+	vec3 diffuse;
+};
+MATERIAL material;
+
+#include "lighting.glsl"
+
+#ifndef DIR_LIGHT
+// packed as in UnpackPointLight; position in view space
+uniform vec4 lightData[4];
+#endif
+
+out vec4 outLight;
+
+void main(void)
+{
+	ivec2 p = ivec2(gl_FragCoord.xy);
+	float depth = texelFetch(gbufferDepth, p, 0).r;
+	if (depth == 1)
+		discard;		// background
+
+	vec4 ndc = vec4(gl_FragCoord.xy / vec2(textureSize(gbufferDepth, 0)) * 2 - 1, depth * 2 - 1, 1);
+	vec4 position = matrixInvProjection * ndc;
+	vec3 vertexP = position.xyz / position.w;
+
+	vec4 normal = texelFetch(gbufferNormal, p, 0);
+	material.ambient = texelFetch(gbufferAmbient, p, 0).rgb;
+	material.diffuse = texelFetch(gbufferDiffuse, p, 0).rgb;
+	material.shininess = normal.w;
+
+#ifdef DIR_LIGHT
+	outLight = vec4(CalculateDirectionalLightColour(vertexP, normal.xyz), 0);
+#else
+	POINT_LIGHT light = UnpackPointLight(lightData[0], lightData[1], lightData[2], lightData[3]);
+	outLight = vec4(CalculatePointLightColour(light, vertexP, normal.xyz), 0);
+#endif
+}
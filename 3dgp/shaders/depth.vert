@@ -0,0 +1,17 @@
+// VERTEX SHADER
+// Depth only - the depth pre-pass of the draw list (see C3dglRenderQueue).
+// The position math is that of basic.vert, so that the main pass passes the GL_EQUAL test
+#version 330
+
+#include "camera.glsl"
+uniform mat4 matrixModelView;
+
+layout (location = 0) in vec3 aVertex;
+
+invariant gl_Position;
+
+void main(void)
+{
+	vec3 vertexPosition = (matrixModelView * vec4(aVertex, 1.0)).xyz;
+	gl_Position = matrixProjection * vec4(vertexPosition, 1.0);
+}
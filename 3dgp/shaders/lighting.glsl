@@ -0,0 +1,104 @@
+// Lighting model - shared by the forward (basic.frag) and the deferred (deferred_light.frag) paths.
+// Requires lights.glsl, and material (ambient, diffuse, shininess): the Material block
+// or a structure filled in from the G-buffer. With SHADOWS, shadows.glsl too; with POINT_SHADOWS, pointshadows.glsl.
+
+// Calculates diffuse colour.
+// intensity = factor of angle between light direction and vertex normal.
+vec3 CalculateDiffuse(vec3 lightDir, vec3 vertexN, vec3 lightDiffuse)
+{
+	vec3 finalDiffuse = material.diffuse;
+
+	float intensity = dot(vertexN, -lightDir);
+	if (intensity > 0)
+		finalDiffuse += lightDiffuse * intensity;
+
+	return finalDiffuse;
+}
+
+// Calculates specular colour.
+// intensity = factor of angle between reflected light direction by vertex normal (where light goes) and eye to vertex direction (e.g. how much light goes into eye).
+//             Then exponentially modified with specular strength and material's own shininess.
+vec3 CalculateSpecular(vec3 lightDir, vec3 vertexN, vec3 vertexP, vec3 lightSpecular, float lightSpecularPower)
+{
+	vec3 finalSpecular = vec3(0, 0, 0);
+
+	vec3 eyeToVertDir = normalize(-vertexP);
+	vec3 reflectDir = normalize(reflect(-lightDir, vertexN));
+
+	float intensity = dot(eyeToVertDir, reflectDir);
+	if (intensity > 0 && lightSpecularPower > 0) {
+		intensity = material.shininess * pow(intensity, lightSpecularPower);
+		finalSpecular += lightSpecular * intensity;
+	}
+
+	return finalSpecular;
+}
+
+// Calculates light attenuation, i.e. how much weaker a point light gets based of distance.
+float CalculateAttenuation(float distanceToLightSource, float lightRadius, float lightCutoff)
+{
+	float d = max(distanceToLightSource - lightRadius, 0.0);
+	float denom = d / lightRadius + 1;
+	float attenuation = 1 / (denom * denom);
+	
+	attenuation = (attenuation - lightCutoff) / (1 - lightCutoff);
+	attenuation = max(attenuation, 0.0);
+
+	return attenuation;
+}
+
+// Calculates total colour of the active directional light. i.e. ambient + diffuse + specular.
+vec3 CalculateDirectionalLightColour(vec3 vertexP, vec3 vertexN)
+{
+	DIRECTIONAL_LIGHT light = lightDirectional;
+
+	vec3 colour = vec3(0, 0, 0);
+
+	if (light.on != 0)
+	{
+		// already in view space (see C3dglLightsBlock::toViewSpace)
+		vec3 lightDirection = light.direction;
+
+		float shadow = 1.0;
+#ifdef SHADOWS
+		shadow = CalculateShadow(vertexP, vertexN);
+#endif
+
+		// the shadow takes the directional part of the diffuse and the specular - material.diffuse stays
+		colour += material.ambient * light.ambient;
+		colour += (material.diffuse + (CalculateDiffuse(lightDirection, vertexN, light.diffuse) - material.diffuse) * shadow) * light.diffuseStrength;
+		colour += CalculateSpecular(lightDirection, vertexN, vertexP, light.specular, light.specularPower) * shadow;
+	}
+
+	return colour;
+}
+
+// Calculates colour of a single point light, i.e. ambient + diffuse + specular (optionally lowered with attenuation)
+vec3 CalculatePointLightColour(POINT_LIGHT light, vec3 vertexP, vec3 vertexN)
+{
+	// already in view space (see C3dglLightsBlock::toViewSpace)
+	vec3 lightDirection = vertexP - light.position;
+
+	float distToP = length(lightDirection);
+	if (distToP <= 0)
+		return vec3(0, 0, 0);
+	lightDirection /= distToP;
+
+	float shadow = 1.0;
+#ifdef POINT_SHADOWS
+	shadow = CalculatePointShadow(light, vertexP, vertexN);
+#endif
+
+	// as the directional light: the shadow takes the directional part of the diffuse and the specular
+	vec3 colour = light.ambient;
+	colour += (material.diffuse + (CalculateDiffuse(lightDirection, vertexN, light.diffuse) - material.diffuse) * shadow) * light.diffuseStrength;
+	colour += CalculateSpecular(lightDirection, vertexN, vertexP, light.specular, light.specularPower) * shadow;
+
+	if (light.radius > 0)
+	{
+		float attenuation = CalculateAttenuation(distToP, light.radius, light.cutoff);
+		colour *= attenuation;
+	}
+
+	return colour;
+}
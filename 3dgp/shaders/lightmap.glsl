@@ -0,0 +1,16 @@
+// Lightmap - see C3dglLightmap.
+// The directional light, with its shadows and bounces, baked on the CPU. There is no second UV set in the meshes:
+// each triangle has its own chart map (two rows, model space position to lightmap UV), fetched by gl_PrimitiveID.
+
+uniform sampler2D lightmap;
+uniform samplerBuffer lightmapCharts;
+uniform int lightmapBase;	// the first triangle of the mesh - sent with each draw
+
+// Calculates the baked colour - ambient + diffuse, no specular
+vec3 CalculateLightmapColour(vec3 modelP)
+{
+	int i = 2 * (lightmapBase + gl_PrimitiveID);
+	vec4 p = vec4(modelP, 1);
+	vec2 uv = vec2(dot(texelFetch(lightmapCharts, i), p), dot(texelFetch(lightmapCharts, i + 1), p));
+	return texture(lightmap, uv).rgb;
+}
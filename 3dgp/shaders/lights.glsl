@@ -0,0 +1,62 @@
+// Light structures - std140 layout, mirrored by C3dglDirLightBlock and C3dglPointLightBlock.
+// Scalars fill the fourth component of the preceding vec3.
+// Directions and positions are in view space - transformed on the CPU once per frame.
+struct DIRECTIONAL_LIGHT
+{ 
+	vec3 direction;
+	int on;
+
+	vec3 ambient;
+
+	vec3 diffuse;
+	float diffuseStrength;
+
+	vec3 specular;
+	float specularPower;
+};
+
+struct POINT_LIGHT
+{
+	vec3 position;
+	int on;
+	
+	vec3 ambient;
+	float radius;
+
+	vec3 diffuse;
+	float diffuseStrength;
+
+	vec3 specular;
+	float specularPower;
+
+	float cutoff;
+	int shadow;		// 1 + the slot of the point shadow maps; 0 - not shadowed
+};
+
+// Up to two point lights.
+#define MAX_POINT_LIGHTS 2
+
+// All lights - uploaded once per frame
+layout (std140) uniform Lights
+{
+	DIRECTIONAL_LIGHT lightDirectional;
+	POINT_LIGHT lightPoint[MAX_POINT_LIGHTS];
+};
+
+// Unpacks a point light stored in 4 vec4's: position, radius | ambient, cutoff | diffuse, diffuseStrength | specular, specularPower
+// - the layout used by the clustered and the deferred light lists
+POINT_LIGHT UnpackPointLight(vec4 t0, vec4 t1, vec4 t2, vec4 t3)
+{
+	POINT_LIGHT light;
+	light.position = t0.xyz;
+	light.on = 1;
+	light.radius = t0.w;
+	light.ambient = t1.rgb;
+	light.cutoff = t1.w;
+	light.diffuse = t2.rgb;
+	light.diffuseStrength = t2.w;
+	light.specular = t3.rgb;
+	light.specularPower = t3.w;
+	light.shadow = 0;
+	return light;
+}
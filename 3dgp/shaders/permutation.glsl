@@ -0,0 +1,7 @@
+// Permutations - selected by C3dglProgramVariants (see C3dglProgramVariants::getDefines).
+// Without PERMUTATION, the shader covers all the lights and the normal map.
+#ifndef PERMUTATION
+#define POINT_LIGHTS MAX_POINT_LIGHTS
+#define DIR_LIGHT
+#define NORMAL_MAP
+#endif
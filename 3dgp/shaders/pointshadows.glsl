@@ -0,0 +1,54 @@
+// Point light shadows - see C3dglPointShadows.
+// Each shadowed light has six layers of the shadow map array - the faces of a world aligned cube, as in
+// shadow_point.geom. POINT_LIGHT::shadow tells the slot of the light.
+
+#define MAX_POINT_SHADOWS 4
+
+// Slots - uploaded once per frame (std140, see C3dglPointShadowsBlock)
+layout (std140) uniform PointShadows
+{
+	mat4 matrixViewToWorld;			// view space to world space directions
+	vec4 pointShadowFar;			// far plane of each slot
+	vec4 pointShadowParams;			// x - near plane, y - 1 / size of a face
+};
+
+uniform sampler2DArrayShadow pointShadowMap;
+
+// the cube faces - must match C3dglPointShadows
+const vec3 c_pointShadowDir[6] = vec3[6](vec3(1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1));
+const vec3 c_pointShadowUp[6] = vec3[6](vec3(0, -1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1), vec3(0, -1, 0), vec3(0, -1, 0));
+
+// Calculates the lit fraction of the fragment: 1 - fully lit, 0 - in the shadow
+float CalculatePointShadow(POINT_LIGHT light, vec3 vertexP, vec3 vertexN)
+{
+	if (light.shadow == 0)
+		return 1.0;
+	int slot = light.shadow - 1;
+
+	// the face - the major axis of the world space direction from the light
+	vec3 v = mat3(matrixViewToWorld) * (vertexP - light.position);
+	vec3 a = abs(v);
+	int face = (a.x >= a.y && a.x >= a.z) ? (v.x > 0 ? 0 : 1) : (a.y >= a.z ? (v.y > 0 ? 2 : 3) : (v.z > 0 ? 4 : 5));
+
+	// normal offset - a texel and a half at the distance of the fragment
+	float dist = max(a.x, max(a.y, a.z));
+	v += mat3(matrixViewToWorld) * vertexN * (3.0 * dist * pointShadowParams.y);
+
+	// the projection of the face, as glm::lookAt and glm::perspective (90 degrees)
+	vec3 f = c_pointShadowDir[face];
+	vec3 s = normalize(cross(f, c_pointShadowUp[face]));
+	vec3 u = cross(s, f);
+	float d = dot(f, v);
+	vec2 uv = vec2(dot(s, v), dot(u, v)) / d * 0.5 + 0.5;
+	float n = pointShadowParams.x, far = pointShadowFar[slot];
+	float z = ((far + n) / (far - n) - 2.0 * far * n / ((far - n) * d)) * 0.5 + 0.5;
+
+	// 3 x 3 PCF, kept within the face
+	float layer = float(slot * 6 + face);
+	float texel = pointShadowParams.y;
+	float lit = 0;
+	for (int y = -1; y <= 1; y++)
+		for (int x = -1; x <= 1; x++)
+			lit += texture(pointShadowMap, vec4(clamp(uv + vec2(x, y) * texel, 0.5 * texel, 1.0 - 0.5 * texel), layer, z));
+	return lit / 9.0;
+}
@@ -0,0 +1,21 @@
+// Light probes - see C3dglLightProbes.
+// L2 spherical harmonics irradiance of the point lights, interpolated per object on the CPU.
+// Requires camera.glsl (the probes are in world space) and material (diffuse).
+
+// Sent with each draw - see C3dglSHProbe::apply
+uniform vec3 shCoeffs[9];	// convolved with the cosine lobe, premultiplied by the basis constants
+uniform vec4 shAmbient;		// rgb - ambient terms; a - weight of material.diffuse
+
+// Calculates total colour of the point lights baked into the probe - ambient + diffuse, no specular
+vec3 CalculateProbeColour(vec3 vertexN)
+{
+	// the view matrix is a rotation and a translation - its transpose takes the normal back to world space
+	vec3 n = transpose(mat3(matrixView)) * vertexN;
+
+	vec3 irradiance = shCoeffs[0]
+		+ shCoeffs[1] * n.y + shCoeffs[2] * n.z + shCoeffs[3] * n.x
+		+ shCoeffs[4] * (n.x * n.y) + shCoeffs[5] * (n.y * n.z) + shCoeffs[6] * (3 * n.z * n.z - 1)
+		+ shCoeffs[7] * (n.x * n.z) + shCoeffs[8] * (n.x * n.x - n.y * n.y);
+
+	return shAmbient.rgb + material.diffuse * shAmbient.a + max(irradiance, vec3(0, 0, 0));
+}
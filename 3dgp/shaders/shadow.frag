@@ -0,0 +1,7 @@
+// FRAGMENT SHADER
+// Depth only - the shadow maps (see C3dglShadowCascades) and the depth pre-pass (depth.vert)
+#version 330
+
+void main(void)
+{
+}
@@ -0,0 +1,12 @@
+// VERTEX SHADER
+// Depth only - the shadow maps (see C3dglShadowCascades). matrixModelView carries the whole light view-projection
+#version 330
+
+uniform mat4 matrixModelView;
+
+layout (location = 0) in vec3 aVertex;
+
+void main(void)
+{
+	gl_Position = matrixModelView * vec4(aVertex, 1.0);
+}
@@ -0,0 +1,41 @@
+// Cascaded shadow maps - see C3dglShadowCascades.
+// The view frustum is split in depth; each cascade has its own layer of the shadow map array, rendered
+// from the directional light. The cascade is chosen by the view depth of the fragment.
+
+#define MAX_CASCADES 4
+
+// Cascades - uploaded once per frame (std140, see C3dglShadowsBlock)
+layout (std140) uniform Shadows
+{
+	mat4 matrixShadow[MAX_CASCADES];	// view space to shadow map space
+	vec4 shadowSplits;					// view depth where each cascade ends
+	vec4 shadowTexelSize;				// world size of a shadow map texel, per cascade
+	ivec4 shadowParams;					// x - number of cascades
+};
+
+uniform sampler2DArrayShadow shadowMap;
+
+// Calculates the lit fraction of the fragment: 1 - fully lit, 0 - in the shadow
+float CalculateShadow(vec3 vertexP, vec3 vertexN)
+{
+	int nCascades = shadowParams.x;
+	float depth = -vertexP.z;
+
+	int cascade = 0;
+	while (cascade < nCascades && depth > shadowSplits[cascade])
+		cascade++;
+	if (cascade >= nCascades)
+		return 1.0;		// beyond the shadow distance
+
+	// normal offset - a texel and a half along the normal keeps the surface off its own texels
+	vec3 p = vertexP + vertexN * (shadowTexelSize[cascade] * 1.5);
+	vec4 s = matrixShadow[cascade] * vec4(p, 1);
+
+	// 3 x 3 PCF - each tap is bilinear filtered by the hardware compare
+	vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+	float lit = 0;
+	for (int y = -1; y <= 1; y++)
+		for (int x = -1; x <= 1; x++)
+			lit += texture(shadowMap, vec4(s.xy + vec2(x, y) * texel, cascade, s.z));
+	return lit / 9.0;
+}
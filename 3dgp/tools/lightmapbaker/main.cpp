@@ -0,0 +1,40 @@
+/*********************************************************************************
+Lightmap baker - the headless counterpart of C3dglLightmap::bake.
+Bakes a job saved by the application (C3dglLightmap::saveJob) on the CPU, on all
+the cores, with no GL context or GL library - so it runs on a Linux build box.
+The lightmap it saves carries the hash of the job, so the application loads it
+only for the very same scene, lights and settings.
+Usage:
+lightmapbaker <job file> <lightmap.tga>
+*********************************************************************************/
+
+#include "../../gl/glew.h"			// the GL types only
+#include "../../gl/3dglLightmap.h"
+#include "../../gl/3dglThreadPool.h"
+
+#include <iostream>
+#include <chrono>
+
+using namespace std;
+using namespace _3dgl;
+
+int main(int argc, char **argv)
+{
+	if (argc != 3)
+	{
+		cerr << "usage: " << argv[0] << " <job file> <lightmap.tga>" << endl;
+		return 2;
+	}
+
+	C3dglLightmap lightmap;
+	if (!lightmap.loadJob(argv[1]))
+		return 1;
+
+	auto t0 = chrono::steady_clock::now();
+	if (!lightmap.bake())
+		return 1;
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	cout << "baked in " << seconds << " s on " << C3dglThreadPool::get().getThreadCount() << " threads" << endl;
+
+	return lightmap.save(argv[2]) ? 0 : 1;
+}